@@ -36,3 +36,52 @@ void			operator delete[]( void* a_addressToRelease ) throw()
 		return;
 	Mem_releaseHunk( (caddr_t)a_addressToRelease );
 }
+
+
+void*			MemCacheLined::operator new( size_t a_requestSize ) throw()
+{
+	return (void*)Mem_allocateLined( a_requestSize );
+}
+
+void*			MemCacheLined::operator new[]( size_t a_requestSize ) throw()
+{
+	return (void*)Mem_allocateLined( a_requestSize );
+}
+
+void			MemCacheLined::operator delete( void* a_addressToRelease ) throw()
+{
+	if( a_addressToRelease == NULL )
+		return;
+	Mem_releaseHunk( (caddr_t)a_addressToRelease );
+}
+
+void			MemCacheLined::operator delete[]( void* a_addressToRelease ) throw()
+{
+	if( a_addressToRelease == NULL )
+		return;
+	Mem_releaseHunk( (caddr_t)a_addressToRelease );
+}
+
+void*			MemLongLived::operator new( size_t a_requestSize ) throw()
+{
+	return (void*)Mem_allocateHunkHinted( a_requestSize, MEM_LONG_LIVED );
+}
+
+void*			MemLongLived::operator new[]( size_t a_requestSize ) throw()
+{
+	return (void*)Mem_allocateHunkHinted( a_requestSize, MEM_LONG_LIVED );
+}
+
+void			MemLongLived::operator delete( void* a_addressToRelease ) throw()
+{
+	if( a_addressToRelease == NULL )
+		return;
+	Mem_releaseHunk( (caddr_t)a_addressToRelease );
+}
+
+void			MemLongLived::operator delete[]( void* a_addressToRelease ) throw()
+{
+	if( a_addressToRelease == NULL )
+		return;
+	Mem_releaseHunk( (caddr_t)a_addressToRelease );
+}
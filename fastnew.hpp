@@ -10,4 +10,32 @@ void*			operator new[] ( size_t a_requestSize ) throw();
 void			operator delete( void* a_addressToRelease ) throw();
 void			operator delete[]( void* a_addressToRelease ) throw();
 
+// Derive from MemCacheLined to give every instance of a type cache lines
+// of its own, e.g. per-thread counters and queue heads that would
+// otherwise be packed next to each other and bounce between caches.
+//
+//	struct Counter : public MemCacheLined { long d_value; };
+//
+struct MemCacheLined
+{
+	static void*	operator new( size_t a_requestSize ) throw();
+	static void*	operator new[]( size_t a_requestSize ) throw();
+	static void		operator delete( void* a_addressToRelease ) throw();
+	static void		operator delete[]( void* a_addressToRelease ) throw();
+};
+
+// Derive from MemLongLived for types whose instances are made once and
+// kept, e.g. configuration and registries, so they are not scattered
+// through the clusters of short lived objects and keep them mapped.
+//
+//	struct Config : public MemLongLived { ... };
+//
+struct MemLongLived
+{
+	static void*	operator new( size_t a_requestSize ) throw();
+	static void*	operator new[]( size_t a_requestSize ) throw();
+	static void		operator delete( void* a_addressToRelease ) throw();
+	static void		operator delete[]( void* a_addressToRelease ) throw();
+};
+
 #endif
@@ -0,0 +1,354 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "mem_aloc.hpp"
+#include "mem_node.hpp"
+
+// fstbench - time allocating and releasing in each size category
+//
+//	fstbench [-r] [threads]
+//
+// Each category is run through three patterns, by every thread at once:
+//
+//	lifo	- allocate a run of hunks, release them newest first
+//	churn	- keep a set of hunks live, releasing one picked at random
+//			  and allocating a new one in its place
+//	batch	- as lifo, allocating with Mem_allocateHunks()
+//
+// and the time per allocate and release pair is printed. The Makefile
+// also links fstbench-bitmap and fstbench-freelist against a library
+// built with every size on one slot tracking policy. When they sit
+// next to fstbench it runs both with -r, which prints bare numbers for
+// the policy built in, and shows them side by side with the faster one
+// per category and pattern. Without them fstbench times the library
+// it was linked with, along with how each category tracks its slots.
+
+namespace
+{
+	// hunks in a lifo run, and live during churn
+	const long			RUN_HUNKS = 4096;
+	const long			CHURN_HUNKS = 1024;
+
+	// how many times each pattern is gone through
+	const long			LIFO_ROUNDS = 64;
+	const long			CHURN_STEPS = RUN_HUNKS * LIFO_ROUNDS;
+
+	const int			PATTERNS = 3;
+
+	struct benchRun
+	{
+		size_t			d_howBig;
+		double			d_nanoseconds[PATTERNS];
+	};
+
+	//************************************************************************
+	//
+	//	now() - CLOCK_MONOTONIC in nanoseconds
+	//
+	//************************************************************************
+	double				now()
+	{
+		struct timespec	time;
+		clock_gettime( CLOCK_MONOTONIC, &time );
+		return time.tv_sec * 1e9 + time.tv_nsec;
+	}
+
+	//************************************************************************
+	//
+	//	touch() - write to a hunk, as a caller would
+	//
+	//************************************************************************
+	void				touch( caddr_t a_hunk )
+	{
+		*(volatile char*)a_hunk = 1;
+	}
+
+	//************************************************************************
+	//
+	//	lifo() - allocate a run, release it newest first
+	//
+	//************************************************************************
+	double				lifo( size_t a_howBig, caddr_t* a_hunks, bool a_batch )
+	{
+		double			start = now();
+		for( long round = 0; round < LIFO_ROUNDS; round++ )
+		{
+			if( a_batch )
+			{
+				Mem_allocateHunks( a_howBig, RUN_HUNKS, a_hunks );
+			}
+			else
+			{
+				for( long index = 0; index < RUN_HUNKS; index++ )
+				{
+					a_hunks[index] = Mem_allocateHunk( a_howBig );
+				}
+			}
+			for( long index = 0; index < RUN_HUNKS; index++ )
+			{
+				touch( a_hunks[index] );
+			}
+			for( long index = RUN_HUNKS - 1; index >= 0; index-- )
+			{
+				Mem_releaseHunk( a_hunks[index] );
+			}
+		}
+		return ( now() - start ) / ( LIFO_ROUNDS * RUN_HUNKS );
+	}
+
+	//************************************************************************
+	//
+	//	churn() - replace hunks picked at random from a live set
+	//
+	//************************************************************************
+	double				churn( size_t a_howBig, caddr_t* a_hunks )
+	{
+		unsigned int	seed = (unsigned int)a_howBig;
+		for( long index = 0; index < CHURN_HUNKS; index++ )
+		{
+			a_hunks[index] = Mem_allocateHunk( a_howBig );
+		}
+
+		double			start = now();
+		for( long step = 0; step < CHURN_STEPS; step++ )
+		{
+			long		index = rand_r( &seed ) % CHURN_HUNKS;
+			Mem_releaseHunk( a_hunks[index] );
+			a_hunks[index] = Mem_allocateHunk( a_howBig );
+			touch( a_hunks[index] );
+		}
+		double			elapsed = ( now() - start ) / CHURN_STEPS;
+
+		for( long index = 0; index < CHURN_HUNKS; index++ )
+		{
+			Mem_releaseHunk( a_hunks[index] );
+		}
+		return elapsed;
+	}
+
+	//************************************************************************
+	//
+	//	runPatterns() - time every pattern at one size, from one thread
+	//
+	//************************************************************************
+	void*				runPatterns( void* a_run )
+	{
+		benchRun*		run = (benchRun*)a_run;
+		caddr_t*		hunks = (caddr_t*)malloc( RUN_HUNKS * sizeof(caddr_t) );
+
+		run->d_nanoseconds[0] = lifo( run->d_howBig, hunks, false );
+		run->d_nanoseconds[1] = churn( run->d_howBig, hunks );
+		run->d_nanoseconds[2] = lifo( run->d_howBig, hunks, true );
+
+		free( hunks );
+		return NULL;
+	}
+
+	//************************************************************************
+	//
+	//	timeSize() - time every pattern at one size, averaged over threads
+	//
+	//************************************************************************
+	void				timeSize( long a_size, long a_threads,
+								  double* a_nanoseconds )
+	{
+		pthread_t*		workers =
+							(pthread_t*)malloc( a_threads * sizeof(pthread_t) );
+		benchRun*		runs = (benchRun*)malloc( a_threads * sizeof(benchRun) );
+
+		for( long thread = 0; thread < a_threads; thread++ )
+		{
+			runs[thread].d_howBig = ( 1UL << a_size ) - sizeof(caddr_t);
+			pthread_create( &workers[thread], NULL, runPatterns,
+							&runs[thread] );
+		}
+
+		for( int pattern = 0; pattern < PATTERNS; pattern++ )
+		{
+			a_nanoseconds[pattern] = 0;
+		}
+		for( long thread = 0; thread < a_threads; thread++ )
+		{
+			pthread_join( workers[thread], NULL );
+			for( int pattern = 0; pattern < PATTERNS; pattern++ )
+			{
+				a_nanoseconds[pattern] += runs[thread].d_nanoseconds[pattern];
+			}
+		}
+		for( int pattern = 0; pattern < PATTERNS; pattern++ )
+		{
+			a_nanoseconds[pattern] /= a_threads;
+		}
+
+		free( runs );
+		free( workers );
+	}
+
+	//************************************************************************
+	//
+	//	openVariant() - start a sibling fstbench built on one policy
+	//
+	//	ARGUMENTS:
+	//		a_self - argv[0], whose directory the variant is looked for in
+	//		a_variant - the variant's file name
+	//		a_threads - threads to pass on
+	//
+	//	RETURNS:
+	//		a pipe to read the variant's -r output from, or NULL. A
+	//		variant that is not there shows up when the pipe is closed.
+	//
+	//************************************************************************
+	FILE*				openVariant( const char* a_self, const char* a_variant,
+									 long a_threads )
+	{
+		const char*		slash = strrchr( a_self, '/' );
+		int				length = slash ? (int)( slash - a_self + 1 ) : 0;
+		char			path[4096];
+		snprintf( path, sizeof(path), "%.*s%s", length, a_self, a_variant );
+
+		char			command[4200];
+		snprintf( command, sizeof(command), "'%s' -r %ld 2>/dev/null",
+				  path, a_threads );
+		return popen( command, "r" );
+	}
+
+	//************************************************************************
+	//
+	//	readVariant() - read one category's line of -r output
+	//
+	//************************************************************************
+	bool				readVariant( FILE* a_pipe, long a_size,
+									 double* a_nanoseconds )
+	{
+		unsigned long	howBig;
+		return fscanf( a_pipe, "%lu %lf %lf %lf", &howBig, &a_nanoseconds[0],
+					   &a_nanoseconds[1], &a_nanoseconds[2] ) == 4 &&
+			   howBig == 1UL << a_size;
+	}
+
+	//************************************************************************
+	//
+	//	compare() - time both policies and show them side by side
+	//
+	//	RETURNS:
+	//		false if either variant could not be run
+	//
+	//	NOTE:
+	//		The variants run one after the other, never at once, so neither
+	//		times the other's load.
+	//
+	//************************************************************************
+	bool				compare( const char* a_self, long a_threads )
+	{
+		static const char* const	names[PATTERNS] =
+										{ "lifo", "churn", "batch" };
+		const long		SIZES = MEM_NODE_LARGEST_SIZE - MEM_NODE_SMALLEST_SIZE + 1;
+		double			bitmap[SIZES][PATTERNS];
+		double			freeList[SIZES][PATTERNS];
+
+		FILE*			pipe = openVariant( a_self, "fstbench-bitmap",
+											a_threads );
+		bool			read = pipe != NULL;
+		for( long size = 0; read && size < SIZES; size++ )
+		{
+			read = readVariant( pipe, size + MEM_NODE_SMALLEST_SIZE,
+								bitmap[size] );
+		}
+		if( pipe )
+		{
+			read = pclose( pipe ) == 0 && read;
+		}
+
+		pipe = read ? openVariant( a_self, "fstbench-freelist", a_threads ) :
+					  NULL;
+		read = pipe != NULL;
+		for( long size = 0; read && size < SIZES; size++ )
+		{
+			read = readVariant( pipe, size + MEM_NODE_SMALLEST_SIZE,
+								freeList[size] );
+		}
+		if( pipe )
+		{
+			read = pclose( pipe ) == 0 && read;
+		}
+		if( !read )
+		{
+			return false;
+		}
+
+		printf( "%8s", "" );
+		for( int pattern = 0; pattern < PATTERNS; pattern++ )
+		{
+			printf( "   %-30s", names[pattern] );
+		}
+		printf( "(ns per allocate and release, %ld thread%s)\n", a_threads,
+				a_threads == 1 ? "" : "s" );
+		printf( "%8s", "size" );
+		for( int pattern = 0; pattern < PATTERNS; pattern++ )
+		{
+			printf( "   %9s %9s %-10s", "bitmap", "free list", " wins" );
+		}
+		printf( "\n" );
+		for( long size = 0; size < SIZES; size++ )
+		{
+			printf( "%8lu", 1UL << ( size + MEM_NODE_SMALLEST_SIZE ) );
+			for( int pattern = 0; pattern < PATTERNS; pattern++ )
+			{
+				printf( "   %9.1f %9.1f  %-9s", bitmap[size][pattern],
+						freeList[size][pattern],
+						bitmap[size][pattern] <= freeList[size][pattern] ?
+							"bitmap" : "free list" );
+			}
+			printf( "\n" );
+		}
+		return true;
+	}
+}
+
+int main( int argc, char** argv )
+{
+	bool				raw = argc > 1 && strcmp( argv[1], "-r" ) == 0;
+	int					first = raw ? 2 : 1;
+	long				threads = argc > first ? atol( argv[first] ) : 1;
+	if( argc > first + 1 || threads < 1 )
+	{
+		fprintf( stderr, "usage: %s [-r] [threads]\n", argv[0] );
+		return 2;
+	}
+
+	if( !raw && compare( argv[0], threads ) )
+	{
+		return 0;
+	}
+
+	if( !raw )
+	{
+		printf( "%8s %10s %10s %10s %10s   (ns per allocate and release, "
+				"%ld thread%s)\n", "size", "slots", "lifo", "churn", "batch",
+				threads, threads == 1 ? "" : "s" );
+	}
+	for( long size = MEM_NODE_SMALLEST_SIZE; size <= MEM_NODE_LARGEST_SIZE;
+		 size++ )
+	{
+		double			nanoseconds[PATTERNS];
+		timeSize( size, threads, nanoseconds );
+		if( raw )
+		{
+			printf( "%lu %.1f %.1f %.1f\n", 1UL << size, nanoseconds[0],
+					nanoseconds[1], nanoseconds[2] );
+		}
+		else
+		{
+			printf( "%8lu %10s %10.1f %10.1f %10.1f\n", 1UL << size,
+					MemNode_freeListSlots( size ) ? "free list" : "bitmap",
+					nanoseconds[0], nanoseconds[1], nanoseconds[2] );
+		}
+		fflush( stdout );
+	}
+
+	return 0;
+}
+
@@ -0,0 +1,262 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "mem_node.hpp"
+#include "mem_walk.hpp"
+
+// fstdiff - compare two heap snapshots
+//
+//	fstdiff before after [count]
+//
+// The snapshots are written by Mem_heapSnapshot(). For each size the
+// clusters held, blocks in use and bytes of cluster are shown before
+// and after, then the spans and the overflow pool, then the count
+// clusters, 20 by default, whose blocks in use grew the most. A cluster
+// counts as the same one if it is at the same address for the same
+// block size.
+
+namespace
+{
+	const int			CLASSES = MEM_NODE_LARGEST_SIZE -
+								  MEM_NODE_SMALLEST_SIZE + 1;
+
+	struct snapshot
+	{
+		MemHeapSnapshotHeader	d_header;
+		MemHeapRecord*	d_records;
+	};
+
+	// totals for one snapshot
+	struct summary
+	{
+		unsigned long	d_clusters[CLASSES];
+		unsigned long	d_live[CLASSES];
+		unsigned long	d_clusterBytes[CLASSES];
+		unsigned long	d_bytes[MEM_HEAP_KINDS];
+	};
+
+	// a cluster and how much more of it is in use
+	struct growth
+	{
+		const MemHeapRecord*	d_record;
+		long			d_bytes;
+	};
+
+	//************************************************************************
+	//
+	//	load() - read a snapshot file
+	//
+	//	RETURNS:
+	//		true if a_snapshot is filled in
+	//		false if the file could not be read or is not a snapshot
+	//
+	//************************************************************************
+	bool				load( const char* a_path, snapshot* a_snapshot )
+	{
+		FILE*			file = fopen( a_path, "rb" );
+		if( file == NULL )
+		{
+			perror( a_path );
+			return false;
+		}
+		bool			loaded = false;
+		MemHeapSnapshotHeader*	header = &a_snapshot->d_header;
+		if( fread( header, sizeof(*header), 1, file ) == 1 &&
+			header->d_magic == MEM_HEAP_MAGIC &&
+			header->d_version == MEM_HEAP_VERSION )
+		{
+			a_snapshot->d_records = (MemHeapRecord*)malloc(
+						( header->d_records + 1 ) * sizeof(MemHeapRecord) );
+			loaded = a_snapshot->d_records != NULL &&
+					 fread( a_snapshot->d_records, sizeof(MemHeapRecord),
+							header->d_records, file ) == header->d_records;
+		}
+		if( !loaded )
+		{
+			fprintf( stderr, "%s: not a heap snapshot\n", a_path );
+		}
+		fclose( file );
+		return loaded;
+	}
+
+	//************************************************************************
+	//
+	//	byAddress() - order records for lookup
+	//
+	//************************************************************************
+	int					byAddress( const void* a_left, const void* a_right )
+	{
+		const MemHeapRecord*	left = (const MemHeapRecord*)a_left;
+		const MemHeapRecord*	right = (const MemHeapRecord*)a_right;
+		if( left->d_address != right->d_address )
+		{
+			return left->d_address < right->d_address ? -1 : 1;
+		}
+		return (int)left->d_kind - (int)right->d_kind;
+	}
+
+	//************************************************************************
+	//
+	//	byGrowth() - order clusters by how much they grew, most first
+	//
+	//************************************************************************
+	int					byGrowth( const void* a_left, const void* a_right )
+	{
+		long			left = ( (const growth*)a_left )->d_bytes;
+		long			right = ( (const growth*)a_right )->d_bytes;
+		return left == right ? 0 : ( left > right ? -1 : 1 );
+	}
+
+	//************************************************************************
+	//
+	//	summarize() - add up a snapshot
+	//
+	//************************************************************************
+	void				summarize( const snapshot* a_snapshot,
+								   summary* a_summary )
+	{
+		*a_summary = summary();
+		for( unsigned long index = 0; index < a_snapshot->d_header.d_records;
+			 index++ )
+		{
+			const MemHeapRecord*	record = &a_snapshot->d_records[index];
+			if( record->d_kind >= MEM_HEAP_KINDS )
+			{
+				continue;
+			}
+			a_summary->d_bytes[record->d_kind] += record->d_bytes;
+
+			int			which = record->d_sizeShift - MEM_NODE_SMALLEST_SIZE;
+			if( record->d_kind != MEM_HEAP_NODE || which < 0 ||
+				which >= CLASSES || record->d_address == 0 )
+			{
+				continue;
+			}
+			a_summary->d_clusters[which]++;
+			a_summary->d_live[which] += record->d_live;
+			a_summary->d_clusterBytes[which] += record->d_bytes;
+		}
+	}
+
+	//************************************************************************
+	//
+	//	change() - print a before and after with the difference
+	//
+	//************************************************************************
+	void				change( unsigned long a_before, unsigned long a_after )
+	{
+		printf( " %9lu %9lu %+10ld", a_before, a_after,
+				(long)a_after - (long)a_before );
+	}
+
+	//************************************************************************
+	//
+	//	report() - print how one snapshot differs from another
+	//
+	//************************************************************************
+	void				report( const snapshot* a_before,
+								const snapshot* a_after, long a_count )
+	{
+		summary			before;
+		summary			after;
+		summarize( a_before, &before );
+		summarize( a_after, &after );
+
+		printf( "%.3f seconds apart\n\n",
+				( (double)a_after->d_header.d_takenAt -
+				  (double)a_before->d_header.d_takenAt ) / 1e9 );
+		printf( "%8s %30s %30s %30s\n", "size", "clusters", "live blocks",
+				"cluster KB" );
+		for( int which = 0; which < CLASSES; which++ )
+		{
+			printf( "%8lu", 1UL << ( which + MEM_NODE_SMALLEST_SIZE ) );
+			change( before.d_clusters[which], after.d_clusters[which] );
+			change( before.d_live[which], after.d_live[which] );
+			change( before.d_clusterBytes[which] / 1024,
+					after.d_clusterBytes[which] / 1024 );
+			printf( "\n" );
+		}
+
+		const char*		names[MEM_HEAP_KINDS] =
+						{ NULL, "spans used KB", "spans free KB",
+						  "overflow used KB", "overflow free KB" };
+		printf( "\n" );
+		for( int kind = MEM_HEAP_SPAN_USED; kind < MEM_HEAP_KINDS; kind++ )
+		{
+			printf( "%-17s", names[kind] );
+			change( before.d_bytes[kind] / 1024, after.d_bytes[kind] / 1024 );
+			printf( "\n" );
+		}
+
+		// the clusters whose blocks in use grew, new ones included
+		qsort( a_before->d_records, a_before->d_header.d_records,
+			   sizeof(MemHeapRecord), byAddress );
+		growth*			grown = (growth*)malloc(
+						( a_after->d_header.d_records + 1 ) * sizeof(growth) );
+		if( grown == NULL )
+		{
+			return;
+		}
+		long			grownCount = 0;
+		for( unsigned long index = 0; index < a_after->d_header.d_records;
+			 index++ )
+		{
+			const MemHeapRecord*	record = &a_after->d_records[index];
+			if( record->d_kind != MEM_HEAP_NODE || record->d_address == 0 )
+			{
+				continue;
+			}
+			const MemHeapRecord*	old = (const MemHeapRecord*)bsearch(
+							record, a_before->d_records,
+							a_before->d_header.d_records,
+							sizeof(MemHeapRecord), byAddress );
+			long		wasLive = 0;
+			if( old != NULL && old->d_sizeShift == record->d_sizeShift )
+			{
+				wasLive = old->d_live;
+			}
+			long		bytes = ( (long)record->d_live - wasLive ) <<
+								record->d_sizeShift;
+			if( bytes > 0 )
+			{
+				grown[grownCount].d_record = record;
+				grown[grownCount].d_bytes = bytes;
+				grownCount++;
+			}
+		}
+		qsort( grown, grownCount, sizeof(growth), byGrowth );
+
+		printf( "\n%18s %8s %6s %10s %10s\n", "cluster", "size", "chain",
+				"live", "grew KB" );
+		for( long index = 0; index < grownCount && index < a_count; index++ )
+		{
+			const MemHeapRecord*	record = grown[index].d_record;
+			printf( "%#18lx %8lu %6s %10u %10.1f\n", record->d_address,
+					1UL << record->d_sizeShift,
+					record->d_chain == 0 ? "short" : "long", record->d_live,
+					grown[index].d_bytes / 1024.0 );
+		}
+		free( grown );
+	}
+}
+
+int main( int argc, char** argv )
+{
+	if( argc < 3 || argc > 4 )
+	{
+		fprintf( stderr, "usage: %s before after [count]\n", argv[0] );
+		return 2;
+	}
+	long				count = argc > 3 ? atol( argv[3] ) : 20;
+
+	snapshot			before;
+	snapshot			after;
+	if( !load( argv[1], &before ) || !load( argv[2], &after ) )
+	{
+		return 1;
+	}
+	report( &before, &after, count );
+	free( before.d_records );
+	free( after.d_records );
+	return 0;
+}
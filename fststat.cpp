@@ -0,0 +1,135 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "mem_stat.hpp"
+
+// fststat - watch the allocator of a running process
+//
+//	fststat pid [interval [count]]
+//
+// The process must have called Mem_statsStart(). Every interval seconds,
+// one by default, the per size counters are printed with the allocation
+// rate since the last report and how full the held clusters are.
+
+namespace
+{
+	//************************************************************************
+	//
+	//	percent() - a part of a whole, 0 when there is no whole
+	//
+	//************************************************************************
+	double				percent( double a_part, double a_whole )
+	{
+		return a_whole == 0 ? 0 : 100.0 * a_part / a_whole;
+	}
+
+	//************************************************************************
+	//
+	//	report() - print one snapshot
+	//
+	//	ARGUMENTS:
+	//		a_now	   - the snapshot
+	//		a_previous - the one before, for rates, or NULL
+	//
+	//************************************************************************
+	void				report( const MemStatsPage* a_now,
+								const MemStatsPage* a_previous )
+	{
+		double			seconds = 0;
+		if( a_previous != NULL )
+		{
+			seconds = ( a_now->d_publishedAt - a_previous->d_publishedAt ) /
+					  1e9;
+		}
+
+		printf( "%8s %12s %10s %6s %9s %8s %10s %10s %9s %6s\n",
+				"size", "allocs/s", "live", "nodes", "clusters", "drained",
+				"held KB", "purged KB", "next KB", "fill%" );
+		for( long index = 0; index < MEM_STATS_CLASSES; index++ )
+		{
+			const MemStatsClass*	now = &a_now->d_classes[index];
+			double			rate = 0;
+			if( seconds > 0 )
+			{
+				rate = ( now->d_allocations -
+						 a_previous->d_classes[index].d_allocations ) /
+					   seconds;
+			}
+			printf( "%8lu %12.0f %10lu %6lu %9lu %8lu %10lu %10lu %9lu %6.1f\n",
+					now->d_blockSize, rate, now->d_live, now->d_nodes,
+					now->d_clustersHooked - now->d_clustersReleased,
+					now->d_clustersDrained,
+					now->d_clusterBytes / 1024, now->d_purgedBytes / 1024,
+					now->d_clusterSize / 1024,
+					percent( (double)now->d_live * now->d_blockSize,
+							 now->d_clusterBytes ) );
+		}
+
+		printf( "spans: %lu KB used, %lu KB free of %lu KB, %.1f%% free\n",
+				a_now->d_spanUsed / 1024, a_now->d_spanFree / 1024,
+				a_now->d_spanHeaps / 1024,
+				percent( a_now->d_spanFree,
+						 a_now->d_spanFree + a_now->d_spanUsed ) );
+		printf( "overflow: %lu KB used, %lu KB free of %lu KB, %.1f%% free\n",
+				a_now->d_varSizeUsed / 1024, a_now->d_varSizeFree / 1024,
+				a_now->d_varSizeSlabs / 1024,
+				percent( a_now->d_varSizeFree,
+						 a_now->d_varSizeFree + a_now->d_varSizeUsed ) );
+		printf( "retired: %lu waiting, %lu released\n",
+				a_now->d_retired - a_now->d_reclaimed, a_now->d_reclaimed );
+		printf( "clusters: %lu KB, big: %lu KB, arenas: %lu KB of %lu KB "
+				"committed\n\n",
+				a_now->d_clusterBytes / 1024, a_now->d_bigBytes / 1024,
+				a_now->d_committedBytes / 1024,
+				a_now->d_reservedBytes / 1024 );
+		fflush( stdout );
+	}
+}
+
+int main( int argc, char** argv )
+{
+	if( argc < 2 || argc > 4 )
+	{
+		fprintf( stderr, "usage: %s pid [interval [count]]\n", argv[0] );
+		return 2;
+	}
+	pid_t				pid = atol( argv[1] );
+	double				interval = argc > 2 ? atof( argv[2] ) : 1;
+	long				count = argc > 3 ? atol( argv[3] ) : -1;
+
+	const MemStatsPage*	page = Mem_statsAttach( pid );
+	if( page == NULL )
+	{
+		fprintf( stderr, "%s: process %ld publishes no allocator stats\n",
+				 argv[0], (long)pid );
+		return 1;
+	}
+
+	MemStatsPage		snapshots[2];
+	long				which = 0;
+	bool				havePrevious = false;
+	while( count != 0 )
+	{
+		if( !Mem_statsRead( page, &snapshots[which] ) )
+		{
+			fprintf( stderr, "%s: stats page stayed busy\n", argv[0] );
+			break;
+		}
+		report( &snapshots[which],
+				havePrevious ? &snapshots[1 - which] : NULL );
+		havePrevious = true;
+		which = 1 - which;
+		if( count > 0 )
+		{
+			count--;
+		}
+		if( count != 0 )
+		{
+			usleep( (useconds_t)( interval * 1000000 ) );
+		}
+	}
+
+	Mem_statsDetach( page );
+	return 0;
+}
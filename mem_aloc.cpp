@@ -14,57 +14,511 @@
 #include		"mem_vsiz.hpp"
 #endif			// __MEM_VSIZ_HPP__
 
+#ifndef			__MEM_SPAN_HPP__
+#include		"mem_span.hpp"
+#endif			// __MEM_SPAN_HPP__
+
+#ifndef			__MEM_BMAP_HPP__
+#include		"mem_bmap.hpp"
+#endif			// __MEM_BMAP_HPP__
+
+#ifndef			__MEM_LAT_HPP__
+#include		"mem_lat.hpp"
+#endif			// __MEM_LAT_HPP__
+
+#ifndef			__MEM_DEFR_HPP__
+#include		"mem_defr.hpp"
+#endif			// __MEM_DEFR_HPP__
+
+#ifndef			__MEM_WALK_HPP__
+#include		"mem_walk.hpp"
+#endif			// __MEM_WALK_HPP__
+
 #include		<stdio.h>
 #include		<unistd.h>
 
+extern bool					s_latencyEnabled;
+extern __thread unsigned long	s_latencyPath;
+extern __thread MemDeferRing*	s_deferRing;
+
 namespace
 {
-	// local function to set up the allocationBlock and nodeClusterMap
-	bool		initMasterTables();
+	// Constants
+	const long	OVERFLOW_POOL = -1;
+	const long	LARGEST_MANAGED_INDEX = MEM_NODE_LARGEST_SIZE -
+										MEM_NODE_SMALLEST_SIZE;
+	const long	LARGEST_MANAGED_ALLOCATION = 32 << LARGEST_MANAGED_INDEX;
+
+	// A back pointer with the low bit set is a distance into an overflow
+	// block, and one with the next bit set is a MemSpan.
+	const unsigned long	LINED_TAG = 1;
+	const unsigned long	SPAN_TAG = 2;
+
+	// The bitmaps of the root nodes. Category i holds blocks of
+	// 32 << i bytes, so a cluster holds CLUSTERSIZE >> (i+5) of them.
+	constinit MemBitmapStorage< ( CLUSTERSIZE >> 5 ) >	s_rootBitmap0;
+	constinit MemBitmapStorage< ( CLUSTERSIZE >> 6 ) >	s_rootBitmap1;
+	constinit MemBitmapStorage< ( CLUSTERSIZE >> 7 ) >	s_rootBitmap2;
+	constinit MemBitmapStorage< ( CLUSTERSIZE >> 8 ) >	s_rootBitmap3;
+	constinit MemBitmapStorage< ( CLUSTERSIZE >> 9 ) >	s_rootBitmap4;
+	constinit MemBitmapStorage< ( CLUSTERSIZE >> 10 ) >	s_rootBitmap5;
+	constinit MemBitmapStorage< ( CLUSTERSIZE >> 11 ) >	s_rootBitmap6;
+	constinit MemBitmapStorage< ( CLUSTERSIZE >> 12 ) >	s_rootBitmap7;
+	constinit MemBitmapStorage< ( CLUSTERSIZE >> 13 ) >	s_rootBitmap8;
+	constinit MemBitmapStorage< ( CLUSTERSIZE >> 14 ) >	s_rootBitmap9;
 
-	// the master tables that manage allocations
-	MemNode**	s_masterAllocationTable = NULL;
+	// The maps of purged pages of the root nodes whose blocks are big
+	// enough, a bit for each page of at least 4KB
+	constinit MemBitmapStorage< CLUSTERSIZE / 4096 >	s_rootPurged7;
+	constinit MemBitmapStorage< CLUSTERSIZE / 4096 >	s_rootPurged8;
+	constinit MemBitmapStorage< CLUSTERSIZE / 4096 >	s_rootPurged9;
+
+	// A root node for each fixed size allocation category. These and
+	// their bitmaps are built at compile time, so the allocator needs
+	// no setting up and the first allocation maps nothing but the
+	// cluster it hands out. Root nodes are not colored.
+	constinit MemNode	s_rootNodes[LARGEST_MANAGED_INDEX + 1] =
+	{
+		{  5, &s_rootBitmap0, NULL, NULL, NULL, 0, 0, CLUSTERSIZE,
+		  0, 0, false, false, 0, NULL, 0 },
+		{  6, &s_rootBitmap1, NULL, NULL, NULL, 0, 0, CLUSTERSIZE,
+		  0, 0, false, false, 0, NULL, 0 },
+		{  7, &s_rootBitmap2, NULL, NULL, NULL, 0, 0, CLUSTERSIZE,
+		  0, 0, false, false, 0, NULL, 0 },
+		{  8, &s_rootBitmap3, NULL, NULL, NULL, 0, 0, CLUSTERSIZE,
+		  0, 0, false, false, 0, NULL, 0 },
+		{  9, &s_rootBitmap4, NULL, NULL, NULL, 0, 0, CLUSTERSIZE,
+		  0, 0, false, false, 0, NULL, 0 },
+		{ 10, &s_rootBitmap5, NULL, NULL, NULL, 0, 0, CLUSTERSIZE,
+		  0, 0, false, false, 0, NULL, 0 },
+		{ 11, &s_rootBitmap6, NULL, NULL, NULL, 0, 0, CLUSTERSIZE,
+		  0, 0, false, false, 0, NULL, 0 },
+		{ 12, &s_rootBitmap7, NULL, NULL, NULL, 0, 0, CLUSTERSIZE,
+		  0, 0, false, false, 0, &s_rootPurged7, 0 },
+		{ 13, &s_rootBitmap8, NULL, NULL, NULL, 0, 0, CLUSTERSIZE,
+		  0, 0, false, false, 0, &s_rootPurged8, 0 },
+		{ 14, &s_rootBitmap9, NULL, NULL, NULL, 0, 0, CLUSTERSIZE,
+		  0, 0, false, false, 0, &s_rootPurged9, 0 }
+	};
+
+	// The master tables that manage allocations, one for each lifetime
+	// hint, so hunks expected to live long do not keep the clusters of
+	// short lived ones from draining. Only the short lived chains start
+	// with a root node, the others get their first node when asked.
+	const int	LIFETIMES = 2;
+	constinit MemNode*	s_masterAllocationTable[LIFETIMES]
+											   [LARGEST_MANAGED_INDEX + 1] =
+	{
+		{
+			&s_rootNodes[0],
+			&s_rootNodes[1],
+			&s_rootNodes[2],
+			&s_rootNodes[3],
+			&s_rootNodes[4],
+			&s_rootNodes[5],
+			&s_rootNodes[6],
+			&s_rootNodes[7],
+			&s_rootNodes[8],
+			&s_rootNodes[9]
+		},
+		{
+			NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL
+		}
+	};
+
+	// The node of each chain blocks came from last. Blocks keep coming
+	// from it until it is full, then MemNode_select() picks the fullest
+	// node with room, so the sparse ones can drain.
+	constinit MemNode*	s_currentNode[LIFETIMES][LARGEST_MANAGED_INDEX + 1] =
+	{
+		{
+			&s_rootNodes[0],
+			&s_rootNodes[1],
+			&s_rootNodes[2],
+			&s_rootNodes[3],
+			&s_rootNodes[4],
+			&s_rootNodes[5],
+			&s_rootNodes[6],
+			&s_rootNodes[7],
+			&s_rootNodes[8],
+			&s_rootNodes[9]
+		},
+		{
+			NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL
+		}
+	};
+
+	// A node of each chain that was full until a block of it was
+	// released. It is about as full as a node with room gets, so it is
+	// taken next without walking the chain.
+	MemNode*	s_refilledNode[LIFETIMES][LARGEST_MANAGED_INDEX + 1];
 
 	// performance tracking counter
 	long		s_allocationRequests = 0;
 
-	// Constants
-	const long	OVERFLOW_POOL = -1;
-	const long	LARGEST_MANAGED_INDEX = 9;
-	const long	LARGEST_MANAGED_ALLOCATION = 32 << LARGEST_MANAGED_INDEX;
+	// which size category holds blocks of at least a_howBig bytes
+	long		sizeClass( size_t a_howBig );
+
+	// get a block from the nodes of one size category
+	caddr_t		findClassBlock( int a_lifetime, long a_index,
+								MemNode** a_managingNode );
+
+	// get a number of blocks from the nodes of one size category
+	long		findClassBlocks( int a_lifetime, long a_index, long a_howMany,
+								 caddr_t* a_blocks, MemNode** a_managingNode );
+
+	// pick the node of a size category to take blocks from next
+	MemNode*	nextClassNode( int a_lifetime, long a_index );
+
+	// put a new node at the front of a size category
+	MemNode*	addClassNode( int a_lifetime, long a_index );
+
+	// link a node in at the front of a size category
+	void		linkClassNode( int a_lifetime, long a_index,
+							   MemNode* a_node );
+
+	//************************************************************************
+	//
+	//	::sizeClass() - find the size category for a block
+	//
+	//	ARGUMENTS:
+	//		a_howBig - the block size needed, back pointer included
+	//
+	//	RETURNS:
+	//		index into s_masterAllocationTable of the smallest category
+	//		whose blocks hold a_howBig bytes
+	//		OVERFLOW_POOL if no category is big enough
+	//
+	//************************************************************************
+	long			sizeClass( size_t a_howBig )
+	{
+		// if this is too big to be handled by the master
+		// allocation table, put it into the overflow bin
+		if( a_howBig > (size_t)LARGEST_MANAGED_ALLOCATION )
+		{
+			return OVERFLOW_POOL;
+		}
+
+		// Otherwise, double from the smallest category
+		// until the block fits
+		long		masterAllocationIndex = 0;
+		size_t		classSize = 32;
+		while( classSize < a_howBig )
+		{
+			classSize <<= 1;
+			masterAllocationIndex++;
+		}
+		return masterAllocationIndex;
+	}
 
 	//************************************************************************
 	//
-	//	::initMasterTables() - File local function to initialize the memory
-	//						 allocator.
+	//	::findClassBlock() - get a block from a size category, adding a
+	//						 MemNode to the category if they are all full
+	//
+	//	ARGUMENTS:
+	//		a_lifetime	   - which of the master tables
+	//		a_index		   - index into s_masterAllocationTable
+	//		a_managingNode - set to the node that owns the block
+	//
+	//	RETURNS:
+	//		the start of the block
+	//		NULL if a MemNode could not be allocated
 	//
 	//	NOTE:
-	//		This function builds the following tables:
-	//			 s_masterAllocationTable
-	//			 s_nodeClusterMap
+	//		Blocks come from the current node while it has room, then
+	//		from the fullest node, see MemNode_select().
 	//
 	//************************************************************************
-	bool			initMasterTables()
+	caddr_t			findClassBlock( int a_lifetime, long a_index,
+									MemNode** a_managingNode )
 	{
-		// allocate a cluster to hold the master allocation table
-		// This is a bit of overkill, but it will due for now
-		s_masterAllocationTable = (MemNode**)Cluster_request();
-		if( s_masterAllocationTable == NULL )
+		// get the MemNode blocks of this size came from last
+		MemNode**	currentNode = &s_currentNode[a_lifetime][a_index];
+		MemNode*	memNodePtr = __atomic_load_n( currentNode,
+												  __ATOMIC_ACQUIRE );
+
+		// and use that memNode to get a hunk for the request
+		while( 1 )
 		{
-			return false;
+			if( memNodePtr != NULL )
+			{
+				caddr_t	newBlock = MemNode_findBlock( memNodePtr );
+
+				// Found a block
+				if( newBlock != NULL )
+				{
+					*a_managingNode = memNodePtr;
+					return newBlock;
+				}
+			}
+
+			// If not, move on to the fullest MemNode of this size
+			// that has room, or make one if they are all full.
+			memNodePtr = ::nextClassNode( a_lifetime, a_index );
+			if( memNodePtr == NULL )
+			{
+				return NULL;
+			}
+			__atomic_store_n( currentNode, memNodePtr, __ATOMIC_RELEASE );
+		}
+	}
+
+	//************************************************************************
+	//
+	//	::findClassBlocks() - get a number of blocks from a size category,
+	//						  adding a MemNode if they are all full
+	//
+	//	ARGUMENTS:
+	//		a_lifetime	   - which of the master tables
+	//		a_index		   - index into s_masterAllocationTable
+	//		a_howMany	   - the most blocks wanted
+	//		a_blocks	   - filled in with the starts of the blocks
+	//		a_managingNode - set to the node that owns the blocks
+	//
+	//	RETURNS:
+	//		how many blocks were found, all from one node
+	//		0 if a MemNode could not be allocated
+	//
+	//************************************************************************
+	long			findClassBlocks( int a_lifetime, long a_index,
+									 long a_howMany, caddr_t* a_blocks,
+									 MemNode** a_managingNode )
+	{
+		MemNode**	currentNode = &s_currentNode[a_lifetime][a_index];
+		MemNode*	memNodePtr = __atomic_load_n( currentNode,
+												  __ATOMIC_ACQUIRE );
+		while( 1 )
+		{
+			if( memNodePtr != NULL )
+			{
+				long	found = MemNode_findBlocks( memNodePtr, a_howMany,
+													a_blocks );
+				if( found != 0 )
+				{
+					*a_managingNode = memNodePtr;
+					return found;
+				}
+			}
+
+			memNodePtr = ::nextClassNode( a_lifetime, a_index );
+			if( memNodePtr == NULL )
+			{
+				return 0;
+			}
+			__atomic_store_n( currentNode, memNodePtr, __ATOMIC_RELEASE );
+		}
+	}
+
+	//************************************************************************
+	//
+	//	::nextClassNode() - pick the node to take blocks from once the
+	//						current one is full
+	//
+	//	ARGUMENTS:
+	//		a_lifetime - which of the master tables
+	//		a_index	   - index into s_masterAllocationTable
+	//
+	//	RETURNS:
+	//		a node that was just refilled, or else the fullest node with
+	//		room, or else a new node
+	//		NULL if a MemNode could not be allocated
+	//
+	//************************************************************************
+	MemNode*		nextClassNode( int a_lifetime, long a_index )
+	{
+		MemNode*	memNodePtr = __atomic_exchange_n(
+								&s_refilledNode[a_lifetime][a_index],
+								(MemNode*)NULL, __ATOMIC_ACQ_REL );
+		if( memNodePtr != NULL )
+		{
+			return memNodePtr;
+		}
+		memNodePtr = MemNode_select( __atomic_load_n(
+							&s_masterAllocationTable[a_lifetime][a_index],
+							__ATOMIC_ACQUIRE ) );
+		if( memNodePtr != NULL )
+		{
+			return memNodePtr;
+		}
+		return ::addClassNode( a_lifetime, a_index );
+	}
+
+	//************************************************************************
+	//
+	//	::addClassNode() - put a new MemNode at the front of a size category
+	//
+	//	ARGUMENTS:
+	//		a_lifetime - which of the master tables
+	//		a_index	   - index into s_masterAllocationTable
+	//
+	//	RETURNS:
+	//		the node
+	//		NULL if a MemNode could not be allocated
+	//
+	//************************************************************************
+	MemNode*		addClassNode( int a_lifetime, long a_index )
+	{
+		// Take a node made ahead of time if there is one,
+		// otherwise pass in the shift factor to get the size
+		// of the block
+		MemNode*	memNodePtr = MemNode_takeSpare( a_index +
+												MEM_NODE_SMALLEST_SIZE );
+		if( memNodePtr == NULL )
+		{
+			memNodePtr = MemNode_create( a_index + MEM_NODE_SMALLEST_SIZE );
+			s_latencyPath |= MEM_LATENCY_NODE_CREATED;
+			if( memNodePtr == NULL )
+			{
+				return NULL;
+			}
 		}
 
-		for( long index = 0; index <= LARGEST_MANAGED_INDEX; index++ )
+		//Now that we have a new valid node, link it in the front.
+		::linkClassNode( a_lifetime, a_index, memNodePtr );
+		return memNodePtr;
+	}
+
+	//************************************************************************
+	//
+	//	::linkClassNode() - push a node onto the front of a size category
+	//
+	//	ARGUMENTS:
+	//		a_lifetime - which of the master tables
+	//		a_index	   - index into s_masterAllocationTable
+	//		a_node	   - the node
+	//
+	//	NOTE:
+	//		Nodes are never unlinked, so a list can be walked
+	//		while others push onto it.
+	//
+	//************************************************************************
+	void			linkClassNode( int a_lifetime, long a_index,
+								   MemNode* a_node )
+	{
+		a_node->d_chain = a_lifetime;
+		MemNode**	chain = &s_masterAllocationTable[a_lifetime][a_index];
+		MemNode*	head = __atomic_load_n( chain, __ATOMIC_ACQUIRE );
+		do
+		{
+			a_node->d_nextNode = head;
+		}
+		while( !__atomic_compare_exchange_n( chain, &head, a_node, false,
+											 __ATOMIC_ACQ_REL,
+											 __ATOMIC_ACQUIRE ) );
+	}
+
+
+	//************************************************************************
+	//
+	//	::allocateHunk() - Mem_allocateHunkHinted() without the timing
+	//
+	//************************************************************************
+	caddr_t			allocateHunk( size_t a_howBig, int a_lifetime )
+	{
+		// Inceremnt the overall allocation request count
+		__atomic_fetch_add( &s_allocationRequests, 1, __ATOMIC_RELAXED );
+	
+		// Add bytes to hold a pointer to the MemNode for this
+		a_howBig += sizeof(caddr_t);
+
+		// Hold which size category should this allocation go into
+		long		masterAllocationIndex = ::sizeClass( a_howBig );
+	
+		// Now that we've determined the bin for this allocation
+		// request the memory and return it to the caller
+
+		if( masterAllocationIndex == OVERFLOW_POOL &&
+			a_howBig <= MEM_SPAN_LARGEST )
+		{
+			// Too big for the fixed size pools, but a run of pages
+			// will do. Point back at the span, tagged.
+			MemSpan*	span;
+			caddr_t		returnAddr = Mem_spanAlloc( a_howBig, &span );
+			if( returnAddr == NULL )
+			{
+				return NULL;
+			}
+			*(unsigned long*)returnAddr = (unsigned long)span | SPAN_TAG;
+			return returnAddr+sizeof(MemNode*);
+		}
+
+		if( masterAllocationIndex == OVERFLOW_POOL )
+		{
+			// This request is too big to be handled in our fixed size
+			// pools. Put in into the overflow pool.
+			caddr_t	  returnAddr = Mem_varSizeAlloc( a_howBig );
+			if( returnAddr == NULL )
+			{
+				return NULL;
+			}
+			// Set the managing node to be NULL to mark this
+			// as being managed by the variable size allocator.
+			*(void**)returnAddr = (void*)NULL;
+			return returnAddr+sizeof(MemNode*);
+		}
+
+		// Otherwise, get a block from the nodes at masterAllocationIndex
+		MemNode*	memNodePtr;
+		caddr_t		newBlock = ::findClassBlock( a_lifetime,
+												 masterAllocationIndex,
+												 &memNodePtr );
+		if( newBlock == NULL )
+		{
+			return NULL;
+		}
+
+		// Add a pointer to the managing node, so we can
+		// delete the block quickly
+		*(caddr_t*)newBlock = (caddr_t)memNodePtr;
+		return newBlock+sizeof(MemNode*);
+	}
+
+
+	//************************************************************************
+	//
+	//	::releaseHunk() - Mem_releaseHunk() without the timing
+	//
+	//************************************************************************
+	void			releaseHunk( caddr_t a_hunkToRelease )
+	{
+
+		// The word before the hunk starts points to the MemNode that
+		// manages the address
+	
+		MemNode*		managingNode =
+								*(MemNode**)(a_hunkToRelease-sizeof(MemNode*));
+
+
+		// If the managing node is NULL, then the variable size allocator
+		// manages it. A tagged value is the distance Mem_allocateLined()
+		// moved the hunk into its overflow block, or the span it is in.
+		unsigned long	backPointer = (unsigned long)managingNode;
+		if( ( backPointer & ( LINED_TAG | SPAN_TAG ) ) == SPAN_TAG )
+		{
+			Mem_spanFree( (MemSpan*)( backPointer & ~SPAN_TAG ) );
+		}
+		else if( managingNode == NULL || ( backPointer & LINED_TAG ) )
+		{
+			unsigned long	distance = (unsigned long)managingNode >> 1;
+			// Note that it varSizeFree will do nothing if it
+			// cannot find this address
+			Mem_varSizeFree( a_hunkToRelease-sizeof(void*)-distance );
+		}
+		else
 		{
-			// Create a root node for each fixed size allocation category	   
-			s_masterAllocationTable[index] = MemNode_create( index+5 );
-			if( s_masterAllocationTable[index] == NULL )
+			// Otherwise, release the hunk from it's node. If that
+			// made room in a full node, fill it next.
+			if( MemNode_releaseBlock( managingNode, a_hunkToRelease ) )
 			{
-				return false;
+				__atomic_store_n( &s_refilledNode[managingNode->d_chain]
+												 [managingNode->d_size -
+												  MEM_NODE_SMALLEST_SIZE],
+								  managingNode, __ATOMIC_RELEASE );
 			}
 		}
-		return true;
 	}
+
 }
 
 
@@ -93,120 +547,336 @@ namespace
 //		to MemNode address. This way, when a hunk is released, the
 //		MemNode can be notified.
 //
-//		These tables are created by the initMasterTables() function
+//		s_masterAllocationTable starts out holding the root nodes,
+//		which are built at compile time.
+//
+//		Requests too big for it, up to MEM_SPAN_LARGEST, get a run of
+//		pages from mem_span, and only bigger ones go to the overflow
+//		pool.
+//
+//		With Mem_latencyEnable() on, each call is timed into the
+//		calling thread's histograms, see mem_lat.hpp.
 //
 //***************************************************************************
 caddr_t			Mem_allocateHunk( size_t a_howBig )
 {
-	// Inceremnt the overall allocation request count
-	s_allocationRequests++;
-	
-	if( s_masterAllocationTable == NULL )
+	return Mem_allocateHunkHinted( a_howBig, MEM_SHORT_LIVED );
+}
+
+
+//***************************************************************************
+//
+//	Mem_allocateHunkHinted() - allocate a hunk of memory that is expected
+//							   to live a long or a short time
+//
+//	ARGUMENTS:
+//		a_howBig   - the requested size
+//		a_lifetime - MEM_SHORT_LIVED or MEM_LONG_LIVED
+//
+//	RETURNS:
+//		pointer to allocated hunk
+//
+//	NOTE:
+//		A cluster is only released when its last block is, so a few
+//		hunks that live for good scattered among short lived ones pin
+//		clusters that are otherwise empty. Each lifetime has its own
+//		chain of MemNodes per size category, so clusters of short lived
+//		hunks drain and are released. Hunks too big for the size
+//		categories are released on their own and ignore the hint.
+//		Release these with Mem_releaseHunk(), like any other hunk.
+//
+//***************************************************************************
+caddr_t			Mem_allocateHunkHinted( size_t a_howBig, int a_lifetime )
+{
+	if( a_lifetime != MEM_LONG_LIVED )
 	{
-		if( ::initMasterTables() == false )
-		{
-			fprintf( stderr, "Mem: cannot initMasterTables()\n" );
-			_exit(-1);
-		}
+		a_lifetime = MEM_SHORT_LIVED;
 	}
 
-	// Hold which size category should this allocation go into
-	long		masterAllocationIndex = 0;
-
-	// Add bytes to hold a pointer to the MemNode for this
-	a_howBig += sizeof(caddr_t);
-	
-	long		poolIndex = a_howBig;
+	if( __builtin_expect( !s_latencyEnabled, 1 ) )
+	{
+		return ::allocateHunk( a_howBig, a_lifetime );
+	}
 
-	// if this is too big to be handled by the master
-	// allocation table, put it into the overflow bin
-	if( poolIndex > LARGEST_MANAGED_ALLOCATION )
+	// Time it, the slow paths taken note themselves in s_latencyPath
+	long		latencyClass = ::sizeClass( a_howBig + sizeof(caddr_t) );
+	if( latencyClass == OVERFLOW_POOL )
 	{
-		masterAllocationIndex = OVERFLOW_POOL;
+		latencyClass = MEM_LATENCY_OVERFLOW;
 	}
-	// Otherwise, we have a special category for this
-	// size of allocation
-	else
+	s_latencyPath = 0;
+	unsigned long	start = Mem_latencyTicks();
+	caddr_t		hunk = ::allocateHunk( a_howBig, a_lifetime );
+	Mem_latencyRecord( MEM_LATENCY_ALLOCATE, latencyClass, start );
+	return hunk;
+}
+
+
+//***************************************************************************
+//
+//	Mem_allocateHunks() - allocate a number of hunks of the same size
+//
+//	ARGUMENTS:
+//		a_howBig  - the requested size of each
+//		a_howMany - how many hunks are wanted
+//		a_hunks	  - filled in with the hunks
+//
+//	RETURNS:
+//		how many hunks were allocated, fewer than a_howMany only if
+//		memory ran out
+//
+//	NOTE:
+//		Blocks are claimed from each node many at a time, in one pass
+//		over its bitmap, which is much cheaper than a call per hunk for
+//		filling a cache or a batch. Release the hunks one at a time with
+//		Mem_releaseHunk().
+//
+//***************************************************************************
+size_t			Mem_allocateHunks( size_t a_howBig, size_t a_howMany,
+								   caddr_t* a_hunks )
+{
+	long		masterAllocationIndex =
+							::sizeClass( a_howBig + sizeof(caddr_t) );
+	size_t		allocated = 0;
+
+	if( masterAllocationIndex == OVERFLOW_POOL )
 	{
-		// shift of anything less than 32
-		poolIndex >>= 5;
-		while( masterAllocationIndex < LARGEST_MANAGED_INDEX )
+		while( allocated < a_howMany )
 		{
-			// if there are no more bits left in poolIndex,
-			// masterAllocationIndex contains the index into the
-			// masterAllocationTable of the node that manages this
-			// size allocation
-			if( poolIndex == 0 )
+			a_hunks[allocated] = Mem_allocateHunk( a_howBig );
+			if( a_hunks[allocated] == NULL )
 			{
 				break;
 			}
-			// if we have not shifted off the last bit,
-			// increment the index, shift, and continue.
-			masterAllocationIndex++;
-			poolIndex >>= 1;
+			allocated++;
 		}
+		return allocated;
 	}
-	
-	// Now that we've determined the bin for this allocation
-	// request the memory and return it to the caller
 
-	if( masterAllocationIndex == OVERFLOW_POOL )
+	__atomic_fetch_add( &s_allocationRequests, a_howMany, __ATOMIC_RELAXED );
+	while( allocated < a_howMany )
+	{
+		MemNode*	memNodePtr;
+		long		found = ::findClassBlocks( MEM_SHORT_LIVED,
+											   masterAllocationIndex,
+											   a_howMany - allocated,
+											   a_hunks + allocated,
+											   &memNodePtr );
+		if( found == 0 )
+		{
+			break;
+		}
+
+		// Point each block back at its node, like Mem_allocateHunk()
+		for( long index = 0; index < found; index++ )
+		{
+			caddr_t		newBlock = a_hunks[allocated + index];
+			*(caddr_t*)newBlock = (caddr_t)memNodePtr;
+			a_hunks[allocated + index] = newBlock+sizeof(MemNode*);
+		}
+		allocated += found;
+	}
+	return allocated;
+}
+
+//***************************************************************************
+//
+//	Mem_allocateLined() - allocate a hunk that owns whole cache lines
+//
+//	ARGUMENTS:
+//		a_howBig - the requested size
+//
+//	RETURNS:
+//		pointer to allocated hunk, aligned on a cache line
+//
+//	NOTE:
+//
+//		The hunk is rounded up to whole cache lines and the back pointer
+//		gets a line of its own in front of it, so no other hunk shares a
+//		line with this one. That keeps objects handed to different
+//		threads from bouncing a line between their caches.
+//
+//		Blocks of 64 bytes and up start on a cache line, so the hunk
+//		starts one line into a block of a power of two size category.
+//		Spans start on a page, so the same goes for them.
+//		Hunks too big for those come from the overflow pool, padded so
+//		the hunk can be moved up to the next line. The back pointer then
+//		holds the distance moved, shifted up and tagged with the low bit,
+//		so Mem_releaseHunk() can find the start of the overflow block.
+//
+//		Release these with Mem_releaseHunk(), like any other hunk.
+//
+//***************************************************************************
+caddr_t			Mem_allocateLined( size_t a_howBig )
+{
+	__atomic_fetch_add( &s_allocationRequests, 1, __ATOMIC_RELAXED );
+
+	// round up to whole lines, and take at least one
+	size_t		linedSize = ( a_howBig + CLUSTER_LINE_SIZE - 1 ) &
+							~( CLUSTER_LINE_SIZE - 1 );
+	if( linedSize == 0 )
 	{
-		// This request is too big to be handled in our fixed size
-		// pools. Put in into the overflow pool.
-		caddr_t	  returnAddr = Mem_varSizeAlloc( a_howBig );
-		// Set the managing node to be NULL to mark this
-		// as being managed by the variable size allocator.
-		*(void**)returnAddr = (void*)NULL;
-		return returnAddr+sizeof(MemNode*);
+		linedSize = CLUSTER_LINE_SIZE;
 	}
 
-	// Otherwise, get the MemNode at masterAllocationIndex
-	MemNode*   memNodePtr =
-					(MemNode*)s_masterAllocationTable[masterAllocationIndex];
+	// add a line for the back pointer
+	long		masterAllocationIndex =
+							::sizeClass( linedSize + CLUSTER_LINE_SIZE );
 
-	// and use that memNode to get a hunk for the request
-	while( 1 )
+	if( masterAllocationIndex == OVERFLOW_POOL &&
+		linedSize + CLUSTER_LINE_SIZE <= MEM_SPAN_LARGEST )
 	{
-		caddr_t	newBlock = MemNode_findBlock( memNodePtr );
+		MemSpan*	span;
+		caddr_t		newSpan = Mem_spanAlloc( linedSize + CLUSTER_LINE_SIZE,
+											 &span );
+		if( newSpan == NULL )
+		{
+			return NULL;
+		}
+		caddr_t		returnAddr = newSpan + CLUSTER_LINE_SIZE;
+		*(unsigned long*)(returnAddr - sizeof(MemNode*)) =
+							(unsigned long)span | SPAN_TAG;
+		return returnAddr;
+	}
 
-		// Check whether this MemNode could fulfill the request
-		if( newBlock == NULL )
+	if( masterAllocationIndex == OVERFLOW_POOL )
+	{
+		// overflow blocks are only SMALLEST_ALLOC aligned, so leave
+		// room to move up to a line on either end
+		caddr_t		varSizeBlock =
+					Mem_varSizeAlloc( linedSize + 2 * CLUSTER_LINE_SIZE );
+		if( varSizeBlock == NULL )
 		{
-			// If not, we need to go to the next MemNode that handles
-			// requests of this size.
-			// Save the previous node so we can link to it
-			// if necessary.
-			MemNode*	prevNode = memNodePtr;
-			memNodePtr = memNodePtr->d_nextNode;
-			// If the node is not yet initialized, make it so
-			if( memNodePtr == NULL )
-			{
-				// pass in the shift factor to get the size of the block
-				memNodePtr = MemNode_create( masterAllocationIndex+5 );
-				// Return an error if a MemNode could not be allocated
-				if( memNodePtr == NULL )
-				{
-					return NULL;
-				}
-				//Now that we have a new valid node, link it in the front
-				memNodePtr->d_nextNode =
-								s_masterAllocationTable[masterAllocationIndex];
-				s_masterAllocationTable[masterAllocationIndex] = memNodePtr;
-			}
-			continue;
+			return NULL;
 		}
-		// Found a block
-		else
+		caddr_t		returnAddr = (caddr_t)
+			( ( (unsigned long)varSizeBlock + sizeof(MemNode*) +
+				CLUSTER_LINE_SIZE - 1 ) & ~( CLUSTER_LINE_SIZE - 1 ) );
+		unsigned long	distance =
+							returnAddr - sizeof(MemNode*) - varSizeBlock;
+		*(unsigned long*)(returnAddr - sizeof(MemNode*)) =
+							( distance << 1 ) | 1;
+		return returnAddr;
+	}
+
+	MemNode*	memNodePtr;
+	caddr_t		newBlock = ::findClassBlock( MEM_SHORT_LIVED,
+											 masterAllocationIndex,
+											 &memNodePtr );
+	if( newBlock == NULL )
+	{
+		return NULL;
+	}
+
+	// the back pointer goes at the end of the block's first line
+	caddr_t		returnAddr = newBlock + CLUSTER_LINE_SIZE;
+	*(caddr_t*)(returnAddr - sizeof(MemNode*)) = (caddr_t)memNodePtr;
+	return returnAddr;
+}
+
+
+//***************************************************************************
+//
+//	Mem_allocateAtLeast() - allocate a hunk of memory and report its
+//							real size
+//
+//	ARGUMENTS:
+//		a_howBig	 - the requested size
+//		a_actualSize - set to the number of bytes the hunk holds, which
+//					   is at least a_howBig. Set to 0 on failure.
+//
+//	RETURNS:
+//		pointer to allocated hunk
+//
+//	NOTE:
+//		Requests are rounded up to the block size of their category, so
+//		a caller that grows a buffer can use the slack instead of
+//		reallocating early.
+//
+//***************************************************************************
+caddr_t			Mem_allocateAtLeast( size_t a_howBig, size_t* a_actualSize )
+{
+	caddr_t		hunk = Mem_allocateHunk( a_howBig );
+	*a_actualSize = ( hunk == NULL ) ? 0 : Mem_usableSize( hunk );
+	return hunk;
+}
+
+//***************************************************************************
+//
+//	Mem_usableSize() - how many bytes a hunk really holds
+//
+//	ARGUMENTS:
+//		a_hunk - a hunk from Mem_allocateHunk() or Mem_allocateLined()
+//
+//	RETURNS:
+//		the number of bytes from a_hunk to the end of its block
+//
+//***************************************************************************
+size_t			Mem_usableSize( caddr_t a_hunk )
+{
+	MemNode*		managingNode = *(MemNode**)(a_hunk-sizeof(MemNode*));
+	unsigned long	backPointer = (unsigned long)managingNode;
+
+	if( ( backPointer & ( LINED_TAG | SPAN_TAG ) ) == SPAN_TAG )
+	{
+		return Mem_spanEnd( (MemSpan*)( backPointer & ~SPAN_TAG ) ) - a_hunk;
+	}
+
+	if( managingNode == NULL || ( backPointer & LINED_TAG ) )
+	{
+		unsigned long	distance = (unsigned long)managingNode >> 1;
+		caddr_t			varSizeBlock = a_hunk - sizeof(void*) - distance;
+		size_t			usable = Mem_varSizeUsableSize( varSizeBlock ) -
+								 sizeof(void*) - distance;
+		// a lined hunk has to stop short of the line its overflow
+		// block shares with the next one, even when it did not move
+		if( backPointer & LINED_TAG )
 		{
-			// Add a pointer to the managing node, so we can
-			// delete the block quickly
-			*(caddr_t*)newBlock = (caddr_t)memNodePtr;
-			return newBlock+sizeof(MemNode*);
+			usable &= ~( CLUSTER_LINE_SIZE - 1 );
 		}
+		return usable;
 	}
+
+	// find the start of the block the hunk lives in
+	unsigned long	offset = a_hunk - managingNode->d_cluster -
+							 managingNode->d_offset;
+	offset >>= managingNode->d_size;
+	offset <<= managingNode->d_size;
+	caddr_t			blockEnd = managingNode->d_cluster +
+							   managingNode->d_offset + offset +
+							   ( 1L << managingNode->d_size );
+	return blockEnd - a_hunk;
 }
 
+//***************************************************************************
+//
+//	Mem_goodSize() - how many bytes Mem_allocateHunk() would really hand
+//					 out for a request
+//
+//	ARGUMENTS:
+//		a_howBig - the requested size
+//
+//	RETURNS:
+//		what Mem_usableSize() would report for the hunk
+//
+//***************************************************************************
+size_t			Mem_goodSize( size_t a_howBig )
+{
+	long		masterAllocationIndex =
+							::sizeClass( a_howBig + sizeof(caddr_t) );
+	if( masterAllocationIndex == OVERFLOW_POOL &&
+		a_howBig + sizeof(caddr_t) <= MEM_SPAN_LARGEST )
+	{
+		return Mem_spanGoodSize( a_howBig + sizeof(caddr_t) ) -
+			   sizeof(caddr_t);
+	}
+	if( masterAllocationIndex == OVERFLOW_POOL )
+	{
+		return Mem_varSizeGoodSize( a_howBig + sizeof(caddr_t) ) -
+			   sizeof(caddr_t);
+	}
+	return ( 32L << masterAllocationIndex ) - sizeof(caddr_t);
+}
 
 //***************************************************************************
 //
@@ -219,30 +889,43 @@ caddr_t			Mem_allocateHunk( size_t a_howBig )
 //	This function first finds the node that manages the cluster that
 //	contains a_hunkToRelease. Then it marks it as unused.
 //
+//	On a thread that defers its releases, see Mem_deferThread(), the
+//	hunk is only put on the thread's ring, unless the ring is full.
+//
 //***************************************************************************
 void			Mem_releaseHunk( caddr_t		a_hunkToRelease )
 {
+	MemDeferRing*	ring = s_deferRing;
+	if( __builtin_expect( ring != NULL, 0 ) )
+	{
+		if( Mem_deferPush( ring, a_hunkToRelease ) )
+		{
+			return;
+		}
+		// the reclaim thread is behind, so the thread pays for itself
+		__atomic_store_n( &ring->d_direct, ring->d_direct + 1,
+						  __ATOMIC_RELAXED );
+	}
 
-	// The word before the hunk starts points to the MemNode that
-	// manages the address
-	
-	MemNode*		managingNode =
-							*(MemNode**)(a_hunkToRelease-sizeof(MemNode*));
-
-
-	// If the managing node is NULL, then the variable size allocator
-	// manages it.
-	if( managingNode == NULL )
+	if( __builtin_expect( !s_latencyEnabled, 1 ) )
 	{
-		// Note that it varSizeFree will do nothing if it
-		// cannot find this address
-		Mem_varSizeFree( a_hunkToRelease-sizeof(void*) );
+		::releaseHunk( a_hunkToRelease );
+		return;
 	}
-	else
+
+	// Time it, under the size category the back pointer names
+	MemNode*		managingNode =
+							*(MemNode**)(a_hunkToRelease-sizeof(MemNode*));
+	long			latencyClass = MEM_LATENCY_OVERFLOW;
+	if( managingNode != NULL &&
+		!( (unsigned long)managingNode & ( LINED_TAG | SPAN_TAG ) ) )
 	{
-		// Otherwise, release the hunk from it's node
-		MemNode_releaseBlock( managingNode, a_hunkToRelease );
+		latencyClass = managingNode->d_size - MEM_NODE_SMALLEST_SIZE;
 	}
+	s_latencyPath = 0;
+	unsigned long	start = Mem_latencyTicks();
+	::releaseHunk( a_hunkToRelease );
+	Mem_latencyRecord( MEM_LATENCY_RELEASE, latencyClass, start );
 }
 
 
@@ -259,8 +942,237 @@ void			Mem_printCounts()
 	for( long index = 0; index <= LARGEST_MANAGED_INDEX; index++ )
 	{
 		fprintf( stderr, "%d bytes:\t%d\n", size,
-				((*s_masterAllocationTable)[index]).d_count );
+				s_masterAllocationTable[MEM_SHORT_LIVED][index]->d_count );
 		size <<= 1;
 	}
 
 }
+
+
+//***************************************************************************
+//
+//	Mem_heapWalk() - report everything the allocator holds
+//
+//	ARGUMENTS:
+//		a_walker  - called with each entry, see mem_walk.hpp
+//		a_context - passed on to a_walker
+//
+//	RETURNS:
+//		false if a_walker stopped the walk
+//
+//	NOTE:
+//		Nodes come first, the root ones then the rest, then the spans
+//		and the overflow pool. Only one part is locked at a time, and
+//		the nodes not at all.
+//
+//***************************************************************************
+bool			Mem_heapWalk( MemHeapWalker a_walker, void* a_context )
+{
+	for( long index = 0; index <= LARGEST_MANAGED_INDEX; index++ )
+	{
+		if( !MemNode_report( &s_rootNodes[index], a_walker, a_context ) )
+		{
+			return false;
+		}
+	}
+	return MemNode_walk( a_walker, a_context ) &&
+		   Mem_spanWalk( a_walker, a_context ) &&
+		   Mem_varSizeWalk( a_walker, a_context );
+}
+
+//***************************************************************************
+//
+//	Mem_trim() - give memory that is not in use back to the OS
+//
+//	RETURNS:
+//		the number of bytes unmapped
+//
+//	NOTE:
+//		Fixed size clusters are released as soon as their last block
+//		is, so besides the overflow pool and the empty span heaps kept
+//		for reuse, only the free pages inside the clusters of the
+//		biggest blocks have anything to give back.
+//
+//***************************************************************************
+size_t			Mem_trim()
+{
+	return Mem_varSizeTrim() + Mem_spanTrim() + Mem_purgePages();
+}
+
+//***************************************************************************
+//
+//	Mem_purgePages() - give back the free pages inside the clusters of
+//					   the size categories with page sized blocks
+//
+//	RETURNS:
+//		the number of bytes purged
+//
+//	NOTE:
+//		Every node of every chain is looked at, so this is for a
+//		thread that can spare the time, like Mem_trim(). The pages
+//		stay mapped and are faulted in again as blocks on them are
+//		handed out, see MemNode_purgePages().
+//
+//***************************************************************************
+size_t			Mem_purgePages()
+{
+	size_t		purged = 0;
+	for( int lifetime = 0; lifetime < LIFETIMES; lifetime++ )
+	{
+		for( long index = MEM_NODE_PURGE_SIZE - MEM_NODE_SMALLEST_SIZE;
+			 index <= LARGEST_MANAGED_INDEX; index++ )
+		{
+			for( MemNode* node = __atomic_load_n(
+							&s_masterAllocationTable[lifetime][index],
+							__ATOMIC_ACQUIRE );
+				 node != NULL;
+				 node = __atomic_load_n( &node->d_nextNode,
+										 __ATOMIC_ACQUIRE ) )
+			{
+				purged += MemNode_purgePages( node );
+			}
+		}
+	}
+	return purged;
+}
+
+//***************************************************************************
+//
+//	Mem_setTrimThreshold() - set how many bytes may be released to the
+//							 overflow pool before it trims itself
+//
+//	ARGUMENTS:
+//		a_bytes - the new threshold, 0 turns automatic trimming off
+//
+//***************************************************************************
+void			Mem_setTrimThreshold( size_t a_bytes )
+{
+	Mem_varSizeSetTrimThreshold( a_bytes );
+}
+
+//***************************************************************************
+//
+//	Mem_setClusterSize() - fix how big the clusters of a size category are
+//
+//	ARGUMENTS:
+//		a_howBig	  - a request size served by the category
+//		a_clusterSize - a power of two from CLUSTER_MIN_SIZE to
+//						CLUSTER_MAX_SIZE, or 0 to let the category adapt
+//
+//	RETURNS:
+//		true if the size was taken
+//		false if the request goes to the overflow pool or the size
+//		does not fit the category
+//
+//	NOTE:
+//		By default each category sizes its clusters by how it is used,
+//		so busy categories hook clusters less often and sparse ones
+//		scan shorter bitmaps. Only clusters hooked by nodes created
+//		after the call are affected. The root nodes stay at CLUSTERSIZE.
+//
+//***************************************************************************
+bool			Mem_setClusterSize( size_t a_howBig, size_t a_clusterSize )
+{
+	long		masterAllocationIndex =
+							::sizeClass( a_howBig + sizeof(caddr_t) );
+	if( masterAllocationIndex == OVERFLOW_POOL )
+	{
+		return false;
+	}
+	return MemNode_setClusterSize( masterAllocationIndex +
+								   MEM_NODE_SMALLEST_SIZE, a_clusterSize );
+}
+
+//***************************************************************************
+//
+//	Mem_reserve() - make room for a number of hunks of a size ahead of
+//					time, and keep it
+//
+//	ARGUMENTS:
+//		a_howBig - the request size
+//		a_count	 - how many hunks of it to make room for
+//		a_flags	 - MEM_RESERVE_LOCK to lock the room in memory
+//
+//	RETURNS:
+//		true if the room is made, faulted in, and locked if asked
+//		false if any of it could not be
+//
+//	NOTE:
+//		The room is added to what is there already and is pinned:
+//		releasing every hunk in it, Mem_trim() and Mem_rssRelease()
+//		leave it be. Fixed size categories get nodes with their
+//		clusters hooked, short lived chain, larger requests get span
+//		heaps, and the largest a slab of the overflow pool.
+//
+//***************************************************************************
+bool			Mem_reserve( size_t a_howBig, size_t a_count, int a_flags )
+{
+	bool		lock = ( a_flags & MEM_RESERVE_LOCK ) != 0;
+	size_t		howBig = a_howBig + sizeof(caddr_t);
+	long		masterAllocationIndex = ::sizeClass( howBig );
+	if( masterAllocationIndex == OVERFLOW_POOL )
+	{
+		if( howBig <= MEM_SPAN_LARGEST )
+		{
+			return Mem_spanReserve( howBig, a_count, lock );
+		}
+		// each hunk takes a whole node, header and all
+		return Mem_reserveBytes(
+				a_count * Mem_varSizeNodeSize( howBig ), a_flags );
+	}
+
+	size_t		slots = 0;
+	while( slots < a_count )
+	{
+		MemNode*	memNodePtr = MemNode_reserve( masterAllocationIndex +
+											  MEM_NODE_SMALLEST_SIZE );
+		if( memNodePtr == NULL )
+		{
+			return false;
+		}
+		bool		populated = Cluster_populate( memNodePtr->d_cluster,
+												  memNodePtr->d_clusterSize,
+												  lock );
+		::linkClassNode( MEM_SHORT_LIVED, masterAllocationIndex,
+						 memNodePtr );
+
+		// A current node with no cluster, like the root node at first,
+		// would hook a new one rather than use what was reserved
+		MemNode**	currentNode =
+					&s_currentNode[MEM_SHORT_LIVED][masterAllocationIndex];
+		MemNode*	current = __atomic_load_n( currentNode, __ATOMIC_ACQUIRE );
+		if( current == NULL ||
+			__atomic_load_n( &current->d_cluster, __ATOMIC_ACQUIRE ) == NULL )
+		{
+			__atomic_compare_exchange_n( currentNode, &current, memNodePtr,
+										 false, __ATOMIC_ACQ_REL,
+										 __ATOMIC_ACQUIRE );
+		}
+		if( !populated )
+		{
+			return false;
+		}
+		slots += ( memNodePtr->d_clusterSize - memNodePtr->d_offset ) >>
+				 ( masterAllocationIndex + MEM_NODE_SMALLEST_SIZE );
+	}
+	return true;
+}
+
+//***************************************************************************
+//
+//	Mem_reserveBytes() - add a_bytes of free room to the overflow pool
+//						 ahead of time, and keep it
+//
+//	ARGUMENTS:
+//		a_bytes - how many bytes
+//		a_flags - MEM_RESERVE_LOCK to lock them in memory
+//
+//	RETURNS:
+//		true if the room is made, faulted in, and locked if asked
+//		false if any of it could not be
+//
+//***************************************************************************
+bool			Mem_reserveBytes( size_t a_bytes, int a_flags )
+{
+	return Mem_varSizeReserve( a_bytes, ( a_flags & MEM_RESERVE_LOCK ) != 0 );
+}
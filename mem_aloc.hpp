@@ -6,11 +6,56 @@
 // Allocate a hunk of memory
 caddr_t			Mem_allocateHunk( size_t a_howBig );
 
+// How long a hunk is expected to live, hunks of each lifetime are kept
+// in clusters of their own
+const int		MEM_SHORT_LIVED = 0;
+const int		MEM_LONG_LIVED = 1;
+
+// Allocate a hunk of memory, with a hint of how long it will live
+caddr_t			Mem_allocateHunkHinted( size_t a_howBig, int a_lifetime );
+
+// Allocate a number of hunks of the same size at once
+size_t			Mem_allocateHunks( size_t a_howBig, size_t a_howMany,
+								   caddr_t* a_hunks );
+
+// Allocate a hunk of memory that shares no cache line with another hunk
+caddr_t			Mem_allocateLined( size_t a_howBig );
+
+// Allocate a hunk of memory and report how much of it may be used
+caddr_t			Mem_allocateAtLeast( size_t a_howBig, size_t* a_actualSize );
+
+// How many bytes a hunk really holds
+size_t			Mem_usableSize( caddr_t a_hunk );
+
+// How many bytes Mem_allocateHunk() would really hand out for a request
+size_t			Mem_goodSize( size_t a_howBig );
+
 // Release a hunk of memory
 void			Mem_releaseHunk( caddr_t a_hunkToRelease );
 
 // Print some stats
 void			Mem_printCounts();
+
+// Give memory that is not in use back to the OS
+size_t			Mem_trim();
+
+// Give back just the free pages between blocks in use in the clusters
+// of the biggest fixed sizes, which Mem_trim() does too
+size_t			Mem_purgePages();
+
+// How many overflow bytes may be released before they are trimmed
+void			Mem_setTrimThreshold( size_t a_bytes );
+
+// Fix the cluster size for the category serving a request size, 0 to adapt
+bool			Mem_setClusterSize( size_t a_howBig, size_t a_clusterSize );
+
+// Make room for a_count hunks of a_howBig bytes, or a_bytes of overflow
+// pool, now, faulted in and kept however much is released
+const int		MEM_RESERVE_LOCK = 1;		// and lock it in memory
+
+bool			Mem_reserve( size_t a_howBig, size_t a_count,
+							 int a_flags = 0 );
+bool			Mem_reserveBytes( size_t a_bytes, int a_flags = 0 );
 #endif			// __MEM_ALOC_H__
 
 
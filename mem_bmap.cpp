@@ -1,4 +1,3 @@
-
 #ifndef		__MEM_BMAP_HPP__
 #include	"mem_bmap.hpp"
 #endif		// __MEM_CLST_HPP__
@@ -11,153 +10,314 @@
 #include	<stddef.h>
 #include	<stdio.h>
 
+#if defined( __x86_64__ ) || defined( __i386__ )
+#include	<immintrin.h>
+#endif
+
 extern size_t				s_clusterSize;
 
 namespace
 {
-	// since our view of the space for bitmaps is an
-	// array of unsigned longs, make it be one.
-	// This is really just a cluster
-	MemBitmap**			s_bitmapRoot = NULL;
+	// The first cluster's worth of bitmap space, so the first bitmaps
+	// need no mapping. It sits in .bss until it is touched.
+	unsigned long		s_firstBitmapBlock[CLUSTERSIZE / sizeof(unsigned long)];
+
+	// Table of the clusters bitmaps are carved from. Each of those
+	// clusters holds slots of a single size, a power of two number of
+	// words. The first slot is given over to the slot size, which is
+	// set once by whoever first needs that size of slot.
+	// This is a cluster's worth of pointers, built at compile time.
+	constinit unsigned long*	s_bitmapRoot[CLUSTERSIZE / sizeof(unsigned long*)] =
+									{ s_firstBitmapBlock };
+
+	// How many bits are in a word of the bitmap
+	const unsigned long	BITS_PER_WORD = sizeof(unsigned long) * CHAR_BIT;
+
+	// the smallest slot, big enough for the two header words
+	const unsigned long	SMALLEST_SLOT = 4;
+
+	// words needed to hold a number of bits
+	unsigned long		numberOfWords( unsigned long a_numberOfBits );
+
+	// mark the bits past the end of a bitmap as used
+	void				fillPadding( MemBitmap* a_bitmap );
+
+	// get a table entry, hooking in a new cluster if there is none
+	unsigned long*		bitmapBlock( unsigned long	a_whichBlock,
+									 unsigned long	a_slotWords );
+
+	// Finds the first word at or after a_from, and before a_words, that
+	// has a clear bit, a_words if there is none. The best one the CPU
+	// can run is picked the first time one is needed.
+	typedef unsigned long	(*wordScanner)( const unsigned long* a_bits,
+											unsigned long a_from,
+											unsigned long a_words );
+	wordScanner			s_wordScanner = NULL;
+
+	//************************************************************************
+	//
+	//	numberOfWords() - words needed to hold a number of bits
+	//
+	//************************************************************************
+	unsigned long		numberOfWords( unsigned long a_numberOfBits )
+	{
+		return ( a_numberOfBits + BITS_PER_WORD - 1 ) / BITS_PER_WORD;
+	}
+
+	//************************************************************************
+	//
+	//	fillPadding() - mark the bits past the end of a bitmap as used
+	//
+	//	NOTE:
+	//		With the unused tail of the last word set, any clear bit is a
+	//		free block and the searches need no bounds check.
+	//
+	//************************************************************************
+	void				fillPadding( MemBitmap* a_bitmap )
+	{
+		unsigned long	usedBits = a_bitmap->d_numberOfBits % BITS_PER_WORD;
+		if( usedBits != 0 )
+		{
+			unsigned long	lastWord =
+								numberOfWords( a_bitmap->d_numberOfBits ) - 1;
+			__atomic_fetch_or( &a_bitmap->d_bits[lastWord],
+							   ~0UL << usedBits, __ATOMIC_RELAXED );
+		}
+	}
+
+	//************************************************************************
+	//
+	//	bitmapBlock() - get a cluster from s_bitmapRoot
+	//
+	//	ARGUMENTS:
+	//		a_whichBlock - index into s_bitmapRoot
+	//		a_slotWords	 - slot size to give the cluster if it has none
+	//
+	//	RETURNS:
+	//		the cluster, whatever its slot size
+	//		NULL if a new one was needed and could not be had
+	//
+	//	NOTE:
+	//		If two threads hook in a cluster at once, the loser gives
+	//		its cluster back and uses the winner's. The slot size is set
+	//		the same way, by swapping it in over 0.
+	//
+	//************************************************************************
+	unsigned long*		bitmapBlock( unsigned long	a_whichBlock,
+									 unsigned long	a_slotWords )
+	{
+		unsigned long*	block = __atomic_load_n( &s_bitmapRoot[a_whichBlock],
+												 __ATOMIC_ACQUIRE );
+		if( block == NULL )
+		{
+			unsigned long*	newBlock =
+							(unsigned long*)Cluster_request( s_clusterSize );
+			if( newBlock == NULL )
+			{
+				return NULL;
+			}
+			if( __atomic_compare_exchange_n( &s_bitmapRoot[a_whichBlock],
+											 &block, newBlock, false,
+											 __ATOMIC_ACQ_REL,
+											 __ATOMIC_ACQUIRE ) )
+			{
+				block = newBlock;
+			}
+			else
+			{
+				Cluster_release( (caddr_t)newBlock, s_clusterSize );
+			}
+		}
+
+		unsigned long	expected = 0;
+		__atomic_compare_exchange_n( &block[0], &expected, a_slotWords, false,
+									 __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE );
+		return block;
+	}
+
+	//************************************************************************
+	//
+	//	scanWords() - find a word with a clear bit, one word at a time
+	//
+	//************************************************************************
+	unsigned long		scanWords( const unsigned long* a_bits,
+								   unsigned long a_from,
+								   unsigned long a_words )
+	{
+		while( a_from < a_words &&
+			   __atomic_load_n( &a_bits[a_from], __ATOMIC_RELAXED ) == ~0UL )
+		{
+			a_from++;
+		}
+		return a_from;
+	}
+
+#if defined( __x86_64__ ) || defined( __i386__ )
+	//************************************************************************
+	//
+	//	scanWordsSse4() - find a word with a clear bit, two words at a time
+	//
+	//	NOTE:
+	//		The vector loads are not atomic, but a word only needs to be
+	//		seen whole, and the claim itself is made with an atomic
+	//		operation that settles any race.
+	//
+	//************************************************************************
+	__attribute__(( target( "sse4.1" ) ))
+	unsigned long		scanWordsSse4( const unsigned long* a_bits,
+									   unsigned long a_from,
+									   unsigned long a_words )
+	{
+		const __m128i	full = _mm_set1_epi64x( -1 );
+		for( ; a_from + 2 <= a_words; a_from += 2 )
+		{
+			__m128i		words = _mm_loadu_si128(
+										(const __m128i*)&a_bits[a_from] );
+			int			fullWords = _mm_movemask_pd(
+							_mm_castsi128_pd( _mm_cmpeq_epi64( words, full ) ) );
+			if( fullWords != 0x3 )
+			{
+				return a_from + __builtin_ctz( ~fullWords );
+			}
+		}
+		return scanWords( a_bits, a_from, a_words );
+	}
+
+	//************************************************************************
+	//
+	//	scanWordsAvx2() - find a word with a clear bit, four words at a time
+	//
+	//************************************************************************
+	__attribute__(( target( "avx2" ) ))
+	unsigned long		scanWordsAvx2( const unsigned long* a_bits,
+									   unsigned long a_from,
+									   unsigned long a_words )
+	{
+		const __m256i	full = _mm256_set1_epi64x( -1 );
+		for( ; a_from + 4 <= a_words; a_from += 4 )
+		{
+			__m256i		words = _mm256_loadu_si256(
+										(const __m256i*)&a_bits[a_from] );
+			int			fullWords = _mm256_movemask_pd(
+							_mm256_castsi256_pd(
+								_mm256_cmpeq_epi64( words, full ) ) );
+			if( fullWords != 0xf )
+			{
+				return a_from + __builtin_ctz( ~fullWords );
+			}
+		}
+		return scanWords( a_bits, a_from, a_words );
+	}
+#endif
 
+	//************************************************************************
+	//
+	//	wordScan() - the word scanner for this CPU
+	//
+	//	NOTE:
+	//		Threads that race to pick one pick the same one.
+	//
+	//************************************************************************
+	wordScanner			wordScan()
+	{
+		wordScanner		scanner =
+						__atomic_load_n( &s_wordScanner, __ATOMIC_RELAXED );
+		if( scanner != NULL )
+		{
+			return scanner;
+		}
+
+		scanner = scanWords;
+#if defined( __x86_64__ ) || defined( __i386__ )
+		__builtin_cpu_init();
+		if( __builtin_cpu_supports( "avx2" ) )
+		{
+			scanner = scanWordsAvx2;
+		}
+		else if( __builtin_cpu_supports( "sse4.1" ) )
+		{
+			scanner = scanWordsSse4;
+		}
+#endif
+		__atomic_store_n( &s_wordScanner, scanner, __ATOMIC_RELAXED );
+		return scanner;
+	}
 }
-#define HIGH_ORDER_BIT				0x80000000
 
 //****************************************************************************
 //
 //	MemBitmap_create() - Create a new bitmap by eeking it out of the block
 //
 //	ARGUMENTS:
-//		a_blockSize - the size of blocks managed by this bitmap
+//		a_numberOfBits - the number of blocks managed by this bitmap
 //
 //
 //	RETURNS:
 //		a pointer to the initialized bitmap
 //		NULL if a bitmap could not be allocated
 //
+//	NOTE:
+//		A slot is claimed by swapping its d_numberOfBits from 0, so any
+//		number of threads can create bitmaps at once without a lock.
+//		Nodes with bigger clusters simply take bigger slots.
+//
 //****************************************************************************
-MemBitmap*		MemBitmap_create( size_t a_blockSize )
+MemBitmap*		MemBitmap_create( size_t a_numberOfBits )
 {
-	// initialize the bitmapRoot, if it's not alread done
-	if( s_bitmapRoot == NULL )
+	// Add one for the the word to hold the number of bits
+	// and one to hold the status, then round up to a slot size
+	unsigned long	slotWords = SMALLEST_SLOT;
+	while( slotWords < 2 + numberOfWords( a_numberOfBits ) )
 	{
-		// Allocate a cluster to hold all bitmaps
-		s_bitmapRoot = (MemBitmap**)Cluster_request();
-		if( s_bitmapRoot == NULL )
-		{
-			return NULL;
-		}
+		slotWords <<= 1;
 	}
 
-	// go from number of bytes in a single allocation block
-	// to number of words the bitmap needs.
-	long			numberOfBits =  s_clusterSize / a_blockSize ;
-	long			numberOfWords = numberOfBits >> 5 ;
-	// If it takes fewer bits than 1 word to hold the bits for this bitmap
-	// the calculation above will report 0. Adjust accordingly.
-	if( numberOfWords == 0 )
+	unsigned long	wordsPerCluster = s_clusterSize / sizeof(unsigned long);
+
+	// the first slot holds the slot size, so a cluster must hold two
+	if( a_numberOfBits == 0 || slotWords > wordsPerCluster / 2 )
 	{
-		numberOfWords = 1;
+		return NULL;
 	}
-	
-	// Add one for the the word to hold the number of words
-	// and one to hold the status
-	numberOfWords+=2;
 
-	// The value we are going to return
-	MemBitmap*		foundBitmap;
-	
-	// look in the bitmapRoot for a hunk of memory to use
-	// which bitmapBlock in bitmapRoot are we looking it
-	long			bitmapBlock;		  
-
-	// loop counter variable, mark position in the bitmapBlock
-	long			index;
-
-	// sentry variable to determine when we've found a spot big enough
-	long			freeZoneSize = 0;
-
-	// Can this be optimized with a bit shift?
-	long wordsPerCluster = s_clusterSize >> 5;
-		
-	for( bitmapBlock = 0;
-		 bitmapBlock < s_clusterSize >> 2;
-		 bitmapBlock++ )
+	for( unsigned long whichBlock = 0;
+		 whichBlock < sizeof(s_bitmapRoot) / sizeof(s_bitmapRoot[0]);
+		 whichBlock++ )
 	{
-
-		// create a bitmapBlock if it is not there.
-		// We will always exit the loop if we had
-		// to create a bitmapBlockn
-		if( s_bitmapRoot[bitmapBlock] == NULL )
+		unsigned long*	block = bitmapBlock( whichBlock, slotWords );
+		if( block == NULL )
 		{
-			s_bitmapRoot[bitmapBlock] = (MemBitmap*)Cluster_request();
-			if( s_bitmapRoot[bitmapBlock] == NULL )
-			{
-				return NULL;
-			}
+			return NULL;
 		}
-		// view the bitmap as an array of longs
-		unsigned long*		bitmapView =
-								(unsigned long*)s_bitmapRoot[bitmapBlock];
-
-		for( index = 0, freeZoneSize = 0;
-			 index < wordsPerCluster;
-			 index++ )
+		// only look in clusters carved into our size of slot
+		if( block[0] != slotWords )
 		{
-			// look for the start of a free hunk. The d_numberOfBits 
-			// value is non-zero for an active bitmap
-			if( bitmapView[index] == 0L )
-			{
-				// Don't get your hopes up. If there are not enough
-				// words left to hold our bitmap, stop and
-				// go to the next block.
-				//  ( bits per cluster) < ( bits required )
-				if( wordsPerCluster < index + numberOfWords )
-				{
-					// Break out and go to the next bitmap block
-					break;
-				}
-				// mark that we are in a candidate for our bitmap
-				// and keep track of how much we've gathered
-				freeZoneSize++;
-			}
-			// We've stumbled onto an existing bitmap
-			else
-			{
-				// Skip ahead the size of that bitmap
-				index += bitmapView[index];
-			}
+			continue;
+		}
 
+		for( unsigned long index = slotWords;
+			 index + slotWords <= wordsPerCluster;
+			 index += slotWords )
+		{
+			MemBitmap*		foundBitmap = (MemBitmap*)&block[index];
+			unsigned long	expected = 0;
 
-			//We've stepped ahead, now see if we can exit
-			if( freeZoneSize == numberOfWords )
+			if( __atomic_load_n( &foundBitmap->d_numberOfBits,
+								 __ATOMIC_RELAXED ) == 0 &&
+				__atomic_compare_exchange_n( &foundBitmap->d_numberOfBits,
+											 &expected, a_numberOfBits,
+											 false, __ATOMIC_ACQ_REL,
+											 __ATOMIC_RELAXED ) )
 			{
-				// we've found enough space. Set the start of the bitmap
-				// back to the start of our hunk and break out
-				//Back up one
-				freeZoneSize--; 
-				index -= freeZoneSize;
-				foundBitmap = (MemBitmap*)&bitmapView[index];
-				// Break out of these loops
-				goto foundBitmap;
+				// the bits were cleared when the slot was given up
+				foundBitmap->d_filled = 0;
+				fillPadding( foundBitmap );
+				// and return its head.
+				return foundBitmap;
 			}
 		}
 	}
-	
- foundBitmap:
-	// if we have reached the end of our block without finding
-	// room for our new bitmap, barf
-	if( freeZoneSize == 0 )
-	{
-		return NULL;
-	}
-
-	// set the first word of the bitmap to the number of bits
-	// in this bitmap
-	foundBitmap->d_numberOfBits = numberOfBits;
-	foundBitmap->d_filled = 0;
-	// and return its head.
-	return foundBitmap;
+	return NULL;
 }
 
 //****************************************************************************
@@ -170,11 +330,17 @@ MemBitmap*		MemBitmap_create( size_t a_blockSize )
 //****************************************************************************
 void			MemBitmap_destroy( MemBitmap* a_bitmapToDestroy )
 {
-	// zero all bits for this bitmap
-	MemBitmap_clear( a_bitmapToDestroy );
+	// zero all bits for this bitmap, padding included
+	unsigned long	words = numberOfWords( a_bitmapToDestroy->d_numberOfBits );
+	for( unsigned long i = 0; i < words; i++ )
+	{
+		a_bitmapToDestroy->d_bits[i] = 0L;
+	}
+	a_bitmapToDestroy->d_filled = 0L;
 
-    // zero the number of bits field for this bitmap
-	a_bitmapToDestroy->d_numberOfBits = 0L;
+	// zero the number of bits field for this bitmap, which frees the slot
+	__atomic_store_n( &a_bitmapToDestroy->d_numberOfBits, 0L,
+					  __ATOMIC_RELEASE );
 }
 
 //****************************************************************************
@@ -189,80 +355,167 @@ void			MemBitmap_destroy( MemBitmap* a_bitmapToDestroy )
 //		index of available free block
 //		ULONG_MAX if a block cannot be found
 //
+//	NOTE:
+//		This only looks, another thread may take the block before it is
+//		marked. Use MemBitmap_claim() to find and mark in one step.
+//
 //****************************************************************************
 unsigned long			MemBitmap_findBlock( MemBitmap* a_whereToLook )
 {
-	// Iterate over each bit using bitIndex as a base counter,
-	// using mods of word size on bitINdex fiure out when
-	// we need to increment wordIndex to the next word
-
 	// If this bitmap is filled, don't bother
-	if( a_whereToLook->d_filled == 1 )
+	if( __atomic_load_n( &a_whereToLook->d_filled, __ATOMIC_RELAXED ) == 1 )
 	{
 		return ULONG_MAX;
 	}
-  
-	// Set a starting point for the bitmap
-	unsigned long*		bitMap = a_whereToLook->d_bits;
 
-	unsigned long index = 0UL;
-	unsigned long bitMask = HIGH_ORDER_BIT;
-	unsigned long maxCount = a_whereToLook->d_numberOfBits;
+	unsigned long	words = numberOfWords( a_whereToLook->d_numberOfBits );
 
-	if( maxCount < 32 )
+	// look word by word
+	for( unsigned long wordIndex = 0; wordIndex < words; wordIndex++ )
 	{
-		// Search on a bit by bit basis if there are fewer than
-		// word-size number of bits in this bitmap.
-		while( index < maxCount )
+		unsigned long	word = __atomic_load_n( &a_whereToLook->d_bits[wordIndex],
+												__ATOMIC_RELAXED );
+		// shortCircuit in case no bit is free
+		if( word != ~0UL )
 		{
-			// Check to see if the bit is free.
-			if( !(*bitMap & bitMask) )
-			{
-				// If it is, return it's position
-				return index;
-			}
-			// Shift toward the LOB 1 bit.
-			bitMask >>= 1;
-			// And try the next bit
-			++index;
+			// the lowest clear bit is the first free block
+			return wordIndex * BITS_PER_WORD + __builtin_ctzl( ~word );
 		}
 	}
-	else
+	// Could not find a bit
+	return ULONG_MAX;
+}
+
+//****************************************************************************
+//
+//	MemBitmap_claim() - Find a free block and mark it as used
+//
+//	ARGUMENTS:
+//		a_whereToLook			- bitmap to find a block in
+//
+//	RETURNS:
+//		index of the block claimed
+//		ULONG_MAX if a block cannot be found
+//
+//	NOTE:
+//		A block is claimed by compare-and-swapping the bit into its word,
+//		so two threads can never come away with the same block.
+//
+//		d_filled is only a hint. A release that races with the scan can
+//		leave it set over a free bit, which costs that bit until the next
+//		release or until the node is emptied.
+//
+//****************************************************************************
+unsigned long			MemBitmap_claim( MemBitmap* a_whereToLook )
+{
+	// If this bitmap is filled, don't bother
+	if( __atomic_load_n( &a_whereToLook->d_filled, __ATOMIC_RELAXED ) == 1 )
+	{
+		return ULONG_MAX;
+	}
+
+	unsigned long	words = numberOfWords( a_whereToLook->d_numberOfBits );
+
+	for( unsigned long wordIndex = 0; wordIndex < words; wordIndex++ )
 	{
-		// look word by word
-		// divide by the word size to get the number of words to examine
-		maxCount >>= 5;
-		while( index < maxCount )
+		unsigned long*	bitMap = &a_whereToLook->d_bits[wordIndex];
+		unsigned long	word = __atomic_load_n( bitMap, __ATOMIC_RELAXED );
+
+		// keep trying this word until it fills up under us
+		while( word != ~0UL )
 		{
-			// shortCircuit in case no bit is free
-			if( (*bitMap & 0xffffffff) == 0xffffffff )
+			unsigned long	whichBit = __builtin_ctzl( ~word );
+			if( __atomic_compare_exchange_n( bitMap, &word,
+											 word | ( 1UL << whichBit ),
+											 false, __ATOMIC_ACQUIRE,
+											 __ATOMIC_RELAXED ) )
 			{
-				bitMask = 0UL;
-				++index;
-				continue;
+				return wordIndex * BITS_PER_WORD + whichBit;
 			}
+		}
+	}
+	// Could not find a bit
+	__atomic_store_n( &a_whereToLook->d_filled, 1UL, __ATOMIC_RELAXED );
+	return ULONG_MAX;
+}
+
+//****************************************************************************
+//
+//	MemBitmap_claimBlocks() - Find free blocks and mark them as used
+//
+//	ARGUMENTS:
+//		a_whereToLook			- bitmap to find blocks in
+//		a_howMany				- the most blocks wanted
+//		a_blocks				- filled in with the indexes claimed,
+//								  lowest first
+//
+//	RETURNS:
+//		how many blocks were claimed, 0 if none were free
+//
+//	NOTE:
+//		One pass is made over the bitmap. Full words are skipped with
+//		vector compares where the CPU has them, and each word with free
+//		bits has as many as are still wanted claimed with one atomic OR.
+//		Bits another thread claimed first are simply not ours, so the
+//		word is looked at again.
+//
+//****************************************************************************
+unsigned long			MemBitmap_claimBlocks( MemBitmap* a_whereToLook,
+											   unsigned long a_howMany,
+											   unsigned long* a_blocks )
+{
+	// If this bitmap is filled, don't bother
+	if( a_howMany == 0 ||
+		__atomic_load_n( &a_whereToLook->d_filled, __ATOMIC_RELAXED ) == 1 )
+	{
+		return 0;
+	}
+
+	wordScanner		scanner = wordScan();
+	unsigned long	words = numberOfWords( a_whereToLook->d_numberOfBits );
+	unsigned long	claimed = 0;
 
-			// We've established that a bit is free, now find it
-			// Set or reset a bit mask starting with the HOB
-			// This will be shifted toward the LOB
-			bitMask = HIGH_ORDER_BIT;
+	unsigned long	wordIndex = scanner( a_whereToLook->d_bits, 0, words );
+	while( wordIndex < words )
+	{
+		unsigned long*	bitMap = &a_whereToLook->d_bits[wordIndex];
+		unsigned long	freeBits = ~__atomic_load_n( bitMap, __ATOMIC_RELAXED );
+		if( freeBits == 0 )
+		{
+			wordIndex = scanner( a_whereToLook->d_bits, wordIndex + 1, words );
+			continue;
+		}
 
-			while( bitMask )
+		// take only the lowest free bits if there are more than we want
+		unsigned long	wanted = a_howMany - claimed;
+		unsigned long	take = freeBits;
+		if( (unsigned long)__builtin_popcountl( freeBits ) > wanted )
+		{
+			take = 0;
+			for( unsigned long count = 0; count < wanted; count++ )
 			{
-				// Check to see if the bit is free.
-				if( !(*bitMap & bitMask) )
-				{
-					// If it is, return it's position
-					return index;
-				}
-				// Shift toward the LOB 1 bit.
-				bitMask >>= 1;
+				take |= freeBits & -freeBits;
+				freeBits &= freeBits - 1;
 			}
 		}
+
+		unsigned long	won = take & ~__atomic_fetch_or( bitMap, take,
+														 __ATOMIC_ACQUIRE );
+		while( won != 0 )
+		{
+			a_blocks[claimed++] = wordIndex * BITS_PER_WORD +
+								  __builtin_ctzl( won );
+			won &= won - 1;
+		}
+		if( claimed == a_howMany )
+		{
+			return claimed;
+		}
 	}
-	// Could not find a bit
-	a_whereToLook->d_filled = 1;
-	return ULONG_MAX;
+
+	// Got to the end, so the bitmap is full or was a moment ago
+	__atomic_store_n( &a_whereToLook->d_filled, 1UL, __ATOMIC_RELAXED );
+	return claimed;
 }
 
 //****************************************************************************
@@ -278,16 +531,14 @@ unsigned long			MemBitmap_findBlock( MemBitmap* a_whereToLook )
 void			MemBitmap_mark( MemBitmap*			a_whereToMark,
 								unsigned long		a_whichBit )
 {
-	//Divide the which bit by 32 to get which word
-	unsigned long		whichWord = a_whichBit >> 5;
-	// Get the modulus of 32 to get which bit of which word
-	unsigned long		whichBit  = a_whichBit & 0x0000001f;
-	// shift the mask into place
-	unsigned long		mask = HIGH_ORDER_BIT;
-	mask >>= whichBit;
+	// Divide by the word size to get which word
+	unsigned long		whichWord = a_whichBit / BITS_PER_WORD;
+	// and take the remainder to get which bit of which word
+	unsigned long		mask = 1UL << ( a_whichBit % BITS_PER_WORD );
 
 	// and mark it
-	a_whereToMark->d_bits[whichWord] |= mask;
+	__atomic_fetch_or( &a_whereToMark->d_bits[whichWord], mask,
+					   __ATOMIC_ACQUIRE );
 }
 
 //****************************************************************************
@@ -303,17 +554,89 @@ void			MemBitmap_mark( MemBitmap*			a_whereToMark,
 void			MemBitmap_unmark( MemBitmap*	a_whereToUnmark,
 								  unsigned long			a_whichBit )
 {
-	//Divide the which bit by 32 to get which word
-	unsigned long		whichWord = a_whichBit >> 5;
-	// Get the modulus of 32 to get which bit of which word
-	unsigned long		whichBit  = a_whichBit & 0x0000001f;
-	// shift the mask into place
-	unsigned long		mask = HIGH_ORDER_BIT;
-	mask >>= whichBit;
-
-	// and unmark it
-	a_whereToUnmark->d_bits[whichWord] &= ~mask;
-	a_whereToUnmark->d_filled = 0;
+	// Divide by the word size to get which word
+	unsigned long		whichWord = a_whichBit / BITS_PER_WORD;
+	// and take the remainder to get which bit of which word
+	unsigned long		mask = 1UL << ( a_whichBit % BITS_PER_WORD );
+
+	// and unmark it. The release keeps our writes to the block from
+	// landing after the next owner's.
+	__atomic_fetch_and( &a_whereToUnmark->d_bits[whichWord], ~mask,
+						__ATOMIC_RELEASE );
+	__atomic_store_n( &a_whereToUnmark->d_filled, 0UL, __ATOMIC_RELAXED );
+}
+
+//****************************************************************************
+//
+//	MemBitmap_isMarked() - see whether a block is marked as used
+//
+//	ARGUMENTS:
+//		a_whereToLook			- bitmap to look in
+//		a_whichBit				- index of the bit to look at
+//
+//	RETURNS:
+//		true if the bit is 1
+//
+//****************************************************************************
+bool			MemBitmap_isMarked( MemBitmap*		a_whereToLook,
+									unsigned long	a_whichBit )
+{
+	unsigned long		whichWord = a_whichBit / BITS_PER_WORD;
+	unsigned long		mask = 1UL << ( a_whichBit % BITS_PER_WORD );
+
+	return ( __atomic_load_n( &a_whereToLook->d_bits[whichWord],
+							  __ATOMIC_ACQUIRE ) & mask ) != 0;
+}
+
+//****************************************************************************
+//
+//	MemBitmap_testAndMark() - Mark a block as used if it is free
+//
+//	ARGUMENTS:
+//		a_whereToMark			- bitmap to work in
+//		a_whichBit				- index of the bit to diddle
+//
+//	RETURNS:
+//		true if this call set the bit
+//		false if it was 1 already, another thread has the block
+//
+//****************************************************************************
+bool			MemBitmap_testAndMark( MemBitmap*		a_whereToMark,
+									   unsigned long	a_whichBit )
+{
+	unsigned long		whichWord = a_whichBit / BITS_PER_WORD;
+	unsigned long		mask = 1UL << ( a_whichBit % BITS_PER_WORD );
+
+	return ( __atomic_fetch_or( &a_whereToMark->d_bits[whichWord], mask,
+								__ATOMIC_ACQUIRE ) & mask ) == 0;
+}
+
+//****************************************************************************
+//
+//	MemBitmap_testAndUnmark() - Mark a block as free if it is used
+//
+//	ARGUMENTS:
+//		a_whereToUnmark			- bitmap to work in
+//		a_whichBit				- index of the bit to diddle
+//
+//	RETURNS:
+//		true if this call cleared the bit
+//		false if it was 0 already
+//
+//****************************************************************************
+bool			MemBitmap_testAndUnmark( MemBitmap*		a_whereToUnmark,
+										 unsigned long	a_whichBit )
+{
+	unsigned long		whichWord = a_whichBit / BITS_PER_WORD;
+	unsigned long		mask = 1UL << ( a_whichBit % BITS_PER_WORD );
+
+	if( ( __atomic_fetch_and( &a_whereToUnmark->d_bits[whichWord], ~mask,
+							  __ATOMIC_RELEASE ) & mask ) == 0 )
+	{
+		return false;
+	}
+	__atomic_store_n( &a_whereToUnmark->d_filled, 0UL, __ATOMIC_RELAXED );
+	return true;
 }
 
 //****************************************************************************
@@ -328,11 +651,33 @@ void			MemBitmap_unmark( MemBitmap*	a_whereToUnmark,
 
 void			MemBitmap_clear( MemBitmap*		a_whereToClear )
 {
-	unsigned long	numberOfWords = 1 + (a_whereToClear->d_numberOfBits >> 5);
+	unsigned long	words = numberOfWords( a_whereToClear->d_numberOfBits );
 	
 	// fill the bitmap with 0's, leave d_numberOfBits alone
-	for( unsigned long i = 0; i < numberOfWords; i++ )
+	for( unsigned long i = 0; i < words; i++ )
 	{
 		a_whereToClear->d_bits[i] = 0L;
 	}
+	fillPadding( a_whereToClear );
+	a_whereToClear->d_filled = 0;
+}
+
+//****************************************************************************
+//
+//	MemBitmap_init() - Lay out an empty bitmap in memory the caller owns
+//
+//	ARGUMENTS:
+//		a_bitmap		- where to put it, with room for the bits
+//		a_numberOfBits	- the number of blocks it manages
+//
+//	NOTE:
+//		The bitmap holds no pointers, so it may live in memory that is
+//		mapped at a different address the next time it is used.
+//
+//****************************************************************************
+void			MemBitmap_init( MemBitmap*	a_bitmap,
+								size_t		a_numberOfBits )
+{
+	a_bitmap->d_numberOfBits = a_numberOfBits;
+	MemBitmap_clear( a_bitmap );
 }
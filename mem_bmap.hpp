@@ -5,6 +5,8 @@
 //	get size_t and caddr_t
 #include <sys/types.h>
 
+// One bit per block, lowest bit of the first word first. A set bit is
+// a used block. All updates are atomic, so threads can share a bitmap.
 struct MemBitmap
 {
 	unsigned long		d_numberOfBits;
@@ -13,8 +15,43 @@ struct MemBitmap
 
 };
 
+// Room for a bitmap of NUMBER_OF_BITS bits that is laid down at compile
+// time, for the bitmaps of the nodes the allocator starts out with.
+// d_bits runs on into d_moreBits.
+template< unsigned long NUMBER_OF_BITS >
+struct MemBitmapStorage : public MemBitmap
+{
+	static const unsigned long	BITS_PER_WORD = sizeof(unsigned long) * 8;
+	static const unsigned long	WORDS =
+						( NUMBER_OF_BITS + BITS_PER_WORD - 1 ) / BITS_PER_WORD;
+
+	unsigned long		d_moreBits[ WORDS > 1 ? WORDS - 1 : 1 ];
+
+	constexpr MemBitmapStorage()
+		: MemBitmap{ NUMBER_OF_BITS, 0, { 0 } }, d_moreBits()
+	{
+		// the bits past the end of the last word are marked as used
+		if( NUMBER_OF_BITS % BITS_PER_WORD != 0 )
+		{
+			unsigned long	padding =
+								~0UL << ( NUMBER_OF_BITS % BITS_PER_WORD );
+			if( WORDS == 1 )
+			{
+				d_bits[0] = padding;
+			}
+			else
+			{
+				d_moreBits[WORDS - 2] = padding;
+			}
+		}
+	}
+};
+
 // Create a new bitmap
-MemBitmap*		MemBitmap_create( size_t a_size );
+MemBitmap*		MemBitmap_create( size_t a_numberOfBits );
+
+// Lay out a bitmap in memory that is already there
+void			MemBitmap_init( MemBitmap* a_bitmap, size_t a_numberOfBits );
 
 // Destroy a bitmap
 void			MemBitmap_destroy( MemBitmap* a_bitmapToDesroy );
@@ -22,6 +59,15 @@ void			MemBitmap_destroy( MemBitmap* a_bitmapToDesroy );
 // Look for a block inside a Cluster managed by this bitmap
 unsigned long	MemBitmap_findBlock( MemBitmap* a_whereToLook );
 
+// Find a free block and mark it as used, safely against other threads
+unsigned long	MemBitmap_claim( MemBitmap* a_whereToLook );
+
+// Find and mark up to a_howMany free blocks in one pass, returning how
+// many were put in a_blocks
+unsigned long	MemBitmap_claimBlocks( MemBitmap* a_whereToLook,
+									   unsigned long a_howMany,
+									   unsigned long* a_blocks );
+
 // Mark a block managed by this bitmap as used by setting it to 1
 void			MemBitmap_mark( MemBitmap*	a_whereToMark,
 								unsigned long a_whichBit );
@@ -29,6 +75,17 @@ void			MemBitmap_mark( MemBitmap*	a_whereToMark,
 void			MemBitmap_unmark( MemBitmap*	a_whereToUnmark,
 								  unsigned long	a_whichBit );
 
+// Whether a block managed by this bitmap is marked as used
+bool			MemBitmap_isMarked( MemBitmap* a_whereToLook,
+									unsigned long a_whichBit );
+
+// Mark a block as used, or as free, only if it is not already, returning
+// whether it changed. Safe against other threads doing the same.
+bool			MemBitmap_testAndMark( MemBitmap* a_whereToMark,
+									   unsigned long a_whichBit );
+bool			MemBitmap_testAndUnmark( MemBitmap* a_whereToUnmark,
+										 unsigned long a_whichBit );
+
 // Mark all blocks managed by this bitmap as free by setting them to 0
 void			MemBitmap_clear( MemBitmap*		a_whereToClear );
 
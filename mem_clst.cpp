@@ -10,6 +10,7 @@
 #include		<sys/types.h>
 #include		<sys/stat.h>
 #include		<fcntl.h>
+#include		<sched.h>
 
 // linux can do anonymous mappings directly
 // solaris needs /dev/zero to do it
@@ -25,11 +26,15 @@
 #endif			// SUN
 #endif			// LINUX
 
-// default to 32k clusters
-#define			CLUSTERSIZE 65536
+// Clusters are carved out of reserved address ranges this big,
+// and made usable this many bytes at a time
+#define			ARENASIZE	((size_t)1 << 32)
+#define			COMMITSIZE	((size_t)1 << 20)
+#define			MAXARENAS	64
 
-// the size of a cluster
-size_t	s_clusterSize = 0;
+// the size of a cluster, fixed at compile time so nothing
+// needs to set it up before the first allocation
+size_t	s_clusterSize = CLUSTERSIZE;
 size_t	s_pageSize = 0;
 
 // file-local variables into the unnamed namespace
@@ -38,6 +43,80 @@ namespace
 	// descriptor to hold /dev/zero
 	int s_zeroFd = -1;
 
+	// A reserved range of address space that clusters are carved from.
+	// The range is mapped PROT_NONE up front. d_next is bumped to carve
+	// a cluster and [d_base, d_base+d_committed) has been made readable
+	// and writable. Both only ever grow.
+	struct arena
+	{
+		caddr_t			d_base;
+		size_t			d_size;
+		size_t			d_next;
+		size_t			d_committed;
+	};
+
+	// The arenas reserved so far. Slots are claimed by bumping
+	// s_arenasClaimed and published by bumping s_arenaCount, so readers
+	// only ever see arenas that are filled in.
+	arena			s_arenas[MAXARENAS];
+	long			s_arenasClaimed = 0;
+	long			s_arenaCount = 0;
+
+	// Released clusters, one stack per power of two size from
+	// CLUSTER_MIN_SIZE up, linked through their first word. Arena
+	// clusters are carved in multiples of CLUSTER_MIN_SIZE, so the low
+	// bits of the head are free to hold a tag that is bumped on every
+	// push and pop. That keeps a pop from succeeding against a head that
+	// was popped and pushed back while it was looking.
+	const unsigned long	FREE_TAG_MASK = CLUSTER_MIN_SIZE - 1;
+	const int		FREE_STACKS = __builtin_ctzl( CLUSTER_MAX_SIZE ) -
+								  __builtin_ctzl( CLUSTER_MIN_SIZE ) + 1;
+	unsigned long	s_freeClusters[FREE_STACKS];
+
+	// Clusters whose pages have been faulted in ahead of time by
+	// Cluster_prefault(), kept apart from the purged ones above and
+	// handed out first. Tagged the same way.
+	unsigned long	s_readyClusters[FREE_STACKS];
+	long			s_readyCount[FREE_STACKS];
+
+	// bytes handed out by Cluster_request() and Cluster_bigRequest()
+	// and not released yet
+	size_t			s_clusterBytes = 0;
+	size_t			s_bigBytes = 0;
+
+	// bytes sitting on the ready stacks
+	size_t			s_readyBytes = 0;
+
+	//************************************************************************
+	//
+	//	openZero() - open /dev/zero to map anonymous memory from
+	//
+	//	RETURNS:
+	//		true if s_zeroFd is open
+	//
+	//************************************************************************
+	bool			openZero()
+	{
+		if( __atomic_load_n( &s_zeroFd, __ATOMIC_ACQUIRE ) == -1 )
+		{
+			int		zeroFd = open( "/dev/zero", O_RDWR );
+			if( zeroFd == -1 )
+			{
+				perror("open /dev/zero: ");
+				return false;
+			}
+			// keep whichever descriptor got there first
+			int		expected = -1;
+			if( !__atomic_compare_exchange_n( &s_zeroFd, &expected, zeroFd,
+											  false, __ATOMIC_ACQ_REL,
+											  __ATOMIC_ACQUIRE ) )
+			{
+				close( zeroFd );
+			}
+		}
+		return true;
+	}
+
 	//************************************************************************
 	//
 	//	fullfilRequest() - get a cluster of anonymous memory
@@ -55,15 +134,10 @@ namespace
 	{
 
 	   // to get anonymous mapping, map on /dev/zero
-	   if( s_zeroFd == -1 )
+	   if( !openZero() )
 	   {
-			s_zeroFd = open( "/dev/zero", O_RDWR );
-			if( s_zeroFd == -1 )
-			{
-				perror("open /dev/zero: ");
-				return NULL;
-			}
-		}
+			return NULL;
+	   }
 
 		caddr_t		cluster = (caddr_t) mmap( (caddr_t) 0,
 											  a_howBig,
@@ -82,25 +156,461 @@ namespace
 
 }
 
+namespace
+{
+	//************************************************************************
+	//
+	//	addArena() - reserve another range of address space to carve
+	//				 clusters from
+	//
+	//	ARGUMENTS:
+	//		a_arenaCount - how many arenas the caller saw
+	//
+	//	RETURNS:
+	//		true if there is a newer arena than a_arenaCount to carve from
+	//		false if no more address space could be reserved
+	//
+	//	NOTE:
+	//		Only one thread reserves at a time. Any other thread that runs
+	//		out of room waits here for it to publish the new arena.
+	//
+	//************************************************************************
+	bool			addArena( long a_arenaCount )
+	{
+		long		expected = a_arenaCount;
+		if( !__atomic_compare_exchange_n( &s_arenasClaimed, &expected,
+										  a_arenaCount + 1, false,
+										  __ATOMIC_ACQ_REL,
+										  __ATOMIC_ACQUIRE ) )
+		{
+			// somebody else is reserving, wait for them to finish
+			while( __atomic_load_n( &s_arenaCount, __ATOMIC_ACQUIRE ) ==
+												a_arenaCount &&
+				   __atomic_load_n( &s_arenasClaimed, __ATOMIC_ACQUIRE ) !=
+												a_arenaCount )
+			{
+				sched_yield();
+			}
+			return __atomic_load_n( &s_arenaCount, __ATOMIC_ACQUIRE ) >
+														a_arenaCount;
+		}
+
+		// Reserve one extra cluster so the arena can start on a
+		// cluster boundary. The slack at either end is never used.
+		caddr_t		reserved = (caddr_t)MAP_FAILED;
+		if( a_arenaCount < MAXARENAS && openZero() )
+		{
+			reserved = (caddr_t) mmap( (caddr_t) 0,
+									   ARENASIZE + CLUSTERSIZE,
+									   PROT_NONE,
+									   MAPPING_FLAGS|MAP_NORESERVE,
+									   s_zeroFd, 0 );
+		}
+		if( reserved == (caddr_t)MAP_FAILED )
+		{
+			// give the slot back so the next caller can try again
+			__atomic_store_n( &s_arenasClaimed, a_arenaCount,
+							  __ATOMIC_RELEASE );
+			return false;
+		}
+
+		arena*		newArena = &s_arenas[a_arenaCount];
+		newArena->d_base = (caddr_t)
+						( ( (unsigned long)reserved + CLUSTERSIZE - 1 ) &
+						  ~(unsigned long)( CLUSTERSIZE - 1 ) );
+		newArena->d_size = ARENASIZE;
+		newArena->d_next = 0;
+		newArena->d_committed = 0;
+		__atomic_store_n( &s_arenaCount, a_arenaCount + 1,
+						  __ATOMIC_RELEASE );
+		return true;
+	}
+
+	//************************************************************************
+	//
+	//	commitArena() - make an arena usable up to at least a given offset
+	//
+	//	ARGUMENTS:
+	//		a_arena - the arena to commit
+	//		a_end	- the offset that must be usable
+	//
+	//	RETURNS:
+	//		true on success
+	//		false if the range could not be made writable
+	//
+	//	NOTE:
+	//		d_committed only moves once everything below it is writable,
+	//		so the range mprotect()ed always starts at the old value.
+	//		Protecting a range twice is harmless, so racing threads do
+	//		not need to agree on who does it. Committed ranges merge
+	//		with the one before, so the arena stays at two mappings.
+	//
+	//************************************************************************
+	bool			commitArena( arena* a_arena, size_t a_end )
+	{
+		size_t		committed =
+					__atomic_load_n( &a_arena->d_committed, __ATOMIC_ACQUIRE );
+		while( committed < a_end )
+		{
+			size_t	newEnd = ( a_end + COMMITSIZE - 1 ) & ~( COMMITSIZE - 1 );
+			if( newEnd > a_arena->d_size )
+			{
+				newEnd = a_arena->d_size;
+			}
+			if( mprotect( a_arena->d_base + committed, newEnd - committed,
+						  PROT_FLAGS ) == -1 )
+			{
+				perror( "mprotect: " );
+				return false;
+			}
+			// on failure committed is reloaded and we go around again
+			__atomic_compare_exchange_n( &a_arena->d_committed, &committed,
+										 newEnd, false, __ATOMIC_ACQ_REL,
+										 __ATOMIC_ACQUIRE );
+		}
+		return true;
+	}
+
+	//************************************************************************
+	//
+	//	freeStack() - find the free stack for a cluster size
+	//
+	//	RETURNS:
+	//		the stack head
+	//		NULL if clusters of this size are not kept
+	//
+	//************************************************************************
+	unsigned long*	freeStack( size_t a_howBig )
+	{
+		if( a_howBig < CLUSTER_MIN_SIZE || a_howBig > CLUSTER_MAX_SIZE ||
+			( a_howBig & ( a_howBig - 1 ) ) != 0 )
+		{
+			return NULL;
+		}
+		return &s_freeClusters[__builtin_ctzl( a_howBig ) -
+							   __builtin_ctzl( CLUSTER_MIN_SIZE )];
+	}
+
+	//************************************************************************
+	//
+	//	carveCluster() - bump a cluster off the end of the newest arena
+	//
+	//	ARGUMENTS:
+	//		a_howBig - the cluster size, a multiple of CLUSTER_MIN_SIZE
+	//
+	//	RETURNS:
+	//		pointer to cluster
+	//		NULL if no address space could be reserved
+	//
+	//************************************************************************
+	caddr_t			carveCluster( size_t a_howBig )
+	{
+		while( 1 )
+		{
+			long	arenaCount =
+						__atomic_load_n( &s_arenaCount, __ATOMIC_ACQUIRE );
+			if( arenaCount > 0 )
+			{
+				arena*	lastArena = &s_arenas[arenaCount - 1];
+				size_t	offset = __atomic_fetch_add( &lastArena->d_next,
+													 a_howBig,
+													 __ATOMIC_RELAXED );
+				if( offset + a_howBig <= lastArena->d_size )
+				{
+					if( !commitArena( lastArena, offset + a_howBig ) )
+					{
+						return NULL;
+					}
+					return lastArena->d_base + offset;
+				}
+			}
+			// The newest arena is used up, or there is none yet
+			if( !addArena( arenaCount ) )
+			{
+				return NULL;
+			}
+		}
+	}
+
+	//************************************************************************
+	//
+	//	inArena() - tell whether a cluster was carved from an arena
+	//
+	//	ARGUMENTS:
+	//		a_clusterAddress - the cluster to look for
+	//
+	//************************************************************************
+	bool			inArena( caddr_t a_clusterAddress )
+	{
+		long		arenaCount =
+						__atomic_load_n( &s_arenaCount, __ATOMIC_ACQUIRE );
+		for( long index = 0; index < arenaCount; index++ )
+		{
+			if( a_clusterAddress >= s_arenas[index].d_base &&
+				a_clusterAddress <
+							s_arenas[index].d_base + s_arenas[index].d_size )
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+
+	//************************************************************************
+	//
+	//	pushCluster() - put a released cluster on a free stack
+	//
+	//************************************************************************
+	void			pushCluster( unsigned long* a_stack,
+								 caddr_t a_clusterAddress )
+	{
+		unsigned long	head =
+					__atomic_load_n( a_stack, __ATOMIC_ACQUIRE );
+		unsigned long	newHead;
+		do
+		{
+			*(unsigned long*)a_clusterAddress = head & ~FREE_TAG_MASK;
+			newHead = (unsigned long)a_clusterAddress |
+					  ( ( head + 1 ) & FREE_TAG_MASK );
+		}
+		while( !__atomic_compare_exchange_n( a_stack, &head, newHead,
+											 false, __ATOMIC_ACQ_REL,
+											 __ATOMIC_ACQUIRE ) );
+	}
+
+	//************************************************************************
+	//
+	//	popCluster() - take a cluster off a free stack
+	//
+	//	RETURNS:
+	//		pointer to cluster
+	//		NULL if the stack is empty
+	//
+	//	NOTE:
+	//		The link may be read from a cluster that another thread has
+	//		just popped and started to use. Arena memory is never unmapped,
+	//		so the read is safe, and the tag makes the exchange fail.
+	//
+	//************************************************************************
+	caddr_t			popCluster( unsigned long* a_stack )
+	{
+		unsigned long	head =
+					__atomic_load_n( a_stack, __ATOMIC_ACQUIRE );
+		unsigned long	newHead;
+		caddr_t			cluster;
+		do
+		{
+			cluster = (caddr_t)( head & ~FREE_TAG_MASK );
+			if( cluster == NULL )
+			{
+				return NULL;
+			}
+			newHead = *(volatile unsigned long*)cluster |
+					  ( ( head + 1 ) & FREE_TAG_MASK );
+		}
+		while( !__atomic_compare_exchange_n( a_stack, &head, newHead,
+											 false, __ATOMIC_ACQ_REL,
+											 __ATOMIC_ACQUIRE ) );
+
+		// the rest of the cluster was purged on release, clear the link
+		*(unsigned long*)cluster = 0;
+		return cluster;
+	}
+
+	//************************************************************************
+	//
+	//	populate() - fault in every page of a cluster
+	//
+	//	NOTE:
+	//		Arena clusters are already mapped, so MAP_POPULATE is no use
+	//		for them, and MADV_WILLNEED does nothing for anonymous
+	//		memory. MADV_POPULATE_WRITE does it in one call where the
+	//		kernel has it, otherwise each page is written to.
+	//
+	//************************************************************************
+	void			populate( caddr_t a_clusterAddress, size_t a_howBig )
+	{
+#ifdef			MADV_POPULATE_WRITE
+		if( madvise( a_clusterAddress, a_howBig, MADV_POPULATE_WRITE ) == 0 )
+		{
+			return;
+		}
+#endif			// MADV_POPULATE_WRITE
+		if(	s_pageSize == 0 )
+		{
+			s_pageSize = getpagesize();
+		}
+		for( size_t offset = 0; offset < a_howBig; offset += s_pageSize )
+		{
+			((volatile char*)a_clusterAddress)[offset] = 0;
+		}
+	}
+}
+
 //****************************************************************************
 //
 //	Cluster_request() - get a hunk of anonymous memory
 //
+//	ARGUMENTS:
+//		a_howBig - the cluster size, CLUSTERSIZE unless the caller
+//				   wants another power of two
+//
 //	RETURNS:
 //		pointer to cluster
 //		NULL on error
 //
+//	NOTE:
+//		Clusters come from the ready stack for their size, then the
+//		free stack, or else are carved out of an address range reserved
+//		up front, so the usual case takes no system call and the
+//		process does not gain a mapping per cluster. Only a ready
+//		cluster comes without page faults to follow. Sizes without a
+//		free stack, or a failure to reserve address space, fall back
+//		to mapping the cluster on its own.
+//
+//****************************************************************************
+caddr_t			Cluster_request( size_t a_howBig )
+{
+	caddr_t			cluster = NULL;
+	unsigned long*	stack = freeStack( a_howBig );
+	if( stack != NULL )
+	{
+		long		index = stack - s_freeClusters;
+		cluster = popCluster( &s_readyClusters[index] );
+		if( cluster != NULL )
+		{
+			__atomic_fetch_sub( &s_readyCount[index], 1, __ATOMIC_RELAXED );
+			__atomic_fetch_sub( &s_readyBytes, a_howBig, __ATOMIC_RELAXED );
+		}
+		else
+		{
+			cluster = popCluster( stack );
+		}
+		if( cluster == NULL )
+		{
+			cluster = carveCluster( a_howBig );
+		}
+	}
+	if( cluster == NULL )
+	{
+		cluster = fullfilRequest( a_howBig );
+	}
+	if( cluster != NULL )
+	{
+		__atomic_fetch_add( &s_clusterBytes, a_howBig, __ATOMIC_RELAXED );
+	}
+	return cluster;
+}
+
+//****************************************************************************
+//
+//	Cluster_prefault() - keep clusters of a size faulted in and ready
+//
+//	ARGUMENTS:
+//		a_howBig - the cluster size
+//		a_count	 - how many ready clusters of that size to keep
+//
+//	RETURNS:
+//		how many are ready now
+//		0 if clusters of this size are not kept
+//
+//	NOTE:
+//		Meant for a thread that keeps the system calls and page faults
+//		of getting a cluster away from the threads that allocate. Ready
+//		clusters count as held memory, not as handed out.
+//
 //****************************************************************************
-caddr_t			Cluster_request()
+long			Cluster_prefault( size_t a_howBig, long a_count )
 {
-	// if not yet defined, get the number of pagesPerClustr
-	// and set the size of a cluster
-	if( s_clusterSize == 0 )
+	unsigned long*	stack = freeStack( a_howBig );
+	if( stack == NULL )
 	{
-		// Keep this a in variable to reduce preprocessor coupling
-		s_clusterSize =	CLUSTERSIZE;
+		return 0;
+	}
+	long			index = stack - s_freeClusters;
+
+	long			ready =
+					__atomic_load_n( &s_readyCount[index], __ATOMIC_RELAXED );
+	while( ready < a_count )
+	{
+		caddr_t		cluster = popCluster( stack );
+		if( cluster == NULL )
+		{
+			cluster = carveCluster( a_howBig );
+			if( cluster == NULL )
+			{
+				break;
+			}
+		}
+		populate( cluster, a_howBig );
+
+		__atomic_fetch_add( &s_readyBytes, a_howBig, __ATOMIC_RELAXED );
+		ready = __atomic_add_fetch( &s_readyCount[index], 1,
+									__ATOMIC_RELAXED );
+		pushCluster( &s_readyClusters[index], cluster );
+	}
+	return ready;
+}
+
+//****************************************************************************
+//
+//	Cluster_populate() - fault in a range ahead of its use
+//
+//	ARGUMENTS:
+//		a_address - start of the range
+//		a_howBig  - length of the range
+//		a_lock	  - true to mlock() it as well
+//
+//	RETURNS:
+//		true if the range is faulted in, and locked if asked
+//		false if it could not be locked, RLIMIT_MEMLOCK most likely
+//
+//****************************************************************************
+bool			Cluster_populate( caddr_t a_address, size_t a_howBig,
+								  bool a_lock )
+{
+	populate( a_address, a_howBig );
+	if( a_lock && mlock( a_address, a_howBig ) == -1 )
+	{
+		perror( "mlock: " );
+		return false;
+	}
+	return true;
+}
+
+//****************************************************************************
+//
+//	Cluster_dropReady() - give the pages of every ready cluster back
+//
+//	RETURNS:
+//		how many bytes of ready clusters were dropped
+//
+//	NOTE:
+//		The clusters keep their addresses on the free stacks, so the
+//		next request of their size still skips the mapping, only not
+//		the page faults.
+//
+//****************************************************************************
+size_t			Cluster_dropReady()
+{
+	size_t			dropped = 0;
+	for( long index = 0; index < FREE_STACKS; index++ )
+	{
+		size_t		howBig = CLUSTER_MIN_SIZE << index;
+		caddr_t		cluster;
+		while( ( cluster = popCluster( &s_readyClusters[index] ) ) != NULL )
+		{
+			__atomic_fetch_sub( &s_readyCount[index], 1, __ATOMIC_RELAXED );
+			__atomic_fetch_sub( &s_readyBytes, howBig, __ATOMIC_RELAXED );
+			if( madvise( cluster, howBig, MADV_DONTNEED ) == -1 )
+			{
+				perror( "madvise: " );
+			}
+			pushCluster( &s_freeClusters[index], cluster );
+			dropped += howBig;
+		}
 	}
-	return fullfilRequest( s_clusterSize );
+	return dropped;
 }
 
 //****************************************************************************
@@ -123,14 +633,6 @@ caddr_t			Cluster_request()
 //****************************************************************************
 caddr_t			Cluster_bigRequest( size_t* a_howBig )
 {
-	// if not yet defined, get the number of pagesPerClustr
-	// and set the size of a cluster
-	if( s_clusterSize == 0 )
-	{
-		// Keep this a in variable to reduce preprocessor coupling
-		s_clusterSize =	CLUSTERSIZE;
-	}
-
 	// Round the requestSize to the next nearest page size
 	if(	s_pageSize == 0 )
 	{
@@ -162,28 +664,164 @@ caddr_t			Cluster_bigRequest( size_t* a_howBig )
 	else
 	{
 		*a_howBig = requestSize;
+		__atomic_fetch_add( &s_bigBytes, requestSize, __ATOMIC_RELAXED );
 	}
 	
 	return newCluster;
 
 }
 
+//****************************************************************************
+//
+//	Cluster_color() - pick where a layout inside a cluster should start
+//
+//	ARGUMENTS:
+//		a_sequence - how many layouts of this kind came before this one
+//		a_span	   - the most bytes the caller is willing to skip
+//
+//	RETURNS:
+//		an offset that is a multiple of CLUSTER_LINE_SIZE and below
+//		both a_span and CLUSTER_COLOR_SPAN
+//
+//	NOTE:
+//		Successive layouts step through the colors one cache line at a
+//		time, so the first block of each lands in a different cache set.
+//
+//****************************************************************************
+size_t			Cluster_color( unsigned long a_sequence, size_t a_span )
+{
+	if( a_span > CLUSTER_COLOR_SPAN )
+	{
+		a_span = CLUSTER_COLOR_SPAN;
+	}
+
+	size_t		numberOfColors = a_span / CLUSTER_LINE_SIZE;
+	if( numberOfColors == 0 )
+	{
+		return 0;
+	}
+	return ( a_sequence % numberOfColors ) * CLUSTER_LINE_SIZE;
+}
+
 //****************************************************************************
 //
 //	Cluster_release() - return a hunk of anonymous memory
 //
 //	ARGS:
 //		a_clusterAddress - pointer to cluster to release
+//		a_howBig		 - the size it was requested with
+//
+//****************************************************************************
+void			Cluster_release( caddr_t a_clusterAddress, size_t a_howBig )
+{
+	__atomic_fetch_sub( &s_clusterBytes, a_howBig, __ATOMIC_RELAXED );
+
+	// Arena clusters stay mapped. Drop their pages and keep the
+	// address range for the next request of the same size.
+	unsigned long*	stack = freeStack( a_howBig );
+	if( stack != NULL && inArena( a_clusterAddress ) )
+	{
+		if( madvise( a_clusterAddress, a_howBig, MADV_DONTNEED ) == -1 )
+		{
+			perror( "madvise: " );
+		}
+		pushCluster( stack, a_clusterAddress );
+		return;
+	}
+
+	if( munmap( a_clusterAddress, a_howBig ) == -1 )
+	{
+		perror( "munmap: " );
+	}
+}
+
+//****************************************************************************
+//
+//	Cluster_bigRelease() - return a big hunk of anonymous memory
+//
+//	ARGS:
+//		a_address - start of the hunk to release, page aligned
+//		a_howBig  - size of the hunk, as returned by Cluster_bigRequest()
 //
 //****************************************************************************
-void			Cluster_release( caddr_t a_clusterAddress )
+void			Cluster_bigRelease( caddr_t a_address, size_t a_howBig )
 {
-	if( munmap( a_clusterAddress, s_clusterSize ) == -1 )
+	__atomic_fetch_sub( &s_bigBytes, a_howBig, __ATOMIC_RELAXED );
+
+	if( munmap( a_address, a_howBig ) == -1 )
 	{
 		perror( "munmap: " );
 	}
 }
 
+//****************************************************************************
+//
+//	Cluster_stats() - report how much memory the cluster layer holds
+//
+//	ARGS:
+//		a_stats - filled in with the byte counts
+//
+//****************************************************************************
+void			Cluster_stats( ClusterStats* a_stats )
+{
+	a_stats->d_clusterBytes =
+					__atomic_load_n( &s_clusterBytes, __ATOMIC_RELAXED );
+	a_stats->d_bigBytes = __atomic_load_n( &s_bigBytes, __ATOMIC_RELAXED );
+	a_stats->d_readyBytes =
+					__atomic_load_n( &s_readyBytes, __ATOMIC_RELAXED );
+	a_stats->d_reservedBytes = 0;
+	a_stats->d_committedBytes = 0;
+
+	long		arenaCount = __atomic_load_n( &s_arenaCount, __ATOMIC_ACQUIRE );
+	for( long index = 0; index < arenaCount; index++ )
+	{
+		a_stats->d_reservedBytes += s_arenas[index].d_size;
+		a_stats->d_committedBytes +=
+				__atomic_load_n( &s_arenas[index].d_committed,
+								 __ATOMIC_RELAXED );
+	}
+}
+
+//****************************************************************************
+//
+//	Cluster_purge() - let the OS reclaim the pages of a range that is
+//					  still mapped
+//
+//	ARGS:
+//		a_address - start of the range
+//		a_howBig  - length of the range
+//
+//	NOTE:
+//		Only the whole pages inside the range are purged, so the partial
+//		pages at either end keep their contents. A purged page reads back
+//		as zeroes the next time it is touched.
+//
+//****************************************************************************
+void			Cluster_purge( caddr_t a_address, size_t a_howBig )
+{
+	if(	s_pageSize == 0 )
+	{
+		s_pageSize = getpagesize();
+	}
+
+	// round the start up and the end down to page boundaries
+	unsigned long	start = ((unsigned long)a_address + s_pageSize - 1) &
+							~(unsigned long)(s_pageSize - 1);
+	unsigned long	end = ((unsigned long)a_address + a_howBig) &
+							~(unsigned long)(s_pageSize - 1);
+
+	// nothing to do if the range does not cover a whole page
+	if( end <= start )
+	{
+		return;
+	}
+
+	if( madvise( (caddr_t)start, end - start, MADV_DONTNEED ) == -1 )
+	{
+		perror( "madvise: " );
+	}
+}
+
 
 #ifdef TEST
 //***************************************************************************
@@ -195,7 +833,7 @@ int main(int, char**)
 {
 	char*		newCluster = NULL;
 	// if Cluster_request() returns NULL, the test has failed
-	newCluster = (char*) Cluster_request();
+	newCluster = (char*) Cluster_request( s_clusterSize );
 	if( newCluster == NULL )
 	{
 		fprintf( stderr, "%50.50s:\t[%4.4s]\n", "Allocate Cluster", "FAIL" );
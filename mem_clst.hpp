@@ -7,13 +7,59 @@
 
 // A cluster is a fixed number of pages.
 
+// default to 64k clusters
+#define			CLUSTERSIZE 65536
+
+// Clusters may also be asked for in any power of two between these.
+// Those are kept for reuse like the default size.
+const size_t			CLUSTER_MIN_SIZE = 16384;
+const size_t			CLUSTER_MAX_SIZE = 1048576;
+
+// Clusters start on page boundaries, so whatever is laid out at the same
+// offset in every cluster competes for the same cache sets. Layouts are
+// rotated across a span of cache line sized colors to spread them out.
+const size_t			CLUSTER_LINE_SIZE = 64;
+const size_t			CLUSTER_COLOR_SPAN = 4096;
+
 // These two routines request and release clusters.
 
 // request a new cluster
-caddr_t					Cluster_request();
+caddr_t					Cluster_request( size_t a_howBig );
 caddr_t					Cluster_bigRequest( size_t* a_howBig );
 
-// release a cluster
-void					Cluster_release( caddr_t a_clusterAddress );
+// keep a_count clusters of a size faulted in for Cluster_request()
+long					Cluster_prefault( size_t a_howBig, long a_count );
+
+// let the OS have the pages of those clusters again, returning the bytes
+size_t					Cluster_dropReady();
+
+// fault in every page of a range now, and lock them in memory if asked,
+// false if they could not be locked
+bool					Cluster_populate( caddr_t a_address, size_t a_howBig,
+										  bool a_lock );
+
+// color offset for the a_sequence'th layout, below a_span bytes
+size_t					Cluster_color( unsigned long a_sequence, size_t a_span );
+
+// release a cluster, a_howBig must be what it was requested with
+void					Cluster_release( caddr_t a_clusterAddress,
+										 size_t a_howBig );
+void					Cluster_bigRelease( caddr_t a_address, size_t a_howBig );
+
+// What the cluster layer holds, in bytes
+struct ClusterStats
+{
+	size_t				d_clusterBytes;		// clusters handed out now
+	size_t				d_bigBytes;			// big hunks handed out now
+	size_t				d_readyBytes;		// faulted in, waiting to be
+											// handed out
+	size_t				d_reservedBytes;	// address space held for arenas
+	size_t				d_committedBytes;	// of that, made usable
+};
+
+void					Cluster_stats( ClusterStats* a_stats );
+
+// hand the whole pages inside a range back to the OS, keeping the mapping
+void					Cluster_purge( caddr_t a_address, size_t a_howBig );
 
 #endif // __MEM_CLST_HPP__
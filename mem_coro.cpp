@@ -0,0 +1,322 @@
+#ifndef			__MEM_CORO_HPP__
+#include		"mem_coro.hpp"
+#endif			// __MEM_CORO_HPP__
+
+#ifndef			__MEM_ALOC_HPP__
+#include		"mem_aloc.hpp"
+#endif			// __MEM_ALOC_HPP__
+
+#ifndef			__MEM_CLST_HPP__
+#include		"mem_clst.hpp"
+#endif			// __MEM_CLST_HPP__
+
+#include		<pthread.h>
+#include		<sched.h>
+#include		<stddef.h>
+
+namespace
+{
+	// frame sizes are rounded up to a multiple of this,
+	// which is also the alignment operator new promises
+	const size_t		FRAME_GRAIN = 16;
+
+	// Frames bigger than this go to Mem_allocateLined(). A plain hunk
+	// sits behind its 8 byte back pointer, so it is not FRAME_GRAIN
+	// aligned, a lined one starts on a cache line.
+	const size_t		LARGEST_POOLED_FRAME = 4096;
+
+	// one pool per multiple of FRAME_GRAIN
+	const size_t		FRAME_BUCKETS = LARGEST_POOLED_FRAME / FRAME_GRAIN;
+
+	// free frames a thread keeps per size before it hands them on
+	unsigned long		s_frameCacheLimit = MEM_FRAME_CACHE_LIMIT;
+
+	// A thread's own free frames, as a LIFO per size linked through
+	// each frame's first word, and the cluster it carves new frames
+	// from. Only the owning thread touches it, so it needs no locking.
+	struct frameCache
+	{
+		caddr_t			d_free[FRAME_BUCKETS];
+		unsigned long	d_count[FRAME_BUCKETS];
+		caddr_t			d_carve;
+		caddr_t			d_carveEnd;
+		bool			d_registered;
+	};
+
+	__thread frameCache	s_frameCache;
+
+	// Frames handed on by threads whose caches are full or gone,
+	// for any thread to take. Each size has its own lock.
+	caddr_t				s_depot[FRAME_BUCKETS];
+	bool				s_depotLock[FRAME_BUCKETS];
+
+	// calls flushCache() when a thread exits
+	pthread_key_t		s_cacheKey;
+	pthread_once_t		s_cacheKeyOnce = PTHREAD_ONCE_INIT;
+
+	//************************************************************************
+	//
+	//	bucket() - which pool serves a frame size
+	//
+	//************************************************************************
+	size_t				bucket( size_t a_size )
+	{
+		return ( a_size + FRAME_GRAIN - 1 ) / FRAME_GRAIN - 1;
+	}
+
+	//************************************************************************
+	//
+	//	depotPush() - hand a frame on to the depot
+	//
+	//************************************************************************
+	void				depotPush( size_t a_bucket, caddr_t a_frame )
+	{
+		while( __atomic_test_and_set( &s_depotLock[a_bucket],
+									  __ATOMIC_ACQUIRE ) )
+		{
+			sched_yield();
+		}
+		*(caddr_t*)a_frame = s_depot[a_bucket];
+		s_depot[a_bucket] = a_frame;
+		__atomic_clear( &s_depotLock[a_bucket], __ATOMIC_RELEASE );
+	}
+
+	//************************************************************************
+	//
+	//	depotPop() - take a frame from the depot
+	//
+	//	RETURNS:
+	//		a frame, NULL if the depot has none of this size
+	//
+	//************************************************************************
+	caddr_t				depotPop( size_t a_bucket )
+	{
+		// don't bother taking the lock for an empty depot
+		if( __atomic_load_n( &s_depot[a_bucket], __ATOMIC_RELAXED ) == NULL )
+		{
+			return NULL;
+		}
+		while( __atomic_test_and_set( &s_depotLock[a_bucket],
+									  __ATOMIC_ACQUIRE ) )
+		{
+			sched_yield();
+		}
+		caddr_t			frame = s_depot[a_bucket];
+		if( frame != NULL )
+		{
+			s_depot[a_bucket] = *(caddr_t*)frame;
+		}
+		__atomic_clear( &s_depotLock[a_bucket], __ATOMIC_RELEASE );
+		return frame;
+	}
+
+	//************************************************************************
+	//
+	//	flushCache() - hand an exiting thread's frames to the depot
+	//
+	//	NOTE:
+	//		Whatever is left of the cluster it was carving from stays
+	//		unused.
+	//
+	//************************************************************************
+	void				flushCache( void* )
+	{
+		for( size_t index = 0; index < FRAME_BUCKETS; index++ )
+		{
+			while( s_frameCache.d_free[index] != NULL )
+			{
+				caddr_t	frame = s_frameCache.d_free[index];
+				s_frameCache.d_free[index] = *(caddr_t*)frame;
+				depotPush( index, frame );
+			}
+			s_frameCache.d_count[index] = 0;
+		}
+		s_frameCache.d_carve = s_frameCache.d_carveEnd = NULL;
+		s_frameCache.d_registered = false;
+	}
+
+	//************************************************************************
+	//
+	//	createCacheKey() - set up the thread exit hook, once
+	//
+	//************************************************************************
+	void				createCacheKey()
+	{
+		pthread_key_create( &s_cacheKey, flushCache );
+	}
+
+	//************************************************************************
+	//
+	//	registerCache() - arrange for the thread's cache to be flushed
+	//					  when the thread exits, the first time it holds
+	//					  anything
+	//
+	//************************************************************************
+	void				registerCache()
+	{
+		if( !s_frameCache.d_registered )
+		{
+			pthread_once( &s_cacheKeyOnce, createCacheKey );
+			pthread_setspecific( s_cacheKey, &s_frameCache );
+			s_frameCache.d_registered = true;
+		}
+	}
+
+	//************************************************************************
+	//
+	//	carveFrame() - cut a new frame from the thread's cluster
+	//
+	//	ARGUMENTS:
+	//		a_bucket - the pool the frame is for
+	//
+	//	RETURNS:
+	//		the frame
+	//		NULL if a new cluster was needed and could not be had
+	//
+	//************************************************************************
+	caddr_t				carveFrame( size_t a_bucket )
+	{
+		size_t			frameSize = ( a_bucket + 1 ) * FRAME_GRAIN;
+
+		if( (size_t)( s_frameCache.d_carveEnd - s_frameCache.d_carve ) <
+																frameSize )
+		{
+			size_t		clusterSize = CLUSTERSIZE;
+			caddr_t		cluster = Cluster_request( clusterSize );
+			if( cluster == NULL )
+			{
+				return NULL;
+			}
+			s_frameCache.d_carve = cluster;
+			s_frameCache.d_carveEnd = cluster + clusterSize;
+			registerCache();
+		}
+
+		caddr_t			frame = s_frameCache.d_carve;
+		s_frameCache.d_carve += frameSize;
+		return frame;
+	}
+}
+
+//****************************************************************************
+//
+//	Mem_frameAllocate() - get a coroutine frame
+//
+//	ARGUMENTS:
+//		a_size - the frame size
+//
+//	RETURNS:
+//		the frame
+//		NULL if no memory could be had
+//
+//	NOTE:
+//		Frames come from the thread's own cache first, then from the
+//		depot, and only then are carved from a cluster. Frames are
+//		never given back to the clusters, they are only recycled.
+//
+//****************************************************************************
+caddr_t					Mem_frameAllocate( size_t a_size )
+{
+	if( a_size > LARGEST_POOLED_FRAME )
+	{
+		return Mem_allocateLined( a_size );
+	}
+	if( a_size == 0 )
+	{
+		a_size = 1;
+	}
+
+	size_t				index = bucket( a_size );
+
+	// the fast path, pop from our own cache
+	caddr_t				frame = s_frameCache.d_free[index];
+	if( frame != NULL )
+	{
+		s_frameCache.d_free[index] = *(caddr_t*)frame;
+		s_frameCache.d_count[index]--;
+		return frame;
+	}
+
+	frame = depotPop( index );
+	if( frame != NULL )
+	{
+		return frame;
+	}
+	return carveFrame( index );
+}
+
+//****************************************************************************
+//
+//	Mem_frameRelease() - give back a coroutine frame
+//
+//	ARGUMENTS:
+//		a_frame - the frame, as returned by Mem_frameAllocate()
+//		a_size	- the size it was allocated with
+//
+//	NOTE:
+//		The frame goes on this thread's cache, whichever thread it came
+//		from. Once the cache holds the limit of a size, further frames
+//		of that size go to the depot. A cache left over the limit when
+//		it was lowered hands on one more with each, so it shrinks as the
+//		thread goes on.
+//
+//****************************************************************************
+void					Mem_frameRelease( caddr_t a_frame, size_t a_size )
+{
+	if( a_frame == NULL )
+	{
+		return;
+	}
+	if( a_size > LARGEST_POOLED_FRAME )
+	{
+		Mem_releaseHunk( a_frame );
+		return;
+	}
+	if( a_size == 0 )
+	{
+		a_size = 1;
+	}
+
+	size_t				index = bucket( a_size );
+
+	unsigned long		limit =
+						__atomic_load_n( &s_frameCacheLimit, __ATOMIC_RELAXED );
+	if( s_frameCache.d_count[index] >= limit )
+	{
+		if( s_frameCache.d_count[index] > limit )
+		{
+			caddr_t		frame = s_frameCache.d_free[index];
+			s_frameCache.d_free[index] = *(caddr_t*)frame;
+			s_frameCache.d_count[index]--;
+			depotPush( index, frame );
+		}
+		depotPush( index, a_frame );
+		return;
+	}
+
+	// the fast path, push onto our own cache. A thread that only
+	// destroys coroutines made elsewhere has not carved, so it may
+	// not be registered yet.
+	registerCache();
+	*(caddr_t*)a_frame = s_frameCache.d_free[index];
+	s_frameCache.d_free[index] = a_frame;
+	s_frameCache.d_count[index]++;
+}
+
+//****************************************************************************
+//
+//	Mem_frameSetCacheLimit() - change how many frames threads keep
+//
+//	ARGUMENTS:
+//		a_frames - free frames of each size a thread may keep
+//
+//	NOTE:
+//		Lowering it moves frames to the depot, where every thread can
+//		reuse them instead of carving more, but the frames themselves
+//		stay allocated.
+//
+//****************************************************************************
+void					Mem_frameSetCacheLimit( unsigned long a_frames )
+{
+	__atomic_store_n( &s_frameCacheLimit, a_frames, __ATOMIC_RELAXED );
+}
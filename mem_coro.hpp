@@ -0,0 +1,49 @@
+#ifndef __MEM_CORO_HPP__
+#define __MEM_CORO_HPP__
+
+//	get size_t and caddr_t
+#include <sys/types.h>
+#include <stdlib.h>
+
+// Coroutine frames are a fixed size per coroutine, but the sizes vary
+// widely and fit the power of two categories badly. These pool frames
+// by their exact size, rounded to 16 bytes, with a per-thread cache in
+// front so creating and destroying a coroutine is a pop and a push.
+
+// Get a frame of a_size bytes
+caddr_t					Mem_frameAllocate( size_t a_size );
+
+// Give back a frame, a_size must be what it was allocated with
+void					Mem_frameRelease( caddr_t a_frame, size_t a_size );
+
+// How many free frames of each size a thread keeps to itself before it
+// hands them on to other threads, by default and as set now
+const unsigned long		MEM_FRAME_CACHE_LIMIT = 64;
+void					Mem_frameSetCacheLimit( unsigned long a_frames );
+
+// Derive a coroutine's promise type from MemFramePooled to keep its
+// frames in the pools.
+//
+//	struct promise_type : public MemFramePooled { ... };
+//
+// We do not throw, and a coroutine has no way to start without its
+// frame, so running out of memory aborts.
+struct MemFramePooled
+{
+	static void*	operator new( size_t a_frameSize )
+	{
+		caddr_t		frame = Mem_frameAllocate( a_frameSize );
+		if( frame == NULL )
+		{
+			abort();
+		}
+		return (void*)frame;
+	}
+
+	static void		operator delete( void* a_frame, size_t a_frameSize ) throw()
+	{
+		Mem_frameRelease( (caddr_t)a_frame, a_frameSize );
+	}
+};
+
+#endif // __MEM_CORO_HPP__
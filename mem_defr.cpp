@@ -0,0 +1,343 @@
+#ifndef			__MEM_DEFR_HPP__
+#include		"mem_defr.hpp"
+#endif			// __MEM_DEFR_HPP__
+
+#ifndef			__MEM_ALOC_HPP__
+#include		"mem_aloc.hpp"
+#endif			// __MEM_ALOC_HPP__
+
+#ifndef			__MEM_CLST_HPP__
+#include		"mem_clst.hpp"
+#endif			// __MEM_CLST_HPP__
+
+#include		<pthread.h>
+#include		<sched.h>
+#include		<stddef.h>
+#include		<time.h>
+
+// The calling thread's ring, NULL if its releases are not deferred.
+// Mem_releaseHunk() looks here first.
+__thread MemDeferRing*	s_deferRing = NULL;
+
+namespace
+{
+	// hunks taken off one ring before moving to the next, so a busy
+	// thread does not keep the others waiting
+	const unsigned long	RECLAIM_BATCH = 256;
+
+	// Every ring ever made. A ring whose thread stopped deferring or
+	// exited is left on the list to be drained, and the next thread
+	// to defer takes it over.
+	MemDeferRing*		s_deferRings = NULL;
+
+	// a ring has one reader at a time, the reclaim thread or a drain
+	bool				s_drainLock = false;
+
+	// the reclaim thread
+	pthread_t			s_reclaimer;
+	bool				s_reclaiming = false;
+	unsigned long		s_interval = 0;
+
+	// gives up a thread's ring when it exits
+	pthread_key_t		s_ringKey;
+	pthread_once_t		s_ringKeyOnce = PTHREAD_ONCE_INIT;
+
+	struct drainGuard
+	{
+		drainGuard()
+		{
+			while( __atomic_test_and_set( &s_drainLock, __ATOMIC_ACQUIRE ) )
+			{
+				sched_yield();
+			}
+		}
+		~drainGuard()
+		{
+			__atomic_clear( &s_drainLock, __ATOMIC_RELEASE );
+		}
+	};
+
+	//************************************************************************
+	//
+	//	releaseRing() - give up a thread's ring for another to take
+	//
+	//	NOTE:
+	//		What is still on it is drained as usual.
+	//
+	//************************************************************************
+	void				releaseRing( void* a_ring )
+	{
+		s_deferRing = NULL;
+		__atomic_store_n( &( (MemDeferRing*)a_ring )->d_owned, false,
+						  __ATOMIC_RELEASE );
+	}
+
+	//************************************************************************
+	//
+	//	createRingKey() - set up the thread exit hook, once
+	//
+	//************************************************************************
+	void				createRingKey()
+	{
+		pthread_key_create( &s_ringKey, releaseRing );
+	}
+
+	//************************************************************************
+	//
+	//	claimRing() - take a ring no thread owns, or make one
+	//
+	//	RETURNS:
+	//		the ring, owned by the caller
+	//		NULL if there was no memory for one
+	//
+	//	NOTE:
+	//		Rings come straight from the cluster layer, so deferring
+	//		never allocates through the rings.
+	//
+	//************************************************************************
+	MemDeferRing*		claimRing()
+	{
+		for( MemDeferRing* ring =
+					__atomic_load_n( &s_deferRings, __ATOMIC_ACQUIRE );
+			 ring != NULL;
+			 ring = ring->d_next )
+		{
+			bool		owned = false;
+			if( !__atomic_load_n( &ring->d_owned, __ATOMIC_RELAXED ) &&
+				__atomic_compare_exchange_n( &ring->d_owned, &owned, true,
+											 false, __ATOMIC_ACQUIRE,
+											 __ATOMIC_RELAXED ) )
+			{
+				return ring;
+			}
+		}
+
+		MemDeferRing*	ring =
+						(MemDeferRing*)Cluster_request( sizeof(MemDeferRing) );
+		if( ring == NULL )
+		{
+			return NULL;
+		}
+		ring->d_owned = true;
+		MemDeferRing*	head =
+						__atomic_load_n( &s_deferRings, __ATOMIC_ACQUIRE );
+		do
+		{
+			ring->d_next = head;
+		}
+		while( !__atomic_compare_exchange_n( &s_deferRings, &head, ring,
+											 false, __ATOMIC_ACQ_REL,
+											 __ATOMIC_ACQUIRE ) );
+		return ring;
+	}
+
+	//************************************************************************
+	//
+	//	reclaimPass() - release a batch from every ring
+	//
+	//	RETURNS:
+	//		how many hunks were released
+	//
+	//************************************************************************
+	size_t				reclaimPass()
+	{
+		drainGuard		guard;
+
+		// a thread that defers may drain, but not into its own ring
+		MemDeferRing*	ownRing = s_deferRing;
+		s_deferRing = NULL;
+
+		size_t			released = 0;
+		for( MemDeferRing* ring =
+					__atomic_load_n( &s_deferRings, __ATOMIC_ACQUIRE );
+			 ring != NULL;
+			 ring = ring->d_next )
+		{
+			unsigned long	head = ring->d_head;
+			unsigned long	tail =
+							__atomic_load_n( &ring->d_tail, __ATOMIC_ACQUIRE );
+			if( tail - head > RECLAIM_BATCH )
+			{
+				tail = head + RECLAIM_BATCH;
+			}
+			for( unsigned long next = head; next != tail; next++ )
+			{
+				Mem_releaseHunk(
+						ring->d_hunks[next & ( MEM_DEFER_RING_SIZE - 1 )] );
+			}
+			__atomic_store_n( &ring->d_head, tail, __ATOMIC_RELEASE );
+			released += tail - head;
+		}
+		s_deferRing = ownRing;
+		return released;
+	}
+
+	//************************************************************************
+	//
+	//	reclaimer() - drain the rings until told to stop
+	//
+	//************************************************************************
+	void*				reclaimer( void* )
+	{
+		while( __atomic_load_n( &s_reclaiming, __ATOMIC_ACQUIRE ) )
+		{
+			if( reclaimPass() == 0 )
+			{
+				struct timespec	delay;
+				delay.tv_sec = s_interval / 1000000;
+				delay.tv_nsec = ( s_interval % 1000000 ) * 1000;
+				nanosleep( &delay, NULL );
+			}
+		}
+		return NULL;
+	}
+}
+
+//****************************************************************************
+//
+//	Mem_deferStart() - start the reclaim thread
+//
+//	ARGUMENTS:
+//		a_intervalUs - microseconds to sleep when the rings are empty
+//
+//	RETURNS:
+//		true if the reclaim thread is running
+//		false if it could not be started, or already was
+//
+//****************************************************************************
+bool					Mem_deferStart( unsigned long a_intervalUs )
+{
+	if( __atomic_load_n( &s_reclaiming, __ATOMIC_ACQUIRE ) ||
+		a_intervalUs == 0 )
+	{
+		return false;
+	}
+	pthread_once( &s_ringKeyOnce, createRingKey );
+	s_interval = a_intervalUs;
+
+	__atomic_store_n( &s_reclaiming, true, __ATOMIC_RELEASE );
+	if( pthread_create( &s_reclaimer, NULL, reclaimer, NULL ) != 0 )
+	{
+		__atomic_store_n( &s_reclaiming, false, __ATOMIC_RELEASE );
+		return false;
+	}
+	return true;
+}
+
+//****************************************************************************
+//
+//	Mem_deferStop() - stop the reclaim thread
+//
+//	NOTE:
+//		Everything deferred before the call is released before it
+//		returns. A thread still deferring after that fills its ring
+//		and then releases for itself.
+//
+//****************************************************************************
+void					Mem_deferStop()
+{
+	if( !__atomic_exchange_n( &s_reclaiming, false, __ATOMIC_ACQ_REL ) )
+	{
+		return;
+	}
+	pthread_join( s_reclaimer, NULL );
+	Mem_deferDrain();
+}
+
+//****************************************************************************
+//
+//	Mem_deferThread() - defer the calling thread's releases or stop
+//
+//	ARGUMENTS:
+//		a_defer - true to defer them from now on, false to stop
+//
+//	RETURNS:
+//		true if the thread's releases are now as asked
+//		false if deferring was asked for and there is no reclaim thread,
+//		or no memory for a ring
+//
+//	NOTE:
+//		A thread that stops leaves what it deferred to be drained.
+//
+//****************************************************************************
+bool					Mem_deferThread( bool a_defer )
+{
+	if( !a_defer )
+	{
+		if( s_deferRing != NULL )
+		{
+			pthread_setspecific( s_ringKey, NULL );
+			releaseRing( s_deferRing );
+		}
+		return true;
+	}
+
+	if( s_deferRing != NULL )
+	{
+		return true;
+	}
+	if( !__atomic_load_n( &s_reclaiming, __ATOMIC_ACQUIRE ) )
+	{
+		return false;
+	}
+	MemDeferRing*		ring = claimRing();
+	if( ring == NULL )
+	{
+		return false;
+	}
+	pthread_setspecific( s_ringKey, ring );
+	s_deferRing = ring;
+	return true;
+}
+
+//****************************************************************************
+//
+//	Mem_deferDrain() - release everything deferred so far
+//
+//	RETURNS:
+//		how many hunks were released
+//
+//	NOTE:
+//		Waits out the reclaim thread's pass if it is in one. Hunks a
+//		thread keeps deferring while this runs may be released too.
+//
+//****************************************************************************
+size_t					Mem_deferDrain()
+{
+	size_t				released = 0;
+	size_t				pass;
+	while( ( pass = reclaimPass() ) != 0 )
+	{
+		released += pass;
+	}
+	return released;
+}
+
+//****************************************************************************
+//
+//	Mem_deferStats() - how the rings are keeping up
+//
+//	ARGUMENTS:
+//		a_pending - set to the hunks waiting on the rings
+//		a_direct  - set to the releases threads made themselves because
+//					their ring was full
+//
+//****************************************************************************
+void					Mem_deferStats( unsigned long* a_pending,
+										unsigned long* a_direct )
+{
+	*a_pending = 0;
+	*a_direct = 0;
+	for( MemDeferRing* ring =
+				__atomic_load_n( &s_deferRings, __ATOMIC_ACQUIRE );
+		 ring != NULL;
+		 ring = ring->d_next )
+	{
+		// the head first, the tail can only have moved on since
+		unsigned long	head = __atomic_load_n( &ring->d_head,
+												__ATOMIC_ACQUIRE );
+		*a_pending += __atomic_load_n( &ring->d_tail, __ATOMIC_ACQUIRE ) -
+					  head;
+		*a_direct += __atomic_load_n( &ring->d_direct, __ATOMIC_RELAXED );
+	}
+}
@@ -0,0 +1,72 @@
+#ifndef __MEM_DEFR_HPP__
+#define __MEM_DEFR_HPP__
+
+//	get size_t and caddr_t
+#include <sys/types.h>
+
+// Releasing a hunk can walk the overflow pool to coalesce, update a
+// bitmap another thread is claiming from, or unmap a cluster. Threads
+// that cannot afford that can have their releases deferred: each
+// release goes on a ring of the thread's own, and a reclaim thread
+// takes them off in batches and releases them for it. A ring has one
+// writer and one reader, so a release costs the thread a store and a
+// counter bump.
+
+// hunks a ring holds, a power of two
+const unsigned long		MEM_DEFER_RING_SIZE = 4096;
+
+// A thread's ring. The thread writes d_tail, the reclaim thread d_head,
+// each on cache lines of its own.
+struct MemDeferRing
+{
+	unsigned long		d_tail;
+	unsigned long		d_seenHead;		// d_head as the thread last read it
+	unsigned long		d_direct;		// released by the thread, ring full
+
+	unsigned long		d_head __attribute__(( aligned( 64 ) ));
+
+	MemDeferRing*		d_next __attribute__(( aligned( 64 ) ));
+	bool				d_owned;		// a thread is deferring into it
+
+	caddr_t				d_hunks[MEM_DEFER_RING_SIZE]
+									__attribute__(( aligned( 64 ) ));
+};
+
+// Start and stop the reclaim thread. It looks at the rings every
+// a_intervalUs microseconds, and keeps at it without sleeping for as
+// long as it finds hunks there. Threads should stop deferring before
+// it is stopped, what they deferred is released on the way out.
+bool					Mem_deferStart( unsigned long a_intervalUs );
+void					Mem_deferStop();
+
+// Defer the calling thread's releases, or stop deferring them
+bool					Mem_deferThread( bool a_defer );
+
+// Release everything deferred so far, from the calling thread
+size_t					Mem_deferDrain();
+
+// Hunks waiting on the rings, and releases threads made themselves
+// because their ring was full
+void					Mem_deferStats( unsigned long* a_pending,
+										unsigned long* a_direct );
+
+// Put a hunk on a ring, false if the ring is full. Only the thread that
+// owns the ring may push.
+inline bool				Mem_deferPush( MemDeferRing* a_ring, caddr_t a_hunk )
+{
+	unsigned long		tail = a_ring->d_tail;
+	if( tail - a_ring->d_seenHead == MEM_DEFER_RING_SIZE )
+	{
+		a_ring->d_seenHead = __atomic_load_n( &a_ring->d_head,
+											  __ATOMIC_ACQUIRE );
+		if( tail - a_ring->d_seenHead == MEM_DEFER_RING_SIZE )
+		{
+			return false;
+		}
+	}
+	a_ring->d_hunks[tail & ( MEM_DEFER_RING_SIZE - 1 )] = a_hunk;
+	__atomic_store_n( &a_ring->d_tail, tail + 1, __ATOMIC_RELEASE );
+	return true;
+}
+
+#endif // __MEM_DEFR_HPP__
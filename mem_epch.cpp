@@ -0,0 +1,478 @@
+#ifndef			__MEM_EPCH_HPP__
+#include		"mem_epch.hpp"
+#endif			// __MEM_EPCH_HPP__
+
+#ifndef			__MEM_ALOC_HPP__
+#include		"mem_aloc.hpp"
+#endif			// __MEM_ALOC_HPP__
+
+#include		<pthread.h>
+#include		<sched.h>
+
+namespace
+{
+	// A limbo chunk fills a 4KB block, back pointer included
+	const long			LIMBO_HUNKS = ( 4096 - 3 * sizeof(caddr_t) ) /
+									  sizeof(caddr_t);
+
+	struct limbo
+	{
+		limbo*			d_next;
+		long			d_count;
+		caddr_t			d_hunks[LIMBO_HUNKS];
+	};
+
+	// A thread retires into the bag of the epoch it sees, by the epoch
+	// modulo BAGS. Once a bag's epoch is two behind it can be released,
+	// so by the time the epoch comes round to a bag again it can be.
+	const int			BAGS = 3;
+
+	// hunks retired between tries at moving the epoch on and releasing
+	const unsigned long	COLLECT_BATCH = 64;
+
+	// What is kept for a thread. The thread writes d_epoch and threads
+	// moving the epoch read it, so it has its cache line to itself.
+	struct epochRecord
+	{
+		// ( epoch << 1 ) | 1 while the thread is in a look, else 0
+		unsigned long	d_epoch;
+
+		long			d_nesting __attribute__(( aligned( 64 ) ));
+		unsigned long	d_sinceCollect;
+		limbo*			d_limbo[BAGS];
+		unsigned long	d_limboEpoch[BAGS];
+		unsigned long	d_retired;
+		unsigned long	d_reclaimed;
+		epochRecord*	d_next;
+		bool			d_owned;		// a thread is using it
+	};
+
+	// the global epoch, only ever moved on by one
+	unsigned long		s_epoch = 1;
+
+	// Every record ever made. A record whose thread exited keeps its
+	// limbo lists, which are released by whoever passes by, and the
+	// next new thread takes it over.
+	epochRecord*		s_epochRecords = NULL;
+
+	// the calling thread's record, NULL until it first needs one
+	__thread epochRecord*	s_epochRecord = NULL;
+
+	// gives up a thread's record when it exits
+	pthread_key_t		s_recordKey;
+	pthread_once_t		s_recordKeyOnce = PTHREAD_ONCE_INIT;
+
+	//************************************************************************
+	//
+	//	releaseRecord() - give up an exiting thread's record
+	//
+	//************************************************************************
+	void				releaseRecord( void* a_record )
+	{
+		epochRecord*	record = (epochRecord*)a_record;
+		s_epochRecord = NULL;
+		record->d_nesting = 0;
+		__atomic_store_n( &record->d_epoch, 0UL, __ATOMIC_RELEASE );
+		__atomic_store_n( &record->d_owned, false, __ATOMIC_RELEASE );
+	}
+
+	//************************************************************************
+	//
+	//	createRecordKey() - set up the thread exit hook, once
+	//
+	//************************************************************************
+	void				createRecordKey()
+	{
+		pthread_key_create( &s_recordKey, releaseRecord );
+	}
+
+	//************************************************************************
+	//
+	//	claimRecord() - take a record no thread owns, or make one
+	//
+	//	RETURNS:
+	//		the record, owned by the caller
+	//		NULL if there was no memory for one
+	//
+	//************************************************************************
+	epochRecord*		claimRecord()
+	{
+		for( epochRecord* record =
+					__atomic_load_n( &s_epochRecords, __ATOMIC_ACQUIRE );
+			 record != NULL;
+			 record = record->d_next )
+		{
+			bool		owned = false;
+			if( !__atomic_load_n( &record->d_owned, __ATOMIC_RELAXED ) &&
+				__atomic_compare_exchange_n( &record->d_owned, &owned, true,
+											 false, __ATOMIC_ACQUIRE,
+											 __ATOMIC_RELAXED ) )
+			{
+				return record;
+			}
+		}
+
+		// on lines of its own, so d_epoch is too
+		epochRecord*	record =
+						(epochRecord*)Mem_allocateLined( sizeof(epochRecord) );
+		if( record == NULL )
+		{
+			return NULL;
+		}
+		*record = epochRecord();
+		record->d_owned = true;
+		epochRecord*	head =
+						__atomic_load_n( &s_epochRecords, __ATOMIC_ACQUIRE );
+		do
+		{
+			record->d_next = head;
+		}
+		while( !__atomic_compare_exchange_n( &s_epochRecords, &head, record,
+											 false, __ATOMIC_ACQ_REL,
+											 __ATOMIC_ACQUIRE ) );
+		return record;
+	}
+
+	//************************************************************************
+	//
+	//	ownRecord() - the calling thread's record, claimed on first use
+	//
+	//	RETURNS:
+	//		the record
+	//		NULL if there was no memory for one
+	//
+	//************************************************************************
+	epochRecord*		ownRecord()
+	{
+		if( s_epochRecord != NULL )
+		{
+			return s_epochRecord;
+		}
+		pthread_once( &s_recordKeyOnce, createRecordKey );
+		epochRecord*	record = claimRecord();
+		if( record == NULL )
+		{
+			return NULL;
+		}
+		pthread_setspecific( s_recordKey, record );
+		s_epochRecord = record;
+		return record;
+	}
+
+	//************************************************************************
+	//
+	//	tryAdvance() - move the epoch on if every look has seen it
+	//
+	//	ARGUMENTS:
+	//		a_epoch - the epoch to move on from
+	//
+	//	RETURNS:
+	//		true if the epoch is past a_epoch now
+	//		false if a thread is still in a look from before it
+	//
+	//************************************************************************
+	bool				tryAdvance( unsigned long a_epoch )
+	{
+		__atomic_thread_fence( __ATOMIC_SEQ_CST );
+		for( epochRecord* record =
+					__atomic_load_n( &s_epochRecords, __ATOMIC_ACQUIRE );
+			 record != NULL;
+			 record = record->d_next )
+		{
+			unsigned long	epoch = __atomic_load_n( &record->d_epoch,
+													 __ATOMIC_ACQUIRE );
+			if( ( epoch & 1 ) && ( epoch >> 1 ) != a_epoch )
+			{
+				return false;
+			}
+		}
+		// losing means somebody else moved it on
+		__atomic_compare_exchange_n( &s_epoch, &a_epoch, a_epoch + 1, false,
+									 __ATOMIC_SEQ_CST, __ATOMIC_RELAXED );
+		return true;
+	}
+
+	//************************************************************************
+	//
+	//	releaseBag() - release every hunk in one of a record's bags
+	//
+	//	ARGUMENTS:
+	//		a_record - the record, owned by the caller
+	//		a_bag	 - which bag
+	//
+	//	RETURNS:
+	//		how many hunks were released
+	//
+	//	NOTE:
+	//		The first chunk is kept for the hunks retired next.
+	//
+	//************************************************************************
+	size_t				releaseBag( epochRecord* a_record, int a_bag )
+	{
+		limbo*			first = a_record->d_limbo[a_bag];
+		size_t			released = 0;
+		for( limbo* chunk = first; chunk != NULL; )
+		{
+			for( long index = 0; index < chunk->d_count; index++ )
+			{
+				Mem_releaseHunk( chunk->d_hunks[index] );
+			}
+			released += chunk->d_count;
+
+			limbo*		next = chunk->d_next;
+			if( chunk != first )
+			{
+				Mem_releaseHunk( (caddr_t)chunk );
+			}
+			chunk = next;
+		}
+		if( first != NULL )
+		{
+			first->d_next = NULL;
+			first->d_count = 0;
+		}
+		__atomic_store_n( &a_record->d_reclaimed,
+						  a_record->d_reclaimed + released, __ATOMIC_RELAXED );
+		return released;
+	}
+
+	//************************************************************************
+	//
+	//	collect() - release the bags of a record no reader can reach
+	//
+	//	ARGUMENTS:
+	//		a_record - the record, owned by the caller
+	//		a_epoch	 - the global epoch, as last read
+	//
+	//	RETURNS:
+	//		how many hunks were released
+	//
+	//************************************************************************
+	size_t				collect( epochRecord* a_record, unsigned long a_epoch )
+	{
+		size_t			released = 0;
+		for( int bag = 0; bag < BAGS; bag++ )
+		{
+			if( a_record->d_limboEpoch[bag] + 2 <= a_epoch )
+			{
+				released += releaseBag( a_record, bag );
+			}
+		}
+		return released;
+	}
+
+	//************************************************************************
+	//
+	//	collectOrphans() - collect() the records of exited threads
+	//
+	//	NOTE:
+	//		A record is owned while it is collected, so a new thread
+	//		cannot take it over meanwhile.
+	//
+	//************************************************************************
+	size_t				collectOrphans( unsigned long a_epoch )
+	{
+		size_t			released = 0;
+		for( epochRecord* record =
+					__atomic_load_n( &s_epochRecords, __ATOMIC_ACQUIRE );
+			 record != NULL;
+			 record = record->d_next )
+		{
+			bool		owned = false;
+			if( !__atomic_load_n( &record->d_owned, __ATOMIC_RELAXED ) &&
+				__atomic_compare_exchange_n( &record->d_owned, &owned, true,
+											 false, __ATOMIC_ACQUIRE,
+											 __ATOMIC_RELAXED ) )
+			{
+				released += collect( record, a_epoch );
+				__atomic_store_n( &record->d_owned, false, __ATOMIC_RELEASE );
+			}
+		}
+		return released;
+	}
+}
+
+//****************************************************************************
+//
+//	Mem_epochEnter() - start a look at a lock-free structure
+//
+//	RETURNS:
+//		true if the look may go ahead
+//		false if there was no memory for the thread's record
+//
+//	NOTE:
+//		The epoch is published before anything of the structure is
+//		read, so a thread moving the epoch on either sees the look or
+//		the look sees nothing retired before it.
+//
+//****************************************************************************
+bool					Mem_epochEnter()
+{
+	epochRecord*		record = ownRecord();
+	if( record == NULL )
+	{
+		return false;
+	}
+	if( record->d_nesting++ == 0 )
+	{
+		unsigned long	epoch = __atomic_load_n( &s_epoch, __ATOMIC_RELAXED );
+		__atomic_store_n( &record->d_epoch, ( epoch << 1 ) | 1,
+						  __ATOMIC_RELAXED );
+		__atomic_thread_fence( __ATOMIC_SEQ_CST );
+	}
+	return true;
+}
+
+//****************************************************************************
+//
+//	Mem_epochExit() - end a look at a lock-free structure
+//
+//****************************************************************************
+void					Mem_epochExit()
+{
+	epochRecord*		record = s_epochRecord;
+	if( record == NULL || record->d_nesting == 0 )
+	{
+		return;
+	}
+	if( --record->d_nesting == 0 )
+	{
+		__atomic_store_n( &record->d_epoch, 0UL, __ATOMIC_RELEASE );
+	}
+}
+
+//****************************************************************************
+//
+//	Mem_retire() - release a hunk once no reader can hold it
+//
+//	ARGUMENTS:
+//		a_hunk - a hunk from Mem_allocateHunk() or its kin, already
+//				 unlinked from where readers find it
+//
+//	RETURNS:
+//		true if the hunk will be released
+//		false if there was no memory to note it, the caller still has it
+//
+//	NOTE:
+//		Every COLLECT_BATCH hunks the thread tries to move the epoch on,
+//		then releases its bags that are old enough, and those of exited
+//		threads.
+//
+//****************************************************************************
+bool					Mem_retire( caddr_t a_hunk )
+{
+	if( a_hunk == NULL )
+	{
+		return true;
+	}
+	epochRecord*		record = ownRecord();
+	if( record == NULL )
+	{
+		return false;
+	}
+
+	// the unlink comes before the read of the epoch
+	__atomic_thread_fence( __ATOMIC_SEQ_CST );
+	unsigned long		epoch = __atomic_load_n( &s_epoch, __ATOMIC_RELAXED );
+	int					bag = epoch % BAGS;
+	if( record->d_limboEpoch[bag] != epoch )
+	{
+		// what is there was retired at least BAGS epochs ago
+		releaseBag( record, bag );
+		record->d_limboEpoch[bag] = epoch;
+	}
+
+	limbo*				chunk = record->d_limbo[bag];
+	if( chunk == NULL || chunk->d_count == LIMBO_HUNKS )
+	{
+		limbo*			more = (limbo*)Mem_allocateHunk( sizeof(limbo) );
+		if( more == NULL )
+		{
+			return false;
+		}
+		more->d_next = chunk;
+		more->d_count = 0;
+		record->d_limbo[bag] = more;
+		chunk = more;
+	}
+	chunk->d_hunks[chunk->d_count++] = a_hunk;
+	__atomic_store_n( &record->d_retired, record->d_retired + 1,
+					  __ATOMIC_RELAXED );
+
+	if( ++record->d_sinceCollect >= COLLECT_BATCH )
+	{
+		record->d_sinceCollect = 0;
+		tryAdvance( epoch );
+		epoch = __atomic_load_n( &s_epoch, __ATOMIC_ACQUIRE );
+		collect( record, epoch );
+		collectOrphans( epoch );
+	}
+	return true;
+}
+
+//****************************************************************************
+//
+//	Mem_retireFlush() - wait for what was retired to be released
+//
+//	RETURNS:
+//		how many hunks were released
+//
+//	NOTE:
+//		Moves the epoch on twice, yielding while threads in looks hold
+//		it back. Hunks exited threads retired in the last two epochs
+//		may be left for later.
+//
+//****************************************************************************
+size_t					Mem_retireFlush()
+{
+	epochRecord*		record = ownRecord();
+	if( record == NULL || record->d_nesting != 0 )
+	{
+		return 0;
+	}
+
+	unsigned long		target =
+						__atomic_load_n( &s_epoch, __ATOMIC_ACQUIRE ) + 2;
+	unsigned long		epoch;
+	while( ( epoch = __atomic_load_n( &s_epoch, __ATOMIC_ACQUIRE ) ) <
+		   target )
+	{
+		if( !tryAdvance( epoch ) )
+		{
+			sched_yield();
+		}
+	}
+	return collect( record, epoch ) + collectOrphans( epoch );
+}
+
+//****************************************************************************
+//
+//	Mem_epochStats() - how retiring is keeping up
+//
+//	ARGUMENTS:
+//		a_stats - filled in with the counts
+//
+//	NOTE:
+//		Each count is exact for its thread, the sums can be a little
+//		out of step while threads retire.
+//
+//****************************************************************************
+void					Mem_epochStats( MemEpochStats* a_stats )
+{
+	*a_stats = MemEpochStats();
+	a_stats->d_epoch = __atomic_load_n( &s_epoch, __ATOMIC_RELAXED );
+	for( epochRecord* record =
+				__atomic_load_n( &s_epochRecords, __ATOMIC_ACQUIRE );
+		 record != NULL;
+		 record = record->d_next )
+	{
+		a_stats->d_retired += __atomic_load_n( &record->d_retired,
+											   __ATOMIC_RELAXED );
+		a_stats->d_reclaimed += __atomic_load_n( &record->d_reclaimed,
+												 __ATOMIC_RELAXED );
+		if( __atomic_load_n( &record->d_owned, __ATOMIC_RELAXED ) )
+		{
+			a_stats->d_threads++;
+		}
+	}
+}
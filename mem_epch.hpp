@@ -0,0 +1,62 @@
+#ifndef __MEM_EPCH_HPP__
+#define __MEM_EPCH_HPP__
+
+//	get size_t and caddr_t
+#include <sys/types.h>
+
+// A lock-free structure cannot release a hunk it unlinks while readers
+// may still hold a pointer to it. Readers wrap each look at the
+// structure in Mem_epochEnter() and Mem_epochExit(), and the writer
+// hands the hunk to Mem_retire() instead of releasing it. Retired hunks
+// wait on a limbo list of the retiring thread, tagged with the global
+// epoch. The epoch moves on only once every thread inside a look has
+// seen it, so two epochs later no reader can still hold a hunk, and the
+// list is given to Mem_releaseHunk() in one go, straight back to the
+// pools of its sizes.
+
+// Start and end a look at a structure. Looks may nest. A thread must
+// not wait for other threads while in one, or the epoch cannot move.
+// Entering is false if there was no memory to note the thread, and
+// the look must not go ahead.
+bool					Mem_epochEnter();
+void					Mem_epochExit();
+
+// Release a hunk once no reader can hold it. False if there was no
+// memory for the limbo list, and the hunk is not retired.
+bool					Mem_retire( caddr_t a_hunk );
+
+// Wait for what the calling thread retired, and what exited threads
+// left, to be released, returning how many hunks were. Not from
+// inside a look.
+size_t					Mem_retireFlush();
+
+struct MemEpochStats
+{
+	unsigned long		d_epoch;		// the global epoch
+	unsigned long		d_retired;		// hunks ever retired
+	unsigned long		d_reclaimed;	// of those, released
+	unsigned long		d_threads;		// threads that ever retired or
+										// looked, that have not exited
+};
+
+void					Mem_epochStats( MemEpochStats* a_stats );
+
+// Holds a look for as long as it is in scope, if d_entered
+struct MemEpochGuard
+{
+	bool				d_entered;
+
+	MemEpochGuard()
+		: d_entered( Mem_epochEnter() )
+	{
+	}
+	~MemEpochGuard()
+	{
+		if( d_entered )
+		{
+			Mem_epochExit();
+		}
+	}
+};
+
+#endif // __MEM_EPCH_HPP__
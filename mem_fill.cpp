@@ -0,0 +1,147 @@
+#ifndef			__MEM_FILL_HPP__
+#include		"mem_fill.hpp"
+#endif			// __MEM_FILL_HPP__
+
+#ifndef			__MEM_NODE_HPP__
+#include		"mem_node.hpp"
+#endif			// __MEM_NODE_HPP__
+
+#ifndef			__MEM_CLST_HPP__
+#include		"mem_clst.hpp"
+#endif			// __MEM_CLST_HPP__
+
+#ifndef			__MEM_RSS_HPP__
+#include		"mem_rss.hpp"
+#endif			// __MEM_RSS_HPP__
+
+#include		<limits.h>
+#include		<pthread.h>
+#include		<time.h>
+
+namespace
+{
+	// the thread that does the refilling, and what it keeps
+	pthread_t			s_refiller;
+	bool				s_refilling = false;
+	long				s_readyClusters = 0;
+	long				s_spareNodes = 0;
+	unsigned long		s_interval = 0;
+
+	//************************************************************************
+	//
+	//	refiller() - top up until told to stop
+	//
+	//************************************************************************
+	void*				refiller( void* )
+	{
+		while( __atomic_load_n( &s_refilling, __ATOMIC_ACQUIRE ) )
+		{
+			Mem_refill( s_readyClusters, s_spareNodes );
+
+			struct timespec	delay;
+			delay.tv_sec = s_interval / 1000;
+			delay.tv_nsec = ( s_interval % 1000 ) * 1000000;
+			nanosleep( &delay, NULL );
+		}
+		return NULL;
+	}
+}
+
+//****************************************************************************
+//
+//	Mem_refill() - stock every size category up
+//
+//	ARGUMENTS:
+//		a_clusters - ready clusters to keep per size category
+//		a_nodes	   - spare nodes to keep per size category
+//
+//	NOTE:
+//		Categories that share a cluster size share the ready clusters
+//		of that size, so that size gets a_clusters for each of them.
+//		The nodes go first, they take ready clusters for their own.
+//		Nothing is made ahead while memory use is near its RSS target,
+//		see Mem_rssPressure().
+//
+//****************************************************************************
+void					Mem_refill( long a_clusters, long a_nodes )
+{
+	long				wanted[sizeof(long) * CHAR_BIT] = { 0 };
+
+	if( Mem_rssPressure() )
+	{
+		return;
+	}
+
+	for( long size = MEM_NODE_SMALLEST_SIZE; size <= MEM_NODE_LARGEST_SIZE;
+		 size++ )
+	{
+		if( a_nodes > 0 )
+		{
+			MemNode_prepare( size, a_nodes );
+		}
+		wanted[__builtin_ctzl( MemNode_clusterSize( size ) )] += a_clusters;
+	}
+
+	for( long shift = 0; shift < (long)( sizeof(long) * CHAR_BIT ); shift++ )
+	{
+		if( wanted[shift] > 0 )
+		{
+			Cluster_prefault( 1UL << shift, wanted[shift] );
+		}
+	}
+}
+
+//****************************************************************************
+//
+//	Mem_refillStart() - start keeping the size categories stocked
+//
+//	ARGUMENTS:
+//		a_clusters	 - ready clusters to keep per size category
+//		a_nodes		 - spare nodes to keep per size category
+//		a_intervalMs - milliseconds between top ups
+//
+//	RETURNS:
+//		true if the refill thread is running
+//		false if it could not be started, or already was
+//
+//	NOTE:
+//		The first top up is done before returning, so allocations made
+//		right after find everything ready.
+//
+//****************************************************************************
+bool					Mem_refillStart( long a_clusters, long a_nodes,
+										 unsigned long a_intervalMs )
+{
+	if( __atomic_load_n( &s_refilling, __ATOMIC_ACQUIRE ) ||
+		a_intervalMs == 0 )
+	{
+		return false;
+	}
+	s_readyClusters = a_clusters;
+	s_spareNodes = a_nodes;
+	s_interval = a_intervalMs;
+	Mem_refill( a_clusters, a_nodes );
+
+	__atomic_store_n( &s_refilling, true, __ATOMIC_RELEASE );
+	if( pthread_create( &s_refiller, NULL, refiller, NULL ) != 0 )
+	{
+		__atomic_store_n( &s_refilling, false, __ATOMIC_RELEASE );
+		return false;
+	}
+	return true;
+}
+
+//****************************************************************************
+//
+//	Mem_refillStop() - stop the refill thread
+//
+//****************************************************************************
+void					Mem_refillStop()
+{
+	if( !__atomic_load_n( &s_refilling, __ATOMIC_ACQUIRE ) )
+	{
+		return;
+	}
+	__atomic_store_n( &s_refilling, false, __ATOMIC_RELEASE );
+	pthread_join( s_refiller, NULL );
+}
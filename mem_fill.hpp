@@ -0,0 +1,25 @@
+#ifndef __MEM_FILL_HPP__
+#define __MEM_FILL_HPP__
+
+//	get size_t and caddr_t
+#include <sys/types.h>
+
+// When a size category runs out of room, the allocating thread makes a
+// node, maps or carves a cluster for it and then takes a page fault on
+// every page it touches. A refill thread can do that ahead of time,
+// keeping each category stocked with spare nodes that already have a
+// faulted in cluster hooked, and the cluster layer with faulted in
+// clusters of each category's size, so allocating threads find them
+// ready and make no system calls.
+
+// Start a thread that tops up every size category to a_clusters ready
+// clusters and a_nodes spare nodes every a_intervalMs milliseconds, and
+// stop it again. What was made ahead stays for allocations to use.
+bool					Mem_refillStart( long a_clusters, long a_nodes,
+										 unsigned long a_intervalMs );
+void					Mem_refillStop();
+
+// Top up once, from the calling thread
+void					Mem_refill( long a_clusters, long a_nodes );
+
+#endif // __MEM_FILL_HPP__
@@ -0,0 +1,330 @@
+#ifndef			__MEM_LAT_HPP__
+#include		"mem_lat.hpp"
+#endif			// __MEM_LAT_HPP__
+
+#ifndef			__MEM_CLST_HPP__
+#include		"mem_clst.hpp"
+#endif			// __MEM_CLST_HPP__
+
+#include		<stddef.h>
+#include		<time.h>
+
+// Whether Mem_allocateHunk() and Mem_releaseHunk() time themselves,
+// and the slow paths the calling thread took since the timing started
+bool					s_latencyEnabled = false;
+__thread unsigned long	s_latencyPath = 0;
+
+namespace
+{
+	// A thread's histograms. Only the thread counts into them, anyone
+	// may read them. They are linked on s_latencyThreads for good, so
+	// the counts of threads that have exited still add up.
+	struct threadLatency
+	{
+		threadLatency*		d_next;
+		MemLatencyHistogram	d_histograms[MEM_LATENCY_OPERATIONS]
+										[MEM_LATENCY_CLASSES]
+										[MEM_LATENCY_PATHS];
+	};
+
+	threadLatency*			s_latencyThreads = NULL;
+	__thread threadLatency*	s_threadLatency = NULL;
+
+	// how many ticks make a microsecond, measured when timing is enabled
+	double					s_ticksPerMicrosecond = 0;
+
+	//************************************************************************
+	//
+	//	calibrate() - measure the tick rate against the monotonic clock
+	//
+	//************************************************************************
+	double				calibrate()
+	{
+		struct timespec	before;
+		struct timespec	after;
+		struct timespec	delay = { 0, 10000000 };
+
+		clock_gettime( CLOCK_MONOTONIC, &before );
+		unsigned long	startTicks = Mem_latencyTicks();
+		nanosleep( &delay, NULL );
+		unsigned long	endTicks = Mem_latencyTicks();
+		clock_gettime( CLOCK_MONOTONIC, &after );
+
+		double			microseconds =
+							( after.tv_sec - before.tv_sec ) * 1e6 +
+							( after.tv_nsec - before.tv_nsec ) / 1e3;
+		return ( endTicks - startTicks ) / microseconds;
+	}
+
+	//************************************************************************
+	//
+	//	threadHistograms() - get the calling thread's histograms
+	//
+	//	RETURNS:
+	//		the histograms, made the first time a thread asks
+	//		NULL if there was no memory for them
+	//
+	//	NOTE:
+	//		They come straight from the cluster layer so timing an
+	//		allocation never allocates.
+	//
+	//************************************************************************
+	threadLatency*		threadHistograms()
+	{
+		threadLatency*	latency = s_threadLatency;
+		if( latency != NULL )
+		{
+			return latency;
+		}
+
+		latency = (threadLatency*)Cluster_request( sizeof(threadLatency) );
+		if( latency == NULL )
+		{
+			return NULL;
+		}
+		threadLatency*	head =
+					__atomic_load_n( &s_latencyThreads, __ATOMIC_ACQUIRE );
+		do
+		{
+			latency->d_next = head;
+		}
+		while( !__atomic_compare_exchange_n( &s_latencyThreads, &head, latency,
+											 false, __ATOMIC_ACQ_REL,
+											 __ATOMIC_ACQUIRE ) );
+		s_threadLatency = latency;
+		return latency;
+	}
+
+	//************************************************************************
+	//
+	//	bucket() - which bucket a number of ticks counts in
+	//
+	//************************************************************************
+	long				bucket( unsigned long a_ticks )
+	{
+		if( a_ticks < 4 )
+		{
+			return a_ticks;
+		}
+		long			power = 63 - __builtin_clzl( a_ticks );
+		long			index = ( power - 1 ) * 4 +
+								( ( a_ticks >> ( power - 2 ) ) & 3 );
+		if( index >= MEM_LATENCY_BUCKETS )
+		{
+			index = MEM_LATENCY_BUCKETS - 1;
+		}
+		return index;
+	}
+
+	//************************************************************************
+	//
+	//	count() - add to a counter only this thread writes
+	//
+	//************************************************************************
+	void				count( unsigned long* a_counter )
+	{
+		__atomic_store_n( a_counter,
+						  __atomic_load_n( a_counter, __ATOMIC_RELAXED ) + 1,
+						  __ATOMIC_RELAXED );
+	}
+}
+
+//****************************************************************************
+//
+//	Mem_latencyEnable() - turn timing on or off
+//
+//	ARGUMENTS:
+//		a_enable - true to time allocations and releases from now on
+//
+//	NOTE:
+//		The first time it is turned on, the tick rate is measured,
+//		which takes 10ms.
+//
+//****************************************************************************
+void					Mem_latencyEnable( bool a_enable )
+{
+	if( a_enable && s_ticksPerMicrosecond == 0 )
+	{
+		s_ticksPerMicrosecond = calibrate();
+	}
+	__atomic_store_n( &s_latencyEnabled, a_enable, __ATOMIC_RELAXED );
+}
+
+//****************************************************************************
+//
+//	Mem_latencyReset() - zero every thread's counts
+//
+//	NOTE:
+//		A thread counting while this runs can put back a count of its
+//		own, so reset with timing off for exact figures.
+//
+//****************************************************************************
+void					Mem_latencyReset()
+{
+	for( threadLatency* latency =
+				__atomic_load_n( &s_latencyThreads, __ATOMIC_ACQUIRE );
+		 latency != NULL;
+		 latency = latency->d_next )
+	{
+		unsigned long*	counter = (unsigned long*)latency->d_histograms;
+		unsigned long*	end = (unsigned long*)( &latency->d_histograms + 1 );
+		for( ; counter < end; counter++ )
+		{
+			__atomic_store_n( counter, 0UL, __ATOMIC_RELAXED );
+		}
+	}
+}
+
+//****************************************************************************
+//
+//	Mem_latencyRecord() - count one timing for the calling thread
+//
+//	ARGUMENTS:
+//		a_operation - MEM_LATENCY_ALLOCATE or MEM_LATENCY_RELEASE
+//		a_class		- the size category, or MEM_LATENCY_OVERFLOW
+//		a_start		- Mem_latencyTicks() when it started
+//
+//	NOTE:
+//		The path is taken from what the slow paths noted in
+//		s_latencyPath, which the caller clears before it starts.
+//
+//****************************************************************************
+void					Mem_latencyRecord( int a_operation, long a_class,
+										   unsigned long a_start )
+{
+	unsigned long		ticks = Mem_latencyTicks() - a_start;
+
+	threadLatency*		latency = threadHistograms();
+	if( latency == NULL )
+	{
+		return;
+	}
+
+	// a new node always hooks a cluster too, so that counts first
+	int					path = MEM_PATH_FAST;
+	if( s_latencyPath & MEM_LATENCY_NODE_CREATED )
+	{
+		path = MEM_PATH_NODE_CREATE;
+	}
+	else if( s_latencyPath & MEM_LATENCY_CLUSTER_MOVED )
+	{
+		path = MEM_PATH_CLUSTER;
+	}
+	else if( a_class == MEM_LATENCY_OVERFLOW )
+	{
+		path = MEM_PATH_OVERFLOW;
+	}
+
+	MemLatencyHistogram*	histogram =
+						&latency->d_histograms[a_operation][a_class][path];
+	count( &histogram->d_count );
+	count( &histogram->d_buckets[bucket( ticks )] );
+}
+
+//****************************************************************************
+//
+//	Mem_latencyHistogram() - sum one histogram over every thread
+//
+//	ARGUMENTS:
+//		a_operation - MEM_LATENCY_ALLOCATE or MEM_LATENCY_RELEASE
+//		a_class		- the size category, or MEM_LATENCY_OVERFLOW
+//		a_path		- one of the MEM_PATH_ values
+//		a_histogram - filled in with the sums
+//
+//****************************************************************************
+void					Mem_latencyHistogram( int a_operation, long a_class,
+											  int a_path,
+											  MemLatencyHistogram* a_histogram )
+{
+	a_histogram->d_count = 0;
+	for( long index = 0; index < MEM_LATENCY_BUCKETS; index++ )
+	{
+		a_histogram->d_buckets[index] = 0;
+	}
+	if( a_operation < 0 || a_operation >= MEM_LATENCY_OPERATIONS ||
+		a_class < 0 || a_class >= MEM_LATENCY_CLASSES ||
+		a_path < 0 || a_path >= MEM_LATENCY_PATHS )
+	{
+		return;
+	}
+
+	for( threadLatency* latency =
+				__atomic_load_n( &s_latencyThreads, __ATOMIC_ACQUIRE );
+		 latency != NULL;
+		 latency = latency->d_next )
+	{
+		MemLatencyHistogram*	histogram =
+						&latency->d_histograms[a_operation][a_class][a_path];
+		a_histogram->d_count +=
+				__atomic_load_n( &histogram->d_count, __ATOMIC_RELAXED );
+		for( long index = 0; index < MEM_LATENCY_BUCKETS; index++ )
+		{
+			a_histogram->d_buckets[index] +=
+				__atomic_load_n( &histogram->d_buckets[index],
+								 __ATOMIC_RELAXED );
+		}
+	}
+}
+
+//****************************************************************************
+//
+//	Mem_latencyBucketTicks() - the fewest ticks a bucket counts
+//
+//****************************************************************************
+unsigned long			Mem_latencyBucketTicks( long a_bucket )
+{
+	if( a_bucket < 4 )
+	{
+		return a_bucket;
+	}
+	long				power = a_bucket / 4 + 1;
+	return (unsigned long)( 4 + a_bucket % 4 ) << ( power - 2 );
+}
+
+//****************************************************************************
+//
+//	Mem_latencyPercentile() - find a percentile of a histogram
+//
+//	ARGUMENTS:
+//		a_histogram - the histogram
+//		a_fraction	- 0.99 for the 99th percentile
+//
+//	RETURNS:
+//		the top of the bucket the percentile falls in, in ticks
+//		0 if the histogram is empty
+//
+//****************************************************************************
+unsigned long			Mem_latencyPercentile(
+									const MemLatencyHistogram* a_histogram,
+									double a_fraction )
+{
+	unsigned long		target =
+						(unsigned long)( a_fraction * a_histogram->d_count );
+	unsigned long		seen = 0;
+	for( long index = 0; index < MEM_LATENCY_BUCKETS; index++ )
+	{
+		seen += a_histogram->d_buckets[index];
+		if( seen > target || ( seen == a_histogram->d_count && seen != 0 ) )
+		{
+			if( index + 1 == MEM_LATENCY_BUCKETS )
+			{
+				return Mem_latencyBucketTicks( index );
+			}
+			return Mem_latencyBucketTicks( index + 1 ) - 1;
+		}
+	}
+	return 0;
+}
+
+//****************************************************************************
+//
+//	Mem_latencyTicksPerMicrosecond() - how many ticks make a microsecond
+//
+//	RETURNS:
+//		the rate measured when timing was first enabled, 0 before then
+//
+//****************************************************************************
+double					Mem_latencyTicksPerMicrosecond()
+{
+	return s_ticksPerMicrosecond;
+}
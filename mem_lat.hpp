@@ -0,0 +1,89 @@
+#ifndef __MEM_LAT_HPP__
+#define __MEM_LAT_HPP__
+
+//	get size_t and caddr_t
+#include <sys/types.h>
+#include <time.h>
+
+#if defined( __x86_64__ ) || defined( __i386__ )
+#include <x86intrin.h>
+#endif
+
+// Mem_allocateHunk() and Mem_releaseHunk() can time themselves with the
+// TSC and keep log-linear histograms of how long they took, per size
+// category and per path through the allocator. Each thread counts into
+// its own histograms, so timing adds no sharing between threads. It is
+// off unless Mem_latencyEnable() turns it on, and then costs a branch.
+
+// what was timed
+const int				MEM_LATENCY_ALLOCATE = 0;
+const int				MEM_LATENCY_RELEASE = 1;
+const int				MEM_LATENCY_OPERATIONS = 2;
+
+// The way it went. Making a node counts first, as it always gets the new
+// node a cluster as well, then getting or giving back a cluster or slab,
+// however either was reached.
+const int				MEM_PATH_FAST = 0;			// a block from a node
+const int				MEM_PATH_NODE_CREATE = 1;	// a new MemNode
+const int				MEM_PATH_CLUSTER = 2;		// a cluster or slab came
+													// or went, maybe mmap
+const int				MEM_PATH_OVERFLOW = 3;		// the overflow pool
+const int				MEM_LATENCY_PATHS = 4;
+
+// Size categories 0 to 9 hold 32 << i bytes, and hunks too big for them,
+// spans and the overflow pool alike, count under the last one.
+const long				MEM_LATENCY_OVERFLOW = 10;
+const long				MEM_LATENCY_CLASSES = 11;
+
+// Four buckets for each power of two of ticks, exact below 4, and the
+// last one takes everything from 7 << 38 on.
+const long				MEM_LATENCY_BUCKETS = 160;
+
+// Slow paths note themselves here as they go, so the path can be told
+// when the timing is recorded
+const unsigned long		MEM_LATENCY_NODE_CREATED = 1;
+const unsigned long		MEM_LATENCY_CLUSTER_MOVED = 2;
+
+struct MemLatencyHistogram
+{
+	unsigned long		d_count;
+	unsigned long		d_buckets[MEM_LATENCY_BUCKETS];
+};
+
+// Read the clock timings are taken in
+inline unsigned long	Mem_latencyTicks()
+{
+#if defined( __x86_64__ ) || defined( __i386__ )
+	return __rdtsc();
+#else
+	struct timespec		time;
+	clock_gettime( CLOCK_MONOTONIC, &time );
+	return time.tv_sec * 1000000000UL + time.tv_nsec;
+#endif
+}
+
+// Turn timing on or off, and zero every thread's counts
+void					Mem_latencyEnable( bool a_enable );
+void					Mem_latencyReset();
+
+// Count one timing that started at a_start for the calling thread
+void					Mem_latencyRecord( int a_operation, long a_class,
+										   unsigned long a_start );
+
+// Sum one histogram over every thread
+void					Mem_latencyHistogram( int a_operation, long a_class,
+											  int a_path,
+											  MemLatencyHistogram* a_histogram );
+
+// The fewest ticks a bucket counts
+unsigned long			Mem_latencyBucketTicks( long a_bucket );
+
+// The ticks below which a_fraction of a histogram's timings fall
+unsigned long			Mem_latencyPercentile(
+									const MemLatencyHistogram* a_histogram,
+									double a_fraction );
+
+// How many ticks make a microsecond
+double					Mem_latencyTicksPerMicrosecond();
+
+#endif // __MEM_LAT_HPP__
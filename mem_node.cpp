@@ -10,216 +10,1733 @@
 #include		"mem_bmap.hpp"
 #endif			// __MEM_BMAP_HPP__
 
+#ifndef			__MEM_LAT_HPP__
+#include		"mem_lat.hpp"
+#endif			// __MEM_LAT_HPP__
+
+#ifndef			__MEM_WALK_HPP__
+#include		"mem_walk.hpp"
+#endif			// __MEM_WALK_HPP__
+
 #include		<limits.h>
 #include		<stddef.h>
 #include		<stdio.h>
+#include		<unistd.h>
 
 extern			size_t s_clusterSize;
+extern __thread	unsigned long s_latencyPath;
+
+// Block sizes whose slots are tracked with a free list instead of a
+// bitmap, one bit per power of two. fstbench shows the free list ahead
+// under churn for the small sizes, while the bitmap claims batches
+// faster. Build with -DMEM_FREE_LIST_SIZES=0 to put every size on
+// bitmaps.
+#ifndef			MEM_FREE_LIST_SIZES
+#define			MEM_FREE_LIST_SIZES	( ( 1UL << 5 ) | ( 1UL << 6 ) | ( 1UL << 7 ) )
+#endif			// MEM_FREE_LIST_SIZES
+
+namespace
+{
+	// file local function to initialize necessary data structures
+	void			initializeMasterNodeTable();
+
+	// The first cluster's worth of nodes, so the first nodes need no
+	// mapping. It sits in .bss until it is touched.
+	MemNode			s_firstNodeBlock[CLUSTERSIZE / sizeof(MemNode)];
+
+	// file local data structure to manage nodes, a cluster's worth of
+	// pointers to clusters of nodes, built at compile time
+	constinit MemNode*	s_masterNodeTable[CLUSTERSIZE / sizeof(MemNode*)] =
+							{ s_firstNodeBlock };
+
+	// how many nodes of each block size have been colored,
+	// indexed by the power of two of the block
+	unsigned long	s_colorSequence[sizeof(long) * CHAR_BIT];
+
+	// d_count is pushed this far below zero while an empty node gives
+	// up its cluster, so nobody starts using it in the meantime
+	const long		NODE_CLOSED = LONG_MIN / 2;
+
+	// Bounds on how many blocks a cluster of any block size holds.
+	// Fewer and a class maps and unmaps clusters all the time, more
+	// and the bitmap scans get long and the cluster is hardly ever
+	// empty enough to give back.
+	const long		MIN_BLOCKS_PER_CLUSTER = 8;
+	const long		MAX_BLOCKS_PER_CLUSTER = 2048;
+
+	// Nodes are sorted into this many buckets by how full they are when
+	// picking one to allocate from, see MemNode_select()
+	const long		OCCUPANCY_BUCKETS = 8;
+
+	// how many clusters a block size hooks between looks at its sizing
+	const long		ADAPT_HOOKS = 16;
+
+	// a block size that hands out fewer blocks than this per cluster
+	// it hooks is spending too much of its time getting clusters
+	const long		CHURN_ALLOCATIONS = 64;
+
+	// How each block size is being used, and the cluster size its next
+	// node gets. The block counts are bumped without a locked
+	// instruction and can lose an update when threads race, which is
+	// close enough for sizing and for stats. Each sits on its own cache
+	// lines so block sizes do not slow each other down.
+	struct classPolicy
+	{
+		long		d_clusterSize;	// 0 until first sized
+		bool		d_pinned;		// set by MemNode_setClusterSize()
+		long		d_live;			// blocks in use
+		long		d_peakLive;		// most in use since the last look
+		long		d_allocations;	// blocks handed out since the last look
+		long		d_hooks;		// clusters hooked since the last look
+		long		d_totalAllocations;	// blocks ever handed out
+		long		d_nodes;		// nodes created
+		long		d_clustersHooked;	// these three are exact
+		long		d_clustersReleased;
+		long		d_clustersDrained;
+		long		d_clusterBytes;	// bytes of cluster hooked now
+		MemNode*	d_spares;		// made ahead by MemNode_prepare()
+		long		d_spareCount;
+		long		d_purgedBytes;	// free pages given back now
+		long		d_pagesPurged;	// pages ever given back
+		long		d_pagesRefaulted;	// of those, used again since
+	} __attribute__(( aligned( 64 ) ));
+
+	// indexed by the power of two of the block
+	classPolicy		s_classPolicy[sizeof(long) * CHAR_BIT];
+
+	// fill an empty slot with a new cluster
+	caddr_t			hookCluster( caddr_t* a_slot, size_t a_clusterSize,
+								 bool* a_hooked = NULL );
+
+	// drop a reference to a node, giving up its cluster if it is empty
+	template< class SLOTS >
+	void			dropCount( MemNode* a_node );
+
+	// the OS page size, looked up once
+	long			s_pageSize = 0;
+	long			pageSize();
+
+	// note that a block handed out is on pages that were given back
+	void			refault( MemNode* a_node, unsigned long a_slot );
+
+	// forget the pages given back, the cluster has gone
+	void			forgetPurged( MemNode* a_node );
+
+	//************************************************************************
+	//
+	//	hookCluster() - make sure a slot holds a cluster
+	//
+	//	ARGS:
+	//		a_slot		  - where the cluster pointer lives
+	//		a_clusterSize - how big a cluster to put there
+	//		a_hooked	  - if not NULL, set to whether this call
+	//						filled the slot
+	//
+	//	RETURNS:
+	//		the cluster in the slot
+	//		NULL if the slot was empty and no cluster could be had
+	//
+	//	NOTE:
+	//		If two threads fill the slot at once, the loser releases its
+	//		cluster and both use the winner's.
+	//
+	//************************************************************************
+	caddr_t			hookCluster( caddr_t* a_slot, size_t a_clusterSize,
+								 bool* a_hooked )
+	{
+		if( a_hooked != NULL )
+		{
+			*a_hooked = false;
+		}
+		caddr_t		cluster = __atomic_load_n( a_slot, __ATOMIC_ACQUIRE );
+		if( cluster != NULL )
+		{
+			return cluster;
+		}
+
+		caddr_t		newCluster = Cluster_request( a_clusterSize );
+		if( newCluster == NULL )
+		{
+			return NULL;
+		}
+		if( __atomic_compare_exchange_n( a_slot, &cluster, newCluster, false,
+										 __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE ) )
+		{
+			if( a_hooked != NULL )
+			{
+				*a_hooked = true;
+			}
+			return newCluster;
+		}
+		Cluster_release( newCluster, a_clusterSize );
+		return cluster;
+	}
+
+	//************************************************************************
+	//
+	//	bumpCount() - add to a sizing count
+	//
+	//	RETURNS:
+	//		the new count
+	//
+	//************************************************************************
+	long			bumpCount( long* a_count, long a_delta )
+	{
+		long		count = __atomic_load_n( a_count, __ATOMIC_RELAXED ) +
+							a_delta;
+		__atomic_store_n( a_count, count, __ATOMIC_RELAXED );
+		return count;
+	}
+
+	//************************************************************************
+	//
+	//	clampClusterSize() - keep a cluster size within what a block
+	//						 size can use
+	//
+	//	ARGS:
+	//		a_size		  - the power of two of the block
+	//		a_clusterSize - the size wanted, a power of two
+	//
+	//	RETURNS:
+	//		a power of two cluster size between CLUSTER_MIN_SIZE and
+	//		CLUSTER_MAX_SIZE, holding as near the wanted number of
+	//		blocks as the block count bounds allow
+	//
+	//************************************************************************
+	long			clampClusterSize( size_t a_size, long a_clusterSize )
+	{
+		if( a_clusterSize > MAX_BLOCKS_PER_CLUSTER << a_size )
+		{
+			a_clusterSize = MAX_BLOCKS_PER_CLUSTER << a_size;
+		}
+		if( a_clusterSize < MIN_BLOCKS_PER_CLUSTER << a_size )
+		{
+			a_clusterSize = MIN_BLOCKS_PER_CLUSTER << a_size;
+		}
+		if( a_clusterSize < (long)CLUSTER_MIN_SIZE )
+		{
+			a_clusterSize = CLUSTER_MIN_SIZE;
+		}
+		if( a_clusterSize > (long)CLUSTER_MAX_SIZE )
+		{
+			a_clusterSize = CLUSTER_MAX_SIZE;
+		}
+		return a_clusterSize;
+	}
+
+	//************************************************************************
+	//
+	//	classClusterSize() - the cluster size the next node for a block
+	//						 size gets
+	//
+	//	ARGS:
+	//		a_size - the power of two of the block
+	//
+	//************************************************************************
+	long			classClusterSize( size_t a_size )
+	{
+		long		clusterSize =
+						__atomic_load_n( &s_classPolicy[a_size].d_clusterSize,
+										 __ATOMIC_RELAXED );
+		if( clusterSize == 0 )
+		{
+			clusterSize = clampClusterSize( a_size, s_clusterSize );
+		}
+		return clusterSize;
+	}
+
+	//************************************************************************
+	//
+	//	adaptClusterSize() - size future clusters of a block size by how
+	//						 the current ones are used
+	//
+	//	ARGS:
+	//		a_size - the power of two of the block
+	//
+	//	NOTE:
+	//		Called each time a node of this size hooks a cluster. Every
+	//		ADAPT_HOOKS hooks, a block size whose live blocks never
+	//		filled an eighth of one cluster is sparse and gets clusters
+	//		half the size. Otherwise, one that handed out fewer than
+	//		CHURN_ALLOCATIONS blocks per hook is churning, mapping and
+	//		giving back clusters for a handful of blocks each, and gets
+	//		clusters twice the size. Nodes keep the size they were
+	//		created with.
+	//
+	//************************************************************************
+	void			adaptClusterSize( size_t a_size )
+	{
+		classPolicy*	policy = &s_classPolicy[a_size];
+		long		hooks = bumpCount( &policy->d_hooks, 1 );
+		if( hooks < ADAPT_HOOKS ||
+			__atomic_load_n( &policy->d_pinned, __ATOMIC_RELAXED ) )
+		{
+			return;
+		}
+
+		long		clusterSize = classClusterSize( a_size );
+		long		blocksPerCluster = clusterSize >> a_size;
+		long		allocations =
+						__atomic_load_n( &policy->d_allocations,
+										 __ATOMIC_RELAXED );
+		long		peakLive =
+						__atomic_load_n( &policy->d_peakLive, __ATOMIC_RELAXED );
+		__atomic_store_n( &policy->d_hooks, 0L, __ATOMIC_RELAXED );
+		__atomic_store_n( &policy->d_allocations, 0L, __ATOMIC_RELAXED );
+		__atomic_store_n( &policy->d_peakLive,
+						  __atomic_load_n( &policy->d_live, __ATOMIC_RELAXED ),
+						  __ATOMIC_RELAXED );
+
+		if( peakLive * 8 < blocksPerCluster )
+		{
+			clusterSize = clampClusterSize( a_size, clusterSize >> 1 );
+		}
+		else if( allocations < hooks * CHURN_ALLOCATIONS )
+		{
+			clusterSize = clampClusterSize( a_size, clusterSize << 1 );
+		}
+		__atomic_store_n( &policy->d_clusterSize, clusterSize,
+						  __ATOMIC_RELAXED );
+	}
+
+	// A slot tracking policy keeps track of which slots of a node's
+	// cluster are free, with static members that are handed the node:
+	//
+	//	init()		- set up a new node with a number of slots
+	//	destroy()	- give back what init() took
+	//	full()		- a quick look at whether every slot is taken
+	//	claim()		- take a free slot, ULONG_MAX if there is none
+	//	claimMany()	- take up to a number of free slots at once
+	//	release()	- give a slot back
+	//	reset()		- make every slot free, while the node is closed
+	//				  and has no cluster
+	//
+	// The node machinery below is a template over the policy, and the
+	// block size picks the policy at compile time, see freeListSize().
+	// Slots are only claimed while the node holds a cluster.
+
+	// One bit per slot in a MemBitmap. Compact, and the lowest free slot
+	// is handed out first, which keeps live blocks packed together.
+	struct bitmapSlots
+	{
+		static bool				init( MemNode* a_node,
+									  unsigned long a_slots )
+		{
+			a_node->d_bitMap = MemBitmap_create( a_slots );
+			return a_node->d_bitMap != NULL;
+		}
+
+		static void				destroy( MemNode* a_node )
+		{
+			MemBitmap_destroy( a_node->d_bitMap );
+			a_node->d_bitMap = NULL;
+		}
+
+		static bool				full( MemNode* a_node )
+		{
+			return __atomic_load_n( &a_node->d_bitMap->d_filled,
+									__ATOMIC_RELAXED ) == 1;
+		}
+
+		static unsigned long	claim( MemNode* a_node )
+		{
+			return MemBitmap_claim( a_node->d_bitMap );
+		}
+
+		static unsigned long	claimMany( MemNode* a_node,
+										   unsigned long a_howMany,
+										   unsigned long* a_slots )
+		{
+			return MemBitmap_claimBlocks( a_node->d_bitMap, a_howMany,
+										  a_slots );
+		}
+
+		static void				release( MemNode* a_node,
+										 unsigned long a_slot )
+		{
+			MemBitmap_unmark( a_node->d_bitMap, a_slot );
+		}
+
+		static void				reset( MemNode* a_node )
+		{
+			// every bit is clear, so the filled hint must be too
+			__atomic_store_n( &a_node->d_bitMap->d_filled, 0UL,
+							  __ATOMIC_RELAXED );
+		}
+	};
+
+	// A LIFO of released slots threaded through the slots themselves,
+	// in front of slots never handed out, which are carved off in order.
+	// The most recently freed block, likely still in cache, goes out
+	// next and claiming never scans. The head holds the slot plus one
+	// in its low half, so 0 is an empty list, and a tag bumped on every
+	// change in its high half. Links are slot numbers, not addresses.
+	const unsigned long		FREE_SLOT_MASK = 0xffffffffUL;
+	const unsigned long		FREE_SLOT_TAG = FREE_SLOT_MASK + 1;
+
+	struct freeListSlots
+	{
+		static unsigned long	slots( MemNode* a_node )
+		{
+			return ( a_node->d_clusterSize - a_node->d_offset ) >>
+				   a_node->d_size;
+		}
+
+		static unsigned long*	link( MemNode* a_node, unsigned long a_slot )
+		{
+			return (unsigned long*)( a_node->d_cluster + a_node->d_offset +
+									 ( a_slot << a_node->d_size ) );
+		}
+
+		static bool				init( MemNode* a_node, unsigned long )
+		{
+			a_node->d_bitMap = NULL;
+			a_node->d_freeSlots = 0;
+			a_node->d_carved = 0;
+			return true;
+		}
+
+		static void				destroy( MemNode* )
+		{
+		}
+
+		static bool				full( MemNode* a_node )
+		{
+			return ( __atomic_load_n( &a_node->d_freeSlots,
+									  __ATOMIC_RELAXED ) &
+					 FREE_SLOT_MASK ) == 0 &&
+				   __atomic_load_n( &a_node->d_carved,
+									__ATOMIC_RELAXED ) >= slots( a_node );
+		}
+
+		// The link is read from a slot that another thread may just have
+		// claimed and written over. The cluster cannot go while we hold
+		// a reference on the node, so the read is safe, and the tag
+		// makes the exchange fail.
+		static unsigned long	claim( MemNode* a_node )
+		{
+			unsigned long	head = __atomic_load_n( &a_node->d_freeSlots,
+													__ATOMIC_ACQUIRE );
+			while( ( head & FREE_SLOT_MASK ) != 0 )
+			{
+				unsigned long	slot = ( head & FREE_SLOT_MASK ) - 1;
+				unsigned long	next = *(volatile unsigned long*)
+												link( a_node, slot );
+				if( __atomic_compare_exchange_n( &a_node->d_freeSlots, &head,
+									next | ( ( head + FREE_SLOT_TAG ) &
+											 ~FREE_SLOT_MASK ),
+									false, __ATOMIC_ACQ_REL,
+									__ATOMIC_ACQUIRE ) )
+				{
+					return slot;
+				}
+			}
+
+			// Nothing released, carve a slot. Carving past the end only
+			// bumps the count, which is reset with the rest.
+			unsigned long	carved = __atomic_fetch_add( &a_node->d_carved, 1,
+														 __ATOMIC_RELAXED );
+			if( carved < slots( a_node ) )
+			{
+				return carved;
+			}
+			return ULONG_MAX;
+		}
+
+		static unsigned long	claimMany( MemNode* a_node,
+										   unsigned long a_howMany,
+										   unsigned long* a_slots )
+		{
+			unsigned long	claimed = 0;
+			while( claimed < a_howMany )
+			{
+				unsigned long	slot = claim( a_node );
+				if( slot == ULONG_MAX )
+				{
+					break;
+				}
+				a_slots[claimed++] = slot;
+			}
+			return claimed;
+		}
+
+		// The release keeps our writes to the block from landing after
+		// the next owner's.
+		static void				release( MemNode* a_node,
+										 unsigned long a_slot )
+		{
+			unsigned long*	slotLink = link( a_node, a_slot );
+			unsigned long	head = __atomic_load_n( &a_node->d_freeSlots,
+													__ATOMIC_RELAXED );
+			do
+			{
+				*slotLink = head & FREE_SLOT_MASK;
+			}
+			while( !__atomic_compare_exchange_n( &a_node->d_freeSlots, &head,
+									( a_slot + 1 ) |
+									( ( head + FREE_SLOT_TAG ) &
+									  ~FREE_SLOT_MASK ),
+									false, __ATOMIC_RELEASE,
+									__ATOMIC_RELAXED ) );
+		}
+
+		static void				reset( MemNode* a_node )
+		{
+			unsigned long	head = __atomic_load_n( &a_node->d_freeSlots,
+													__ATOMIC_RELAXED );
+			__atomic_store_n( &a_node->d_freeSlots,
+							  ( head + FREE_SLOT_TAG ) & ~FREE_SLOT_MASK,
+							  __ATOMIC_RELAXED );
+			__atomic_store_n( &a_node->d_carved, 0UL, __ATOMIC_RELAXED );
+		}
+	};
+
+	//************************************************************************
+	//
+	//	freeListSize() - whether a block size tracks its slots with a
+	//					 free list rather than a bitmap
+	//
+	//************************************************************************
+	constexpr bool	freeListSize( size_t a_size )
+	{
+		return a_size < sizeof(unsigned long) * CHAR_BIT &&
+			   ( ( MEM_FREE_LIST_SIZES ) >> a_size ) & 1;
+	}
+
+	//************************************************************************
+	//
+	//	dropCount() - give back a reference taken on d_count
+	//
+	//	ARGS:
+	//		a_node - the node to drop the reference on
+	//
+	//	NOTE:
+	//		d_count counts used blocks plus threads that are busy claiming
+	//		one. Whoever drops it to zero tries to close the node. Closing
+	//		only works while nobody else holds a reference, and a claimer
+	//		that finds the node closed backs out and looks elsewhere. The
+	//		cluster is given up while closed. Reopening adds NODE_CLOSED
+	//		back instead of storing 0, so that claimers who backed in and
+	//		out meanwhile are still counted right. Pinned nodes are never
+	//		closed.
+	//
+	//************************************************************************
+	template< class SLOTS >
+	void			dropCount( MemNode* a_node )
+	{
+		if( __atomic_sub_fetch( &a_node->d_count, 1, __ATOMIC_ACQ_REL ) != 0 ||
+			a_node->d_pinned )
+		{
+			return;
+		}
+
+		long		expected = 0;
+		if( !__atomic_compare_exchange_n( &a_node->d_count, &expected,
+										  NODE_CLOSED, false,
+										  __ATOMIC_ACQ_REL,
+										  __ATOMIC_RELAXED ) )
+		{
+			// somebody started claiming, the node stays open
+			return;
+		}
+
+		caddr_t		cluster = __atomic_exchange_n( &a_node->d_cluster,
+												   (caddr_t)NULL,
+												   __ATOMIC_ACQ_REL );
+		if( cluster != NULL )
+		{
+			Cluster_release( cluster, a_node->d_clusterSize );
+			s_latencyPath |= MEM_LATENCY_CLUSTER_MOVED;
+
+			classPolicy*	policy = &s_classPolicy[a_node->d_size];
+			__atomic_fetch_add( &policy->d_clustersReleased, 1,
+								__ATOMIC_RELAXED );
+			if( __atomic_exchange_n( &a_node->d_draining, false,
+									 __ATOMIC_RELAXED ) )
+			{
+				__atomic_fetch_add( &policy->d_clustersDrained, 1,
+									__ATOMIC_RELAXED );
+			}
+			__atomic_fetch_sub( &policy->d_clusterBytes,
+								a_node->d_clusterSize, __ATOMIC_RELAXED );
+		}
+		// every slot is free, and the cluster they were in is gone
+		SLOTS::reset( a_node );
+		forgetPurged( a_node );
+		__atomic_fetch_sub( &a_node->d_count, NODE_CLOSED, __ATOMIC_RELEASE );
+	}
+
+	//************************************************************************
+	//
+	//	pageSize() - the size of the OS pages
+	//
+	//************************************************************************
+	long			pageSize()
+	{
+		long		size = __atomic_load_n( &s_pageSize, __ATOMIC_RELAXED );
+		if( size == 0 )
+		{
+			size = getpagesize();
+			__atomic_store_n( &s_pageSize, size, __ATOMIC_RELAXED );
+		}
+		return size;
+	}
+
+	//************************************************************************
+	//
+	//	refault() - clear the purged bits of the pages under a block
+	//				just handed out
+	//
+	//	ARGS:
+	//		a_node - the node, with the block's slot claimed
+	//		a_slot - the slot
+	//
+	//	NOTE:
+	//		The pages read back as zeroes and the OS faults them in
+	//		again as they are touched, so there is nothing to do but
+	//		count them. Two blocks can share a page, and only the one
+	//		that clears its bit counts it.
+	//
+	//************************************************************************
+	void			refault( MemNode* a_node, unsigned long a_slot )
+	{
+		unsigned long	start = a_node->d_offset + ( a_slot << a_node->d_size );
+		unsigned long	end = start + ( 1UL << a_node->d_size );
+		unsigned long	size = pageSize();
+		long			pages = 0;
+		for( unsigned long page = start / size; page * size < end; page++ )
+		{
+			if( MemBitmap_testAndUnmark( a_node->d_purged, page ) )
+			{
+				pages++;
+			}
+		}
+		if( pages == 0 )
+		{
+			return;
+		}
+		__atomic_fetch_sub( &a_node->d_purgedPages, pages, __ATOMIC_RELAXED );
+
+		classPolicy*	policy = &s_classPolicy[a_node->d_size];
+		__atomic_fetch_sub( &policy->d_purgedBytes, pages * size,
+							__ATOMIC_RELAXED );
+		__atomic_fetch_add( &policy->d_pagesRefaulted, pages,
+							__ATOMIC_RELAXED );
+	}
+
+	//************************************************************************
+	//
+	//	forgetPurged() - clear every purged bit of a node
+	//
+	//	ARGS:
+	//		a_node - the node, closed or never linked
+	//
+	//************************************************************************
+	void			forgetPurged( MemNode* a_node )
+	{
+		long		pages = __atomic_exchange_n( &a_node->d_purgedPages, 0L,
+												 __ATOMIC_RELAXED );
+		if( pages == 0 )
+		{
+			return;
+		}
+		for( long page = 0; page < a_node->d_clusterSize / pageSize(); page++ )
+		{
+			MemBitmap_unmark( a_node->d_purged, page );
+		}
+		__atomic_fetch_sub( &s_classPolicy[a_node->d_size].d_purgedBytes,
+							pages * pageSize(), __ATOMIC_RELAXED );
+	}
+
+	//************************************************************************
+	//
+	//	nodeCluster() - get a node's cluster, hooking one if it has none
+	//
+	//	ARGS:
+	//		a_node - the node, with a reference held on d_count
+	//
+	//	RETURNS:
+	//		the cluster
+	//		NULL if one was needed and could not be had
+	//
+	//************************************************************************
+	caddr_t			nodeCluster( MemNode* a_node )
+	{
+		caddr_t		cluster = __atomic_load_n( &a_node->d_cluster,
+											   __ATOMIC_ACQUIRE );
+		if( cluster != NULL )
+		{
+			return cluster;
+		}
+
+		bool		hooked;
+		cluster = hookCluster( &a_node->d_cluster, a_node->d_clusterSize,
+							   &hooked );
+		if( cluster == NULL )
+		{
+			return NULL;
+		}
+		if( hooked )
+		{
+			classPolicy*	policy = &s_classPolicy[a_node->d_size];
+			s_latencyPath |= MEM_LATENCY_CLUSTER_MOVED;
+			__atomic_fetch_add( &policy->d_clustersHooked, 1,
+								__ATOMIC_RELAXED );
+			__atomic_fetch_add( &policy->d_clusterBytes,
+								a_node->d_clusterSize, __ATOMIC_RELAXED );
+		}
+		adaptClusterSize( a_node->d_size );
+		return cluster;
+	}
+
+	//************************************************************************
+	//
+	//	countAllocations() - count blocks handed out for sizing and stats
+	//
+	//	ARGS:
+	//		a_size	 - the power of two of the block
+	//		a_blocks - how many were handed out
+	//
+	//************************************************************************
+	void			countAllocations( size_t a_size, long a_blocks )
+	{
+		classPolicy*	policy = &s_classPolicy[a_size];
+		bumpCount( &policy->d_allocations, a_blocks );
+		bumpCount( &policy->d_totalAllocations, a_blocks );
+		long		live = bumpCount( &policy->d_live, a_blocks );
+		if( live > __atomic_load_n( &policy->d_peakLive, __ATOMIC_RELAXED ) )
+		{
+			__atomic_store_n( &policy->d_peakLive, live, __ATOMIC_RELAXED );
+		}
+	}
+
+	//************************************************************************
+	//
+	//	occupancy() - which bucket a node falls in by how full it is
+	//
+	//	ARGS:
+	//		a_node - the node, which may be in use by other threads
+	//
+	//	RETURNS:
+	//		OCCUPANCY_BUCKETS if the node is full
+	//		0 if it is empty or closed, likely with no cluster
+	//		1 to OCCUPANCY_BUCKETS - 1 if partly used, fuller higher
+	//
+	//************************************************************************
+	long			occupancy( MemNode* a_node )
+	{
+		if( freeListSize( a_node->d_size ) ? freeListSlots::full( a_node ) :
+											 bitmapSlots::full( a_node ) )
+		{
+			return OCCUPANCY_BUCKETS;
+		}
+		long		count = __atomic_load_n( &a_node->d_count,
+											 __ATOMIC_RELAXED );
+		if( count <= 0 )
+		{
+			return 0;
+		}
+		long		slots = ( a_node->d_clusterSize - a_node->d_offset ) >>
+							a_node->d_size;
+		long		bucket = 1 + count * ( OCCUPANCY_BUCKETS - 1 ) / slots;
+		if( bucket > OCCUPANCY_BUCKETS - 1 )
+		{
+			bucket = OCCUPANCY_BUCKETS - 1;
+		}
+		return bucket;
+	}
+
+	//************************************************************************
+	//
+	//	::findBlock() - MemNode_findBlock() for one slot tracking policy
+	//
+	//************************************************************************
+	template< class SLOTS >
+	caddr_t			findBlock( MemNode* a_whereToLook )
+	{
+		// don't bother with a node that is full
+		if( SLOTS::full( a_whereToLook ) )
+		{
+			return NULL;
+		}
+
+		// Up the count first, which keeps the cluster from going away.
+		// If the node is closed, somebody is giving its cluster up.
+		if( __atomic_fetch_add( &a_whereToLook->d_count, 1,
+								__ATOMIC_ACQ_REL ) < 0 )
+		{
+			__atomic_fetch_sub( &a_whereToLook->d_count, 1, __ATOMIC_RELEASE );
+			return NULL;
+		}
+
+		// If we do not have a cluster yet, create one. A free list is
+		// threaded through it, so it must be there before claiming.
+		caddr_t			cluster = nodeCluster( a_whereToLook );
+		if( cluster == NULL )
+		{
+			dropCount< SLOTS >( a_whereToLook );
+			return NULL;
+		}
+
+		// get the position of the free block, marking the slot as
+		// occupied
+		unsigned long	offset = SLOTS::claim( a_whereToLook );
+
+		// if a block cannot be found in our node, return NULL.
+		// caller can go look elsewhere
+		if( offset == ULONG_MAX )
+		{
+			dropCount< SLOTS >( a_whereToLook );
+			return NULL;
+		}
+		countAllocations( a_whereToLook->d_size, 1 );
+
+		// The slot was claimed after any purge of its pages let go of
+		// it, so a count of 0 means none of them are purged
+		if( __atomic_load_n( &a_whereToLook->d_purgedPages,
+							 __ATOMIC_RELAXED ) != 0 )
+		{
+			refault( a_whereToLook, offset );
+		}
+
+		// calculate its offset in the cluster, past the color offset
+		offset <<= a_whereToLook->d_size;
+		offset += a_whereToLook->d_offset;
+
+		// add the offset to the start of the cluster to get the address
+		// of the block
+		return cluster + offset ;
+	}
+
+	//************************************************************************
+	//
+	//	::findBlocks() - MemNode_findBlocks() for one slot tracking policy
+	//
+	//************************************************************************
+	template< class SLOTS >
+	long			findBlocks( MemNode* a_whereToLook, long a_howMany,
+								caddr_t* a_blocks )
+	{
+		// don't bother with a node that is full
+		if( a_howMany <= 0 || SLOTS::full( a_whereToLook ) )
+		{
+			return 0;
+		}
+
+		if( __atomic_fetch_add( &a_whereToLook->d_count, 1,
+								__ATOMIC_ACQ_REL ) < 0 )
+		{
+			__atomic_fetch_sub( &a_whereToLook->d_count, 1, __ATOMIC_RELEASE );
+			return 0;
+		}
+
+		caddr_t			cluster = nodeCluster( a_whereToLook );
+		if( cluster == NULL )
+		{
+			dropCount< SLOTS >( a_whereToLook );
+			return 0;
+		}
+
+		// the slot numbers are put where their addresses will go
+		unsigned long*	offsets = (unsigned long*)a_blocks;
+		long			found = SLOTS::claimMany( a_whereToLook, a_howMany,
+												  offsets );
+		if( found == 0 )
+		{
+			dropCount< SLOTS >( a_whereToLook );
+			return 0;
+		}
+		__atomic_fetch_add( &a_whereToLook->d_count, found - 1,
+							__ATOMIC_RELAXED );
+		countAllocations( a_whereToLook->d_size, found );
+
+		bool			purged = __atomic_load_n(
+									&a_whereToLook->d_purgedPages,
+									__ATOMIC_RELAXED ) != 0;
+		for( long index = 0; index < found; index++ )
+		{
+			if( purged )
+			{
+				refault( a_whereToLook, offsets[index] );
+			}
+			a_blocks[index] = cluster + a_whereToLook->d_offset +
+							  ( offsets[index] << a_whereToLook->d_size );
+		}
+		return found;
+	}
+
+	//************************************************************************
+	//
+	//	::releaseBlock() - MemNode_releaseBlock() for one slot tracking
+	//					   policy
+	//
+	//************************************************************************
+	template< class SLOTS >
+	bool			releaseBlock( MemNode* a_whereToLook,
+								  caddr_t a_blockToRelease )
+	{
+		bool			wasFull = SLOTS::full( a_whereToLook );
+
+		// calculate the offset in the cluster of the block, past the
+		// color offset
+		unsigned long	offset = a_blockToRelease - a_whereToLook->d_cluster;
+		offset -= a_whereToLook->d_offset;
+
+		// divide by the block size to get the index of the slot
+		offset >>= (unsigned long)a_whereToLook->d_size;
+
+		// and free that slot.
+		SLOTS::release( a_whereToLook, offset );
+		bumpCount( &s_classPolicy[a_whereToLook->d_size].d_live, -1 );
+
+		// Reduce the count, releasing the cluster if it was the last
+		dropCount< SLOTS >( a_whereToLook );
+
+		// That's it! We need not touch the actual memory.
+		return wasFull;
+	}
+}
+
+
+
+//****************************************************************************
+//
+//	MemNode_create - find and initialize a new node
+//
+//	ARGS:
+//		a_size - the power of two of the block
+//
+//	RETURNS:
+//		pointer to a new MemNode
+//		NULL on error.
+//
+//	NOTE:
+//		This function causes a new BittMap to be created and
+//		a new Cluster to be requested. The intention is that
+//		all allocations in this node be taken from this cluster
+//		and managed using this bitmap
+//
+//****************************************************************************
+MemNode*		MemNode_create( size_t a_size )
+{
+	// Needed outside of the loops
+	MemNode*	  newNodePtr = NULL;
+	
+	// find the first available node in the array
+	// Iterate over each node handle in the s_masterNodeTable
+	for( MemNode** newNodeHandle = s_masterNodeTable;
+		 newNodeHandle < s_masterNodeTable +
+						 sizeof(s_masterNodeTable) / sizeof(MemNode*) &&
+		 newNodePtr == NULL;
+		 newNodeHandle++ )
+	{
+		// See if we need to make a new block to hold nodes
+		MemNode*	nodeBlock = (MemNode*)hookCluster( (caddr_t*)newNodeHandle,
+														   s_clusterSize );
+		if( nodeBlock == NULL )
+		{
+			// If we cannot get a cluster to hold nodes we're stuck.
+			return NULL;
+		}
+		// We have a cluster to look in, now search it for a free node.
+		// The cluster need not be a whole number of nodes, so only the
+		// nodes that fit in it whole are looked at.
+		for( MemNode* candidate = nodeBlock;
+			 candidate < nodeBlock + s_clusterSize / sizeof(MemNode);
+			 candidate++ )
+		{
+			// Take the node by swapping in our size. Whoever gets
+			// there first keeps it.
+			long	expected = 0;
+			if( __atomic_load_n( &candidate->d_size, __ATOMIC_RELAXED ) == 0 &&
+				__atomic_compare_exchange_n( &candidate->d_size, &expected,
+											 (long)a_size, false,
+											 __ATOMIC_ACQ_REL,
+											 __ATOMIC_RELAXED ) )
+			{
+				// Ha! we've found our node!
+				newNodePtr = candidate;
+				break;
+			}
+		}
+	}
+	if( newNodePtr == NULL )
+	{
+		// the node table is full
+		return NULL;
+	}
+
+	// Pick a color for the blocks. Skipping the offset costs the blocks
+	// that no longer fit at the end of the cluster, so only color
+	// sizes where that stays within a sixteenth of the cluster.
+	long		clusterSize = classClusterSize( a_size );
+	long		blockSize = 1L << a_size;
+	long		colorSpan = clusterSize >> 4;
+	long		offset = 0;
+	if( blockSize <= colorSpan )
+	{
+		offset = Cluster_color( __atomic_fetch_add( &s_colorSequence[a_size],
+													1, __ATOMIC_RELAXED ),
+								colorSpan );
+	}
+
+	// Now that we have a node, initialize it
+	newNodePtr->d_offset = offset;
+	newNodePtr->d_clusterSize = clusterSize;
+	unsigned long	slots = ( clusterSize - offset ) >> a_size;
+	if( freeListSize( a_size ) ? !freeListSlots::init( newNodePtr, slots ) :
+								 !bitmapSlots::init( newNodePtr, slots ) )
+	{
+		// give the node back
+		__atomic_store_n( &newNodePtr->d_size, 0L, __ATOMIC_RELEASE );
+		return NULL;
+	}
+	//newNodePtr->d_cluster = Cluster_request();
+	newNodePtr->d_cluster = NULL;
+	newNodePtr->d_count = 0L;
+	newNodePtr->d_draining = false;
+	newNodePtr->d_pinned = false;
+	newNodePtr->d_chain = 0;
+	newNodePtr->d_purged = NULL;
+	newNodePtr->d_purgedPages = 0;
+	if( a_size >= MEM_NODE_PURGE_SIZE && !freeListSize( a_size ) &&
+		clusterSize >= pageSize() )
+	{
+		// without a map the node simply never purges
+		newNodePtr->d_purged = MemBitmap_create( clusterSize / pageSize() );
+	}
+	newNodePtr->d_previousNode = newNodePtr->d_nextNode = NULL;
+	__atomic_fetch_add( &s_classPolicy[a_size].d_nodes, 1, __ATOMIC_RELAXED );
+
+	// Return the new node to the caller. Nobody else can see it
+	// until the caller links it into a list.
+	return newNodePtr;
+}
+
+//****************************************************************************
+//
+//	MemNode_destroy - free the resources used by this node
+//
+//	ARGS:
+//		a_nodeToDestroy - the node to destroy
+//
+//	NOTE:
+//		This function causes the Cluster to be released and the
+//		BitMap to be freed.
+//
+//****************************************************************************
+void			MemNode_destroy( MemNode* a_nodeToDestroy )
+{
+	// free our bitmap, if we have one
+	if( freeListSize( a_nodeToDestroy->d_size ) )
+	{
+		freeListSlots::destroy( a_nodeToDestroy );
+	}
+	else
+	{
+		bitmapSlots::destroy( a_nodeToDestroy );
+	}
+
+	// and the map of purged pages
+	if( a_nodeToDestroy->d_purged != NULL )
+	{
+		forgetPurged( a_nodeToDestroy );
+		MemBitmap_destroy( a_nodeToDestroy->d_purged );
+		a_nodeToDestroy->d_purged = NULL;
+	}
+
+	// release our cluster, if one was ever hooked
+	if( a_nodeToDestroy->d_cluster != NULL )
+	{
+		Cluster_release( a_nodeToDestroy->d_cluster,
+						 a_nodeToDestroy->d_clusterSize );
+		a_nodeToDestroy->d_cluster = NULL;
+	}
+
+	// another hint that this is not used
+	__atomic_store_n( &a_nodeToDestroy->d_size, 0L, __ATOMIC_RELEASE );
+
+	// free further down the chain
+	// NoteToSelf: find non-recursive technique
+	if( a_nodeToDestroy->d_nextNode != NULL )
+	{
+		MemNode_destroy( a_nodeToDestroy->d_nextNode );
+		a_nodeToDestroy->d_nextNode = NULL;
+	}
+}
+
+//****************************************************************************
+//
+//	MemNode_findBlock - find a free block in the Cluster managed by
+//						this block
+//
+//	ARGS:
+//		a_whereToLook - the node where we want to find the block
+//
+//	RETURNS:
+//		pointer to the block.
+//		NULL if a block could not be found
+//
+//****************************************************************************
+caddr_t			MemNode_findBlock( MemNode* a_whereToLook )
+{
+	if( freeListSize( a_whereToLook->d_size ) )
+	{
+		return ::findBlock< freeListSlots >( a_whereToLook );
+	}
+	return ::findBlock< bitmapSlots >( a_whereToLook );
+}
+
+//****************************************************************************
+//
+//	MemNode_select - pick the node of a chain to allocate from next
+//
+//	ARGS:
+//		a_chain - the first node of the chain
+//
+//	RETURNS:
+//		the fullest node that still has room
+//		NULL if every node is full
+//
+//	NOTE:
+//		Blocks given out from the fullest nodes leave the sparse ones
+//		alone, so their blocks are all released in time and they give
+//		their clusters back. Handing out from the first node with room
+//		spreads blocks over every partly used cluster instead, and none
+//		of them ever empties.
+//
+//		Nodes are never taken off a chain, so rather than keep lists
+//		per bucket, which would move a node on every allocation, the
+//		chain is walked and each node bucketed by its d_count as it is
+//		passed. The walk stops at the first node in the top bucket
+//		below full. Partly used nodes passed over on the way are marked
+//		as draining, for MemNode_stats(). Empty nodes are only picked
+//		if no node is partly used, and then one still holding its
+//		cluster, like a pinned one, over one that would hook a new one.
+//		The counts move under us, so the pick is only a good guess.
+//
+//****************************************************************************
+MemNode*		MemNode_select( MemNode* a_chain )
+{
+	MemNode*	best = NULL;
+	long		bestBucket = -1;
+	for( MemNode* node = a_chain; node != NULL;
+		 node = __atomic_load_n( &node->d_nextNode, __ATOMIC_ACQUIRE ) )
+	{
+		long	bucket = occupancy( node );
+		if( bucket == OCCUPANCY_BUCKETS )
+		{
+			continue;
+		}
+		if( bucket == 0 && bestBucket == 0 &&
+			__atomic_load_n( &best->d_cluster, __ATOMIC_RELAXED ) == NULL &&
+			__atomic_load_n( &node->d_cluster, __ATOMIC_RELAXED ) != NULL )
+		{
+			// among empty nodes, one that kept its cluster needs no
+			// new one hooked
+			best = node;
+			continue;
+		}
+		if( bucket <= bestBucket )
+		{
+			// passed over for a fuller node
+			if( bucket > 0 )
+			{
+				__atomic_store_n( &node->d_draining, true, __ATOMIC_RELAXED );
+			}
+			continue;
+		}
+		if( bestBucket > 0 )
+		{
+			__atomic_store_n( &best->d_draining, true, __ATOMIC_RELAXED );
+		}
+		best = node;
+		bestBucket = bucket;
+		if( bucket == OCCUPANCY_BUCKETS - 1 )
+		{
+			break;
+		}
+	}
+	if( best != NULL )
+	{
+		__atomic_store_n( &best->d_draining, false, __ATOMIC_RELAXED );
+	}
+	return best;
+}
 
-namespace
+//****************************************************************************
+//
+//	MemNode_findBlocks - find a number of free blocks in the Cluster
+//						 managed by this node
+//
+//	ARGS:
+//		a_whereToLook - the node where we want to find the blocks
+//		a_howMany	  - the most blocks wanted
+//		a_blocks	  - filled in with the blocks
+//
+//	RETURNS:
+//		how many blocks were found, 0 if the node is full
+//
+//	NOTE:
+//		The reference taken while claiming becomes the first block's,
+//		so d_count is touched twice however many are found.
+//
+//****************************************************************************
+long			MemNode_findBlocks( MemNode* a_whereToLook, long a_howMany,
+									caddr_t* a_blocks )
 {
-	// file local function to initialize necessary data structures
-	void			initializeMasterNodeTable();
+	if( freeListSize( a_whereToLook->d_size ) )
+	{
+		return ::findBlocks< freeListSlots >( a_whereToLook, a_howMany,
+											  a_blocks );
+	}
+	return ::findBlocks< bitmapSlots >( a_whereToLook, a_howMany, a_blocks );
+}
 
-	// file local data structure to manage nodes
-	MemNode**		s_masterNodeTable = NULL;
+//****************************************************************************
+//
+//	MemNode_releaseBlock - release a block in the Cluster managed by
+//						   this block
+//
+//	ARGS:
+//		a_whereToLook - the node where we want to find the block
+//		a_blockToRelease - address of the block to release
+//
+//	RETURNS:
+//		true if the node was full before, so it is about as full as a
+//		node with room can be
+//
+//	NOTE:
+//		Note, this routine just manipulates the bitmap or free list to
+//		indicate the memory is free.
+//
+//****************************************************************************
+bool			MemNode_releaseBlock( MemNode* a_whereToLook,
+									  caddr_t a_blockToRelease )
+{
+	if( freeListSize( a_whereToLook->d_size ) )
+	{
+		return ::releaseBlock< freeListSlots >( a_whereToLook,
+												a_blockToRelease );
+	}
+	return ::releaseBlock< bitmapSlots >( a_whereToLook, a_blockToRelease );
 }
 
+//****************************************************************************
+//
+//	MemNode_setClusterSize - fix the cluster size for a block size
+//
+//	ARGS:
+//		a_size		  - the power of two of the block
+//		a_clusterSize - a power of two from CLUSTER_MIN_SIZE to
+//						CLUSTER_MAX_SIZE, or 0 to go back to adapting
+//
+//	RETURNS:
+//		true if the size was taken
+//		false if it is out of range or too small for the block
+//
+//	NOTE:
+//		Only nodes created from now on get the new size. The size is
+//		taken as given, outside the block count bounds adapting keeps to.
+//
+//****************************************************************************
+bool			MemNode_setClusterSize( size_t a_size, size_t a_clusterSize )
+{
+	if( a_size >= sizeof(s_classPolicy) / sizeof(classPolicy) )
+	{
+		return false;
+	}
+	classPolicy*	policy = &s_classPolicy[a_size];
+	if( a_clusterSize == 0 )
+	{
+		__atomic_store_n( &policy->d_pinned, false, __ATOMIC_RELAXED );
+		__atomic_store_n( &policy->d_clusterSize, 0L, __ATOMIC_RELAXED );
+		return true;
+	}
+	if( a_clusterSize < CLUSTER_MIN_SIZE || a_clusterSize > CLUSTER_MAX_SIZE ||
+		( a_clusterSize & ( a_clusterSize - 1 ) ) != 0 ||
+		a_clusterSize < ( 1UL << a_size ) )
+	{
+		return false;
+	}
+	__atomic_store_n( &policy->d_pinned, true, __ATOMIC_RELAXED );
+	__atomic_store_n( &policy->d_clusterSize, (long)a_clusterSize,
+					  __ATOMIC_RELAXED );
+	return true;
+}
 
+//****************************************************************************
+//
+//	MemNode_clusterSize - the cluster size the next node for a block
+//						  size would get
+//
+//	ARGS:
+//		a_size - the power of two of the block
+//
+//****************************************************************************
+size_t			MemNode_clusterSize( size_t a_size )
+{
+	if( a_size >= sizeof(s_classPolicy) / sizeof(classPolicy) )
+	{
+		return 0;
+	}
+	return classClusterSize( a_size );
+}
 
 //****************************************************************************
 //
-//	MemNode_create - find and initialize a new node
+//	MemNode_freeListSlots - tell how a block size tracks its slots
 //
 //	ARGS:
 //		a_size - the power of two of the block
 //
 //	RETURNS:
-//		pointer to a new MemNode
-//		NULL on error.
+//		true for a free list, false for a bitmap
+//
+//****************************************************************************
+bool			MemNode_freeListSlots( size_t a_size )
+{
+	return freeListSize( a_size );
+}
+
+//****************************************************************************
+//
+//	MemNode_stats - report how a block size is being used
+//
+//	ARGS:
+//		a_size	- the power of two of the block
+//		a_stats - filled in with the counts
 //
 //	NOTE:
-//		This function causes a new BittMap to be created and
-//		a new Cluster to be requested. The intention is that
-//		all allocations in this node be taken from this cluster
-//		and managed using this bitmap
+//		Block counts are approximate while other threads are busy, see
+//		classPolicy. Node and cluster counts are exact.
 //
 //****************************************************************************
-MemNode*		MemNode_create( size_t a_size )
+void			MemNode_stats( size_t a_size, MemNodeStats* a_stats )
 {
-	// initialize the necessary data structures,
-	// if they are not already done
-	if( s_masterNodeTable == NULL )
+	if( a_size >= sizeof(s_classPolicy) / sizeof(classPolicy) )
 	{
-		// allocate a Cluster to hold the table of
-		// MemNode pointers
-		s_masterNodeTable = (MemNode**)Cluster_request();
-		if( s_masterNodeTable == NULL )
-		{
-			// If we cannot get a cluster for the masterNodeTable
-			// we're stuck.
-			return NULL;
-		}
+		*a_stats = MemNodeStats();
+		return;
 	}
+	classPolicy*	policy = &s_classPolicy[a_size];
+	a_stats->d_allocations =
+			__atomic_load_n( &policy->d_totalAllocations, __ATOMIC_RELAXED );
+	a_stats->d_live = __atomic_load_n( &policy->d_live, __ATOMIC_RELAXED );
+	a_stats->d_nodes = __atomic_load_n( &policy->d_nodes, __ATOMIC_RELAXED );
+	a_stats->d_clustersHooked =
+			__atomic_load_n( &policy->d_clustersHooked, __ATOMIC_RELAXED );
+	a_stats->d_clustersReleased =
+			__atomic_load_n( &policy->d_clustersReleased, __ATOMIC_RELAXED );
+	a_stats->d_clustersDrained =
+			__atomic_load_n( &policy->d_clustersDrained, __ATOMIC_RELAXED );
+	a_stats->d_clusterBytes =
+			__atomic_load_n( &policy->d_clusterBytes, __ATOMIC_RELAXED );
+	a_stats->d_clusterSize = classClusterSize( a_size );
+	a_stats->d_spareNodes =
+			__atomic_load_n( &policy->d_spareCount, __ATOMIC_RELAXED );
+	a_stats->d_purgedBytes =
+			__atomic_load_n( &policy->d_purgedBytes, __ATOMIC_RELAXED );
+	a_stats->d_pagesPurged =
+			__atomic_load_n( &policy->d_pagesPurged, __ATOMIC_RELAXED );
+	a_stats->d_pagesRefaulted =
+			__atomic_load_n( &policy->d_pagesRefaulted, __ATOMIC_RELAXED );
+}
 
-	// Needed outside of the loops
-	MemNode*	  newNodePtr;
-	
-	// find the first available node in the array
-	// Iterate over each node handle in the s_masterNodeTable
-	for( MemNode** newNodeHandle = s_masterNodeTable;
-		 (caddr_t)newNodeHandle < (caddr_t)s_masterNodeTable+s_clusterSize;
-		 newNodeHandle++ )
+//****************************************************************************
+//
+//	MemNode_prepare - make nodes for a block size ahead of time
+//
+//	ARGS:
+//		a_size	- the power of two of the block
+//		a_count - how many spare nodes to keep
+//
+//	RETURNS:
+//		how many spare nodes there are now
+//
+//	NOTE:
+//		Each spare gets a faulted in cluster hooked up front, so the
+//		thread that takes it with MemNode_takeSpare() finds it ready
+//		to hand out blocks. Meant for a thread that keeps that work
+//		away from the threads that allocate.
+//
+//****************************************************************************
+long			MemNode_prepare( size_t a_size, long a_count )
+{
+	if( a_size >= sizeof(s_classPolicy) / sizeof(classPolicy) )
 	{
-		// See if we need to make a new block to hold nodes
-		if( *newNodeHandle == NULL )
+		return 0;
+	}
+	classPolicy*	policy = &s_classPolicy[a_size];
+
+	long		spares =
+				__atomic_load_n( &policy->d_spareCount, __ATOMIC_RELAXED );
+	while( spares < a_count )
+	{
+		MemNode*	newNode = MemNode_create( a_size );
+		if( newNode == NULL )
 		{
-			// We've found a slot that needs a new cluster block	
-			*newNodeHandle = (MemNode*)Cluster_request();
-			if( *newNodeHandle == NULL )
-			{
-				// If we cannot get a cluster to hold nodes we're stuck.
-				return NULL;
-			}
+			break;
 		}
-		// We have a cluster to look in, now search it for a free node
-		for( newNodePtr = *newNodeHandle;
-			 (caddr_t)newNodePtr < (caddr_t)*newNodeHandle + s_clusterSize;
-			 newNodePtr++ )
+		Cluster_prefault( newNode->d_clusterSize, 1 );
+		if( hookCluster( &newNode->d_cluster,
+						 newNode->d_clusterSize ) != NULL )
 		{
-			if( newNodePtr->d_size == 0 )
-			{
-				// Ha! we've found our node!
-				// break out of these loops
-				goto foundNode;
-			}
+			__atomic_fetch_add( &policy->d_clustersHooked, 1,
+								__ATOMIC_RELAXED );
+			__atomic_fetch_add( &policy->d_clusterBytes,
+								newNode->d_clusterSize, __ATOMIC_RELAXED );
 		}
-	}
- foundNode:
-	// Now that we have a node, initialize it
-	newNodePtr->d_bitMap = MemBitmap_create( 1 << a_size );
-	//newNodePtr->d_cluster = Cluster_request();
-	newNodePtr->d_cluster = NULL;
-	newNodePtr->d_size = a_size;
-	newNodePtr->d_count = 0L;
-	newNodePtr->d_previousNode = newNodePtr->d_nextNode = NULL;
 
-	// Return the new node to the caller
-	return newNodePtr;
+		MemNode*	head =
+					__atomic_load_n( &policy->d_spares, __ATOMIC_ACQUIRE );
+		do
+		{
+			newNode->d_nextNode = head;
+		}
+		while( !__atomic_compare_exchange_n( &policy->d_spares, &head,
+											 newNode, false,
+											 __ATOMIC_ACQ_REL,
+											 __ATOMIC_ACQUIRE ) );
+		spares = __atomic_add_fetch( &policy->d_spareCount, 1,
+									 __ATOMIC_RELAXED );
+	}
+	return spares;
 }
 
 //****************************************************************************
 //
-//	MemNode_destroy - free the resources used by this node
+//	MemNode_takeSpare - take a node made by MemNode_prepare()
 //
 //	ARGS:
-//		a_nodeToDestroy - the node to destroy
+//		a_size - the power of two of the block
+//
+//	RETURNS:
+//		the node, ready to be linked into a list
+//		NULL if there are no spares
 //
 //	NOTE:
-//		This function causes the Cluster to be released and the
-//		BitMap to be freed.
+//		A node taken is never made a spare again, so a node cannot come
+//		back to the head of the stack while another thread is looking
+//		at it, and the exchange needs no tag.
 //
 //****************************************************************************
-void			MemNode_destroy( MemNode* a_nodeToDestroy )
+MemNode*		MemNode_takeSpare( size_t a_size )
 {
-	// free our bitmap
-	MemBitmap_destroy( a_nodeToDestroy->d_bitMap );
-	a_nodeToDestroy->d_bitMap = NULL;
+	if( a_size >= sizeof(s_classPolicy) / sizeof(classPolicy) )
+	{
+		return NULL;
+	}
+	classPolicy*	policy = &s_classPolicy[a_size];
 
-	// release our cluster
-	Cluster_release( a_nodeToDestroy->d_cluster );
+	MemNode*	spare = __atomic_load_n( &policy->d_spares, __ATOMIC_ACQUIRE );
+	do
+	{
+		if( spare == NULL )
+		{
+			return NULL;
+		}
+	}
+	while( !__atomic_compare_exchange_n( &policy->d_spares, &spare,
+										 spare->d_nextNode, false,
+										 __ATOMIC_ACQ_REL,
+										 __ATOMIC_ACQUIRE ) );
 
-	// another hint that this is not used
-	a_nodeToDestroy->d_size = 0;
+	__atomic_fetch_sub( &policy->d_spareCount, 1, __ATOMIC_RELAXED );
+	spare->d_nextNode = NULL;
+	return spare;
+}
 
-	// free further down the chain
-	// NoteToSelf: find non-recursive technique
-	if( a_nodeToDestroy->d_nextNode != NULL )
+//****************************************************************************
+//
+//	MemNode_dropSpares - destroy the nodes made ahead for a block size
+//
+//	ARGS:
+//		a_size - the power of two of the block
+//
+//	RETURNS:
+//		how many bytes of cluster the spares gave back
+//
+//****************************************************************************
+size_t			MemNode_dropSpares( size_t a_size )
+{
+	if( a_size >= sizeof(s_classPolicy) / sizeof(classPolicy) )
 	{
-		MemNode_destroy( a_nodeToDestroy->d_nextNode );
-		a_nodeToDestroy->d_nextNode = NULL;
+		return 0;
+	}
+	classPolicy*	policy = &s_classPolicy[a_size];
+
+	size_t		dropped = 0;
+	MemNode*	spare;
+	while( ( spare = MemNode_takeSpare( a_size ) ) != NULL )
+	{
+		if( spare->d_cluster != NULL )
+		{
+			__atomic_fetch_add( &policy->d_clustersReleased, 1,
+								__ATOMIC_RELAXED );
+			__atomic_fetch_sub( &policy->d_clusterBytes,
+								spare->d_clusterSize, __ATOMIC_RELAXED );
+			dropped += spare->d_clusterSize;
+		}
+		MemNode_destroy( spare );
 	}
+	return dropped;
 }
 
 //****************************************************************************
 //
-//	MemNode_findBlock - find a free block in the Cluster managed by
-//						this block
+//	MemNode_reserve - make a node that keeps its cluster
 //
 //	ARGS:
-//		a_whereToLook - the node where we want to find the block
+//		a_size - the power of two of the block
 //
 //	RETURNS:
-//		pointer to the block.
-//		NULL if a block could not be found
+//		the node, with its cluster hooked, ready to be linked into a list
+//		NULL if there was no memory for it
+//
+//	NOTE:
+//		The node is never closed, so its cluster stays hooked however
+//		many of its blocks are released. The caller faults it in.
 //
 //****************************************************************************
-caddr_t			MemNode_findBlock( MemNode* a_whereToLook )
+MemNode*		MemNode_reserve( size_t a_size )
 {
-	// get the position of the free block from the bitmap
-	unsigned long	offset = MemBitmap_findBlock( a_whereToLook->d_bitMap );
-
-	// if a block cannot be found in our node, return NULL.
-	// caller can go look elsewhere
-	if( offset == ULONG_MAX )
+	MemNode*	newNode = MemNode_create( a_size );
+	if( newNode == NULL )
+	{
+		return NULL;
+	}
+	if( hookCluster( &newNode->d_cluster, newNode->d_clusterSize ) == NULL )
 	{
+		MemNode_destroy( newNode );
 		return NULL;
 	}
+	newNode->d_pinned = true;
 
-	// Mark the slot as occupied
-	MemBitmap_mark( a_whereToLook->d_bitMap, offset );
-	
-	// calculate its offset in the cluster
-	offset <<= a_whereToLook->d_size;
+	classPolicy*	policy = &s_classPolicy[a_size];
+	__atomic_fetch_add( &policy->d_clustersHooked, 1, __ATOMIC_RELAXED );
+	__atomic_fetch_add( &policy->d_clusterBytes, newNode->d_clusterSize,
+						__ATOMIC_RELAXED );
+	return newNode;
+}
+
+//****************************************************************************
+//
+//	MemNode_purgePages - give the OS back the pages of a node's cluster
+//						 that no block in use touches
+//
+//	ARGS:
+//		a_node - the node, which may be in use by other threads
+//
+//	RETURNS:
+//		how many bytes were given back by this call
+//
+//	NOTE:
+//		A cluster is only given back whole once its last block is
+//		released, so a sparse cluster of big blocks can hold many free
+//		pages. The blocks over a page are claimed as if handed out
+//		while it is purged, so nobody writes to them meanwhile, then
+//		let go with the page marked in d_purged. Runs of free pages
+//		are purged with one call. Pages already purged are skipped,
+//		and so are pinned nodes and nodes without a map.
+//
+//****************************************************************************
+size_t			MemNode_purgePages( MemNode* a_node )
+{
+	if( a_node->d_purged == NULL || a_node->d_pinned )
+	{
+		return 0;
+	}
+
+	// hold a reference so the cluster stays while we work
+	if( __atomic_fetch_add( &a_node->d_count, 1, __ATOMIC_ACQ_REL ) < 0 )
+	{
+		__atomic_fetch_sub( &a_node->d_count, 1, __ATOMIC_RELEASE );
+		return 0;
+	}
+	caddr_t			cluster = __atomic_load_n( &a_node->d_cluster,
+											   __ATOMIC_ACQUIRE );
+	if( cluster == NULL )
+	{
+		dropCount< bitmapSlots >( a_node );
+		return 0;
+	}
 
-	// Up the count
-	a_whereToLook->d_count++;
+	unsigned long	size = pageSize();
+	long			pages = a_node->d_clusterSize / size;
+	unsigned long	offset = a_node->d_offset;
+	unsigned long	slots = ( a_node->d_clusterSize - offset ) >>
+							a_node->d_size;
+	classPolicy*	policy = &s_classPolicy[a_node->d_size];
 
-	// If we do not have a cluster yet, create one.
-	if( a_whereToLook->d_cluster == NULL )
+	// the run of free pages found so far, and the slots claimed for it
+	long			runStart = -1;
+	unsigned long	claimedFrom = 0;
+	unsigned long	claimedTo = 0;
+	long			purged = 0;
+	for( long page = 0; page <= pages; page++ )
 	{
-		a_whereToLook->d_cluster = Cluster_request();
+		bool		free = page < pages &&
+						   !MemBitmap_isMarked( a_node->d_purged, page );
+		if( free )
+		{
+			// the slots over the page, none if it is all color
+			// offset or past the last slot
+			unsigned long	pageStart = page * size;
+			unsigned long	first = 0;
+			unsigned long	last = 0;
+			if( pageStart + size > offset )
+			{
+				if( pageStart > offset )
+				{
+					first = ( pageStart - offset ) >> a_node->d_size;
+				}
+				last = ( ( pageStart + size - offset - 1 ) >>
+						 a_node->d_size ) + 1;
+			}
+			first = first < slots ? first : slots;
+			last = last < slots ? last : slots;
+
+			if( runStart == -1 )
+			{
+				claimedFrom = claimedTo = first;
+			}
+			// a slot across two pages was claimed with the first
+			for( unsigned long slot = first > claimedTo ? first : claimedTo;
+				 slot < last && free; slot++ )
+			{
+				free = MemBitmap_testAndMark( a_node->d_bitMap, slot );
+				if( free )
+				{
+					claimedTo = slot + 1;
+				}
+			}
+		}
+		if( free )
+		{
+			if( runStart == -1 )
+			{
+				runStart = page;
+			}
+			continue;
+		}
+
+		if( runStart != -1 )
+		{
+			Cluster_purge( cluster + runStart * size,
+						   ( page - runStart ) * size );
+			for( long index = runStart; index < page; index++ )
+			{
+				MemBitmap_mark( a_node->d_purged, index );
+			}
+			__atomic_fetch_add( &a_node->d_purgedPages, page - runStart,
+								__ATOMIC_RELAXED );
+			__atomic_fetch_add( &policy->d_purgedBytes,
+								( page - runStart ) * size, __ATOMIC_RELAXED );
+			__atomic_fetch_add( &policy->d_pagesPurged, page - runStart,
+								__ATOMIC_RELAXED );
+			purged += page - runStart;
+			runStart = -1;
+		}
+		// let the slots go, after the marks so a claimer sees them
+		for( unsigned long slot = claimedFrom; slot < claimedTo; slot++ )
+		{
+			MemBitmap_unmark( a_node->d_bitMap, slot );
+		}
+		claimedFrom = claimedTo = 0;
 	}
 
-	// add the offset to the start of the cluster to get the address
-	// of the block
-	return ((caddr_t)a_whereToLook->d_cluster) + offset ;
+	dropCount< bitmapSlots >( a_node );
+	return purged * size;
 }
 
 //****************************************************************************
 //
-//	MemNode_releaseBlock - release a block in the Cluster managed by
-//						   this block
+//	MemNode_report - report one node to a heap walker
 //
 //	ARGS:
-//		a_whereToLook - the node where we want to find the block
-//		a_blockToRelease - address of the block to release
+//		a_node	 - the node
+//		a_walker - called with its entry
+//		a_context - passed on to a_walker
+//
+//	RETURNS:
+//		what a_walker returned, true for a node slot not in use
 //
 //	NOTE:
-//		Note, this routine just manipulates the bitmap to indicate
-//		the memory is free. 
+//		Bitmaps are never unmapped, so the occupancy bits can be read
+//		while the node changes, they just may not add up to d_live.
 //
 //****************************************************************************
-void			MemNode_releaseBlock( MemNode* a_whereToLook,
-									  caddr_t a_blockToRelease )
-{	
-	// calculate the  offset in the bitmap from the address of the
-	// block's cluster and the address to be freed
-  	unsigned long		offset = a_blockToRelease - a_whereToLook->d_cluster;
-
-	// divide by the block size to get the index of the bit
-	offset >>= (unsigned long)a_whereToLook->d_size;
-
-	// and unmark that bit.
-	MemBitmap_unmark( a_whereToLook->d_bitMap, offset );
+bool			MemNode_report( MemNode* a_node, MemHeapWalker a_walker,
+								void* a_context )
+{
+	long		size = __atomic_load_n( &a_node->d_size, __ATOMIC_ACQUIRE );
+	if( size == 0 )
+	{
+		return true;
+	}
 
-	// Reduce the count
-	a_whereToLook->d_count--;
+	MemHeapEntry	entry;
+	entry.d_kind = MEM_HEAP_NODE;
+	entry.d_address = __atomic_load_n( &a_node->d_cluster, __ATOMIC_ACQUIRE );
+	entry.d_bytes = entry.d_address != NULL ? a_node->d_clusterSize : 0;
+	entry.d_sizeShift = size;
+	entry.d_chain = a_node->d_chain;
+	entry.d_live = __atomic_load_n( &a_node->d_count, __ATOMIC_RELAXED );
+	if( entry.d_live < 0 )
+	{
+		// closed, and giving up its cluster
+		entry.d_live = 0;
+	}
+	entry.d_offset = a_node->d_offset;
+	entry.d_slots = ( a_node->d_clusterSize - a_node->d_offset ) >> size;
+	entry.d_occupancy = NULL;
+	if( !freeListSize( size ) && a_node->d_bitMap != NULL )
+	{
+		entry.d_occupancy = a_node->d_bitMap->d_bits;
+	}
+	return a_walker( &entry, a_context );
+}
 
-	if( a_whereToLook->d_count == 0 )
+//****************************************************************************
+//
+//	MemNode_walk - report every node made with MemNode_create()
+//
+//	ARGS:
+//		a_walker  - called with each node's entry
+//		a_context - passed on to a_walker
+//
+//	RETURNS:
+//		false if a_walker stopped the walk
+//
+//	NOTE:
+//		Spare nodes are reported too. The root nodes of the size
+//		categories are not made here and are not reported.
+//
+//****************************************************************************
+bool			MemNode_walk( MemHeapWalker a_walker, void* a_context )
+{
+	for( MemNode** nodeHandle = s_masterNodeTable;
+		 nodeHandle < s_masterNodeTable +
+					  sizeof(s_masterNodeTable) / sizeof(MemNode*);
+		 nodeHandle++ )
 	{
-		Cluster_release( a_whereToLook->d_cluster );
-		a_whereToLook->d_cluster = NULL;
+		// node clusters are hooked in order, the first empty handle
+		// is the end
+		MemNode*	nodeBlock = __atomic_load_n( nodeHandle, __ATOMIC_ACQUIRE );
+		if( nodeBlock == NULL )
+		{
+			break;
+		}
+		for( MemNode* node = nodeBlock;
+			 node < nodeBlock + s_clusterSize / sizeof(MemNode);
+			 node++ )
+		{
+			if( !MemNode_report( node, a_walker, a_context ) )
+			{
+				return false;
+			}
+		}
 	}
-	// That's it! We need not touch the actual memory.
+	return true;
 }
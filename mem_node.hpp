@@ -6,7 +6,6 @@
 
 struct MemBitmap;
 
-// This struct assumes 32-bit pointers
 struct MemNode
 {
 	// Size of the blocks this node is managing.
@@ -24,13 +23,69 @@ struct MemNode
 	MemNode*	d_previousNode;
 	MemNode*	d_nextNode;
 
-	// How many blocks of this node are in use
+	// How many blocks of this node are in use, plus threads busy
+	// claiming one. Negative while an empty node gives up its cluster.
 	long		d_count;
 
-	// padding to take this to 32 bytes, the next power of 2
-	// so that some multiple of these will fit into a cluster
-	caddr_t		d_padding2;
-	caddr_t		d_padding3;
+	// Where the first block starts in the cluster. Rotated from
+	// node to node so blocks of different clusters use different
+	// cache sets.
+	long		d_offset;
+
+	// How big d_cluster is. Picked per block size when the node
+	// is created, and the bitmap is sized to match.
+	long		d_clusterSize;
+
+	// Block sizes that track their slots with a free list instead of
+	// d_bitMap keep the head of the list of released slots here, and
+	// how many slots have been carved off the cluster since it was
+	// hooked.
+	unsigned long	d_freeSlots;
+	unsigned long	d_carved;
+
+	// Set while MemNode_select() passes the node over for fuller ones,
+	// so it gets no new blocks and can drain.
+	bool		d_draining;
+
+	// Set for nodes made by MemNode_reserve(), which keep their
+	// cluster when it empties
+	bool		d_pinned;
+
+	// Which of its owner's chains the node is linked on
+	int			d_chain;
+
+	// For block sizes from 1 << MEM_NODE_PURGE_SIZE up, a bit per page
+	// of the cluster, set while MemNode_purgePages() has given the page
+	// back to the OS, and how many are set. NULL for smaller sizes.
+	MemBitmap*	d_purged;
+	long		d_purgedPages;
+};
+
+// Nodes manage blocks of 1 << MEM_NODE_SMALLEST_SIZE up to
+// 1 << MEM_NODE_LARGEST_SIZE bytes
+const long		MEM_NODE_SMALLEST_SIZE = 5;
+const long		MEM_NODE_LARGEST_SIZE = 14;
+
+// The smallest block size, as a power of two, whose clusters can have
+// whole free pages between blocks in use worth giving back
+const size_t	MEM_NODE_PURGE_SIZE = 12;
+
+// How one block size is being used
+struct MemNodeStats
+{
+	long		d_allocations;		// blocks ever handed out
+	long		d_live;				// blocks in use now
+	long		d_nodes;			// nodes created
+	long		d_clustersHooked;	// clusters ever hooked
+	long		d_clustersReleased;	// clusters ever given back
+	long		d_clustersDrained;	// of those, given back by nodes
+									// MemNode_select() passed over
+	long		d_clusterBytes;		// bytes of cluster hooked now
+	long		d_clusterSize;		// what the next node gets
+	long		d_spareNodes;		// made ahead and not taken yet
+	long		d_purgedBytes;		// free pages given back now
+	long		d_pagesPurged;		// pages ever given back
+	long		d_pagesRefaulted;	// of those, used again since
 };
 
 // Create a new node
@@ -42,8 +97,43 @@ void			MemNode_destroy( MemNode* a_nodeToDestroy );
 // Look for a block inside a cluster managed by this node
 caddr_t			MemNode_findBlock( MemNode* a_whereToLook );
 
-// Look for a block inside a cluster managed by this node
-void			MemNode_releaseBlock( MemNode* a_whereToLook,
+// Pick the fullest node of a chain that has room, NULL if none has
+MemNode*		MemNode_select( MemNode* a_chain );
+
+// Look for up to a_howMany blocks at once, returning how many were found
+long			MemNode_findBlocks( MemNode* a_whereToLook, long a_howMany,
+									caddr_t* a_blocks );
+
+// Release a block of a cluster managed by this node, true if the node
+// was full before
+bool			MemNode_releaseBlock( MemNode* a_whereToLook,
 									  caddr_t	a_blockToRelease );
 
+// Fix the cluster size new nodes get for a block size, 0 to adapt it
+bool			MemNode_setClusterSize( size_t a_size, size_t a_clusterSize );
+
+// The cluster size the next node for a block size would get
+size_t			MemNode_clusterSize( size_t a_size );
+
+// Whether a block size tracks its slots with a free list, not a bitmap
+bool			MemNode_freeListSlots( size_t a_size );
+
+// Report how a block size is being used
+void			MemNode_stats( size_t a_size, MemNodeStats* a_stats );
+
+// Keep a_count nodes for a block size made, with clusters hooked
+long			MemNode_prepare( size_t a_size, long a_count );
+
+// Take one of those nodes, NULL if there are none
+MemNode*		MemNode_takeSpare( size_t a_size );
+
+// Destroy the ones not taken, returning the bytes of cluster given back
+size_t			MemNode_dropSpares( size_t a_size );
+
+// Make a node for a block size that never gives up its cluster
+MemNode*		MemNode_reserve( size_t a_size );
+
+// Give back the free pages inside a node's cluster, returning the bytes
+size_t			MemNode_purgePages( MemNode* a_node );
+
 #endif // __MEM_NODE_HPP__
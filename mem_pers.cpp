@@ -0,0 +1,917 @@
+#ifndef			__MEM_PERS_HPP__
+#include		"mem_pers.hpp"
+#endif			// __MEM_PERS_HPP__
+
+#ifndef			__MEM_CLST_HPP__
+#include		"mem_clst.hpp"
+#endif			// __MEM_CLST_HPP__
+
+#ifndef			__MEM_BMAP_HPP__
+#include		"mem_bmap.hpp"
+#endif			// __MEM_BMAP_HPP__
+
+#ifndef			__MEM_NODE_HPP__
+#include		"mem_node.hpp"
+#endif			// __MEM_NODE_HPP__
+
+#include		<errno.h>
+#include		<fcntl.h>
+#include		<limits.h>
+#include		<sched.h>
+#include		<stdio.h>
+#include		<sys/mman.h>
+#include		<sys/stat.h>
+#include		<unistd.h>
+
+namespace
+{
+	// "fstalloc" read as a little endian word
+	const unsigned long	PERSIST_MAGIC = 0x636f6c6c61747366UL;
+
+	// bumped whenever the layout of the file changes
+	const unsigned long	PERSIST_VERSION = 2;
+
+	// The heap is carved in pages of this size, whatever the page size
+	// of the machine that maps it. The first page holds the heap header.
+	const size_t		PERSIST_PAGE = 4096;
+
+	// Hunks of up to 32 << (PERSIST_CLASSES-1) bytes, header included,
+	// are blocks in a cluster of that size. Bigger ones get a run of
+	// pages to themselves.
+	const long			PERSIST_CLASSES = 8;
+
+	// every hunk is preceded by the offset of the run that holds it
+	const size_t		HUNK_HEADER = sizeof(size_t);
+
+	// what a run is being used for, otherwise the power of two
+	// of the blocks of a cluster
+	const long			FREE_RUN = -1;
+	const long			HUNK_RUN = 0;
+}
+
+// The heap header, at the start of the file. The handle callers get
+// is the address it is mapped at.
+struct MemPersistHeap
+{
+	unsigned long		d_magic;
+	unsigned long		d_version;
+
+	// bytes in the file
+	size_t				d_size;
+
+	// offset of the first page never carved
+	size_t				d_next;
+
+	// offset of the root hunk, 0 for none
+	size_t				d_root;
+
+	// offset of the first free run, the list is sorted by offset
+	size_t				d_freeRuns;
+
+	// offset of the newest cluster of each block size
+	size_t				d_classes[PERSIST_CLASSES];
+
+	// only one thread, of any process, carves or frees runs at a time
+	bool				d_lock;
+};
+
+namespace
+{
+	// A run of pages carved from the heap. d_next links free runs, and
+	// the clusters of a block size.
+	struct run
+	{
+		size_t			d_size;
+		size_t			d_next;
+		long			d_class;
+	};
+
+	// a run of HUNK_RUN holds one hunk this far in
+	const size_t		RUN_HEADER = 32;
+
+	// A run that is a cluster of blocks of one size. Clusters are never
+	// taken off their size's list, so the list can be walked without a
+	// lock while other threads and processes push new ones on. When an
+	// older cluster empties its pages are punched out instead. d_count works
+	// as MemNode::d_count does. The bitmap has room for the smallest
+	// blocks.
+	struct cluster : public run
+	{
+		long			d_count;
+		MemBitmapStorage< ( CLUSTERSIZE >> MEM_NODE_SMALLEST_SIZE ) >
+						d_bitmap;
+	};
+
+	// d_count is pushed this far below zero while an empty cluster
+	// has its pages punched out, so nobody claims a block meanwhile
+	const long			CLUSTER_CLOSED = LONG_MIN / 2;
+
+	// how many milliseconds to wait for another process to finish
+	// creating a shared heap
+	const long			ATTACH_TRIES = 1000;
+
+	// the first block of a cluster starts here, on a cache line
+	const size_t		CLUSTER_HEADER =
+							( sizeof(cluster) + CLUSTER_LINE_SIZE - 1 ) &
+							~( CLUSTER_LINE_SIZE - 1 );
+
+	struct persistGuard
+	{
+		persistGuard( MemPersistHeap* a_heap )
+			: d_heap( a_heap )
+		{
+			while( __atomic_test_and_set( &d_heap->d_lock, __ATOMIC_ACQUIRE ) )
+			{
+				sched_yield();
+			}
+		}
+		~persistGuard()
+		{
+			__atomic_clear( &d_heap->d_lock, __ATOMIC_RELEASE );
+		}
+
+		MemPersistHeap*	d_heap;
+	};
+
+	//************************************************************************
+	//
+	//	runAt() - the run at an offset in the heap
+	//
+	//************************************************************************
+	run*				runAt( MemPersistHeap* a_heap, size_t a_offset )
+	{
+		return (run*)( (caddr_t)a_heap + a_offset );
+	}
+
+	//************************************************************************
+	//
+	//	clusterAt() - the cluster at an offset in the heap
+	//
+	//************************************************************************
+	cluster*			clusterAt( MemPersistHeap* a_heap, size_t a_offset )
+	{
+		return (cluster*)( (caddr_t)a_heap + a_offset );
+	}
+
+	//************************************************************************
+	//
+	//	carveRun() - take a run of pages from the heap
+	//
+	//	ARGUMENTS:
+	//		a_heap	- the heap, locked
+	//		a_bytes - how much is needed, a multiple of PERSIST_PAGE
+	//
+	//	RETURNS:
+	//		offset of the run, its d_size filled in and maybe bigger
+	//		than asked for
+	//		0 if the heap is full
+	//
+	//	NOTE:
+	//		The first free run that fits is split, and only when it
+	//		is used up do we go on to pages never carved before.
+	//
+	//************************************************************************
+	size_t				carveRun( MemPersistHeap* a_heap, size_t a_bytes )
+	{
+		size_t*			link = &a_heap->d_freeRuns;
+		while( *link != 0 )
+		{
+			size_t		offset = *link;
+			run*		freeRun = runAt( a_heap, offset );
+			if( freeRun->d_size >= a_bytes )
+			{
+				if( freeRun->d_size - a_bytes >= PERSIST_PAGE )
+				{
+					// the tail stays free, in the same place in the list
+					run*	tail = runAt( a_heap, offset + a_bytes );
+					tail->d_size = freeRun->d_size - a_bytes;
+					tail->d_next = freeRun->d_next;
+					tail->d_class = FREE_RUN;
+					*link = offset + a_bytes;
+					freeRun->d_size = a_bytes;
+				}
+				else
+				{
+					*link = freeRun->d_next;
+				}
+				return offset;
+			}
+			link = &freeRun->d_next;
+		}
+
+		if( a_heap->d_size - a_heap->d_next < a_bytes )
+		{
+			return 0;
+		}
+		size_t			offset = a_heap->d_next;
+		a_heap->d_next += a_bytes;
+		runAt( a_heap, offset )->d_size = a_bytes;
+		return offset;
+	}
+
+	//************************************************************************
+	//
+	//	freeRun() - give a run of pages back to the heap
+	//
+	//	ARGUMENTS:
+	//		a_heap	 - the heap, locked
+	//		a_offset - offset of the run
+	//
+	//	NOTE:
+	//		The run is merged with free neighbours, and a run that ends
+	//		where carving stopped moves that point back instead. Pages
+	//		past the run header are punched out of the file so a big
+	//		heap that shrinks gives its memory and disk back.
+	//
+	//************************************************************************
+	void				freeRun( MemPersistHeap* a_heap, size_t a_offset )
+	{
+		run*			newRun = runAt( a_heap, a_offset );
+		newRun->d_class = FREE_RUN;
+
+		// find the free runs on either side
+		size_t*			link = &a_heap->d_freeRuns;
+		run*			previous = NULL;
+		while( *link != 0 && *link < a_offset )
+		{
+			previous = runAt( a_heap, *link );
+			link = &previous->d_next;
+		}
+		newRun->d_next = *link;
+		*link = a_offset;
+
+		// merge with the one after
+		if( newRun->d_next == a_offset + newRun->d_size )
+		{
+			run*		following = runAt( a_heap, newRun->d_next );
+			newRun->d_size += following->d_size;
+			newRun->d_next = following->d_next;
+		}
+
+		// and the one before
+		if( previous != NULL &&
+			(caddr_t)previous + previous->d_size == (caddr_t)newRun )
+		{
+			previous->d_size += newRun->d_size;
+			previous->d_next = newRun->d_next;
+			newRun = previous;
+			a_offset = (caddr_t)previous - (caddr_t)a_heap;
+		}
+
+		// the last run goes back to being uncarved
+		if( newRun->d_next == 0 && a_offset + newRun->d_size == a_heap->d_next )
+		{
+			size_t*		tailLink = &a_heap->d_freeRuns;
+			while( *tailLink != a_offset )
+			{
+				tailLink = &runAt( a_heap, *tailLink )->d_next;
+			}
+			*tailLink = 0;
+			a_heap->d_next = a_offset;
+			madvise( (caddr_t)newRun, newRun->d_size, MADV_REMOVE );
+			return;
+		}
+
+		// Not every file system can punch holes, the pages
+		// are merely kept if this one cannot
+		if( newRun->d_size > PERSIST_PAGE )
+		{
+			madvise( (caddr_t)newRun + PERSIST_PAGE,
+					 newRun->d_size - PERSIST_PAGE, MADV_REMOVE );
+		}
+	}
+
+	//************************************************************************
+	//
+	//	dropCount() - give back a reference taken on a cluster's d_count
+	//
+	//	ARGUMENTS:
+	//		a_heap	  - the heap
+	//		a_cluster - the cluster to drop the reference on
+	//
+	//	NOTE:
+	//		The same protocol as the MemNode one. Whoever drops the count
+	//		to zero closes the cluster if nobody else is claiming, punches
+	//		out the pages past the header, and opens it again. The newest
+	//		cluster of each size is left alone, so a hunk allocated and
+	//		released over and over does not punch and fault in the same
+	//		pages every time.
+	//
+	//************************************************************************
+	void				dropCount( MemPersistHeap* a_heap, cluster* a_cluster )
+	{
+		if( __atomic_sub_fetch( &a_cluster->d_count, 1, __ATOMIC_ACQ_REL ) != 0 )
+		{
+			return;
+		}
+		if( __atomic_load_n( &a_heap->d_classes[a_cluster->d_class -
+												MEM_NODE_SMALLEST_SIZE],
+							 __ATOMIC_ACQUIRE ) ==
+			(size_t)( (caddr_t)a_cluster - (caddr_t)a_heap ) )
+		{
+			return;
+		}
+
+		long			expected = 0;
+		if( !__atomic_compare_exchange_n( &a_cluster->d_count, &expected,
+										  CLUSTER_CLOSED, false,
+										  __ATOMIC_ACQ_REL,
+										  __ATOMIC_RELAXED ) )
+		{
+			return;
+		}
+
+		// Not every file system can punch holes, the pages
+		// are merely kept if this one cannot
+		madvise( (caddr_t)a_cluster + PERSIST_PAGE,
+				 a_cluster->d_size - PERSIST_PAGE, MADV_REMOVE );
+
+		__atomic_store_n( &a_cluster->d_bitmap.d_filled, 0UL,
+						  __ATOMIC_RELAXED );
+		__atomic_fetch_sub( &a_cluster->d_count, CLUSTER_CLOSED,
+							__ATOMIC_RELEASE );
+	}
+
+	//************************************************************************
+	//
+	//	clusterBlock() - claim a block in one cluster
+	//
+	//	ARGUMENTS:
+	//		a_heap	 - the heap
+	//		a_offset - offset of the cluster
+	//
+	//	RETURNS:
+	//		the block, its header filled in
+	//		NULL if the cluster is full or closed
+	//
+	//************************************************************************
+	caddr_t				clusterBlock( MemPersistHeap* a_heap, size_t a_offset )
+	{
+		cluster*		foundCluster = clusterAt( a_heap, a_offset );
+		if( __atomic_load_n( &foundCluster->d_bitmap.d_filled,
+							 __ATOMIC_RELAXED ) == 1 )
+		{
+			return NULL;
+		}
+		if( __atomic_fetch_add( &foundCluster->d_count, 1,
+								__ATOMIC_ACQ_REL ) < 0 )
+		{
+			__atomic_fetch_sub( &foundCluster->d_count, 1, __ATOMIC_RELEASE );
+			return NULL;
+		}
+
+		unsigned long	bit = MemBitmap_claim( &foundCluster->d_bitmap );
+		if( bit == ULONG_MAX )
+		{
+			dropCount( a_heap, foundCluster );
+			return NULL;
+		}
+
+		caddr_t			block = (caddr_t)foundCluster + CLUSTER_HEADER +
+								( bit << foundCluster->d_class );
+		*(size_t*)block = a_offset;
+		return block;
+	}
+
+	//************************************************************************
+	//
+	//	classBlock() - get a block of one size
+	//
+	//	ARGUMENTS:
+	//		a_heap	- the heap
+	//		a_index - which block size, 32 << a_index bytes
+	//
+	//	RETURNS:
+	//		the block, its header filled in
+	//		NULL if the heap is full
+	//
+	//	NOTE:
+	//		No lock is taken unless every cluster of the size is full and
+	//		a new one has to be carved. It goes on the front of the list
+	//		with a compare and swap, so a thread walking the list meanwhile
+	//		just does not see it.
+	//
+	//************************************************************************
+	caddr_t				classBlock( MemPersistHeap* a_heap, long a_index )
+	{
+		while( 1 )
+		{
+			size_t		head = __atomic_load_n( &a_heap->d_classes[a_index],
+												__ATOMIC_ACQUIRE );
+			for( size_t offset = head; offset != 0;
+				 offset = clusterAt( a_heap, offset )->d_next )
+			{
+				caddr_t	block = clusterBlock( a_heap, offset );
+				if( block != NULL )
+				{
+					return block;
+				}
+			}
+
+			size_t		offset;
+			{
+				persistGuard	guard( a_heap );
+				offset = carveRun( a_heap, CLUSTERSIZE );
+			}
+			if( offset == 0 )
+			{
+				return NULL;
+			}
+
+			long		shift = a_index + MEM_NODE_SMALLEST_SIZE;
+			cluster*	newCluster = clusterAt( a_heap, offset );
+			newCluster->d_class = shift;
+			newCluster->d_count = 0;
+			MemBitmap_init( &newCluster->d_bitmap,
+							( CLUSTERSIZE - CLUSTER_HEADER ) >> shift );
+			do
+			{
+				newCluster->d_next = head;
+			}
+			while( !__atomic_compare_exchange_n( &a_heap->d_classes[a_index],
+												 &head, offset, false,
+												 __ATOMIC_ACQ_REL,
+												 __ATOMIC_ACQUIRE ) );
+		}
+	}
+
+	//************************************************************************
+	//
+	//	mapFile() - map a whole heap file
+	//
+	//************************************************************************
+	MemPersistHeap*		mapFile( int a_fd, size_t a_size )
+	{
+		MemPersistHeap*	heap = (MemPersistHeap*) mmap( (caddr_t) 0, a_size,
+													   PROT_READ|PROT_WRITE,
+													   MAP_SHARED, a_fd, 0 );
+		if( heap == (MemPersistHeap*)MAP_FAILED )
+		{
+			perror( "mmap: " );
+			return NULL;
+		}
+		return heap;
+	}
+
+	//************************************************************************
+	//
+	//	createHeap() - lay a new heap out in an empty file
+	//
+	//	ARGUMENTS:
+	//		a_fd	 - the file
+	//		a_howBig - how big to make it
+	//
+	//	RETURNS:
+	//		the heap
+	//		NULL if the file could not be sized or mapped
+	//
+	//************************************************************************
+	MemPersistHeap*		createHeap( int a_fd, size_t a_howBig )
+	{
+		size_t			size = ( a_howBig + PERSIST_PAGE - 1 ) &
+							   ~( PERSIST_PAGE - 1 );
+		if( size < 2 * PERSIST_PAGE )
+		{
+			return NULL;
+		}
+		if( ftruncate( a_fd, size ) == -1 )
+		{
+			perror( "ftruncate: " );
+			return NULL;
+		}
+
+		MemPersistHeap*	heap = mapFile( a_fd, size );
+		if( heap == NULL )
+		{
+			return NULL;
+		}
+		heap->d_version = PERSIST_VERSION;
+		heap->d_size = size;
+		heap->d_next = PERSIST_PAGE;
+		// the rest of the header is 0 in a new file, and the
+		// magic number goes in last to mark it finished
+		__atomic_store_n( &heap->d_magic, PERSIST_MAGIC, __ATOMIC_RELEASE );
+		return heap;
+	}
+
+	//************************************************************************
+	//
+	//	attachHeap() - map a heap that is already in a file
+	//
+	//	ARGUMENTS:
+	//		a_fd	 - the file
+	//		a_shared - other processes may have it mapped, and may still
+	//				   be laying it out
+	//
+	//	RETURNS:
+	//		the heap
+	//		NULL if the file could not be mapped or is not a heap
+	//
+	//************************************************************************
+	MemPersistHeap*		attachHeap( int a_fd, bool a_shared )
+	{
+		// give whoever is creating a shared heap a second to finish
+		struct stat		fileStat;
+		for( long tries = 0; ; tries++ )
+		{
+			if( fstat( a_fd, &fileStat ) == -1 )
+			{
+				perror( "fstat: " );
+				return NULL;
+			}
+			if( fileStat.st_size != 0 || !a_shared || tries == ATTACH_TRIES )
+			{
+				break;
+			}
+			usleep( 1000 );
+		}
+
+		size_t			size = fileStat.st_size;
+		if( size < 2 * PERSIST_PAGE )
+		{
+			return NULL;
+		}
+		MemPersistHeap*	heap = mapFile( a_fd, size );
+		if( heap == NULL )
+		{
+			return NULL;
+		}
+
+		for( long tries = 0;
+			 a_shared && tries < ATTACH_TRIES &&
+			 __atomic_load_n( &heap->d_magic, __ATOMIC_ACQUIRE ) == 0;
+			 tries++ )
+		{
+			usleep( 1000 );
+		}
+		if( __atomic_load_n( &heap->d_magic, __ATOMIC_ACQUIRE ) !=
+															PERSIST_MAGIC ||
+			heap->d_version != PERSIST_VERSION ||
+			heap->d_size != size )
+		{
+			munmap( (caddr_t)heap, size );
+			return NULL;
+		}
+
+		// Only one process has a persistent heap open, so a lock
+		// still held was held by one that died
+		if( !a_shared )
+		{
+			__atomic_clear( &heap->d_lock, __ATOMIC_RELEASE );
+		}
+		return heap;
+	}
+
+	//************************************************************************
+	//
+	//	openHeap() - map the heap in a file, creating it if the file
+	//				 is empty
+	//
+	//************************************************************************
+	MemPersistHeap*		openHeap( int a_fd, size_t a_howBig )
+	{
+		struct stat		fileStat;
+		if( fstat( a_fd, &fileStat ) == -1 )
+		{
+			perror( "fstat: " );
+			return NULL;
+		}
+		if( fileStat.st_size == 0 )
+		{
+			return createHeap( a_fd, a_howBig );
+		}
+		return attachHeap( a_fd, false );
+	}
+}
+
+//****************************************************************************
+//
+//	Mem_persistOpen() - map a heap kept in a file
+//
+//	ARGUMENTS:
+//		a_path	 - the file
+//		a_howBig - how big to make the heap if the file is new or
+//				   empty, otherwise ignored
+//
+//	RETURNS:
+//		the heap
+//		NULL if the file could not be opened or holds something else
+//
+//	NOTE:
+//		Opening an existing heap maps it and checks its header, nothing
+//		more, so it takes as long no matter how big the heap is. Pages
+//		are read in as they are touched.
+//
+//****************************************************************************
+MemPersistHeap*			Mem_persistOpen( const char* a_path, size_t a_howBig )
+{
+	int			fd = open( a_path, O_RDWR|O_CREAT, 0600 );
+	if( fd == -1 )
+	{
+		perror( "open: " );
+		return NULL;
+	}
+
+	// the mapping keeps the file open
+	MemPersistHeap*	heap = openHeap( fd, a_howBig );
+	close( fd );
+	return heap;
+}
+
+//****************************************************************************
+//
+//	Mem_persistOpenFd() - map a heap kept in an open file
+//
+//	ARGUMENTS:
+//		a_fd	 - the file, such as a memfd, opened for reading and
+//				   writing. It may be closed once this returns.
+//		a_howBig - how big to make the heap if the file is empty
+//
+//	RETURNS:
+//		the heap
+//		NULL if the file could not be mapped or holds something else
+//
+//****************************************************************************
+MemPersistHeap*			Mem_persistOpenFd( int a_fd, size_t a_howBig )
+{
+	return openHeap( a_fd, a_howBig );
+}
+
+//****************************************************************************
+//
+//	Mem_persistClose() - unmap a heap
+//
+//	ARGUMENTS:
+//		a_heap - the heap, which must not be used again
+//
+//	NOTE:
+//		Nothing is written out here. The pages reach the file whenever
+//		the system gets to them, or at Mem_persistSync().
+//
+//****************************************************************************
+void					Mem_persistClose( MemPersistHeap* a_heap )
+{
+	if( a_heap == NULL )
+	{
+		return;
+	}
+	if( munmap( (caddr_t)a_heap, a_heap->d_size ) == -1 )
+	{
+		perror( "munmap: " );
+	}
+}
+
+//****************************************************************************
+//
+//	Mem_persistSync() - write a heap out to its file
+//
+//	RETURNS:
+//		true once everything is in the file
+//		false on error
+//
+//****************************************************************************
+bool					Mem_persistSync( MemPersistHeap* a_heap )
+{
+	if( msync( (caddr_t)a_heap, a_heap->d_size, MS_SYNC ) == -1 )
+	{
+		perror( "msync: " );
+		return false;
+	}
+	return true;
+}
+
+//****************************************************************************
+//
+//	Mem_persistAllocate() - allocate a hunk in a heap
+//
+//	ARGUMENTS:
+//		a_heap	 - the heap
+//		a_howBig - how many bytes are needed
+//
+//	RETURNS:
+//		the hunk
+//		NULL if the heap is full
+//
+//	NOTE:
+//		Small hunks are had without a lock, so any number of threads
+//		in any number of processes can allocate at once. Big ones take
+//		the heap lock to carve their run.
+//
+//****************************************************************************
+caddr_t					Mem_persistAllocate( MemPersistHeap* a_heap,
+											 size_t a_howBig )
+{
+	if( a_heap == NULL || a_howBig > a_heap->d_size )
+	{
+		return NULL;
+	}
+
+	// small hunks are blocks of the smallest size they fit
+	size_t				blockSize = a_howBig + HUNK_HEADER;
+	if( blockSize <=
+		( 1UL << ( MEM_NODE_SMALLEST_SIZE + PERSIST_CLASSES - 1 ) ) )
+	{
+		long			index = 0;
+		while( ( 1UL << ( MEM_NODE_SMALLEST_SIZE + index ) ) < blockSize )
+		{
+			index++;
+		}
+		caddr_t			block = classBlock( a_heap, index );
+		if( block == NULL )
+		{
+			return NULL;
+		}
+		return block + HUNK_HEADER;
+	}
+
+	// big ones get their own run
+	persistGuard		guard( a_heap );
+	size_t				runSize = ( a_howBig + RUN_HEADER + PERSIST_PAGE - 1 ) &
+								  ~( PERSIST_PAGE - 1 );
+	size_t				offset = carveRun( a_heap, runSize );
+	if( offset == 0 )
+	{
+		return NULL;
+	}
+	runAt( a_heap, offset )->d_class = HUNK_RUN;
+
+	caddr_t				hunk = (caddr_t)a_heap + offset + RUN_HEADER;
+	*(size_t*)( hunk - HUNK_HEADER ) = offset;
+	return hunk;
+}
+
+//****************************************************************************
+//
+//	Mem_persistRelease() - release a hunk in a heap
+//
+//	ARGUMENTS:
+//		a_heap - the heap
+//		a_hunk - a hunk from Mem_persistAllocate() on the same heap,
+//				 possibly by another process
+//
+//	NOTE:
+//		A cluster whose last block is released keeps its place in the
+//		heap but gives its pages back, unless it is the newest of its
+//		size. Only big hunks take the lock.
+//
+//****************************************************************************
+void					Mem_persistRelease( MemPersistHeap* a_heap,
+											caddr_t a_hunk )
+{
+	if( a_heap == NULL || a_hunk == NULL )
+	{
+		return;
+	}
+
+	size_t				offset = *(size_t*)( a_hunk - HUNK_HEADER );
+	run*				hunkRun = runAt( a_heap, offset );
+	if( hunkRun->d_class == HUNK_RUN )
+	{
+		persistGuard	guard( a_heap );
+		freeRun( a_heap, offset );
+		return;
+	}
+
+	cluster*			hunkCluster = (cluster*)hunkRun;
+	unsigned long		bit = ( a_hunk - HUNK_HEADER -
+								( (caddr_t)hunkCluster + CLUSTER_HEADER ) ) >>
+							  hunkCluster->d_class;
+	MemBitmap_unmark( &hunkCluster->d_bitmap, bit );
+	dropCount( a_heap, hunkCluster );
+}
+
+//****************************************************************************
+//
+//	Mem_persistRoot() - get the hunk everything else in a heap hangs from
+//
+//	RETURNS:
+//		the root hunk
+//		NULL if none was set
+//
+//****************************************************************************
+caddr_t					Mem_persistRoot( MemPersistHeap* a_heap )
+{
+	return Mem_persistAddress( a_heap,
+							   __atomic_load_n( &a_heap->d_root,
+												__ATOMIC_ACQUIRE ) );
+}
+
+//****************************************************************************
+//
+//	Mem_persistSetRoot() - set the hunk everything else in a heap
+//						   hangs from
+//
+//	ARGUMENTS:
+//		a_heap - the heap
+//		a_hunk - a hunk in the heap, or NULL for none
+//
+//****************************************************************************
+void					Mem_persistSetRoot( MemPersistHeap* a_heap,
+											caddr_t a_hunk )
+{
+	__atomic_store_n( &a_heap->d_root, Mem_persistOffset( a_heap, a_hunk ),
+					  __ATOMIC_RELEASE );
+}
+
+//****************************************************************************
+//
+//	Mem_persistOffset() - turn an address in a heap into an offset
+//
+//	RETURNS:
+//		the offset, which stays good when the heap is mapped elsewhere
+//		0 for NULL
+//
+//****************************************************************************
+size_t					Mem_persistOffset( MemPersistHeap* a_heap,
+										   caddr_t a_address )
+{
+	if( a_address == NULL )
+	{
+		return 0;
+	}
+	return a_address - (caddr_t)a_heap;
+}
+
+//****************************************************************************
+//
+//	Mem_persistAddress() - turn an offset in a heap into an address
+//
+//	RETURNS:
+//		the address where the heap is mapped now
+//		NULL for 0
+//
+//****************************************************************************
+caddr_t					Mem_persistAddress( MemPersistHeap* a_heap,
+											size_t a_offset )
+{
+	if( a_offset == 0 )
+	{
+		return NULL;
+	}
+	return (caddr_t)a_heap + a_offset;
+}
+
+//****************************************************************************
+//
+//	Mem_sharedOpen() - map a heap in shared memory
+//
+//	ARGUMENTS:
+//		a_name	 - the shm_open() name, such as "/workers"
+//		a_howBig - how big to make the heap if this process creates it
+//
+//	RETURNS:
+//		the heap
+//		NULL if it could not be created or mapped
+//
+//	NOTE:
+//		Whichever process gets there first creates the heap, and the
+//		others wait for it to be laid out. Each process maps the heap
+//		at its own address, so a hunk is handed to another process as
+//		its Mem_persistOffset(). A process that dies holding the heap
+//		lock, which is only taken for hunks of more than 4KB, leaves
+//		the others waiting on it.
+//
+//****************************************************************************
+MemPersistHeap*			Mem_sharedOpen( const char* a_name, size_t a_howBig )
+{
+	int			fd = shm_open( a_name, O_RDWR|O_CREAT|O_EXCL, 0600 );
+	if( fd != -1 )
+	{
+		MemPersistHeap*	heap = createHeap( fd, a_howBig );
+		if( heap == NULL )
+		{
+			shm_unlink( a_name );
+		}
+		close( fd );
+		return heap;
+	}
+	if( errno != EEXIST )
+	{
+		perror( "shm_open: " );
+		return NULL;
+	}
+
+	fd = shm_open( a_name, O_RDWR, 0600 );
+	if( fd == -1 )
+	{
+		perror( "shm_open: " );
+		return NULL;
+	}
+	MemPersistHeap*	heap = attachHeap( fd, true );
+	close( fd );
+	return heap;
+}
+
+//****************************************************************************
+//
+//	Mem_sharedUnlink() - remove a shared heap's name
+//
+//	NOTE:
+//		Processes that have it mapped keep using it, the memory goes
+//		when the last one unmaps it.
+//
+//****************************************************************************
+void					Mem_sharedUnlink( const char* a_name )
+{
+	shm_unlink( a_name );
+}
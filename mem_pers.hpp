@@ -0,0 +1,50 @@
+#ifndef __MEM_PERS_HPP__
+#define __MEM_PERS_HPP__
+
+//	get size_t and caddr_t
+#include <sys/types.h>
+
+// A heap kept in a file, or a memfd, mapped MAP_SHARED. Everything the
+// heap needs to find its hunks again lives in the file and refers to
+// other parts of it by offset, so a process can map it again after a
+// restart and pick up where it left off. The file is mapped wherever
+// the system likes, so anything stored in a hunk that refers to another
+// hunk should be an offset as well.
+struct MemPersistHeap;
+
+// Map the heap in a file, making it a_howBig bytes if the file is new.
+// Only one process may have it open.
+MemPersistHeap*			Mem_persistOpen( const char* a_path, size_t a_howBig );
+
+// The same, for a file that is already open, such as a memfd
+MemPersistHeap*			Mem_persistOpenFd( int a_fd, size_t a_howBig );
+
+// Map a heap in POSIX shared memory that any number of processes
+// allocate and release in at once, creating it if it is not there
+MemPersistHeap*			Mem_sharedOpen( const char* a_name, size_t a_howBig );
+void					Mem_sharedUnlink( const char* a_name );
+
+// Unmap a heap, it stays in the file
+void					Mem_persistClose( MemPersistHeap* a_heap );
+
+// Write the heap out to the file
+bool					Mem_persistSync( MemPersistHeap* a_heap );
+
+// Allocate and release hunks in the heap
+caddr_t					Mem_persistAllocate( MemPersistHeap* a_heap,
+											 size_t a_howBig );
+void					Mem_persistRelease( MemPersistHeap* a_heap,
+											caddr_t a_hunk );
+
+// The hunk everything else in the heap is found from
+caddr_t					Mem_persistRoot( MemPersistHeap* a_heap );
+void					Mem_persistSetRoot( MemPersistHeap* a_heap,
+											caddr_t a_hunk );
+
+// Convert between addresses in the heap and offsets, 0 is NULL
+size_t					Mem_persistOffset( MemPersistHeap* a_heap,
+										   caddr_t a_address );
+caddr_t					Mem_persistAddress( MemPersistHeap* a_heap,
+											size_t a_offset );
+
+#endif // __MEM_PERS_HPP__
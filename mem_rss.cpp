@@ -0,0 +1,486 @@
+#ifndef			__MEM_RSS_HPP__
+#include		"mem_rss.hpp"
+#endif			// __MEM_RSS_HPP__
+
+#ifndef			__MEM_ALOC_HPP__
+#include		"mem_aloc.hpp"
+#endif			// __MEM_ALOC_HPP__
+
+#ifndef			__MEM_NODE_HPP__
+#include		"mem_node.hpp"
+#endif			// __MEM_NODE_HPP__
+
+#ifndef			__MEM_CLST_HPP__
+#include		"mem_clst.hpp"
+#endif			// __MEM_CLST_HPP__
+
+#ifndef			__MEM_SPAN_HPP__
+#include		"mem_span.hpp"
+#endif			// __MEM_SPAN_HPP__
+
+#ifndef			__MEM_CORO_HPP__
+#include		"mem_coro.hpp"
+#endif			// __MEM_CORO_HPP__
+
+#include		<fcntl.h>
+#include		<limits.h>
+#include		<poll.h>
+#include		<pthread.h>
+#include		<stdio.h>
+#include		<stdlib.h>
+#include		<string.h>
+#include		<time.h>
+#include		<unistd.h>
+
+namespace
+{
+	// Use at PRESSURE_PERCENT of the target or more gives memory back,
+	// and the caches stay lean until use is below RELIEF_PERCENT, so
+	// they do not fill and empty with every small swing.
+	const size_t		PRESSURE_PERCENT = 90;
+	const size_t		RELIEF_PERCENT = 75;
+
+	// frames a thread keeps per size while the caches are lean
+	const unsigned long	LEAN_FRAME_CACHE = 4;
+
+	// Report tasks stalled on memory for 100ms of any 2s. The kernel
+	// wants the terminating NUL written too.
+	const char			PSI_TRIGGER[] = "some 100000 2000000";
+
+	// where the cgroup files are, empty if we are in no v2 cgroup
+	const char			CGROUP_ROOT[] = "/sys/fs/cgroup";
+	char				s_cgroupDir[PATH_MAX] = "";
+
+	// what is watched, and the thread doing the watching
+	size_t				s_target = 0;
+	bool				s_fromCgroup = false;
+	bool				s_pressure = false;
+	int					s_psiFd = -1;
+	pthread_t			s_watcher;
+	bool				s_watching = false;
+	unsigned long		s_interval = 0;
+
+	//************************************************************************
+	//
+	//	readFile() - read a small file whole
+	//
+	//	ARGUMENTS:
+	//		a_path	 - the file
+	//		a_buffer - filled in, NUL terminated
+	//		a_size	 - how big a_buffer is
+	//
+	//	RETURNS:
+	//		true if anything was read
+	//
+	//	NOTE:
+	//		Straight system calls, so measuring never allocates.
+	//
+	//************************************************************************
+	bool				readFile( const char* a_path, char* a_buffer,
+								  size_t a_size )
+	{
+		int				fd = open( a_path, O_RDONLY );
+		if( fd == -1 )
+		{
+			return false;
+		}
+		ssize_t			length = read( fd, a_buffer, a_size - 1 );
+		close( fd );
+		if( length <= 0 )
+		{
+			return false;
+		}
+		a_buffer[length] = '\0';
+		return true;
+	}
+
+	//************************************************************************
+	//
+	//	findCgroup() - find the directory of our v2 cgroup
+	//
+	//	RETURNS:
+	//		true if s_cgroupDir is set
+	//
+	//************************************************************************
+	bool				findCgroup()
+	{
+		char			cgroups[4096];
+		if( !readFile( "/proc/self/cgroup", cgroups, sizeof(cgroups) ) )
+		{
+			return false;
+		}
+
+		// the unified hierarchy is the one with id 0 and no controllers
+		for( char* line = cgroups; line != NULL && *line != '\0'; )
+		{
+			char*		next = strchr( line, '\n' );
+			if( next != NULL )
+			{
+				*next++ = '\0';
+			}
+			if( strncmp( line, "0::", 3 ) == 0 )
+			{
+				snprintf( s_cgroupDir, sizeof(s_cgroupDir), "%s%s",
+						  CGROUP_ROOT, line + 3 );
+				return true;
+			}
+			line = next;
+		}
+		return false;
+	}
+
+	//************************************************************************
+	//
+	//	cgroupValue() - read a number from one of our cgroup's files
+	//
+	//	RETURNS:
+	//		the number
+	//		0 if the file could not be read or says "max"
+	//
+	//************************************************************************
+	size_t				cgroupValue( const char* a_file )
+	{
+		char			path[PATH_MAX];
+		char			value[64];
+		int				length = snprintf( path, sizeof(path), "%s/%s",
+										   s_cgroupDir, a_file );
+		if( length < 0 || (size_t)length >= sizeof(path) ||
+			!readFile( path, value, sizeof(value) ) ||
+			strncmp( value, "max", 3 ) == 0 )
+		{
+			return 0;
+		}
+		return strtoul( value, NULL, 10 );
+	}
+
+	//************************************************************************
+	//
+	//	residentBytes() - our own RSS
+	//
+	//************************************************************************
+	size_t				residentBytes()
+	{
+		char			statm[256];
+		if( !readFile( "/proc/self/statm", statm, sizeof(statm) ) )
+		{
+			return 0;
+		}
+		char*			resident = strchr( statm, ' ' );
+		if( resident == NULL )
+		{
+			return 0;
+		}
+		return strtoul( resident, NULL, 10 ) * sysconf( _SC_PAGESIZE );
+	}
+
+	//************************************************************************
+	//
+	//	openPsi() - ask the kernel to tell us about memory stalls
+	//
+	//	RETURNS:
+	//		a descriptor to poll for POLLPRI
+	//		-1 if PSI is not there
+	//
+	//	NOTE:
+	//		Our cgroup's stalls are watched if it has them, else the
+	//		whole system's.
+	//
+	//************************************************************************
+	int					openPsi()
+	{
+		char			path[PATH_MAX];
+		int				length = snprintf( path, sizeof(path),
+										   "%s/memory.pressure", s_cgroupDir );
+		const char*		paths[] = { path, "/proc/pressure/memory" };
+		for( size_t index = s_cgroupDir[0] == '\0' || length < 0 ||
+							(size_t)length >= sizeof(path) ? 1 : 0;
+			 index < sizeof(paths) / sizeof(paths[0]);
+			 index++ )
+		{
+			int			fd = open( paths[index], O_RDWR|O_NONBLOCK );
+			if( fd == -1 )
+			{
+				continue;
+			}
+			if( write( fd, PSI_TRIGGER, sizeof(PSI_TRIGGER) ) ==
+				(ssize_t)sizeof(PSI_TRIGGER) )
+			{
+				return fd;
+			}
+			close( fd );
+		}
+		return -1;
+	}
+
+	//************************************************************************
+	//
+	//	setPressure() - keep the caches lean or let them fill
+	//
+	//************************************************************************
+	void				setPressure( bool a_pressure )
+	{
+		if( __atomic_exchange_n( &s_pressure, a_pressure,
+								 __ATOMIC_RELAXED ) != a_pressure )
+		{
+			Mem_frameSetCacheLimit( a_pressure ? LEAN_FRAME_CACHE :
+												 MEM_FRAME_CACHE_LIMIT );
+		}
+	}
+
+	//************************************************************************
+	//
+	//	cachesRefilled() - whether anything was kept for later again
+	//
+	//	NOTE:
+	//		Only ready clusters and spare nodes build up while the caches
+	//		are lean. What the trims give back is walked for, so doing
+	//		that again on every measurement finds little and costs much.
+	//
+	//************************************************************************
+	bool				cachesRefilled()
+	{
+		ClusterStats	clusters;
+		Cluster_stats( &clusters );
+		if( clusters.d_readyBytes > 0 )
+		{
+			return true;
+		}
+		for( long size = MEM_NODE_SMALLEST_SIZE; size <= MEM_NODE_LARGEST_SIZE;
+			 size++ )
+		{
+			MemNodeStats	node;
+			MemNode_stats( size, &node );
+			if( node.d_spareNodes > 0 )
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+
+	//************************************************************************
+	//
+	//	watcher() - measure until told to stop
+	//
+	//	NOTE:
+	//		With PSI, the wait for the next measurement is a poll that a
+	//		stall cuts short, and a stall gives memory back at once.
+	//
+	//************************************************************************
+	void*				watcher( void* )
+	{
+		while( __atomic_load_n( &s_watching, __ATOMIC_ACQUIRE ) )
+		{
+			if( s_psiFd != -1 )
+			{
+				struct pollfd	stall = { s_psiFd, POLLPRI, 0 };
+				if( poll( &stall, 1, s_interval ) > 0 &&
+					( stall.revents & POLLPRI ) )
+				{
+					setPressure( true );
+					Mem_rssRelease();
+					continue;
+				}
+			}
+			else
+			{
+				struct timespec	delay;
+				delay.tv_sec = s_interval / 1000;
+				delay.tv_nsec = ( s_interval % 1000 ) * 1000000;
+				nanosleep( &delay, NULL );
+			}
+			Mem_rssCheck();
+		}
+		return NULL;
+	}
+}
+
+//****************************************************************************
+//
+//	Mem_rssRelease() - give back everything held for later
+//
+//	RETURNS:
+//		how many bytes were given back
+//
+//	NOTE:
+//		Spare nodes go first, their clusters join the purged ones. What
+//		is left mapped reads back as zeroes and is quick to use again.
+//		Frames are never given back, lean thread caches only stop them
+//		piling up in one thread while others carve more.
+//
+//****************************************************************************
+size_t					Mem_rssRelease()
+{
+	size_t				released = 0;
+	for( long size = MEM_NODE_SMALLEST_SIZE; size <= MEM_NODE_LARGEST_SIZE;
+		 size++ )
+	{
+		released += MemNode_dropSpares( size );
+	}
+	released += Cluster_dropReady();
+	released += Mem_trim();
+	released += Mem_spanPurge();
+	return released;
+}
+
+//****************************************************************************
+//
+//	Mem_rssCheck() - measure once, and give back memory if near the target
+//
+//	RETURNS:
+//		how many bytes were given back
+//
+//	NOTE:
+//		With no target only PSI stalls put the caches under pressure,
+//		and a measurement clears it. Everything is given back once as
+//		use nears the target, and after that only when ready clusters
+//		or spare nodes have built up again.
+//
+//****************************************************************************
+size_t					Mem_rssCheck()
+{
+	size_t				target = __atomic_load_n( &s_target, __ATOMIC_RELAXED );
+	if( target == 0 )
+	{
+		setPressure( false );
+		return 0;
+	}
+
+	size_t				usage = Mem_rssUsage();
+	if( usage >= target / 100 * PRESSURE_PERCENT )
+	{
+		bool			starting = !Mem_rssPressure();
+		setPressure( true );
+		if( starting || cachesRefilled() )
+		{
+			return Mem_rssRelease();
+		}
+		return 0;
+	}
+	if( usage < target / 100 * RELIEF_PERCENT )
+	{
+		setPressure( false );
+	}
+	return 0;
+}
+
+//****************************************************************************
+//
+//	Mem_rssStart() - start keeping memory use under a target
+//
+//	ARGUMENTS:
+//		a_targetBytes - the target, 0 for the cgroup's limit
+//		a_intervalMs  - milliseconds between measurements
+//		a_psi		  - true to give memory back on PSI memory stalls too
+//
+//	RETURNS:
+//		true if the watcher thread is running
+//		false if there was nothing to watch, it could not be started,
+//		or already was
+//
+//	NOTE:
+//		A cgroup with no limit and PSI asked for still watches the
+//		stalls.
+//
+//****************************************************************************
+bool					Mem_rssStart( size_t a_targetBytes,
+									  unsigned long a_intervalMs, bool a_psi )
+{
+	if( __atomic_load_n( &s_watching, __ATOMIC_ACQUIRE ) ||
+		a_intervalMs == 0 )
+	{
+		return false;
+	}
+
+	s_cgroupDir[0] = '\0';
+	bool				inCgroup = findCgroup();
+	s_fromCgroup = false;
+	if( a_targetBytes == 0 && inCgroup )
+	{
+		a_targetBytes = cgroupValue( "memory.high" );
+		if( a_targetBytes == 0 )
+		{
+			a_targetBytes = cgroupValue( "memory.max" );
+		}
+		s_fromCgroup = a_targetBytes != 0;
+	}
+
+	s_psiFd = a_psi ? openPsi() : -1;
+	if( a_targetBytes == 0 && s_psiFd == -1 )
+	{
+		return false;
+	}
+	__atomic_store_n( &s_target, a_targetBytes, __ATOMIC_RELAXED );
+	s_interval = a_intervalMs;
+	Mem_rssCheck();
+
+	__atomic_store_n( &s_watching, true, __ATOMIC_RELEASE );
+	if( pthread_create( &s_watcher, NULL, watcher, NULL ) != 0 )
+	{
+		__atomic_store_n( &s_watching, false, __ATOMIC_RELEASE );
+		Mem_rssStop();
+		return false;
+	}
+	return true;
+}
+
+//****************************************************************************
+//
+//	Mem_rssStop() - stop watching, and let the caches fill again
+//
+//****************************************************************************
+void					Mem_rssStop()
+{
+	if( __atomic_exchange_n( &s_watching, false, __ATOMIC_ACQ_REL ) )
+	{
+		pthread_join( s_watcher, NULL );
+	}
+	if( s_psiFd != -1 )
+	{
+		close( s_psiFd );
+		s_psiFd = -1;
+	}
+	__atomic_store_n( &s_target, 0UL, __ATOMIC_RELAXED );
+	setPressure( false );
+}
+
+//****************************************************************************
+//
+//	Mem_rssTarget() - the target being kept to
+//
+//	RETURNS:
+//		the target in bytes, 0 if there is none
+//
+//****************************************************************************
+size_t					Mem_rssTarget()
+{
+	return __atomic_load_n( &s_target, __ATOMIC_RELAXED );
+}
+
+//****************************************************************************
+//
+//	Mem_rssUsage() - the memory use measured against the target
+//
+//	RETURNS:
+//		the cgroup's memory.current if the target is the cgroup's,
+//		else our RSS, in bytes
+//
+//****************************************************************************
+size_t					Mem_rssUsage()
+{
+	if( s_fromCgroup )
+	{
+		return cgroupValue( "memory.current" );
+	}
+	return residentBytes();
+}
+
+//****************************************************************************
+//
+//	Mem_rssPressure() - whether the caches are being kept lean
+//
+//****************************************************************************
+bool					Mem_rssPressure()
+{
+	return __atomic_load_n( &s_pressure, __ATOMIC_RELAXED );
+}
@@ -0,0 +1,40 @@
+#ifndef __MEM_RSS_HPP__
+#define __MEM_RSS_HPP__
+
+//	get size_t and caddr_t
+#include <sys/types.h>
+
+// The allocator holds on to memory it is not using, so the next
+// requests are quick: ready clusters, spare nodes, empty span heaps and
+// free overflow slabs. None of it shows as free to anyone else. Given an
+// RSS target, a watcher thread keeps an eye on memory use and gives all
+// of that back as use nears the target, keeping the caches lean until
+// use has fallen well below it again. Frames in thread caches are not
+// given back, the caches only keep fewer while lean.
+
+// Start watching every a_intervalMs milliseconds, and stop. A target of
+// 0 takes the cgroup's memory.high, or its memory.max without one, and
+// measures the cgroup's memory.current against it, otherwise our own
+// RSS is. With a_psi, memory stalls the kernel reports through PSI
+// count as nearing the target as soon as they happen.
+bool					Mem_rssStart( size_t a_targetBytes,
+									  unsigned long a_intervalMs, bool a_psi );
+void					Mem_rssStop();
+
+// The target being kept to, 0 if there is none
+size_t					Mem_rssTarget();
+
+// The memory use measured against it
+size_t					Mem_rssUsage();
+
+// Whether use is near the target, and the caches are kept lean
+bool					Mem_rssPressure();
+
+// Measure once, from the calling thread, giving memory back if use is
+// near the target. Returns the bytes given back.
+size_t					Mem_rssCheck();
+
+// Give back everything held for later, whatever the use
+size_t					Mem_rssRelease();
+
+#endif // __MEM_RSS_HPP__
@@ -0,0 +1,575 @@
+#ifndef			__MEM_SPAN_HPP__
+#include		"mem_span.hpp"
+#endif			// __MEM_SPAN_HPP__
+
+#ifndef			__MEM_CLST_HPP__
+#include		"mem_clst.hpp"
+#endif			// __MEM_CLST_HPP__
+
+#ifndef			__MEM_LAT_HPP__
+#include		"mem_lat.hpp"
+#endif			// __MEM_LAT_HPP__
+
+#ifndef			__MEM_WALK_HPP__
+#include		"mem_walk.hpp"
+#endif			// __MEM_WALK_HPP__
+
+#include		<sched.h>
+
+extern __thread unsigned long	s_latencyPath;
+
+// A heap starts with its page map, an entry for every page of the heap.
+// Only the entries of the first and last page of a span are kept up to
+// date, which is all that freeing and coalescing look at.
+struct MemSpan
+{
+	// the other free spans in the same bin, through their first pages
+	MemSpan*			d_next;
+	MemSpan*			d_prev;
+	// the span's first page in the heap and its length in pages
+	unsigned int		d_start;
+	unsigned int		d_pages;
+	bool				d_free;
+	// in the map entry of a heap's first page, set for heaps made by
+	// Mem_spanReserve(), which are kept mapped and faulted in
+	bool				d_pinned;
+};
+
+namespace
+{
+	// Heaps are mapped on their own, and with a 1MB span the largest
+	// a heap still holds a few of them.
+	const size_t		HEAP_SIZE = 4194304;
+	const long			HEAP_PAGES = HEAP_SIZE / MEM_SPAN_PAGE_SIZE;
+	const long			LARGEST_PAGES = MEM_SPAN_LARGEST / MEM_SPAN_PAGE_SIZE;
+
+	// the page map takes the first pages of its heap
+	const long			MAP_PAGES = ( sizeof(MemSpan) * HEAP_PAGES +
+									  MEM_SPAN_PAGE_SIZE - 1 ) /
+									MEM_SPAN_PAGE_SIZE;
+	const long			BODY_PAGES = HEAP_PAGES - MAP_PAGES;
+
+	// Bin n holds free spans of n pages, up to the largest span handed
+	// out. Longer free spans all go in the last bin, and any of them
+	// will do for any request.
+	const long			LONG_BIN = LARGEST_PAGES + 1;
+	const long			BINS = LONG_BIN + 1;
+	const long			MASK_WORDS = ( BINS + 63 ) / 64;
+
+	MemSpan*			s_bins[BINS];
+
+	// a bit for each bin that holds a span
+	unsigned long		s_binMask[MASK_WORDS];
+
+	// Heaps with nothing handed out are kept for the next requests,
+	// rather than mapping them again, up to KEPT_HEAPS of them, so a
+	// load that swings across a few heaps does not map and unmap them.
+	// Any more are given back.
+	const long			KEPT_HEAPS = 4;
+	MemSpan*			s_emptyHeaps[KEPT_HEAPS];
+	long				s_emptyCount = 0;
+
+	// Every heap, linked through the map entry of its first page. The
+	// map's own span is never free, so the links are not otherwise used.
+	MemSpan*			s_heaps = NULL;
+
+	size_t				s_freeBytes = 0;
+	size_t				s_usedBytes = 0;
+	size_t				s_heapBytes = 0;
+
+	// The bins and the page maps are changed in place, so only one
+	// thread at a time may be in here. Hold a spanGuard to get in.
+	bool				s_spanLock = false;
+
+	struct spanGuard
+	{
+		spanGuard()
+		{
+			while( __atomic_test_and_set( &s_spanLock, __ATOMIC_ACQUIRE ) )
+			{
+				sched_yield();
+			}
+		}
+		~spanGuard()
+		{
+			__atomic_clear( &s_spanLock, __ATOMIC_RELEASE );
+		}
+	};
+
+	//************************************************************************
+	//
+	//	binFor() - which bin a span of a_pages pages goes in
+	//
+	//************************************************************************
+	long				binFor( long a_pages )
+	{
+		return ( a_pages > LARGEST_PAGES ) ? LONG_BIN : a_pages;
+	}
+
+	//************************************************************************
+	//
+	//	markSpan() - set the map entries at both ends of a span
+	//
+	//	ARGUMENTS:
+	//		a_heap	- the heap's page map
+	//		a_start - the span's first page
+	//		a_pages - its length in pages
+	//		a_free	- whether it is free
+	//
+	//************************************************************************
+	void				markSpan( MemSpan* a_heap, long a_start, long a_pages,
+								  bool a_free )
+	{
+		MemSpan*		first = &a_heap[a_start];
+		MemSpan*		last = &a_heap[a_start + a_pages - 1];
+		first->d_start = last->d_start = a_start;
+		first->d_pages = last->d_pages = a_pages;
+		first->d_free = last->d_free = a_free;
+	}
+
+	//************************************************************************
+	//
+	//	pushFree() - mark a span free and put it in its bin
+	//
+	//************************************************************************
+	void				pushFree( MemSpan* a_heap, long a_start, long a_pages )
+	{
+		markSpan( a_heap, a_start, a_pages, true );
+
+		long			bin = binFor( a_pages );
+		MemSpan*		span = &a_heap[a_start];
+		span->d_prev = NULL;
+		span->d_next = s_bins[bin];
+		if( span->d_next != NULL )
+		{
+			span->d_next->d_prev = span;
+		}
+		s_bins[bin] = span;
+		s_binMask[bin / 64] |= 1UL << ( bin % 64 );
+	}
+
+	//************************************************************************
+	//
+	//	unlinkFree() - take a free span out of its bin
+	//
+	//************************************************************************
+	void				unlinkFree( MemSpan* a_span )
+	{
+		long			bin = binFor( a_span->d_pages );
+		if( a_span->d_prev != NULL )
+		{
+			a_span->d_prev->d_next = a_span->d_next;
+		}
+		else
+		{
+			s_bins[bin] = a_span->d_next;
+			if( s_bins[bin] == NULL )
+			{
+				s_binMask[bin / 64] &= ~( 1UL << ( bin % 64 ) );
+			}
+		}
+		if( a_span->d_next != NULL )
+		{
+			a_span->d_next->d_prev = a_span->d_prev;
+		}
+	}
+
+	//************************************************************************
+	//
+	//	findFree() - find the shortest free span of at least a_pages pages
+	//
+	//	RETURNS:
+	//		the span, still in its bin
+	//		NULL if no heap has one
+	//
+	//************************************************************************
+	MemSpan*			findFree( long a_pages )
+	{
+		long			bin = binFor( a_pages );
+		long			word = bin / 64;
+		unsigned long	bits = s_binMask[word] & ( ~0UL << ( bin % 64 ) );
+		while( bits == 0 )
+		{
+			if( ++word == MASK_WORDS )
+			{
+				return NULL;
+			}
+			bits = s_binMask[word];
+		}
+		return s_bins[word * 64 + __builtin_ctzl( bits )];
+	}
+
+	//************************************************************************
+	//
+	//	addHeap() - map another heap and put its pages in the bins
+	//
+	//	RETURNS:
+	//		true if there is a new heap
+	//		false if it could not be mapped
+	//
+	//************************************************************************
+	bool				addHeap()
+	{
+		MemSpan*		heap = (MemSpan*)Cluster_request( HEAP_SIZE );
+		s_latencyPath |= MEM_LATENCY_CLUSTER_MOVED;
+		if( heap == NULL )
+		{
+			return false;
+		}
+		s_heapBytes += HEAP_SIZE;
+
+		// the map's own pages are a span that is never freed, so
+		// nothing coalesces into them
+		markSpan( heap, 0, MAP_PAGES, false );
+		heap->d_pinned = false;
+		heap->d_prev = NULL;
+		heap->d_next = s_heaps;
+		if( s_heaps != NULL )
+		{
+			s_heaps->d_prev = heap;
+		}
+		s_heaps = heap;
+		pushFree( heap, MAP_PAGES, BODY_PAGES );
+		s_freeBytes += BODY_PAGES * MEM_SPAN_PAGE_SIZE;
+		return true;
+	}
+
+	//************************************************************************
+	//
+	//	releaseHeap() - give an empty heap back, its span already unbinned
+	//
+	//************************************************************************
+	void				releaseHeap( MemSpan* a_heap )
+	{
+		if( a_heap->d_prev != NULL )
+		{
+			a_heap->d_prev->d_next = a_heap->d_next;
+		}
+		else
+		{
+			s_heaps = a_heap->d_next;
+		}
+		if( a_heap->d_next != NULL )
+		{
+			a_heap->d_next->d_prev = a_heap->d_prev;
+		}
+		s_freeBytes -= BODY_PAGES * MEM_SPAN_PAGE_SIZE;
+		s_heapBytes -= HEAP_SIZE;
+		Cluster_release( (caddr_t)a_heap, HEAP_SIZE );
+		s_latencyPath |= MEM_LATENCY_CLUSTER_MOVED;
+	}
+}
+
+//****************************************************************************
+//
+//	Mem_spanAlloc() - get a run of whole pages
+//
+//	ARGUMENTS:
+//		a_size - how many bytes the run must hold
+//		a_span - set to the span, to free it by
+//
+//	RETURNS:
+//		the start of the run, page aligned
+//		NULL if a_size is over MEM_SPAN_LARGEST or no heap could be mapped
+//
+//	NOTE:
+//		The shortest free span that is long enough is split, and what is
+//		left over goes back in the bins.
+//
+//****************************************************************************
+caddr_t					Mem_spanAlloc( size_t a_size, MemSpan** a_span )
+{
+	long				pages = ( a_size + MEM_SPAN_PAGE_SIZE - 1 ) /
+								MEM_SPAN_PAGE_SIZE;
+	if( pages == 0 )
+	{
+		pages = 1;
+	}
+	if( pages > LARGEST_PAGES )
+	{
+		return NULL;
+	}
+
+	spanGuard			guard;
+
+	MemSpan*			span = findFree( pages );
+	if( span == NULL )
+	{
+		if( !addHeap() )
+		{
+			return NULL;
+		}
+		span = findFree( pages );
+	}
+	unlinkFree( span );
+
+	long				start = span->d_start;
+	long				length = span->d_pages;
+	MemSpan*			heap = span - start;
+	if( length == BODY_PAGES )
+	{
+		for( long index = 0; index < s_emptyCount; index++ )
+		{
+			if( s_emptyHeaps[index] == heap )
+			{
+				s_emptyHeaps[index] = s_emptyHeaps[--s_emptyCount];
+				break;
+			}
+		}
+	}
+
+	markSpan( heap, start, pages, false );
+	if( length > pages )
+	{
+		pushFree( heap, start + pages, length - pages );
+	}
+	s_freeBytes -= pages * MEM_SPAN_PAGE_SIZE;
+	s_usedBytes += pages * MEM_SPAN_PAGE_SIZE;
+
+	*a_span = span;
+	return (caddr_t)heap + start * MEM_SPAN_PAGE_SIZE;
+}
+
+//****************************************************************************
+//
+//	Mem_spanFree() - free a span, joining it to free spans on either side
+//
+//	ARGUMENTS:
+//		a_span - the span Mem_spanAlloc() handed back
+//
+//	NOTE:
+//		A heap left with nothing handed out is kept if fewer than
+//		KEPT_HEAPS are, otherwise it is given back to the OS. Pinned
+//		heaps are always kept, and not counted.
+//
+//****************************************************************************
+void					Mem_spanFree( MemSpan* a_span )
+{
+	spanGuard			guard;
+
+	long				start = a_span->d_start;
+	long				pages = a_span->d_pages;
+	long				end = start + pages;
+	MemSpan*			heap = a_span - start;
+	s_usedBytes -= pages * MEM_SPAN_PAGE_SIZE;
+	s_freeBytes += pages * MEM_SPAN_PAGE_SIZE;
+
+	// the map entry before the span is the last page of the span before
+	// it, and the map's own span is never free, so this stays in the heap
+	MemSpan*			before = &heap[start - 1];
+	if( before->d_free )
+	{
+		MemSpan*		first = &heap[before->d_start];
+		unlinkFree( first );
+		start = first->d_start;
+		pages += first->d_pages;
+	}
+	if( end < HEAP_PAGES && heap[end].d_free )
+	{
+		unlinkFree( &heap[end] );
+		pages += heap[end].d_pages;
+	}
+
+	if( pages == BODY_PAGES && !heap->d_pinned )
+	{
+		if( s_emptyCount == KEPT_HEAPS )
+		{
+			releaseHeap( heap );
+			return;
+		}
+		s_emptyHeaps[s_emptyCount++] = heap;
+	}
+	pushFree( heap, start, pages );
+}
+
+//****************************************************************************
+//
+//	Mem_spanReserve() - map heaps for spans ahead of time and keep them
+//
+//	ARGUMENTS:
+//		a_size	- the bytes each span must hold
+//		a_count - how many such spans to make room for
+//		a_lock	- true to lock the heaps in memory
+//
+//	RETURNS:
+//		true if the heaps are mapped, faulted in, and locked if asked
+//		false if any of it could not be done
+//
+//	NOTE:
+//		Room is made on top of what the heaps held already. The new
+//		heaps are pinned, they are never given back or purged.
+//
+//****************************************************************************
+bool					Mem_spanReserve( size_t a_size, size_t a_count,
+										 bool a_lock )
+{
+	long				pages = Mem_spanGoodSize( a_size ) / MEM_SPAN_PAGE_SIZE;
+	if( pages > LARGEST_PAGES )
+	{
+		return false;
+	}
+	size_t				perHeap = BODY_PAGES / pages;
+	size_t				heaps = ( a_count + perHeap - 1 ) / perHeap;
+
+	spanGuard			guard;
+
+	bool				reserved = true;
+	for( size_t index = 0; index < heaps; index++ )
+	{
+		if( !addHeap() )
+		{
+			return false;
+		}
+		s_heaps->d_pinned = true;
+		reserved = Cluster_populate( (caddr_t)s_heaps, HEAP_SIZE, a_lock ) &&
+				   reserved;
+	}
+	return reserved;
+}
+
+//****************************************************************************
+//
+//	Mem_spanEnd() - where a span ends
+//
+//	RETURNS:
+//		the address just past the span's last page
+//
+//****************************************************************************
+caddr_t					Mem_spanEnd( MemSpan* a_span )
+{
+	MemSpan*			heap = a_span - a_span->d_start;
+	return (caddr_t)heap +
+		   ( a_span->d_start + a_span->d_pages ) * MEM_SPAN_PAGE_SIZE;
+}
+
+//****************************************************************************
+//
+//	Mem_spanGoodSize() - how many bytes a span for a request would hold
+//
+//****************************************************************************
+size_t					Mem_spanGoodSize( size_t a_size )
+{
+	if( a_size == 0 )
+	{
+		return MEM_SPAN_PAGE_SIZE;
+	}
+	return ( a_size + MEM_SPAN_PAGE_SIZE - 1 ) & ~( MEM_SPAN_PAGE_SIZE - 1 );
+}
+
+//****************************************************************************
+//
+//	Mem_spanTrim() - give back the heaps kept with nothing handed out
+//
+//	RETURNS:
+//		the number of bytes unmapped
+//
+//****************************************************************************
+size_t					Mem_spanTrim()
+{
+	spanGuard			guard;
+
+	size_t				trimmed = s_emptyCount * HEAP_SIZE;
+	while( s_emptyCount > 0 )
+	{
+		MemSpan*		heap = s_emptyHeaps[--s_emptyCount];
+		unlinkFree( &heap[MAP_PAGES] );
+		releaseHeap( heap );
+	}
+	return trimmed;
+}
+
+//****************************************************************************
+//
+//	Mem_spanPurge() - let the OS have the pages of every free span
+//
+//	RETURNS:
+//		the number of bytes purged
+//
+//	NOTE:
+//		The spans stay mapped and binned, and read back as zeroes. The
+//		page maps are in pages of their own and are left alone, and so
+//		are pinned heaps.
+//
+//****************************************************************************
+size_t					Mem_spanPurge()
+{
+	spanGuard			guard;
+
+	size_t				purged = 0;
+	for( long bin = 1; bin < BINS; bin++ )
+	{
+		for( MemSpan* span = s_bins[bin]; span != NULL; span = span->d_next )
+		{
+			MemSpan*	heap = span - span->d_start;
+			if( heap->d_pinned )
+			{
+				continue;
+			}
+			size_t		length = span->d_pages * MEM_SPAN_PAGE_SIZE;
+			Cluster_purge( (caddr_t)heap + span->d_start * MEM_SPAN_PAGE_SIZE,
+						   length );
+			purged += length;
+		}
+	}
+	return purged;
+}
+
+//****************************************************************************
+//
+//	Mem_spanWalk() - report every span of every heap
+//
+//	ARGUMENTS:
+//		a_walker  - called with each span's entry
+//		a_context - passed on to a_walker
+//
+//	RETURNS:
+//		false if a_walker stopped the walk
+//
+//	NOTE:
+//		The map entry of a span's first page is always up to date, so
+//		each span leads to the next. The maps are not reported.
+//
+//****************************************************************************
+bool					Mem_spanWalk( MemHeapWalker a_walker, void* a_context )
+{
+	spanGuard			guard;
+
+	MemHeapEntry		entry = {};
+	for( MemSpan* heap = s_heaps; heap != NULL; heap = heap->d_next )
+	{
+		for( long page = MAP_PAGES; page < HEAP_PAGES;
+			 page += heap[page].d_pages )
+		{
+			entry.d_kind = heap[page].d_free ? MEM_HEAP_SPAN_FREE :
+											   MEM_HEAP_SPAN_USED;
+			entry.d_address = (caddr_t)heap + page * MEM_SPAN_PAGE_SIZE;
+			entry.d_bytes = heap[page].d_pages * MEM_SPAN_PAGE_SIZE;
+			if( !a_walker( &entry, a_context ) )
+			{
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+//****************************************************************************
+//
+//	Mem_spanStats() - report how full the span heaps are
+//
+//	ARGUMENTS:
+//		a_freeBytes - set to the bytes in free spans
+//		a_usedBytes - set to the bytes in spans handed out
+//		a_heapBytes - set to the bytes of every heap held, maps included
+//
+//****************************************************************************
+void					Mem_spanStats( size_t* a_freeBytes,
+									   size_t* a_usedBytes,
+									   size_t* a_heapBytes )
+{
+	spanGuard			guard;
+
+	*a_freeBytes = s_freeBytes;
+	*a_usedBytes = s_usedBytes;
+	*a_heapBytes = s_heapBytes;
+}
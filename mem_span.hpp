@@ -0,0 +1,44 @@
+#ifndef __MEM_SPAN_HPP__
+#define __MEM_SPAN_HPP__
+
+//	get size_t and caddr_t
+#include <sys/types.h>
+
+// Requests too big for the size categories but no bigger than
+// MEM_SPAN_LARGEST get a run of whole pages, a span, cut from a large
+// heap. Free spans are kept in bins by their length in pages, and a map
+// with an entry per page finds the spans on either side of one being
+// freed, so neighbors coalesce. Both take constant time, which the
+// overflow pool's list walks do not.
+
+const size_t			MEM_SPAN_PAGE_SIZE = 4096;
+const size_t			MEM_SPAN_LARGEST = 1048576;
+
+// The map entry of a span's first page. Keep it to free the span by.
+struct MemSpan;
+
+// Get a span holding a_size bytes, page aligned, NULL if out of memory
+caddr_t					Mem_spanAlloc( size_t a_size, MemSpan** a_span );
+void					Mem_spanFree( MemSpan* a_span );
+
+// Where a span ends, and how many bytes one for a request would hold
+caddr_t					Mem_spanEnd( MemSpan* a_span );
+size_t					Mem_spanGoodSize( size_t a_size );
+
+// Map and fault in heaps with room for a_count spans of a_size bytes,
+// and keep them however little of them is used
+bool					Mem_spanReserve( size_t a_size, size_t a_count,
+										 bool a_lock );
+
+// give the heaps kept in case they are needed again back to the OS
+size_t					Mem_spanTrim();
+
+// and let the OS have the pages of free spans, keeping them mapped
+size_t					Mem_spanPurge();
+
+// free bytes, bytes handed out, and bytes mapped for heaps
+void					Mem_spanStats( size_t* a_freeBytes,
+									   size_t* a_usedBytes,
+									   size_t* a_heapBytes );
+
+#endif // __MEM_SPAN_HPP__
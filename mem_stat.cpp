@@ -0,0 +1,372 @@
+#ifndef			__MEM_STAT_HPP__
+#include		"mem_stat.hpp"
+#endif			// __MEM_STAT_HPP__
+
+#ifndef			__MEM_NODE_HPP__
+#include		"mem_node.hpp"
+#endif			// __MEM_NODE_HPP__
+
+#ifndef			__MEM_CLST_HPP__
+#include		"mem_clst.hpp"
+#endif			// __MEM_CLST_HPP__
+
+#ifndef			__MEM_SPAN_HPP__
+#include		"mem_span.hpp"
+#endif			// __MEM_SPAN_HPP__
+
+#ifndef			__MEM_VSIZ_HPP__
+#include		"mem_vsiz.hpp"
+#endif			// __MEM_VSIZ_HPP__
+
+#ifndef			__MEM_EPCH_HPP__
+#include		"mem_epch.hpp"
+#endif			// __MEM_EPCH_HPP__
+
+#include		<fcntl.h>
+#include		<pthread.h>
+#include		<sched.h>
+#include		<stddef.h>
+#include		<stdio.h>
+#include		<sys/mman.h>
+#include		<time.h>
+#include		<unistd.h>
+
+namespace
+{
+	// how many times a reader tries for a snapshot before giving up
+	const long			READ_TRIES = 1000;
+
+	const size_t		PAGE_WORDS = sizeof(MemStatsPage) /
+									 sizeof(unsigned long);
+
+	// the page we publish to, and the thread that does it
+	MemStatsPage*		s_statsPage = NULL;
+	pthread_t			s_publisher;
+	bool				s_publishing = false;
+
+	// serializes writers, Mem_statsPublish() may be called from
+	// anywhere while the publisher runs
+	bool				s_publishLock = false;
+
+	//************************************************************************
+	//
+	//	pageName() - the shm_open() name of a process's stats page
+	//
+	//************************************************************************
+	void				pageName( pid_t a_pid, char* a_name, size_t a_size )
+	{
+		snprintf( a_name, a_size, "/fstalloc.%ld", (long)a_pid );
+	}
+
+	//************************************************************************
+	//
+	//	now() - CLOCK_MONOTONIC in nanoseconds
+	//
+	//************************************************************************
+	unsigned long		now()
+	{
+		struct timespec	time;
+		clock_gettime( CLOCK_MONOTONIC, &time );
+		return time.tv_sec * 1000000000UL + time.tv_nsec;
+	}
+
+	//************************************************************************
+	//
+	//	gather() - fill in a snapshot of the counters
+	//
+	//************************************************************************
+	void				gather( MemStatsPage* a_page )
+	{
+		for( long index = 0; index < MEM_STATS_CLASSES; index++ )
+		{
+			MemNodeStats	nodeStats;
+			MemNode_stats( index + MEM_NODE_SMALLEST_SIZE, &nodeStats );
+
+			MemStatsClass*	classStats = &a_page->d_classes[index];
+			classStats->d_blockSize = 1UL << ( index + MEM_NODE_SMALLEST_SIZE );
+			classStats->d_allocations = nodeStats.d_allocations;
+			classStats->d_live = nodeStats.d_live < 0 ? 0 : nodeStats.d_live;
+			classStats->d_nodes = nodeStats.d_nodes + 1;
+			classStats->d_clustersHooked = nodeStats.d_clustersHooked;
+			classStats->d_clustersReleased = nodeStats.d_clustersReleased;
+			classStats->d_clustersDrained = nodeStats.d_clustersDrained;
+			classStats->d_clusterBytes = nodeStats.d_clusterBytes;
+			classStats->d_clusterSize = nodeStats.d_clusterSize;
+			classStats->d_purgedBytes = nodeStats.d_purgedBytes;
+		}
+
+		ClusterStats	clusterStats;
+		Cluster_stats( &clusterStats );
+		a_page->d_clusterBytes = clusterStats.d_clusterBytes;
+		a_page->d_bigBytes = clusterStats.d_bigBytes;
+		a_page->d_reservedBytes = clusterStats.d_reservedBytes;
+		a_page->d_committedBytes = clusterStats.d_committedBytes;
+
+		size_t			freeBytes;
+		size_t			usedBytes;
+		size_t			slabBytes;
+		Mem_varSizeStats( &freeBytes, &usedBytes, &slabBytes );
+		a_page->d_varSizeFree = freeBytes;
+		a_page->d_varSizeUsed = usedBytes;
+		a_page->d_varSizeSlabs = slabBytes;
+
+		size_t			heapBytes;
+		Mem_spanStats( &freeBytes, &usedBytes, &heapBytes );
+		a_page->d_spanFree = freeBytes;
+		a_page->d_spanUsed = usedBytes;
+		a_page->d_spanHeaps = heapBytes;
+
+		MemEpochStats	epochStats;
+		Mem_epochStats( &epochStats );
+		a_page->d_retired = epochStats.d_retired;
+		a_page->d_reclaimed = epochStats.d_reclaimed;
+
+		a_page->d_publishedAt = now();
+	}
+
+	//************************************************************************
+	//
+	//	publisher() - publish the counters until told to stop
+	//
+	//************************************************************************
+	void*				publisher( void* )
+	{
+		while( __atomic_load_n( &s_publishing, __ATOMIC_ACQUIRE ) )
+		{
+			Mem_statsPublish();
+
+			unsigned long	interval = s_statsPage->d_interval;
+			struct timespec	delay;
+			delay.tv_sec = interval / 1000;
+			delay.tv_nsec = ( interval % 1000 ) * 1000000;
+			nanosleep( &delay, NULL );
+		}
+		return NULL;
+	}
+}
+
+//****************************************************************************
+//
+//	Mem_statsStart() - start publishing the allocator's counters
+//
+//	ARGUMENTS:
+//		a_intervalMs - milliseconds between publishes
+//
+//	RETURNS:
+//		true if the page was made and the publisher is running
+//		false if it could not be, or already was
+//
+//	NOTE:
+//		The page is /dev/shm/fstalloc.<pid>, readable only by our user.
+//
+//****************************************************************************
+bool					Mem_statsStart( unsigned long a_intervalMs )
+{
+	if( s_statsPage != NULL || a_intervalMs == 0 )
+	{
+		return false;
+	}
+
+	char				name[64];
+	pageName( getpid(), name, sizeof(name) );
+	int					fd = shm_open( name, O_RDWR|O_CREAT|O_TRUNC, 0600 );
+	if( fd == -1 )
+	{
+		perror( "shm_open: " );
+		return false;
+	}
+	if( ftruncate( fd, sizeof(MemStatsPage) ) == -1 )
+	{
+		perror( "ftruncate: " );
+		close( fd );
+		shm_unlink( name );
+		return false;
+	}
+	MemStatsPage*		page = (MemStatsPage*) mmap( (caddr_t) 0,
+													 sizeof(MemStatsPage),
+													 PROT_READ|PROT_WRITE,
+													 MAP_SHARED, fd, 0 );
+	close( fd );
+	if( page == (MemStatsPage*)MAP_FAILED )
+	{
+		perror( "mmap: " );
+		shm_unlink( name );
+		return false;
+	}
+
+	page->d_version = MEM_STATS_VERSION;
+	page->d_pid = getpid();
+	page->d_interval = a_intervalMs;
+	__atomic_store_n( &page->d_magic, MEM_STATS_MAGIC, __ATOMIC_RELEASE );
+	s_statsPage = page;
+
+	__atomic_store_n( &s_publishing, true, __ATOMIC_RELEASE );
+	if( pthread_create( &s_publisher, NULL, publisher, NULL ) != 0 )
+	{
+		__atomic_store_n( &s_publishing, false, __ATOMIC_RELEASE );
+		s_statsPage = NULL;
+		munmap( (caddr_t)page, sizeof(MemStatsPage) );
+		shm_unlink( name );
+		return false;
+	}
+	return true;
+}
+
+//****************************************************************************
+//
+//	Mem_statsStop() - stop publishing and remove the page
+//
+//****************************************************************************
+void					Mem_statsStop()
+{
+	if( s_statsPage == NULL )
+	{
+		return;
+	}
+	__atomic_store_n( &s_publishing, false, __ATOMIC_RELEASE );
+	pthread_join( s_publisher, NULL );
+
+	char				name[64];
+	pageName( getpid(), name, sizeof(name) );
+	shm_unlink( name );
+	munmap( (caddr_t)s_statsPage, sizeof(MemStatsPage) );
+	s_statsPage = NULL;
+}
+
+//****************************************************************************
+//
+//	Mem_statsPublish() - write the counters to the page now
+//
+//	NOTE:
+//		The counters are gathered first, so readers only ever wait on
+//		the copy into the page.
+//
+//****************************************************************************
+void					Mem_statsPublish()
+{
+	MemStatsPage*		page = s_statsPage;
+	if( page == NULL )
+	{
+		return;
+	}
+
+	MemStatsPage		snapshot;
+	gather( &snapshot );
+
+	while( __atomic_test_and_set( &s_publishLock, __ATOMIC_ACQUIRE ) )
+	{
+		sched_yield();
+	}
+
+	unsigned long		sequence = page->d_sequence;
+	__atomic_store_n( &page->d_sequence, sequence + 1, __ATOMIC_RELAXED );
+	__atomic_thread_fence( __ATOMIC_RELEASE );
+
+	// everything after the header words
+	unsigned long*		from = (unsigned long*)&snapshot;
+	unsigned long*		to = (unsigned long*)page;
+	for( size_t word = offsetof( MemStatsPage, d_publishedAt ) /
+					   sizeof(unsigned long);
+		 word < PAGE_WORDS; word++ )
+	{
+		__atomic_store_n( &to[word], from[word], __ATOMIC_RELAXED );
+	}
+
+	__atomic_store_n( &page->d_sequence, sequence + 2, __ATOMIC_RELEASE );
+	__atomic_clear( &s_publishLock, __ATOMIC_RELEASE );
+}
+
+//****************************************************************************
+//
+//	Mem_statsAttach() - map the stats page of a process
+//
+//	ARGUMENTS:
+//		a_pid - the process
+//
+//	RETURNS:
+//		the page, read only
+//		NULL if the process does not publish one
+//
+//****************************************************************************
+const MemStatsPage*		Mem_statsAttach( pid_t a_pid )
+{
+	char				name[64];
+	pageName( a_pid, name, sizeof(name) );
+	int					fd = shm_open( name, O_RDONLY, 0 );
+	if( fd == -1 )
+	{
+		return NULL;
+	}
+	MemStatsPage*		page = (MemStatsPage*) mmap( (caddr_t) 0,
+													 sizeof(MemStatsPage),
+													 PROT_READ, MAP_SHARED,
+													 fd, 0 );
+	close( fd );
+	if( page == (MemStatsPage*)MAP_FAILED )
+	{
+		return NULL;
+	}
+	if( __atomic_load_n( &page->d_magic, __ATOMIC_ACQUIRE ) !=
+														MEM_STATS_MAGIC ||
+		page->d_version != MEM_STATS_VERSION )
+	{
+		munmap( (caddr_t)page, sizeof(MemStatsPage) );
+		return NULL;
+	}
+	return page;
+}
+
+//****************************************************************************
+//
+//	Mem_statsDetach() - unmap a page from Mem_statsAttach()
+//
+//****************************************************************************
+void					Mem_statsDetach( const MemStatsPage* a_page )
+{
+	if( a_page != NULL )
+	{
+		munmap( (caddr_t)a_page, sizeof(MemStatsPage) );
+	}
+}
+
+//****************************************************************************
+//
+//	Mem_statsRead() - take a consistent copy of a stats page
+//
+//	ARGUMENTS:
+//		a_page - the page
+//		a_copy - where to copy it
+//
+//	RETURNS:
+//		true if a_copy holds one publish, whole
+//		false if every try overlapped a write
+//
+//****************************************************************************
+bool					Mem_statsRead( const MemStatsPage* a_page,
+									   MemStatsPage* a_copy )
+{
+	const unsigned long*	from = (const unsigned long*)a_page;
+	unsigned long*			to = (unsigned long*)a_copy;
+
+	for( long tries = 0; tries < READ_TRIES; tries++ )
+	{
+		unsigned long	sequence =
+						__atomic_load_n( &a_page->d_sequence, __ATOMIC_ACQUIRE );
+		if( ( sequence & 1 ) != 0 )
+		{
+			sched_yield();
+			continue;
+		}
+		for( size_t word = 0; word < PAGE_WORDS; word++ )
+		{
+			to[word] = __atomic_load_n( &from[word], __ATOMIC_RELAXED );
+		}
+		__atomic_thread_fence( __ATOMIC_ACQUIRE );
+		if( __atomic_load_n( &a_page->d_sequence, __ATOMIC_RELAXED ) ==
+																sequence )
+		{
+			return true;
+		}
+	}
+	return false;
+}
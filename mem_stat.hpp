@@ -0,0 +1,89 @@
+#ifndef __MEM_STAT_HPP__
+#define __MEM_STAT_HPP__
+
+//	get size_t, caddr_t and pid_t
+#include <sys/types.h>
+
+// The allocator can publish its counters to a page of shared memory,
+// /dev/shm/fstalloc.<pid>, for fststat or anything else to read while
+// the process runs. The whole page is rewritten under a sequence count
+// that is odd while a write is under way, so a reader that sees the
+// same even count before and after copying has a consistent snapshot.
+
+// "fststats" read as a little endian word
+const unsigned long		MEM_STATS_MAGIC = 0x7374617473747366UL;
+const unsigned long		MEM_STATS_VERSION = 5;
+
+// one entry per fixed size category, blocks of 32 << i bytes
+const long				MEM_STATS_CLASSES = 10;
+
+struct MemStatsClass
+{
+	unsigned long		d_blockSize;
+	unsigned long		d_allocations;		// blocks ever handed out
+	unsigned long		d_live;				// blocks in use now
+	unsigned long		d_nodes;			// nodes, the root one included
+	unsigned long		d_clustersHooked;	// clusters ever hooked
+	unsigned long		d_clustersReleased;	// clusters ever given back
+	unsigned long		d_clustersDrained;	// of those, by nodes left to
+											// drain
+	unsigned long		d_clusterBytes;		// bytes of cluster held now
+	unsigned long		d_clusterSize;		// what the next node gets
+	unsigned long		d_purgedBytes;		// of d_clusterBytes, free pages
+											// given back to the OS
+};
+
+// Every field is an unsigned long, so readers can copy it a word at
+// a time.
+struct MemStatsPage
+{
+	unsigned long		d_magic;
+	unsigned long		d_version;
+	unsigned long		d_sequence;
+	unsigned long		d_pid;
+
+	// milliseconds between publishes, and CLOCK_MONOTONIC nanoseconds
+	// at the last one
+	unsigned long		d_interval;
+	unsigned long		d_publishedAt;
+
+	MemStatsClass		d_classes[MEM_STATS_CLASSES];
+
+	// cluster layer
+	unsigned long		d_clusterBytes;
+	unsigned long		d_bigBytes;
+	unsigned long		d_reservedBytes;
+	unsigned long		d_committedBytes;
+
+	// overflow pool
+	unsigned long		d_varSizeFree;
+	unsigned long		d_varSizeUsed;
+	unsigned long		d_varSizeSlabs;
+
+	// span heaps
+	unsigned long		d_spanFree;
+	unsigned long		d_spanUsed;
+	unsigned long		d_spanHeaps;
+
+	// hunks handed to Mem_retire(), and of those released
+	unsigned long		d_retired;
+	unsigned long		d_reclaimed;
+};
+
+// Start publishing every a_intervalMs milliseconds from a thread of
+// our own, and stop again, removing the page
+bool					Mem_statsStart( unsigned long a_intervalMs );
+void					Mem_statsStop();
+
+// Publish now, if started
+void					Mem_statsPublish();
+
+// Map the page another process publishes, NULL if it has none
+const MemStatsPage*		Mem_statsAttach( pid_t a_pid );
+void					Mem_statsDetach( const MemStatsPage* a_page );
+
+// Copy a consistent snapshot, false if the writer kept it busy
+bool					Mem_statsRead( const MemStatsPage* a_page,
+									   MemStatsPage* a_copy );
+
+#endif // __MEM_STAT_HPP__
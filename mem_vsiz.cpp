@@ -6,8 +6,21 @@
 #include		"mem_clst.hpp"
 #endif			// __MEM_CLST_HPP__
 
+#ifndef			__MEM_LAT_HPP__
+#include		"mem_lat.hpp"
+#endif			// __MEM_LAT_HPP__
+
+#ifndef			__MEM_WALK_HPP__
+#include		"mem_walk.hpp"
+#endif			// __MEM_WALK_HPP__
+
+#include		<stddef.h>
 #include		<stdio.h>
+#include		<string.h>
 #include		<assert.h>
+#include		<sched.h>
+
+extern __thread unsigned long	s_latencyPath;
 
 // file-static structures functions and data
 namespace
@@ -35,6 +48,81 @@ namespace
 	const unsigned long SMALLEST_ALLOC = 32;
 	// Mask for doing mods of SMALLEST_ALLOC
 	const unsigned long SMALLEST_ALLOC_MASK = SMALLEST_ALLOC-1;
+
+	// once this many bytes have been freed since the free list was last
+	// trimmed, Mem_varSizeFree() hands them back to the OS
+	const size_t		DEFAULT_TRIM_THRESHOLD = 1 << 20;
+
+	// a hunk handed to us by Cluster_bigRequest()
+	struct slab
+	{
+		caddr_t			d_base;
+		size_t			d_size;
+		// color offset of the first node in the slab
+		size_t			d_offset;
+		// made by Mem_varSizeReserve(), never unmapped or purged
+		bool			d_pinned;
+	};
+
+	// table of every slab we hold, so we know which ranges
+	// of the free list can be unmapped. Lives in a cluster of its
+	// own, replaced by one twice the size whenever it fills.
+	slab*				s_slabTable = NULL;
+	long				s_slabCount = 0;
+	size_t				s_slabTableSize = 0;
+
+	// how many bytes are on the free list right now
+	size_t				s_freeBytes = 0;
+
+	// How many of those were freed since the last trim, and may still be
+	// resident. Purged pages stay on the free list, so s_freeBytes alone
+	// would call for a trim on every free.
+	size_t				s_unpurgedBytes = 0;
+
+	// free bytes we are willing to keep before trimming
+	size_t				s_trimThreshold = DEFAULT_TRIM_THRESHOLD;
+
+	// how many slabs have been colored
+	unsigned long		s_colorSequence = 0;
+
+	// The free and used lists are walked and relinked in place, so only
+	// one thread at a time may be in here. Hold a listGuard to get in.
+	bool				s_listLock = false;
+
+	struct listGuard
+	{
+		listGuard()
+		{
+			while( __atomic_test_and_set( &s_listLock, __ATOMIC_ACQUIRE ) )
+			{
+				sched_yield();
+			}
+		}
+		~listGuard()
+		{
+			__atomic_clear( &s_listLock, __ATOMIC_RELEASE );
+		}
+	};
+
+	// how big a node is needed to hold a request
+	size_t				nodeSize( size_t a_size );
+
+	// remember a new slab
+	bool				addSlab( caddr_t a_base, size_t a_size,
+								 size_t a_offset, bool a_pinned );
+
+	// put a new slab on the free list
+	node*				insertSlab( caddr_t a_slab, size_t a_size,
+									bool a_pinned );
+
+	// purge the pages of a free range that are not in pinned slabs
+	void				purgeFree( caddr_t a_start, caddr_t a_end );
+
+	// give whole slabs and whole pages of a free node back to the OS
+	node*				trimNode( node* a_prevNode, node* a_nodeToTrim );
+
+	// trim every node on the free list
+	void				trimList();
 }
 
 // Make nodes pointing to self to serve as the base for the lists.
@@ -45,6 +133,258 @@ node		s_usedListHead = { 0, &s_usedListHead, '\0' };
 node_ptr	s_freeList = &s_freeListHead;
 node_ptr	s_usedList = &s_usedListHead;
 
+namespace
+{
+	//************************************************************************
+	//
+	//	nodeSize() - how big a node is needed to hold a request
+	//
+	//	ARGUMENTS:
+	//		a_size - the number of bytes requested
+	//
+	//	RETURNS:
+	//		the node size, header included
+	//
+	//************************************************************************
+	size_t				nodeSize( size_t a_size )
+	{
+		// increase the required node size to include the header
+		size_t			requestSize = a_size;
+		requestSize += HEADER_SIZE;
+
+		// and align it on a SMALLEST_ALLOC boundary
+		requestSize += SMALLEST_ALLOC - ( requestSize & SMALLEST_ALLOC_MASK );
+		return requestSize;
+	}
+
+	//************************************************************************
+	//
+	//	addSlab() - record a slab from Cluster_bigRequest() in s_slabTable
+	//
+	//	ARGUMENTS:
+	//		a_base	 - start of the slab
+	//		a_size	 - size of the slab
+	//		a_offset - color offset of the slab's first node
+	//		a_pinned - true to never trim it
+	//
+	//	RETURNS:
+	//		true if the slab is recorded
+	//		false if the table was full and could not be grown, and the
+	//		slab must not be used, as trimming could not tell it apart
+	//
+	//************************************************************************
+	bool				addSlab( caddr_t a_base, size_t a_size,
+								 size_t a_offset, bool a_pinned )
+	{
+		if( (size_t)s_slabCount >= s_slabTableSize / sizeof(slab) )
+		{
+			size_t		tableSize = s_slabTable == NULL ? CLUSTERSIZE :
+														  2 * s_slabTableSize;
+			slab*		table = (slab*)Cluster_request( tableSize );
+			if( table == NULL )
+			{
+				return false;
+			}
+			if( s_slabTable != NULL )
+			{
+				memcpy( table, s_slabTable, s_slabCount * sizeof(slab) );
+				Cluster_release( (caddr_t)s_slabTable, s_slabTableSize );
+			}
+			s_slabTable = table;
+			s_slabTableSize = tableSize;
+		}
+		s_slabTable[s_slabCount].d_base = a_base;
+		s_slabTable[s_slabCount].d_size = a_size;
+		s_slabTable[s_slabCount].d_offset = a_offset;
+		s_slabTable[s_slabCount].d_pinned = a_pinned;
+		s_slabCount++;
+		return true;
+	}
+
+	//************************************************************************
+	//
+	//	insertSlab() - make a new slab a node on the free list
+	//
+	//	ARGUMENTS:
+	//		a_slab	 - the slab, from Cluster_bigRequest()
+	//		a_size	 - its size
+	//		a_pinned - true to never trim it
+	//
+	//	RETURNS:
+	//		the slab's node
+	//		NULL if the slab could not be recorded, it is released
+	//
+	//	NOTE:
+	//		The node starts at the next color so slab headers do not all
+	//		share cache sets, and goes in address order.
+	//
+	//************************************************************************
+	node*				insertSlab( caddr_t a_slab, size_t a_size,
+									bool a_pinned )
+	{
+		size_t			offset = Cluster_color( s_colorSequence++, a_size );
+		if( !addSlab( a_slab, a_size, offset, a_pinned ) )
+		{
+			Cluster_bigRelease( a_slab, a_size );
+			return NULL;
+		}
+		node_ptr		slabNode = (node_ptr)(a_slab + offset);
+		slabNode->d_size = a_size - offset;
+		s_freeBytes += slabNode->d_size;
+
+		// Walk the list to find the proper place for this node
+		node_ptr		currentNode = s_freeList;
+		while( currentNode->d_next < slabNode &&
+			   currentNode->d_next != &s_freeListHead )
+		{
+			currentNode = currentNode->d_next;
+		}
+		// current node is just before where slab node needs to be inserted or
+		// we are at the end of the list.
+		// In either case, insert slabNode after currentNode.
+#ifdef DEBUG
+		fprintf( stderr,
+		"Alloc: put new slab %p on free list between %p and %p\n",
+		(void*)slabNode, (void*)currentNode,
+		(void*)currentNode->d_next );
+#endif
+		slabNode->d_next = currentNode->d_next;
+		currentNode->d_next = slabNode;
+		return slabNode;
+	}
+
+	//************************************************************************
+	//
+	//	purgeFree() - purge the whole pages of a free range, except where
+	//				  pinned slabs lie
+	//
+	//************************************************************************
+	void				purgeFree( caddr_t a_start, caddr_t a_end )
+	{
+		for( long index = 0; index < s_slabCount; index++ )
+		{
+			caddr_t		base = s_slabTable[index].d_base;
+			caddr_t		end = base + s_slabTable[index].d_size;
+			if( s_slabTable[index].d_pinned && base < a_end && end > a_start )
+			{
+				if( base > a_start )
+				{
+					purgeFree( a_start, base );
+				}
+				if( end < a_end )
+				{
+					purgeFree( end, a_end );
+				}
+				return;
+			}
+		}
+		Cluster_purge( a_start, a_end - a_start );
+	}
+
+	//************************************************************************
+	//
+	//	trimNode() - unmap every slab that lies wholly inside a free node
+	//				 and purge the whole pages of what is left over
+	//
+	//	ARGUMENTS:
+	//		a_prevNode	 - the node in front of a_nodeToTrim on the free list
+	//		a_nodeToTrim - the free node to trim
+	//
+	//	RETURNS:
+	//		the last node of the free list in front of what used to be
+	//		a_nodeToTrim->d_next. This is a_prevNode if nothing is left.
+	//
+	//	NOTE:
+	//		The pieces between unmapped slabs stay on the free list in
+	//		address order, so the list stays sorted and no free node ever
+	//		covers unmapped memory.
+	//
+	//************************************************************************
+	node*				trimNode( node* a_prevNode, node* a_nodeToTrim )
+	{
+		caddr_t			start = (caddr_t)a_nodeToTrim;
+		caddr_t			end = start + a_nodeToTrim->d_size;
+		// grab this now, the header may be unmapped below
+		node_ptr		nextNode = a_nodeToTrim->d_next;
+
+		while( start < end )
+		{
+			// find the lowest slab lying wholly inside [start,end).
+			// The color offset in front of its first node is never
+			// on the free list, so it does not need to be covered.
+			// Pinned slabs stay.
+			long		found = -1;
+			for( long index = 0; index < s_slabCount; index++ )
+			{
+				caddr_t	base = s_slabTable[index].d_base;
+				if( !s_slabTable[index].d_pinned &&
+					base + s_slabTable[index].d_offset >= start &&
+					base + s_slabTable[index].d_size <= end &&
+					( found == -1 || base < s_slabTable[found].d_base ) )
+				{
+					found = index;
+				}
+			}
+
+			caddr_t		pieceEnd = end;
+			if( found != -1 )
+			{
+				pieceEnd = s_slabTable[found].d_base;
+				if( pieceEnd < start )
+				{
+					pieceEnd = start;
+				}
+			}
+
+			// whatever is in front of the slab stays on the free list
+			if( pieceEnd > start )
+			{
+				node_ptr	piece = (node_ptr)start;
+				piece->d_size = pieceEnd - start;
+				a_prevNode->d_next = piece;
+				a_prevNode = piece;
+				// keep the header, let the rest go
+				purgeFree( start + offsetof(node, d_block), pieceEnd );
+			}
+			if( found == -1 )
+			{
+				break;
+			}
+
+			// the slab itself goes back to the OS
+			start = s_slabTable[found].d_base + s_slabTable[found].d_size;
+			s_freeBytes -= s_slabTable[found].d_size -
+						   s_slabTable[found].d_offset;
+			Cluster_bigRelease( s_slabTable[found].d_base,
+								s_slabTable[found].d_size );
+			s_latencyPath |= MEM_LATENCY_CLUSTER_MOVED;
+#ifdef DEBUG
+			fprintf( stderr, "Trim: released slab %p, %lu bytes\n",
+					 s_slabTable[found].d_base,
+					 (unsigned long)s_slabTable[found].d_size );
+#endif
+			s_slabTable[found] = s_slabTable[--s_slabCount];
+		}
+		a_prevNode->d_next = nextNode;
+		return a_prevNode;
+	}
+
+	//************************************************************************
+	//
+	//	trimList() - trim every node on the free list
+	//
+	//************************************************************************
+	void				trimList()
+	{
+		node_ptr		prevNode = s_freeList;
+		while( prevNode->d_next != &s_freeListHead )
+		{
+			prevNode = trimNode( prevNode, prevNode->d_next );
+		}
+		s_unpurgedBytes = 0;
+	}
+}
+
 //****************************************************************************
 //
 //	Mem_varSizeAlloc() - allocate a node from the free list, breaking nodes
@@ -60,16 +400,14 @@ node_ptr	s_usedList = &s_usedListHead;
 //****************************************************************************
 caddr_t					Mem_varSizeAlloc( size_t a_size )
 {
+	listGuard			guard;
+
 	node_ptr			currentNode;
 	node_ptr			prevNode = NULL;
 	node_ptr			newFreeNodePtr;
 
-	// increase the required node size to include the header
-	size_t				requestSize = a_size;
-	requestSize += HEADER_SIZE;
-
-	// and align it on a SMALLEST_ALLOC boundary
-	requestSize += SMALLEST_ALLOC - ( requestSize & SMALLEST_ALLOC_MASK );
+	// the node size, header included
+	size_t				requestSize = nodeSize( a_size );
 	
 	// walk the list of free nodes until the first fit is found
 	currentNode = s_freeList;
@@ -88,37 +426,21 @@ caddr_t					Mem_varSizeAlloc( size_t a_size )
 	if( currentNode->d_next == &s_freeListHead &&
 		currentNode->d_size < requestSize )
 	{
-		// Get another slab of memory
-		size_t		   size = requestSize;
+		// Get another slab of memory, with room for a color offset
+		size_t		   size = requestSize + CLUSTER_COLOR_SPAN;
 		caddr_t		   newSlab = Cluster_bigRequest( &size );
+		s_latencyPath |= MEM_LATENCY_CLUSTER_MOVED;
 		// If we could not fulfill the request, return NULL
 		if( newSlab == NULL )
 		{
 			return NULL;
 		}
 
-		// Make the new slab into a node
-		node_ptr	slabNode = (node_ptr)newSlab;
-		slabNode->d_size = size;
-
-		// Walk the list to find the proper place for this node
-		currentNode = s_freeList;
-		while( currentNode->d_next < slabNode &&
-			   currentNode->d_next != &s_freeListHead )
+		currentNode = insertSlab( newSlab, size, false );
+		if( currentNode == NULL )
 		{
-			currentNode = currentNode->d_next;
+			return NULL;
 		}
-		// current node is just before where slab node needs to be inserted or
-		// we are at the end of the list.
-		// In either case, insert slabNode after currentNode.
-#ifdef DEBUG
-		fprintf( stderr,
-		"Alloc: put new slab %8.8x on free list between %8.8x and %8.8x\n",
-		slabNode, currentNode, currentNode->d_next );
-#endif
-		slabNode->d_next = currentNode->d_next;
-		currentNode->d_next = slabNode;
-		currentNode = slabNode;
 	}
 
 	// we now have the first fit, break it to the size we need
@@ -132,8 +454,8 @@ caddr_t					Mem_varSizeAlloc( size_t a_size )
 		// currentNode now contains the block to fulfill the request
 #ifdef DEBUG
 	   	fprintf( stderr,
-				 "Alloc: took %8.8x from the free list\n",
-				 currentNode );
+				 "Alloc: took %p from the free list\n",
+				 (void*)currentNode );
 #endif
 	}
 	// otherwise we need to break currentNode into two pieces
@@ -148,11 +470,14 @@ caddr_t					Mem_varSizeAlloc( size_t a_size )
 		currentNode = (node_ptr)((caddr_t)currentNode + currentNode->d_size);
 #ifdef DEBUG
 	   	fprintf( stderr,
-				 "Alloc: Broke %8.8x out of the free list\n",
-				 currentNode );
+				 "Alloc: Broke %p out of the free list\n",
+				 (void*)currentNode );
 #endif
 	}
 	// Current node is no longer a node in the free list
+	s_freeBytes -= requestSize;
+	s_unpurgedBytes -= requestSize < s_unpurgedBytes ? requestSize :
+													   s_unpurgedBytes;
 
 	// update the node to be returned
 
@@ -171,8 +496,8 @@ caddr_t					Mem_varSizeAlloc( size_t a_size )
 	}
 #ifdef DEBUG
 	fprintf( stderr,
-	"Alloc: put %8.8x on used list between %8.8x and %8.8x\n",
-	currentNode, srchNode, srchNode->d_next );
+	"Alloc: put %p on used list between %p and %p\n",
+	(void*)currentNode, (void*)srchNode, (void*)srchNode->d_next );
 #endif
 
 	// srchNode is now positioned just before currentNode
@@ -181,8 +506,8 @@ caddr_t					Mem_varSizeAlloc( size_t a_size )
 
 #ifdef DEBUG
    	fprintf( stderr,
-			 "Alloc: returning %8.8x from node %8.8x\n",
-				 &currentNode->d_block, currentNode );
+			 "Alloc: returning %p from node %p\n",
+				 (void*)&currentNode->d_block, (void*)currentNode );
 #endif
 	return &currentNode->d_block;
 }
@@ -198,6 +523,8 @@ caddr_t					Mem_varSizeAlloc( size_t a_size )
 //****************************************************************************
 void					Mem_varSizeFree( caddr_t a_addr )
 {
+	listGuard			guard;
+
 	// we can always free NULL
 	if( a_addr == NULL ) return;
 
@@ -209,12 +536,13 @@ void					Mem_varSizeFree( caddr_t a_addr )
 // 	}
 
 	// calculate the address of the node
-	node_ptr			nodeAddr = (node_ptr)((caddr_t)a_addr - 8);
+	node_ptr			nodeAddr =
+							(node_ptr)((caddr_t)a_addr - offsetof(node, d_block));
 	// from here on out, any reference to size includes HEADER_SIZE
 
 #ifdef DEBUG
-	   fprintf( stderr, "Attempt to free block: %8.8x\n",
-				nodeAddr );
+	   fprintf( stderr, "Attempt to free block: %p\n",
+				(void*)nodeAddr );
 #endif
 	
 	// Start at the head of the used list
@@ -233,16 +561,16 @@ void					Mem_varSizeFree( caddr_t a_addr )
 	{
 #ifdef DEBUG
 	   fprintf( stderr,
-				"Free: attempt to free block not held: %8.8x\n",
-				nodeAddr );
+				"Free: attempt to free block not held: %p\n",
+				(void*)nodeAddr );
 #endif
 		return;
 	}
 
 #ifdef DEBUG
 	   fprintf( stderr,
-				"Free: found block: %8.8x in used list. \nIt better be the same as %8.8x\n",
-				currentNode->d_next, nodeAddr );
+				"Free: found block: %p in used list. \nIt better be the same as %p\n",
+				(void*)currentNode->d_next, (void*)nodeAddr );
 #endif
 	// remove the node to close the gap
 	currentNode->d_next = nodeAddr->d_next;
@@ -263,6 +591,8 @@ void					Mem_varSizeFree( caddr_t a_addr )
 	}
 	nodeAddr->d_next = currentNode->d_next;
 	currentNode->d_next = nodeAddr;
+	s_freeBytes += nodeAddr->d_size;
+	s_unpurgedBytes += nodeAddr->d_size;
 
 	// then see whether we can coalesce adjacent nodes
 	// first with the next node in the list
@@ -278,6 +608,140 @@ void					Mem_varSizeFree( caddr_t a_addr )
 		currentNode->d_size += currentNode->d_next->d_size;
 		currentNode->d_next = currentNode->d_next->d_next;
 	}
+
+	// If enough has been freed since the last trim, give it back to the
+	// OS. What was purged before is not counted again, so this happens
+	// once per threshold's worth of frees, not on every one after.
+	if( s_trimThreshold != 0 && s_unpurgedBytes > s_trimThreshold )
+	{
+		trimList();
+	}
+}
+
+//****************************************************************************
+//
+//	Mem_varSizeUsableSize() - how many bytes a block really holds
+//
+//	PARAMETERS:
+//		a_addr: the address of the block member of an allocated node
+//
+//	RETURNS:
+//		the bytes from a_addr to the end of its node
+//
+//****************************************************************************
+size_t					Mem_varSizeUsableSize( caddr_t a_addr )
+{
+	node_ptr			nodeAddr =
+							(node_ptr)((caddr_t)a_addr - offsetof(node, d_block));
+	return nodeAddr->d_size - offsetof(node, d_block);
+}
+
+//****************************************************************************
+//
+//	Mem_varSizeGoodSize() - how many bytes a block would really hold
+//
+//	PARAMETERS:
+//		a_size: the size that would be passed to Mem_varSizeAlloc()
+//
+//	RETURNS:
+//		what Mem_varSizeUsableSize() would report for the block
+//
+//****************************************************************************
+size_t					Mem_varSizeGoodSize( size_t a_size )
+{
+	return nodeSize( a_size ) - offsetof(node, d_block);
+}
+
+//****************************************************************************
+//
+//	Mem_varSizeNodeSize() - how many bytes of the pool a block would take
+//
+//	PARAMETERS:
+//		a_size: the size that would be passed to Mem_varSizeAlloc()
+//
+//	RETURNS:
+//		the size of the node, header included, that would be cut from
+//		the free list for it
+//
+//****************************************************************************
+size_t					Mem_varSizeNodeSize( size_t a_size )
+{
+	return nodeSize( a_size );
+}
+
+//****************************************************************************
+//
+//	Mem_varSizeTrim() - give free memory back to the OS
+//
+//	RETURNS:
+//		the number of bytes unmapped
+//
+//	NOTE:
+//		Slabs that are completely free are unmapped and dropped from the
+//		free list. The whole pages inside the remaining free nodes are
+//		purged, so they stop counting against the resident set while
+//		staying on the free list.
+//
+//****************************************************************************
+size_t					Mem_varSizeTrim()
+{
+	listGuard			guard;
+
+	size_t				freeBefore = s_freeBytes;
+	trimList();
+	return freeBefore - s_freeBytes;
+}
+
+//****************************************************************************
+//
+//	Mem_varSizeReserve() - add a slab to the pool ahead of time
+//
+//	PARAMETERS:
+//		a_bytes - how many bytes of free blocks to add
+//		a_lock	- true to lock the slab in memory
+//
+//	RETURNS:
+//		true if the slab is on the free list, faulted in, and locked if
+//		asked
+//		false if any of it could not be done
+//
+//	NOTE:
+//		The slab is pinned, trimming never unmaps or purges it.
+//
+//****************************************************************************
+bool					Mem_varSizeReserve( size_t a_bytes, bool a_lock )
+{
+	listGuard			guard;
+
+	// room for a header and a color offset. Cluster_bigRequest()
+	// doubles what it is asked for, so ask for half, in clusters.
+	size_t				size = nodeSize( a_bytes ) + CLUSTER_COLOR_SPAN;
+	size = ( ( size / 2 + CLUSTERSIZE - 1 ) / CLUSTERSIZE ) * CLUSTERSIZE;
+	caddr_t				newSlab = Cluster_bigRequest( &size );
+	if( newSlab == NULL )
+	{
+		return false;
+	}
+	if( insertSlab( newSlab, size, true ) == NULL )
+	{
+		return false;
+	}
+	return Cluster_populate( newSlab, size, a_lock );
+}
+
+//****************************************************************************
+//
+//	Mem_varSizeSetTrimThreshold() - set how many bytes Mem_varSizeFree()
+//									lets be freed before trimming on
+//									its own
+//
+//	PARAMETERS:
+//		a_bytes - the new threshold, 0 turns automatic trimming off
+//
+//****************************************************************************
+void					Mem_varSizeSetTrimThreshold( size_t a_bytes )
+{
+	s_trimThreshold = a_bytes;
 }
 
 //****************************************************************************
@@ -287,6 +751,8 @@ void					Mem_varSizeFree( caddr_t a_addr )
 //****************************************************************************
 void					Mem_printVarSizeList()
 {
+	listGuard			guard;
+
 	size_t				usedSize = 0;
 	size_t				freeSize = 0;
 	size_t				usedCount = 0;
@@ -294,32 +760,106 @@ void					Mem_printVarSizeList()
 	
 	fprintf( stderr, "\n" );
 	fprintf( stderr, "Used list:\n" );
-	node_ptr			node = s_usedList;
-	while( node->d_next != &s_usedListHead )
+	// the heads hold no block, the lists start after them
+	node_ptr			node = s_usedList->d_next;
+	while( node != &s_usedListHead )
 	{
 		++usedCount;
 		usedSize += node->d_size;
-		fprintf( stderr, "0x%8.8x:%d bytes\n", node, node->d_size );
+		fprintf( stderr, "%p:%zu bytes\n", (void*)node, node->d_size );
 		node = node->d_next;
 	}
 	fprintf( stderr, "\n" );
 	fprintf( stderr, "Free list:\n" );
-	node = s_freeList;
-	while( node->d_next != &s_freeListHead )
+	node = s_freeList->d_next;
+	while( node != &s_freeListHead )
 	{
 		++freeCount;
 		freeSize += node->d_size;
-		fprintf( stderr, "0x%8.8x:%d bytes\n", node, node->d_size );
+		fprintf( stderr, "%p:%zu bytes\n", (void*)node, node->d_size );
 		node = node->d_next;
 	}
 
 	fprintf( stderr, "\n" );
 	fprintf( stderr, "Counts:\n" );
-	fprintf( stderr, "Used Count:\t%d\n", usedCount );
-	fprintf( stderr, "Used Size:\t%d\n", usedSize );
-	fprintf( stderr, "Free Count:\t%d\n", freeCount );
-	fprintf( stderr, "Free Size:\t%d\n", freeSize );
-	fprintf( stderr, "Total Size:\t%d\n", usedSize + freeSize );
+	fprintf( stderr, "Used Count:\t%zu\n", usedCount );
+	fprintf( stderr, "Used Size:\t%zu\n", usedSize );
+	fprintf( stderr, "Free Count:\t%zu\n", freeCount );
+	fprintf( stderr, "Free Size:\t%zu\n", freeSize );
+	fprintf( stderr, "Total Size:\t%zu\n", usedSize + freeSize );
 }
 
 
+
+//****************************************************************************
+//
+//	Mem_varSizeWalk() - report every block of the overflow pool
+//
+//	PARAMETERS:
+//		a_walker  - called with each block's entry, headers included
+//		a_context - passed on to a_walker
+//
+//	RETURNS:
+//		false if a_walker stopped the walk
+//
+//****************************************************************************
+bool					Mem_varSizeWalk( MemHeapWalker a_walker,
+										 void* a_context )
+{
+	listGuard			guard;
+
+	MemHeapEntry		entry = {};
+	node_ptr			lists[] = { s_usedList, s_freeList };
+	node_ptr			heads[] = { &s_usedListHead, &s_freeListHead };
+	int					kinds[] = { MEM_HEAP_OVERFLOW_USED,
+									MEM_HEAP_OVERFLOW_FREE };
+	for( int list = 0; list < 2; list++ )
+	{
+		entry.d_kind = kinds[list];
+		for( node_ptr node = lists[list]->d_next; node != heads[list];
+			 node = node->d_next )
+		{
+			entry.d_address = (caddr_t)node;
+			entry.d_bytes = node->d_size;
+			if( !a_walker( &entry, a_context ) )
+			{
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+//****************************************************************************
+//
+//	Mem_varSizeStats() - report how full the overflow pool is
+//
+//	PARAMETERS:
+//		a_freeBytes - set to the bytes on the free list
+//		a_usedBytes - set to the bytes in blocks handed out, headers
+//					  included
+//		a_slabBytes - set to the bytes of every slab held
+//
+//****************************************************************************
+void					Mem_varSizeStats( size_t* a_freeBytes,
+										  size_t* a_usedBytes,
+										  size_t* a_slabBytes )
+{
+	listGuard			guard;
+
+	size_t				slabBytes = 0;
+	size_t				offsetBytes = 0;
+	for( long index = 0; index < s_slabCount; index++ )
+	{
+		slabBytes += s_slabTable[index].d_size;
+		offsetBytes += s_slabTable[index].d_offset;
+	}
+	// slabs that did not fit in the table are not counted
+	*a_freeBytes = s_freeBytes;
+	*a_usedBytes = 0;
+	if( slabBytes - offsetBytes > s_freeBytes )
+	{
+		*a_usedBytes = slabBytes - offsetBytes - s_freeBytes;
+	}
+	*a_slabBytes = slabBytes;
+}
@@ -9,5 +9,24 @@ caddr_t					Mem_varSizeAlloc( size_t	a_size );
 void					Mem_varSizeFree( caddr_t	a_addr );
 void					Mem_printVarSizeList();
 
+// how many bytes a block holds, or would hold for a request
+size_t					Mem_varSizeUsableSize( caddr_t	a_addr );
+size_t					Mem_varSizeGoodSize( size_t	a_size );
+
+// how many bytes of the pool a request takes, its header included
+size_t					Mem_varSizeNodeSize( size_t	a_size );
+
+// give free slabs and free pages back to the OS
+size_t					Mem_varSizeTrim();
+void					Mem_varSizeSetTrimThreshold( size_t a_bytes );
+
+// add a slab of a_bytes that is faulted in and never trimmed
+bool					Mem_varSizeReserve( size_t a_bytes, bool a_lock );
+
+// free bytes, bytes handed out, and bytes mapped for the pool
+void					Mem_varSizeStats( size_t* a_freeBytes,
+										  size_t* a_usedBytes,
+										  size_t* a_slabBytes );
+
 
 #endif //__MEM_VSIZ_H__
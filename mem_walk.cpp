@@ -0,0 +1,128 @@
+#ifndef			__MEM_WALK_HPP__
+#include		"mem_walk.hpp"
+#endif			// __MEM_WALK_HPP__
+
+#include		<fcntl.h>
+#include		<stdio.h>
+#include		<time.h>
+#include		<unistd.h>
+
+namespace
+{
+	// records gathered before they are written out
+	const long			SNAPSHOT_BATCH = 256;
+
+	// where a snapshot is being written
+	struct snapshotFile
+	{
+		int				d_fd;
+		bool			d_failed;
+		unsigned long	d_records;
+		long			d_batched;
+		MemHeapRecord	d_batch[SNAPSHOT_BATCH];
+	};
+
+	//************************************************************************
+	//
+	//	flush() - write out the records gathered so far
+	//
+	//************************************************************************
+	void				flush( snapshotFile* a_file )
+	{
+		size_t			length = a_file->d_batched * sizeof(MemHeapRecord);
+		if( !a_file->d_failed && length > 0 &&
+			write( a_file->d_fd, a_file->d_batch, length ) != (ssize_t)length )
+		{
+			a_file->d_failed = true;
+		}
+		a_file->d_batched = 0;
+	}
+
+	//************************************************************************
+	//
+	//	record() - the heap walker that gathers a snapshot
+	//
+	//	NOTE:
+	//		Writes go straight to the file with no stdio buffer, so
+	//		nothing is allocated while a part of the heap is locked.
+	//
+	//************************************************************************
+	bool				record( const MemHeapEntry* a_entry, void* a_context )
+	{
+		snapshotFile*	file = (snapshotFile*)a_context;
+		MemHeapRecord*	record = &file->d_batch[file->d_batched++];
+		record->d_address = (unsigned long)a_entry->d_address;
+		record->d_bytes = a_entry->d_bytes;
+		record->d_live = a_entry->d_kind == MEM_HEAP_NODE ? a_entry->d_live :
+															0;
+		record->d_kind = a_entry->d_kind;
+		record->d_sizeShift = a_entry->d_kind == MEM_HEAP_NODE ?
+														a_entry->d_sizeShift : 0;
+		record->d_chain = a_entry->d_kind == MEM_HEAP_NODE ? a_entry->d_chain :
+															 0;
+		record->d_unused = 0;
+		file->d_records++;
+
+		if( file->d_batched == SNAPSHOT_BATCH )
+		{
+			flush( file );
+		}
+		return !file->d_failed;
+	}
+}
+
+//****************************************************************************
+//
+//	Mem_heapSnapshot() - write what the allocator holds to a file
+//
+//	ARGUMENTS:
+//		a_path - the file to write, replaced if it is there
+//
+//	RETURNS:
+//		true if the whole snapshot was written
+//		false if the file could not be
+//
+//	NOTE:
+//		The header goes first with no record count, and is written
+//		again with it once the walk is done.
+//
+//****************************************************************************
+bool					Mem_heapSnapshot( const char* a_path )
+{
+	int					fd = open( a_path, O_WRONLY|O_CREAT|O_TRUNC, 0644 );
+	if( fd == -1 )
+	{
+		perror( "open: " );
+		return false;
+	}
+
+	struct timespec		now;
+	clock_gettime( CLOCK_REALTIME, &now );
+	MemHeapSnapshotHeader	header;
+	header.d_magic = MEM_HEAP_MAGIC;
+	header.d_version = MEM_HEAP_VERSION;
+	header.d_pid = getpid();
+	header.d_takenAt = now.tv_sec * 1000000000UL + now.tv_nsec;
+	header.d_records = 0;
+
+	snapshotFile		file;
+	file.d_fd = fd;
+	file.d_records = 0;
+	file.d_batched = 0;
+	file.d_failed = write( fd, &header, sizeof(header) ) !=
+					(ssize_t)sizeof(header);
+	if( !file.d_failed )
+	{
+		Mem_heapWalk( record, &file );
+		flush( &file );
+	}
+
+	header.d_records = file.d_records;
+	if( !file.d_failed &&
+		pwrite( fd, &header, sizeof(header), 0 ) != (ssize_t)sizeof(header) )
+	{
+		file.d_failed = true;
+	}
+	close( fd );
+	return !file.d_failed;
+}
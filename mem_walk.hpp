@@ -0,0 +1,96 @@
+#ifndef __MEM_WALK_HPP__
+#define __MEM_WALK_HPP__
+
+//	get size_t, caddr_t and pid_t
+#include <sys/types.h>
+
+// Mem_heapWalk() reports everything the allocator holds, one entry at a
+// time: each node with its cluster, each span of the span heaps, and
+// each block of the overflow pool. A snapshot is the same walk written
+// to a file, compactly, and fstdiff compares two of them to show which
+// sizes and clusters grew. The walk runs alongside the threads that
+// allocate, so what it reports can be a little out of step.
+
+struct MemNode;
+
+// what an entry is
+const int				MEM_HEAP_NODE = 0;			// a node and its cluster
+const int				MEM_HEAP_SPAN_USED = 1;		// a span handed out
+const int				MEM_HEAP_SPAN_FREE = 2;		// a free span
+const int				MEM_HEAP_OVERFLOW_USED = 3;	// an overflow block
+const int				MEM_HEAP_OVERFLOW_FREE = 4;	// free in the overflow
+const int				MEM_HEAP_KINDS = 5;
+
+struct MemHeapEntry
+{
+	int					d_kind;
+	caddr_t				d_address;		// the cluster, span or block,
+										// NULL for a node with no cluster
+	size_t				d_bytes;		// how long it is
+
+	// nodes only
+	int					d_sizeShift;	// blocks are 1 << d_sizeShift bytes
+	int					d_chain;		// MEM_SHORT_LIVED or MEM_LONG_LIVED
+	long				d_live;			// blocks in use
+	long				d_slots;		// blocks the cluster holds
+	long				d_offset;		// where the first one starts
+
+	// A bit per block, lowest bit of the first word first, set while
+	// the block is in use. NULL for the block sizes that track their
+	// slots with a free list, see MemNode_freeListSlots().
+	const unsigned long*	d_occupancy;
+};
+
+// Return false to stop the walk. The overflow pool and the span heaps
+// are locked while their entries are reported, so a walker must not
+// allocate or release anything that would go to them.
+typedef bool			(*MemHeapWalker)( const MemHeapEntry* a_entry,
+										  void* a_context );
+
+// Walk everything, returning false if the walker stopped it
+bool					Mem_heapWalk( MemHeapWalker a_walker,
+									  void* a_context );
+
+// Each part walks its own. Mem_heapWalk() reports the root nodes of
+// the size categories, MemNode_walk() the nodes made since.
+bool					MemNode_walk( MemHeapWalker a_walker,
+									  void* a_context );
+bool					MemNode_report( MemNode* a_node,
+										MemHeapWalker a_walker,
+										void* a_context );
+bool					Mem_spanWalk( MemHeapWalker a_walker,
+									  void* a_context );
+bool					Mem_varSizeWalk( MemHeapWalker a_walker,
+										 void* a_context );
+
+// A snapshot file is a header and then d_records records
+
+// "fstheap" and a NUL read as a little endian word
+const unsigned long		MEM_HEAP_MAGIC = 0x0070616568747366UL;
+const unsigned long		MEM_HEAP_VERSION = 1;
+
+struct MemHeapSnapshotHeader
+{
+	unsigned long		d_magic;
+	unsigned long		d_version;
+	unsigned long		d_pid;
+	unsigned long		d_takenAt;		// CLOCK_REALTIME nanoseconds
+	unsigned long		d_records;
+};
+
+// An entry without the occupancy bits
+struct MemHeapRecord
+{
+	unsigned long		d_address;
+	unsigned long		d_bytes;
+	unsigned int		d_live;
+	unsigned char		d_kind;
+	unsigned char		d_sizeShift;
+	unsigned char		d_chain;
+	unsigned char		d_unused;
+};
+
+// Write a snapshot, false if the file could not be written
+bool					Mem_heapSnapshot( const char* a_path );
+
+#endif // __MEM_WALK_HPP__
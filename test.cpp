@@ -1,27 +1,1137 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sched.h>
 
 #include "mem_vsiz.hpp"
+#include "mem_aloc.hpp"
+#include "mem_node.hpp"
+#include "mem_span.hpp"
+#include "mem_clst.hpp"
+#include "mem_coro.hpp"
+#include "mem_lat.hpp"
+#include "mem_pers.hpp"
+#include "mem_stat.hpp"
+#include "mem_fill.hpp"
+#include "mem_walk.hpp"
+#include "mem_defr.hpp"
+#include "mem_epch.hpp"
 
-int main()
+namespace
 {
+	// threads, and hunks each one keeps, in the churn test
+	const long			CHURN_THREADS = 8;
+	const long			CHURN_SLOTS = 256;
+	const long			CHURN_ROUNDS = 50000;
+
+	// the biggest hunk the churn test asks for, past the spans
+	const size_t		CHURN_LARGEST = 300000;
+
+	// frames made on one thread and released on another, of a size
+	// nothing else uses
+	const long			FRAME_COUNT = 32;
+	const size_t		FRAME_SIZE = 1008;
+
+	// how many hunks the reserve test makes room for
+	const size_t		RESERVE_COUNT = 2000;
+
+	// a linked list kept in a persistent heap, by offset
+	struct persistItem
+	{
+		size_t			d_next;
+		long			d_value;
+	};
+
+	const long			PERSIST_ITEMS = 500;
+
+	// hunks the hint test allocates, short and long lived in turn
+	const long			HINTED_HUNKS = 64;
+
+	// hunks retired while a reader holds the epoch back
+	const unsigned long	RETIRED_HUNKS = 1000;
+
+	//************************************************************************
+	//
+	//	report() - print how a test went
+	//
+	//	RETURNS:
+	//		a_passed
+	//
+	//************************************************************************
+	bool				report( const char* a_test, bool a_passed )
+	{
+		fprintf( stderr, "%50.50s:\t[%4.4s]\n", a_test,
+				 a_passed ? "PASS" : "FAIL" );
+		return a_passed;
+	}
+
+	//************************************************************************
+	//
+	//	churner() - allocate and release hunks of every size at random,
+	//				checking nothing written to one lands in another
+	//
+	//	ARGUMENTS:
+	//		a_seed - where this thread's random sizes start, and the byte
+	//				 it marks its hunks with
+	//
+	//	RETURNS:
+	//		NULL if every hunk held what was written to it, else non NULL
+	//
+	//************************************************************************
+	void*				churner( void* a_seed )
+	{
+		unsigned int	seed = (unsigned int)(long)a_seed;
+		caddr_t			hunks[CHURN_SLOTS] = { NULL };
+		size_t			sizes[CHURN_SLOTS] = { 0 };
+		long			failures = 0;
+
+		for( long round = 0; round < CHURN_ROUNDS; round++ )
+		{
+			long		slot = rand_r( &seed ) % CHURN_SLOTS;
+			char		mark = (char)( slot + (long)a_seed );
+			if( hunks[slot] != NULL )
+			{
+				// the first and last bytes are enough to catch overlap
+				if( hunks[slot][0] != mark ||
+					hunks[slot][sizes[slot] - 1] != mark )
+				{
+					failures++;
+				}
+				Mem_releaseHunk( hunks[slot] );
+				hunks[slot] = NULL;
+				continue;
+			}
+
+			// mostly small hunks, now and then a big one
+			size_t		size = 1 + rand_r( &seed ) % 2048;
+			if( rand_r( &seed ) % 64 == 0 )
+			{
+				size = 1 + rand_r( &seed ) % CHURN_LARGEST;
+			}
+			hunks[slot] = Mem_allocateHunk( size );
+			if( hunks[slot] == NULL )
+			{
+				failures++;
+				continue;
+			}
+			sizes[slot] = size;
+			memset( hunks[slot], mark, size );
+		}
+
+		for( long slot = 0; slot < CHURN_SLOTS; slot++ )
+		{
+			if( hunks[slot] != NULL )
+			{
+				Mem_releaseHunk( hunks[slot] );
+			}
+		}
+		return failures == 0 ? NULL : a_seed;
+	}
+
+	//************************************************************************
+	//
+	//	testChurn() - many threads allocating and releasing at once
+	//
+	//************************************************************************
+	bool				testChurn()
+	{
+		pthread_t		threads[CHURN_THREADS];
+		for( long index = 0; index < CHURN_THREADS; index++ )
+		{
+			if( pthread_create( &threads[index], NULL, churner,
+								(void*)( index + 1 ) ) != 0 )
+			{
+				return report( "Multithreaded Churn", false );
+			}
+		}
+
+		bool			passed = true;
+		for( long index = 0; index < CHURN_THREADS; index++ )
+		{
+			void*		result;
+			pthread_join( threads[index], &result );
+			passed = passed && result == NULL;
+		}
+		return report( "Multithreaded Churn", passed );
+	}
+
+	//************************************************************************
+	//
+	//	latencyCount() - how many timings of one operation on one size
+	//					 category every thread has counted, on any path
+	//
+	//************************************************************************
+	unsigned long		latencyCount( int a_operation, long a_class )
+	{
+		unsigned long	count = 0;
+		for( int path = 0; path < MEM_LATENCY_PATHS; path++ )
+		{
+			MemLatencyHistogram	histogram;
+			Mem_latencyHistogram( a_operation, a_class, path, &histogram );
+			count += histogram.d_count;
+		}
+		return count;
+	}
+
+	//************************************************************************
+	//
+	//	testLatency() - a reset zeroes the counts of allocations and
+	//					releases alike, and percentiles are in order
+	//
+	//************************************************************************
+	bool				testLatency()
+	{
+		// 100 bytes and the hunk header are size category 2
+		const size_t	howBig = 100;
+		const long		sizeClass = 2;
+		const long		count = 1000;
+
+		// one hunk kept live holds the node's cluster, so the rest are
+		// timed on the fast path rather than hooking it each time
+		caddr_t			held = Mem_allocateHunk( howBig );
+		Mem_latencyEnable( true );
+		Mem_releaseHunk( Mem_allocateHunk( howBig ) );
+		Mem_latencyReset();
+		bool			passed =
+							latencyCount( MEM_LATENCY_ALLOCATE, sizeClass ) == 0 &&
+							latencyCount( MEM_LATENCY_RELEASE, sizeClass ) == 0;
+
+		for( long index = 0; index < count; index++ )
+		{
+			Mem_releaseHunk( Mem_allocateHunk( howBig ) );
+		}
+		Mem_latencyEnable( false );
+		Mem_releaseHunk( held );
+		passed = passed &&
+				 latencyCount( MEM_LATENCY_ALLOCATE, sizeClass ) == count &&
+				 latencyCount( MEM_LATENCY_RELEASE, sizeClass ) == count;
+
+		MemLatencyHistogram	fast;
+		Mem_latencyHistogram( MEM_LATENCY_ALLOCATE, sizeClass, MEM_PATH_FAST,
+							  &fast );
+		passed = passed && fast.d_count > 0 &&
+				 Mem_latencyPercentile( &fast, 0.5 ) <=
+				 Mem_latencyPercentile( &fast, 0.99 );
+		return report( "Latency Reset And Percentile", passed );
+	}
+
+	//************************************************************************
+	//
+	//	frameReleaser() - release frames made on another thread, and exit
+	//
+	//************************************************************************
+	void*				frameReleaser( void* a_frames )
+	{
+		caddr_t*		frames = (caddr_t*)a_frames;
+		for( long index = 0; index < FRAME_COUNT; index++ )
+		{
+			Mem_frameRelease( frames[index], FRAME_SIZE );
+		}
+		return NULL;
+	}
+
+	//************************************************************************
+	//
+	//	testFrameThreadExit() - frames a thread released into its cache,
+	//							without ever carving, are handed on when
+	//							it exits
+	//
+	//************************************************************************
+	bool				testFrameThreadExit()
+	{
+		caddr_t			frames[FRAME_COUNT];
+		for( long index = 0; index < FRAME_COUNT; index++ )
+		{
+			frames[index] = Mem_frameAllocate( FRAME_SIZE );
+		}
+
+		pthread_t		releaser;
+		if( pthread_create( &releaser, NULL, frameReleaser, frames ) != 0 )
+		{
+			return report( "Frame Cache Flushed At Thread Exit", false );
+		}
+		pthread_join( releaser, NULL );
+
+		// every frame should come back out of the depot
+		bool			passed = true;
+		for( long index = 0; index < FRAME_COUNT; index++ )
+		{
+			caddr_t		frame = Mem_frameAllocate( FRAME_SIZE );
+			bool		found = false;
+			for( long old = 0; old < FRAME_COUNT; old++ )
+			{
+				found = found || frames[old] == frame;
+			}
+			passed = passed && found;
+		}
+		return report( "Frame Cache Flushed At Thread Exit", passed );
+	}
+
+	//************************************************************************
+	//
+	//	testLinedUsableSize() - lined hunks of every kind start on a line
+	//							and may only be used up to the end of one
+	//
+	//************************************************************************
+	bool				testLinedUsableSize()
+	{
+		const size_t	sizes[] = { 1, 100, 1000, 20000, 300000, 2000000 };
+		const unsigned long	line = CLUSTER_LINE_SIZE - 1;
+		bool			passed = true;
+		for( size_t index = 0; index < sizeof(sizes) / sizeof(sizes[0]);
+			 index++ )
+		{
+			for( long round = 0; round < 16; round++ )
+			{
+				caddr_t	hunk = Mem_allocateLined( sizes[index] + round * 8 );
+				size_t	usable = Mem_usableSize( hunk );
+				passed = passed && ( (unsigned long)hunk & line ) == 0 &&
+						 ( (unsigned long)( hunk + usable ) & line ) == 0 &&
+						 usable >= sizes[index] + round * 8;
+				Mem_releaseHunk( hunk );
+			}
+		}
+		return report( "Lined Hunks Keep To Their Lines", passed );
+	}
+
+	//************************************************************************
+	//
+	//	testSlabTable() - more overflow slabs than the first slab table
+	//					  holds are all given back by a trim
+	//
+	//************************************************************************
+	bool				testSlabTable()
+	{
+		// each of these takes a slab of its own
+		const size_t	howBig = 100000;
+		const long		count = 3000;
+		caddr_t*		blocks = (caddr_t*)malloc( count * sizeof(caddr_t) );
+
+		ClusterStats	before;
+		Cluster_stats( &before );
+		Mem_varSizeSetTrimThreshold( 0 );
+		bool			passed = true;
+		for( long index = 0; index < count; index++ )
+		{
+			blocks[index] = Mem_varSizeAlloc( howBig );
+			passed = passed && blocks[index] != NULL;
+		}
+		for( long index = 0; index < count; index++ )
+		{
+			Mem_varSizeFree( blocks[index] );
+		}
+		Mem_varSizeTrim();
+		Mem_varSizeSetTrimThreshold( 1 << 20 );
+		free( blocks );
+
+		ClusterStats	after;
+		Cluster_stats( &after );
+		return report( "Trim Unmaps Every Overflow Slab",
+					   passed && after.d_bigBytes <= before.d_bigBytes );
+	}
+
+	//************************************************************************
+	//
+	//	testReserve() - hunks fit in reserved room without hooking new
+	//					clusters, and keep fitting after a trim
+	//
+	//************************************************************************
+	bool				testReserve()
+	{
+		// 100 bytes and the hunk header go in blocks of 128
+		const size_t	howBig = 100;
+		const size_t	blockSize = 7;
+		if( !report( "Reserve Room",
+					 Mem_reserve( howBig, RESERVE_COUNT ) ) )
+		{
+			return false;
+		}
+
+		MemNodeStats	before;
+		MemNode_stats( blockSize, &before );
+		caddr_t			hunks[RESERVE_COUNT];
+		for( int pass = 0; pass < 2; pass++ )
+		{
+			for( size_t index = 0; index < RESERVE_COUNT; index++ )
+			{
+				hunks[index] = Mem_allocateHunk( howBig );
+				memset( hunks[index], 0x5a, howBig );
+			}
+			for( size_t index = 0; index < RESERVE_COUNT; index++ )
+			{
+				Mem_releaseHunk( hunks[index] );
+			}
+			Mem_trim();
+		}
+
+		MemNodeStats	after;
+		MemNode_stats( blockSize, &after );
+		return report( "Allocate From Reserved Room",
+					   after.d_clustersHooked == before.d_clustersHooked );
+	}
+
+	//************************************************************************
+	//
+	//	testReserveOverflow() - overflow hunks fit in the room reserved
+	//							for them without mapping another slab
+	//
+	//************************************************************************
+	bool				testReserveOverflow()
+	{
+		const size_t	howBig = MEM_SPAN_LARGEST + 100000;
+		const long		count = 8;
+		bool			passed = Mem_reserve( howBig, count );
+
+		ClusterStats	before;
+		Cluster_stats( &before );
+		caddr_t			hunks[count];
+		for( long index = 0; index < count; index++ )
+		{
+			hunks[index] = Mem_allocateHunk( howBig );
+			passed = passed && hunks[index] != NULL;
+		}
+		ClusterStats	after;
+		Cluster_stats( &after );
+		for( long index = 0; index < count; index++ )
+		{
+			Mem_releaseHunk( hunks[index] );
+		}
+		return report( "Allocate From Reserved Overflow Room",
+					   passed && after.d_bigBytes == before.d_bigBytes );
+	}
+
+	//************************************************************************
+	//
+	//	testPurge() - the free pages between blocks in use are given back,
+	//				  and the blocks on them can be used again
+	//
+	//************************************************************************
+	bool				testPurge()
+	{
+		// blocks of 16K, each one free holds whole pages
+		const size_t	howBig = 16000;
+		const size_t	blockSize = 14;
+		const long		count = 16;
+		caddr_t			hunks[count];
+		for( long index = 0; index < count; index++ )
+		{
+			hunks[index] = Mem_allocateHunk( howBig );
+			memset( hunks[index], (char)index, howBig );
+		}
+		for( long index = 1; index < count; index += 2 )
+		{
+			Mem_releaseHunk( hunks[index] );
+		}
+
+		MemNodeStats	stats;
+		bool			passed = Mem_purgePages() > 0;
+		MemNode_stats( blockSize, &stats );
+		passed = passed && stats.d_purgedBytes > 0;
+
+		for( long index = 1; index < count; index += 2 )
+		{
+			hunks[index] = Mem_allocateHunk( howBig );
+			memset( hunks[index], (char)index, howBig );
+		}
+		for( long index = 0; index < count; index++ )
+		{
+			passed = passed && hunks[index][0] == (char)index &&
+					 hunks[index][howBig - 1] == (char)index;
+			Mem_releaseHunk( hunks[index] );
+		}
+		return report( "Purge Free Pages", passed );
+	}
+
+	//************************************************************************
+	//
+	//	testPersistReopen() - what is put in a persistent heap is there
+	//						  after it is closed and opened again
+	//
+	//************************************************************************
+	bool				testPersistReopen()
+	{
+		char			path[] = "/tmp/fstallocXXXXXX";
+		int				fd = mkstemp( path );
+		if( fd == -1 )
+		{
+			return report( "Persistent Heap Reopen", false );
+		}
+		close( fd );
+
+		MemPersistHeap*	heap = Mem_persistOpen( path, 1 << 22 );
+		bool			passed = heap != NULL;
+		size_t			head = 0;
+		for( long index = 0; passed && index < PERSIST_ITEMS; index++ )
+		{
+			persistItem*	item = (persistItem*)
+								Mem_persistAllocate( heap, sizeof(persistItem) );
+			passed = item != NULL;
+			if( passed )
+			{
+				item->d_next = head;
+				item->d_value = index;
+				head = Mem_persistOffset( heap, (caddr_t)item );
+			}
+		}
+		// and one big enough to get a run of its own
+		caddr_t			big = passed ? Mem_persistAllocate( heap, 100000 ) :
+									   NULL;
+		passed = passed && big != NULL;
+		if( passed )
+		{
+			memset( big, 0x3c, 100000 );
+			persistItem*	root = (persistItem*)
+								Mem_persistAllocate( heap, sizeof(persistItem) );
+			root->d_next = head;
+			root->d_value = Mem_persistOffset( heap, big );
+			Mem_persistSetRoot( heap, (caddr_t)root );
+			passed = Mem_persistSync( heap );
+		}
+		Mem_persistClose( heap );
+
+		heap = passed ? Mem_persistOpen( path, 0 ) : NULL;
+		passed = passed && heap != NULL;
+		persistItem*	root = passed ? (persistItem*)Mem_persistRoot( heap ) :
+										NULL;
+		passed = passed && root != NULL;
+		if( passed )
+		{
+			big = Mem_persistAddress( heap, root->d_value );
+			passed = big[0] == 0x3c && big[99999] == 0x3c;
+			Mem_persistRelease( heap, big );
+
+			long		expected = PERSIST_ITEMS;
+			for( size_t offset = root->d_next; offset != 0; )
+			{
+				persistItem*	item = (persistItem*)
+									Mem_persistAddress( heap, offset );
+				passed = passed && item->d_value == --expected;
+				offset = item->d_next;
+				Mem_persistRelease( heap, (caddr_t)item );
+			}
+			passed = passed && expected == 0;
+			Mem_persistSetRoot( heap, NULL );
+			Mem_persistRelease( heap, (caddr_t)root );
+		}
+		Mem_persistClose( heap );
+		unlink( path );
+		return report( "Persistent Heap Reopen", passed );
+	}
+
+	//************************************************************************
+	//
+	//	testSharedHeap() - a hunk another process puts in a shared heap
+	//					   is found by this one
+	//
+	//************************************************************************
+	bool				testSharedHeap()
+	{
+		char			name[64];
+		snprintf( name, sizeof(name), "/fstalloc-test-%ld", (long)getpid() );
+		MemPersistHeap*	heap = Mem_sharedOpen( name, 1 << 20 );
+		if( heap == NULL )
+		{
+			return report( "Shared Heap Between Processes", false );
+		}
+
+		const char		message[] = "written by the child";
+		pid_t			child = fork();
+		if( child == 0 )
+		{
+			MemPersistHeap*	childHeap = Mem_sharedOpen( name, 1 << 20 );
+			caddr_t		hunk = childHeap == NULL ? NULL :
+							   Mem_persistAllocate( childHeap, sizeof(message) );
+			if( hunk == NULL )
+			{
+				_exit( 1 );
+			}
+			memcpy( hunk, message, sizeof(message) );
+			Mem_persistSetRoot( childHeap, hunk );
+			Mem_persistClose( childHeap );
+			_exit( 0 );
+		}
+
+		int				status = 0;
+		bool			passed = child != -1 &&
+								 waitpid( child, &status, 0 ) == child &&
+								 WIFEXITED( status ) &&
+								 WEXITSTATUS( status ) == 0;
+		caddr_t			hunk = passed ? Mem_persistRoot( heap ) : NULL;
+		passed = passed && hunk != NULL && strcmp( hunk, message ) == 0;
+		Mem_persistClose( heap );
+		Mem_sharedUnlink( name );
+		return report( "Shared Heap Between Processes", passed );
+	}
+
+	//************************************************************************
+	//
+	//	testStatsPage() - the stats page another process would read shows
+	//					  what this one holds
+	//
+	//************************************************************************
+	bool				testStatsPage()
+	{
+		// 100 bytes and the hunk header are size category 2
+		const size_t	howBig = 100;
+		const long		sizeClass = 2;
+		const long		count = 100;
+
+		if( !Mem_statsStart( 10 ) )
+		{
+			return report( "Stats Page Read", false );
+		}
+		const MemStatsPage*	page = Mem_statsAttach( getpid() );
+		bool			passed = page != NULL;
+
+		caddr_t			hunks[count];
+		for( long index = 0; index < count; index++ )
+		{
+			hunks[index] = Mem_allocateHunk( howBig );
+		}
+		MemStatsPage	held;
+		Mem_statsPublish();
+		passed = passed && Mem_statsRead( page, &held );
+		for( long index = 0; index < count; index++ )
+		{
+			Mem_releaseHunk( hunks[index] );
+		}
+		MemStatsPage	released;
+		Mem_statsPublish();
+		passed = passed && Mem_statsRead( page, &released );
 
-	for( int i2=0; i2< 1000; i2++ )
-	{
-		void*		ptr[1000];
-		size_t			index=0;
-	
-		for(index = 0; index <= 1000; index++ )
-			ptr[index] = Mem_varSizeAlloc( rand() % 1000 );
- 		Mem_printVarSizeList();
- 		for(index=0 ; index < 1000; index++ )
-		for(index=999 ; index >= 0; index-- )
-			Mem_varSizeFree( (caddr_t)ptr[index] );
- 		Mem_printVarSizeList();
-		for(index = 0; index < 1000; index++ )
-			ptr[index] = malloc( rand() % 1000 );
-		for(index=999 ; index >= 0; index-- )
-			free( (caddr_t)ptr[index] );
-	}
-	return 0;
+		passed = passed && held.d_magic == MEM_STATS_MAGIC &&
+				 held.d_version == MEM_STATS_VERSION &&
+				 held.d_pid == (unsigned long)getpid() &&
+				 held.d_classes[sizeClass].d_blockSize == 128 &&
+				 held.d_classes[sizeClass].d_live -
+					released.d_classes[sizeClass].d_live == count &&
+				 released.d_sequence > held.d_sequence;
+		if( page != NULL )
+		{
+			Mem_statsDetach( page );
+		}
+		Mem_statsStop();
+		return report( "Stats Page Read", passed );
+	}
+
+	//************************************************************************
+	//
+	//	testRefill() - the refill thread stocks each size category, and
+	//				   an allocation that needs a new node takes a spare
+	//
+	//************************************************************************
+	bool				testRefill()
+	{
+		// 2000 bytes and the hunk header go in blocks of 2048
+		const size_t	howBig = 2000;
+		const size_t	blockSize = 11;
+		const long		most = 4096;
+
+		bool			passed = Mem_refillStart( 1, 1, 10 );
+		Mem_refillStop();
+
+		MemNodeStats	before;
+		MemNode_stats( blockSize, &before );
+		ClusterStats	clusters;
+		Cluster_stats( &clusters );
+		passed = passed && before.d_spareNodes > 0 &&
+				 clusters.d_readyBytes > 0;
+
+		// fill the category until it has to take the spare
+		caddr_t*		hunks = (caddr_t*)malloc( most * sizeof(caddr_t) );
+		MemNodeStats	after = before;
+		long			count = 0;
+		while( passed && count < most &&
+			   after.d_spareNodes == before.d_spareNodes )
+		{
+			hunks[count] = Mem_allocateHunk( howBig );
+			passed = hunks[count] != NULL;
+			count += passed ? 1 : 0;
+			MemNode_stats( blockSize, &after );
+		}
+		passed = passed && after.d_spareNodes < before.d_spareNodes;
+
+		for( long index = 0; index < count; index++ )
+		{
+			Mem_releaseHunk( hunks[index] );
+		}
+		free( hunks );
+		return report( "Refill Spare Nodes And Clusters", passed );
+	}
+
+	// a range of span heap, and whether one free span holds it all
+	struct spanRange
+	{
+		caddr_t			d_start;
+		caddr_t			d_end;
+		bool			d_found;
+	};
+
+	//************************************************************************
+	//
+	//	spanCovers() - heap walker that looks for a free span holding a
+	//				   spanRange
+	//
+	//************************************************************************
+	bool				spanCovers( const MemHeapEntry* a_entry,
+									void* a_range )
+	{
+		spanRange*		range = (spanRange*)a_range;
+		if( a_entry->d_kind == MEM_HEAP_SPAN_FREE &&
+			a_entry->d_address <= range->d_start &&
+			a_entry->d_address + a_entry->d_bytes >= range->d_end )
+		{
+			range->d_found = true;
+		}
+		return !range->d_found;
+	}
+
+	//************************************************************************
+	//
+	//	testSpanCoalesce() - three spans side by side, freed outside in,
+	//						 come back together as one free span
+	//
+	//************************************************************************
+	bool				testSpanCoalesce()
+	{
+		const size_t	howBig = 16 * MEM_SPAN_PAGE_SIZE;
+		const long		most = 64;
+		MemSpan*		spans[most];
+		caddr_t			starts[most];
+
+		// take spans until the last three sit next to each other, the
+		// ones before fill in what earlier tests left free
+		long			count = 0;
+		bool			passed = false;
+		while( !passed && count < most )
+		{
+			starts[count] = Mem_spanAlloc( howBig, &spans[count] );
+			if( starts[count] == NULL )
+			{
+				break;
+			}
+			count++;
+			passed = count >= 3 &&
+					 Mem_spanEnd( spans[count - 3] ) == starts[count - 2] &&
+					 Mem_spanEnd( spans[count - 2] ) == starts[count - 1];
+		}
+
+		spanRange		range = { NULL, NULL, false };
+		if( passed )
+		{
+			range.d_start = starts[count - 3];
+			range.d_end = Mem_spanEnd( spans[count - 1] );
+			Mem_spanFree( spans[count - 3] );
+			Mem_spanFree( spans[count - 1] );
+			Mem_spanFree( spans[count - 2] );
+			count -= 3;
+			Mem_spanWalk( spanCovers, &range );
+		}
+		for( long index = 0; index < count; index++ )
+		{
+			Mem_spanFree( spans[index] );
+		}
+		return report( "Free Spans Coalesce", passed && range.d_found );
+	}
+
+	// hunks allocated with a lifetime hint, and the chain of the node
+	// whose cluster each one was found in, -1 until it is
+	struct hintedHunks
+	{
+		caddr_t			d_hunks[HINTED_HUNKS];
+		int				d_hints[HINTED_HUNKS];
+		int				d_chains[HINTED_HUNKS];
+	};
+
+	//************************************************************************
+	//
+	//	findChains() - heap walker that notes which chain's cluster holds
+	//				   each hinted hunk
+	//
+	//************************************************************************
+	bool				findChains( const MemHeapEntry* a_entry,
+									void* a_hinted )
+	{
+		hintedHunks*	hinted = (hintedHunks*)a_hinted;
+		if( a_entry->d_kind != MEM_HEAP_NODE || a_entry->d_address == NULL )
+		{
+			return true;
+		}
+		for( long index = 0; index < HINTED_HUNKS; index++ )
+		{
+			if( hinted->d_hunks[index] >= a_entry->d_address &&
+				hinted->d_hunks[index] <
+					a_entry->d_address + a_entry->d_bytes )
+			{
+				hinted->d_chains[index] = a_entry->d_chain;
+			}
+		}
+		return true;
+	}
+
+	//************************************************************************
+	//
+	//	testLifetimeHint() - short and long lived hunks of one size are
+	//						 kept in clusters of their own
+	//
+	//************************************************************************
+	bool				testLifetimeHint()
+	{
+		// 200 bytes and the hunk header go in blocks of 256
+		const size_t	howBig = 200;
+
+		hintedHunks		hinted;
+		bool			passed = true;
+		for( long index = 0; index < HINTED_HUNKS; index++ )
+		{
+			hinted.d_hints[index] = index % 2 ? MEM_LONG_LIVED :
+												MEM_SHORT_LIVED;
+			hinted.d_hunks[index] =
+				Mem_allocateHunkHinted( howBig, hinted.d_hints[index] );
+			hinted.d_chains[index] = -1;
+			passed = passed && hinted.d_hunks[index] != NULL;
+		}
+
+		passed = passed && Mem_heapWalk( findChains, &hinted );
+		for( long index = 0; index < HINTED_HUNKS; index++ )
+		{
+			passed = passed &&
+					 hinted.d_chains[index] == hinted.d_hints[index];
+			Mem_releaseHunk( hinted.d_hunks[index] );
+		}
+		return report( "Lifetime Hints Keep Apart", passed );
+	}
+
+	//************************************************************************
+	//
+	//	testSelectFullest() - a chain hands out from its fullest node, and
+	//						  the sparse node it passes over drains
+	//
+	//************************************************************************
+	bool				testSelectFullest()
+	{
+		// blocks of 1K, half a cluster of them in the fuller node
+		const size_t	blockSize = 10;
+		const long		fill = ( MemNode_clusterSize( blockSize ) >>
+								 blockSize ) / 2;
+
+		MemNode*		sparse = MemNode_create( blockSize );
+		MemNode*		fuller = MemNode_create( blockSize );
+		if( sparse == NULL || fuller == NULL )
+		{
+			return report( "Select The Fullest Node", false );
+		}
+		sparse->d_nextNode = fuller;
+		fuller->d_previousNode = sparse;
+
+		caddr_t*		blocks = (caddr_t*)malloc( fill * sizeof(caddr_t) );
+		caddr_t			lone = MemNode_findBlock( sparse );
+		bool			passed = lone != NULL;
+		for( long index = 0; index < fill; index++ )
+		{
+			blocks[index] = MemNode_findBlock( fuller );
+			passed = passed && blocks[index] != NULL;
+		}
+
+		// the sparse node is first on the chain, but passed over
+		MemNodeStats	before;
+		MemNode_stats( blockSize, &before );
+		passed = passed && MemNode_select( sparse ) == fuller;
+
+		MemNodeStats	after;
+		MemNode_releaseBlock( sparse, lone );
+		MemNode_stats( blockSize, &after );
+		passed = passed &&
+				 after.d_clustersDrained == before.d_clustersDrained + 1;
+
+		for( long index = 0; index < fill; index++ )
+		{
+			MemNode_releaseBlock( fuller, blocks[index] );
+		}
+		free( blocks );
+		MemNode_destroy( sparse );
+		return report( "Select The Fullest Node", passed );
+	}
+
+	//************************************************************************
+	//
+	//	testDeferDrain() - a deferring thread's releases wait on its ring
+	//					   until they are drained
+	//
+	//************************************************************************
+	bool				testDeferDrain()
+	{
+		// 300 bytes and the hunk header go in blocks of 512
+		const size_t	howBig = 300;
+		const size_t	blockSize = 9;
+		const long		count = 256;
+
+		// the reclaim thread sleeps half a second, long enough to leave
+		// the ring alone while it is looked at
+		if( !Mem_deferStart( 500000 ) || !Mem_deferThread( true ) )
+		{
+			Mem_deferStop();
+			return report( "Drain Deferred Releases", false );
+		}
+
+		caddr_t			hunks[count];
+		for( long index = 0; index < count; index++ )
+		{
+			hunks[index] = Mem_allocateHunk( howBig );
+		}
+		MemNodeStats	held;
+		MemNode_stats( blockSize, &held );
+		for( long index = 0; index < count; index++ )
+		{
+			Mem_releaseHunk( hunks[index] );
+		}
+
+		unsigned long	pending;
+		unsigned long	direct;
+		MemNodeStats	deferred;
+		Mem_deferStats( &pending, &direct );
+		MemNode_stats( blockSize, &deferred );
+		bool			passed = pending == count &&
+								 deferred.d_live == held.d_live;
+
+		size_t			drained = Mem_deferDrain();
+		MemNodeStats	released;
+		Mem_deferStats( &pending, &direct );
+		MemNode_stats( blockSize, &released );
+		passed = passed && drained == count && pending == 0 &&
+				 held.d_live - released.d_live == count;
+
+		Mem_deferThread( false );
+		Mem_deferStop();
+		return report( "Drain Deferred Releases", passed );
+	}
+
+	// what a heap walk found: every entry, and the blocks in use of the
+	// nodes of one block size, counted and from their occupancy bits
+	struct heapTally
+	{
+		int				d_sizeShift;
+		long			d_entries;
+		long			d_live;
+		long			d_bits;
+	};
+
+	//************************************************************************
+	//
+	//	tallyHeap() - heap walker that fills in a heapTally
+	//
+	//************************************************************************
+	bool				tallyHeap( const MemHeapEntry* a_entry, void* a_tally )
+	{
+		heapTally*		tally = (heapTally*)a_tally;
+		tally->d_entries++;
+		if( a_entry->d_kind != MEM_HEAP_NODE ||
+			a_entry->d_sizeShift != tally->d_sizeShift )
+		{
+			return true;
+		}
+		tally->d_live += a_entry->d_live;
+		for( long slot = 0; a_entry->d_occupancy != NULL &&
+							slot < a_entry->d_slots; slot++ )
+		{
+			tally->d_bits += ( a_entry->d_occupancy[slot / 64] >>
+							   ( slot % 64 ) ) & 1;
+		}
+		return true;
+	}
+
+	//************************************************************************
+	//
+	//	testHeapSnapshot() - a heap walk and the snapshot written from it
+	//						 account for every block in use
+	//
+	//************************************************************************
+	bool				testHeapSnapshot()
+	{
+		// 3000 bytes and the hunk header go in blocks of 4096, which
+		// track their slots with a bitmap
+		const size_t	howBig = 3000;
+		const int		blockSize = 12;
+		const long		count = 100;
+
+		caddr_t			hunks[count];
+		for( long index = 0; index < count; index++ )
+		{
+			hunks[index] = Mem_allocateHunk( howBig );
+		}
+
+		MemNodeStats	stats;
+		MemNode_stats( blockSize, &stats );
+		heapTally		tally = { blockSize, 0, 0, 0 };
+		bool			passed = Mem_heapWalk( tallyHeap, &tally ) &&
+								 tally.d_live == stats.d_live &&
+								 tally.d_live >= count;
+		if( !MemNode_freeListSlots( blockSize ) )
+		{
+			passed = passed && tally.d_bits == tally.d_live;
+		}
+
+		char			path[] = "/tmp/fstheapXXXXXX";
+		int				fd = mkstemp( path );
+		passed = passed && fd != -1 && Mem_heapSnapshot( path );
+		FILE*			snapshot = fd == -1 ? NULL : fdopen( fd, "r" );
+		MemHeapSnapshotHeader	header;
+		passed = passed && snapshot != NULL &&
+				 fread( &header, sizeof(header), 1, snapshot ) == 1 &&
+				 header.d_magic == MEM_HEAP_MAGIC &&
+				 header.d_version == MEM_HEAP_VERSION &&
+				 header.d_pid == (unsigned long)getpid() &&
+				 (long)header.d_records == tally.d_entries;
+
+		long			live = 0;
+		MemHeapRecord	record;
+		for( unsigned long index = 0; passed && index < header.d_records;
+			 index++ )
+		{
+			passed = fread( &record, sizeof(record), 1, snapshot ) == 1;
+			if( record.d_kind == MEM_HEAP_NODE &&
+				record.d_sizeShift == blockSize )
+			{
+				live += record.d_live;
+			}
+		}
+		passed = passed && live == tally.d_live;
+		if( snapshot != NULL )
+		{
+			fclose( snapshot );
+		}
+		unlink( path );
+
+		for( long index = 0; index < count; index++ )
+		{
+			Mem_releaseHunk( hunks[index] );
+		}
+		return report( "Heap Walk And Snapshot", passed );
+	}
+
+	//************************************************************************
+	//
+	//	epochReader() - stay in a look until told to leave it
+	//
+	//	ARGUMENTS:
+	//		a_stage - set to 1 once in the look, left when it is 2
+	//
+	//************************************************************************
+	void*				epochReader( void* a_stage )
+	{
+		int*			stage = (int*)a_stage;
+		if( !Mem_epochEnter() )
+		{
+			__atomic_store_n( stage, -1, __ATOMIC_RELEASE );
+			return NULL;
+		}
+		__atomic_store_n( stage, 1, __ATOMIC_RELEASE );
+		while( __atomic_load_n( stage, __ATOMIC_ACQUIRE ) != 2 )
+		{
+			sched_yield();
+		}
+		Mem_epochExit();
+		return NULL;
+	}
+
+	//************************************************************************
+	//
+	//	testEpochGrace() - nothing retired is released while a reader
+	//					   that might hold it is in a look
+	//
+	//************************************************************************
+	bool				testEpochGrace()
+	{
+		MemEpochStats	before;
+		Mem_epochStats( &before );
+
+		int				stage = 0;
+		pthread_t		reader;
+		if( pthread_create( &reader, NULL, epochReader, &stage ) != 0 )
+		{
+			return report( "Epoch Grace Period", false );
+		}
+		while( __atomic_load_n( &stage, __ATOMIC_ACQUIRE ) == 0 )
+		{
+			sched_yield();
+		}
+		bool			passed = stage == 1;
+
+		// enough that the retiring thread tries to move the epoch on
+		// and collect a few times over
+		for( unsigned long index = 0; passed && index < RETIRED_HUNKS;
+			 index++ )
+		{
+			passed = Mem_retire( Mem_allocateHunk( 64 ) );
+		}
+		MemEpochStats	during;
+		Mem_epochStats( &during );
+		passed = passed && during.d_reclaimed == before.d_reclaimed &&
+				 during.d_epoch <= before.d_epoch + 1;
+
+		__atomic_store_n( &stage, 2, __ATOMIC_RELEASE );
+		pthread_join( reader, NULL );
+
+		size_t			flushed = Mem_retireFlush();
+		MemEpochStats	after;
+		Mem_epochStats( &after );
+		passed = passed && flushed == RETIRED_HUNKS &&
+				 after.d_reclaimed - before.d_reclaimed == RETIRED_HUNKS;
+		return report( "Epoch Grace Period", passed );
+	}
+
+	//************************************************************************
+	//
+	//	testVarSize() - allocate and free the overflow pool at random,
+	//					printing the lists as we go
+	//
+	//************************************************************************
+	bool				testVarSize()
+	{
+		for( int i2=0; i2< 1000; i2++ )
+		{
+			void*		ptr[1000];
+			long			index=0;
+
+			for(index = 0; index < 1000; index++ )
+				ptr[index] = Mem_varSizeAlloc( rand() % 1000 );
+	 		Mem_printVarSizeList();
+			for(index=999 ; index >= 0; index-- )
+				Mem_varSizeFree( (caddr_t)ptr[index] );
+	 		Mem_printVarSizeList();
+			for(index = 0; index < 1000; index++ )
+				ptr[index] = malloc( rand() % 1000 );
+			for(index=999 ; index >= 0; index-- )
+				free( (caddr_t)ptr[index] );
+		}
+		return report( "Variable Size Pool", true );
+	}
+}
+
+int main()
+{
+	bool				passed = true;
+	passed = testChurn() && passed;
+	passed = testLatency() && passed;
+	passed = testFrameThreadExit() && passed;
+	passed = testLinedUsableSize() && passed;
+	passed = testSlabTable() && passed;
+	passed = testReserve() && passed;
+	passed = testReserveOverflow() && passed;
+	passed = testPurge() && passed;
+	passed = testPersistReopen() && passed;
+	passed = testSharedHeap() && passed;
+	passed = testStatsPage() && passed;
+	passed = testRefill() && passed;
+	passed = testSpanCoalesce() && passed;
+	passed = testLifetimeHint() && passed;
+	passed = testSelectFullest() && passed;
+	passed = testDeferDrain() && passed;
+	passed = testHeapSnapshot() && passed;
+	passed = testEpochGrace() && passed;
+	passed = testVarSize() && passed;
+	return passed ? 0 : 1;
 }